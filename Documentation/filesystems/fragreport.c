@@ -0,0 +1,122 @@
+/*
+ * fragreport.c: how fragmented are the files on a filesystem.
+ *
+ * For each file given, and each regular file below each directory
+ * given, the blocks are mapped with the FIBMAP ioctl and counted in
+ * extents, runs of physically contiguous blocks.  A file in one extent
+ * can be read without seeking.  Holes don't break an extent.
+ *
+ * Usage:	fragreport [-v] file-or-directory ...
+ *
+ *	-v	print a line for every file: blocks, extents and the
+ *		average extent length in blocks.
+ *
+ * FIBMAP needs root.  Compile with:	gcc -O2 -o fragreport fragreport.c
+ */
+
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+static int verbose;
+static unsigned long nr_files, nr_fragmented;
+static unsigned long long nr_blocks, nr_extents;
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: fragreport [-v] file-or-directory ...\n");
+	exit(1);
+}
+
+static int report_file(const char *path, const struct stat *st)
+{
+	unsigned long blocks = 0, extents = 0;
+	long i, nblocks, last = -1;
+	int fd, bsize, phys;	/* FIBMAP takes an int */
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return 0;
+	}
+	if (ioctl(fd, FIGETBSZ, &bsize) < 0) {
+		perror("FIGETBSZ");
+		exit(1);
+	}
+	nblocks = (st->st_size + bsize - 1) / bsize;
+	for (i = 0; i < nblocks; i++) {
+		phys = i;
+		if (ioctl(fd, FIBMAP, &phys) < 0) {
+			perror("FIBMAP");
+			exit(1);
+		}
+		if (!phys)
+			continue;
+		if (phys != last + 1)
+			extents++;
+		last = phys;
+		blocks++;
+	}
+	close(fd);
+
+	if (verbose)
+		printf("%8lu %8lu %10.1f  %s\n", blocks, extents,
+		       extents ? (double) blocks / extents : 0.0, path);
+	nr_files++;
+	nr_blocks += blocks;
+	nr_extents += extents;
+	if (extents > 1)
+		nr_fragmented++;
+	return 0;
+}
+
+static int walk(const char *path, const struct stat *st, int type,
+		struct FTW *ftw)
+{
+	if (type == FTW_F && S_ISREG(st->st_mode))
+		return report_file(path, st);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "v")) != -1) {
+		switch (c) {
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind == argc)
+		usage();
+
+	if (verbose)
+		printf("%8s %8s %10s  %s\n", "blocks", "extents", "blk/ext",
+		       "file");
+	for (; optind < argc; optind++) {
+		if (nftw(argv[optind], walk, 16, FTW_PHYS | FTW_MOUNT) < 0) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	printf("%lu files, %llu blocks in %llu extents", nr_files,
+	       nr_blocks, nr_extents);
+	if (nr_extents)
+		printf(", %.1f blocks per extent",
+		       (double) nr_blocks / nr_extents);
+	printf("\n%lu files (%.1f%%) in more than one extent\n",
+	       nr_fragmented,
+	       nr_files ? 100.0 * nr_fragmented / nr_files : 0.0);
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * futexbench.c: lock/unlock cost of a futex-based mutex against a SysV
+ * semaphore.
+ *
+ * Each of nproc processes takes and drops the lock iterations times,
+ * bumping a shared counter inside it.  The futex mutex is the usual
+ * three-state one (0 free, 1 locked, 2 locked with waiters): it only
+ * enters the kernel when it has to sleep or wake somebody, while every
+ * semop() is a system call.  With one process the difference is the
+ * uncontended fast path; with more it is the cost of contention.
+ *
+ * Usage:	futexbench [-n iterations] nproc ...
+ *
+ *	-n	lock/unlock pairs per process, default 100000.
+ *
+ * Compile with:	gcc -O2 -o futexbench futexbench.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+#ifndef SYS_futex
+#define SYS_futex	240
+#endif
+
+struct shared {
+	volatile int lock;
+	volatile unsigned long counter;
+};
+
+#if defined(__GLIBC__) && !defined(_SEM_SEMUN_UNDEFINED)
+/* union semun is defined by including <sys/sem.h> */
+#else
+union semun {
+	int val;
+	struct semid_ds *buf;
+	unsigned short *array;
+};
+#endif
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: futexbench [-n iterations] nproc ...\n");
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static inline int cmpxchg(volatile int *p, int old, int new)
+{
+	int prev;
+
+	__asm__ __volatile__("lock; cmpxchgl %2,%1"
+			     : "=a" (prev), "+m" (*p)
+			     : "r" (new), "0" (old)
+			     : "memory");
+	return prev;
+}
+
+static inline int xchg(volatile int *p, int new)
+{
+	__asm__ __volatile__("xchgl %0,%1"
+			     : "+r" (new), "+m" (*p)
+			     :
+			     : "memory");
+	return new;
+}
+
+static inline int atomic_dec_return_old(volatile int *p)
+{
+	int old = -1;
+
+	__asm__ __volatile__("lock; xaddl %0,%1"
+			     : "+r" (old), "+m" (*p)
+			     :
+			     : "memory");
+	return old;
+}
+
+static void futex_lock(volatile int *lock)
+{
+	int c;
+
+	c = cmpxchg(lock, 0, 1);
+	if (c == 0)
+		return;
+	if (c != 2)
+		c = xchg(lock, 2);
+	while (c != 0) {
+		syscall(SYS_futex, lock, FUTEX_WAIT, 2, NULL, NULL);
+		c = xchg(lock, 2);
+	}
+}
+
+static void futex_unlock(volatile int *lock)
+{
+	if (atomic_dec_return_old(lock) != 1) {
+		*lock = 0;
+		syscall(SYS_futex, lock, FUTEX_WAKE, 1, NULL, NULL);
+	}
+}
+
+static void sem_op(int semid, int op)
+{
+	struct sembuf sb;
+
+	sb.sem_num = 0;
+	sb.sem_op = op;
+	sb.sem_flg = 0;
+	if (semop(semid, &sb, 1) < 0) {
+		perror("semop");
+		exit(1);
+	}
+}
+
+static double run(struct shared *sh, int semid, int nproc, int iterations)
+{
+	double start;
+	pid_t pid;
+	int i, j;
+
+	sh->lock = 0;
+	sh->counter = 0;
+	start = now();
+	for (i = 0; i < nproc; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid)
+			continue;
+		for (j = 0; j < iterations; j++) {
+			if (semid < 0)
+				futex_lock(&sh->lock);
+			else
+				sem_op(semid, -1);
+			sh->counter++;
+			if (semid < 0)
+				futex_unlock(&sh->lock);
+			else
+				sem_op(semid, 1);
+		}
+		_exit(0);
+	}
+	for (i = 0; i < nproc; i++)
+		wait(NULL);
+	if (sh->counter != (unsigned long) nproc * iterations) {
+		fprintf(stderr, "lost updates: %lu of %lu\n", sh->counter,
+			(unsigned long) nproc * iterations);
+		exit(1);
+	}
+	return (now() - start) / ((double) nproc * iterations);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 100000;
+	struct shared *sh;
+	union semun arg;
+	int c, semid;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind == argc)
+		usage();
+
+	sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sh == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	semid = semget(IPC_PRIVATE, 1, IPC_CREAT | 0600);
+	if (semid < 0) {
+		perror("semget");
+		return 1;
+	}
+	arg.val = 1;
+	if (semctl(semid, 0, SETVAL, arg) < 0) {
+		perror("semctl");
+		return 1;
+	}
+
+	printf("%6s %14s %14s\n", "nproc", "futex usec/op", "semop usec/op");
+	for (; optind < argc; optind++) {
+		int nproc = atoi(argv[optind]);
+
+		if (nproc <= 0)
+			usage();
+		printf("%6d %14.3f", nproc, run(sh, -1, nproc, iterations));
+		printf(" %14.3f\n", run(sh, semid, nproc, iterations));
+	}
+	semctl(semid, 0, IPC_RMID, arg);
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * forkbench.c: fork()+exit() latency against the parent's resident size.
+ *
+ * For each size given (in megabytes) the parent maps and touches that
+ * much memory, then times fork() with the child calling _exit() at once
+ * and the parent reaping it.  This is what a large process pays for
+ * every fork()+exec() of a helper.
+ *
+ * Usage:	forkbench [-s] [-n iterations] size-in-MB ...
+ *
+ *	-s	use a MAP_SHARED anonymous mapping instead of a private
+ *		one.  Compare the result with /proc/sys/vm/lazy_fork set
+ *		to 1 and to 0.
+ *	-n	number of forks to average over, default 100.
+ *
+ * Compile with:	gcc -O2 -o forkbench forkbench.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: forkbench [-s] [-n iterations] size-in-MB ...\n");
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static double time_forks(int iterations)
+{
+	double start;
+	pid_t pid;
+	int i;
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0)
+			_exit(0);
+		if (waitpid(pid, NULL, 0) != pid) {
+			perror("waitpid");
+			exit(1);
+		}
+	}
+	return (now() - start) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+	int shared = 0, iterations = 100;
+	long pagesize = sysconf(_SC_PAGESIZE);
+	int c;
+
+	while ((c = getopt(argc, argv, "sn:")) != -1) {
+		switch (c) {
+		case 's':
+			shared = 1;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind == argc)
+		usage();
+
+	printf("%10s %12s\n", "RSS (MB)", "usec/fork");
+	printf("%10s %12.1f\n", "0", time_forks(iterations));
+
+	for (; optind < argc; optind++) {
+		size_t size = (size_t) atol(argv[optind]) << 20;
+		char *p;
+		size_t off;
+
+		if (!size)
+			usage();
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS,
+			 -1, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			return 1;
+		}
+		for (off = 0; off < size; off += pagesize)
+			p[off] = 1;
+
+		printf("%10s %12.1f\n", argv[optind], time_forks(iterations));
+		munmap(p, size);
+	}
+	return 0;
+}
@@ -131,6 +131,18 @@ atomic_t irq_mis_count;
  * Generic, controller-independent functions:
  */
 
+#ifdef CONFIG_SMP
+/* Rows of IPIs sent, see the IPI_* reasons in <asm/hardirq.h> */
+static const char *ipi_names[NR_IPI_REASONS] = {
+	[IPI_TLB_MM]		= "TLM",
+	[IPI_TLB_RANGE]		= "TLR",
+	[IPI_TLB_PAGE]		= "TLP",
+	[IPI_TLB_LAZY]		= "TLZ",
+	[IPI_RESCHEDULE]	= "RES",
+	[IPI_CALL_FUNCTION]	= "CAL",
+};
+#endif
+
 int get_irq_list(char *buf)
 {
 	int i, j;
@@ -172,6 +184,15 @@ int get_irq_list(char *buf)
 		p += sprintf(p, "%10u ",
 			apic_timer_irqs[cpu_logical_map(j)]);
 	p += sprintf(p, "\n");
+#endif
+#ifdef CONFIG_SMP
+	for (i = 0; i < NR_IPI_REASONS; i++) {
+		p += sprintf(p, "%s: ", ipi_names[i]);
+		for (j = 0; j < smp_num_cpus; j++)
+			p += sprintf(p, "%10u ",
+				ipi_sent(cpu_logical_map(j), i));
+		p += sprintf(p, "\n");
+	}
 #endif
 	p += sprintf(p, "ERR: %10u\n", atomic_read(&irq_err_count));
 #ifdef CONFIG_X86_IO_APIC
@@ -336,6 +336,8 @@ static void inline leave_mm (unsigned long cpu)
  * 	Atomically set the bit [other cpus will start sending flush ipis],
  * 	and test the bit.
  * 1b3) if the bit was 0: leave_mm was called, flush the tlb.
+ *	Likewise if flush_pending is set: a flush skipped this cpu,
+ *	see skip_lazy_cpus().
  * 2) switch %%esp, ie current
  *
  * The interrupt must handle 2 special cases:
@@ -383,6 +385,40 @@ asmlinkage void smp_invalidate_interrupt (void)
 	clear_bit(cpu, &flush_cpumask);
 }
 
+/*
+ * A cpu in lazy tlb mode runs a kernel thread on the page tables of the
+ * last mm it ran, and never touches user addresses.  When user pages are
+ * unmapped it needn't be interrupted: mark the flush pending instead,
+ * and switch_mm() reloads %cr3 before the cpu uses the mm again.  The
+ * state is checked again after setting flush_pending, against the cpu
+ * leaving lazy mode for this mm at the same time (switch_mm() sets the
+ * state before it tests flush_pending, and the locked bitop in between
+ * orders the two).
+ *
+ * The cpus keep their bit in mm->cpu_vm_mask, so flush_tlb_mm(), which
+ * is used when page tables go away, still makes them leave the mm.
+ */
+static unsigned long skip_lazy_cpus(unsigned long cpumask, struct mm_struct *mm)
+{
+	unsigned long mask = cpumask;
+	int cpu;
+
+	while (mask) {
+		cpu = ffz(~mask);
+		mask &= mask - 1;
+		if (cpu_tlbstate[cpu].state != TLBSTATE_LAZY ||
+		    cpu_tlbstate[cpu].active_mm != mm)
+			continue;
+		cpu_tlbstate[cpu].flush_pending = 1;
+		mb();
+		if (cpu_tlbstate[cpu].state == TLBSTATE_LAZY) {
+			cpumask &= ~(1UL << cpu);
+			ipi_sent(smp_processor_id(), IPI_TLB_LAZY)++;
+		}
+	}
+	return cpumask;
+}
+
 static void flush_tlb_others (unsigned long cpumask, struct mm_struct *mm,
 						unsigned long va)
 {
@@ -433,14 +469,36 @@ void flush_tlb_current_task(void)
 	unsigned long cpu_mask = mm->cpu_vm_mask & ~(1 << smp_processor_id());
 
 	local_flush_tlb();
-	if (cpu_mask)
+	if (cpu_mask) {
+		ipi_sent(smp_processor_id(), IPI_TLB_MM) += hweight32(cpu_mask);
 		flush_tlb_others(cpu_mask, mm, FLUSH_ALL);
+	}
 }
 
 void flush_tlb_mm (struct mm_struct * mm)
 {
 	unsigned long cpu_mask = mm->cpu_vm_mask & ~(1 << smp_processor_id());
 
+	if (current->active_mm == mm) {
+		if (current->mm)
+			local_flush_tlb();
+		else
+			leave_mm(smp_processor_id());
+	}
+	if (cpu_mask) {
+		ipi_sent(smp_processor_id(), IPI_TLB_MM) += hweight32(cpu_mask);
+		flush_tlb_others(cpu_mask, mm, FLUSH_ALL);
+	}
+}
+
+/*
+ * Unmapping user pages: the mmu_gather code calls this once per batch
+ * of pages.  The page tables stay, so lazy tlb cpus can be skipped.
+ */
+void flush_tlb_range(struct mm_struct * mm, unsigned long start, unsigned long end)
+{
+	unsigned long cpu_mask = mm->cpu_vm_mask & ~(1 << smp_processor_id());
+
 	if (current->active_mm == mm) {
 		if (current->mm)
 			local_flush_tlb();
@@ -448,7 +506,11 @@ void flush_tlb_mm (struct mm_struct * mm)
 			leave_mm(smp_processor_id());
 	}
 	if (cpu_mask)
+		cpu_mask = skip_lazy_cpus(cpu_mask, mm);
+	if (cpu_mask) {
+		ipi_sent(smp_processor_id(), IPI_TLB_RANGE) += hweight32(cpu_mask);
 		flush_tlb_others(cpu_mask, mm, FLUSH_ALL);
+	}
 }
 
 void flush_tlb_page(struct vm_area * vma, unsigned long va)
@@ -464,7 +526,11 @@ void flush_tlb_page(struct vm_area * vma, unsigned long va)
 	}
 
 	if (cpu_mask)
+		cpu_mask = skip_lazy_cpus(cpu_mask, mm);
+	if (cpu_mask) {
+		ipi_sent(smp_processor_id(), IPI_TLB_PAGE) += hweight32(cpu_mask);
 		flush_tlb_others(cpu_mask, mm, va);
+	}
 }
 
 static inline void do_flush_tlb_all_local(void)
@@ -496,6 +562,7 @@ void flush_tlb_all(void)
 
 void smp_send_reschedule(int cpu)
 {
+	ipi_sent(smp_processor_id(), IPI_RESCHEDULE)++;
 	send_IPI_mask(1 << cpu, RESCHEDULE_VECTOR);
 }
 
@@ -551,6 +618,7 @@ int smp_call_function (void (*func) (void *info), void *info, int nonatomic,
 	spin_lock(&call_lock);
 	call_data = &data;
 	wmb();
+	ipi_sent(smp_processor_id(), IPI_CALL_FUNCTION) += cpus;
 	/* Send a message to all other CPUs and wait for them to respond */
 	send_IPI_allbutself(CALL_FUNCTION_VECTOR);
 
@@ -0,0 +1,371 @@
+/*
+ *  linux/arch/i386/mm/hugetlbpage.c
+ *
+ *  IA-32 huge TLB pages.  A pool of 4MB (2MB with PAE) pages is set aside
+ *  at boot with "hugepages=" or later through /proc/sys/vm/nr_hugepages,
+ *  and handed out to hugetlbfs files and SHM_HUGETLB segments.  A huge
+ *  page is mapped into user space by one PSE entry in the page directory,
+ *  so every process attaching a segment shares the pages at PMD level and
+ *  needs no page tables for it at all.
+ *
+ *  Huge mappings are always shared and populated at mmap time; they are
+ *  never faulted in, never swapped and never copied on write.
+ */
+
+#include <linux/config.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/sysctl.h>
+#include <linux/hugetlb.h>
+
+#include <asm/pgalloc.h>
+#include <asm/processor.h>
+
+#define HPAGE_PTES	(1 << HUGETLB_PAGE_ORDER)
+
+/*
+ * Free huge pages are kept on htlbpage_freelist, linked through the
+ * ->list of their first page.  Every small page of a huge page in the
+ * pool holds a count of one, so that get_user_pages() can take and drop
+ * references on them like on any other page.
+ */
+static LIST_HEAD(htlbpage_freelist);
+static spinlock_t htlbpage_lock = SPIN_LOCK_UNLOCKED;
+static int htlbpagemem;		/* free huge pages */
+static int htlbzone_pages;	/* huge pages in the pool */
+
+int htlbpage_max;		/* the size the pool should have */
+
+static struct page *htlb_page_get(void)
+{
+	struct page *page;
+	int i;
+
+	page = alloc_pages(GFP_HIGHUSER, HUGETLB_PAGE_ORDER);
+	if (!page)
+		return NULL;
+	for (i = 1; i < HPAGE_PTES; i++)
+		set_page_count(&page[i], 1);
+	return page;
+}
+
+static void htlb_page_put(struct page *page)
+{
+	int i;
+
+	for (i = 1; i < HPAGE_PTES; i++)
+		set_page_count(&page[i], 0);
+	__free_pages(page, HUGETLB_PAGE_ORDER);
+}
+
+/*
+ * Take a huge page out of the pool, cleared.  Returns NULL when the pool
+ * is empty; we never go to the page allocator for a huge page here, it
+ * would almost never find one after boot.
+ */
+struct page *alloc_huge_page(void)
+{
+	struct page *page;
+	int i;
+
+	spin_lock(&htlbpage_lock);
+	if (list_empty(&htlbpage_freelist)) {
+		spin_unlock(&htlbpage_lock);
+		return NULL;
+	}
+	page = list_entry(htlbpage_freelist.next, struct page, list);
+	list_del(&page->list);
+	htlbpagemem--;
+	spin_unlock(&htlbpage_lock);
+
+	for (i = 0; i < HPAGE_PTES; i++)
+		clear_highpage(&page[i]);
+	return page;
+}
+
+/*
+ * Give a huge page back to the pool, or to the page allocator if the
+ * pool has been shrunk below what was in use at the time.
+ */
+void free_huge_page(struct page *page)
+{
+	spin_lock(&htlbpage_lock);
+	if (htlbzone_pages > htlbpage_max) {
+		htlbzone_pages--;
+		spin_unlock(&htlbpage_lock);
+		htlb_page_put(page);
+		return;
+	}
+	list_add(&page->list, &htlbpage_freelist);
+	htlbpagemem++;
+	spin_unlock(&htlbpage_lock);
+}
+
+int hugetlb_free_pages(void)
+{
+	return htlbpagemem;
+}
+
+/*
+ * Grow or shrink the pool towards 'count' huge pages.  Pages that are
+ * in use go back to the page allocator when they are freed.
+ */
+static void set_hugetlb_mem_size(int count)
+{
+	struct page *page;
+
+	if (count < 0)
+		count = 0;
+	htlbpage_max = count;
+
+	while (htlbzone_pages < count) {
+		page = htlb_page_get();
+		if (!page) {
+			htlbpage_max = htlbzone_pages;
+			break;
+		}
+		spin_lock(&htlbpage_lock);
+		list_add(&page->list, &htlbpage_freelist);
+		htlbpagemem++;
+		htlbzone_pages++;
+		spin_unlock(&htlbpage_lock);
+	}
+
+	spin_lock(&htlbpage_lock);
+	while (htlbzone_pages > count && !list_empty(&htlbpage_freelist)) {
+		page = list_entry(htlbpage_freelist.next, struct page, list);
+		list_del(&page->list);
+		htlbpagemem--;
+		htlbzone_pages--;
+		spin_unlock(&htlbpage_lock);
+		htlb_page_put(page);
+		spin_lock(&htlbpage_lock);
+	}
+	spin_unlock(&htlbpage_lock);
+}
+
+int hugetlb_sysctl_handler(ctl_table *table, int write, struct file *file,
+			   void *buffer, size_t *length)
+{
+	int error;
+
+	/* Without PSE the pages could never be mapped; keep none */
+	if (write && !cpu_has_pse)
+		return -EINVAL;
+	error = proc_dointvec(table, write, file, buffer, length);
+	if (!error && write)
+		set_hugetlb_mem_size(htlbpage_max);
+	return error;
+}
+
+int hugetlb_report_meminfo(char *buf)
+{
+	return sprintf(buf,
+			"HugePages_Total: %5d\n"
+			"HugePages_Free:  %5d\n"
+			"Hugepagesize:    %5lu kB\n",
+			htlbzone_pages, htlbpagemem, HPAGE_SIZE >> 10);
+}
+
+/*
+ * The page directory entry mapping 'addr' doubles as the huge pte.
+ * pmd_alloc() may drop mm->page_table_lock.
+ */
+static pte_t *huge_pte_alloc(struct mm_struct *mm, unsigned long addr)
+{
+	pgd_t *pgd = pgd_offset(mm, addr);
+
+	return (pte_t *) pmd_alloc(mm, pgd, addr);
+}
+
+static pte_t *huge_pte_offset(struct mm_struct *mm, unsigned long addr)
+{
+	pgd_t *pgd = pgd_offset(mm, addr);
+
+	if (pgd_none(*pgd))
+		return NULL;
+	return (pte_t *) pmd_offset(pgd, addr);
+}
+
+static pte_t make_huge_pte(struct vm_area *vma, struct page *page)
+{
+	pte_t entry;
+
+	entry = pte_mkyoung(mk_pte(page, vma->vm_page_prot));
+	if (vma->vm_flags & VM_WRITE)
+		entry = pte_mkdirty(entry);
+	entry.pte_low |= _PAGE_PSE;
+	return entry;
+}
+
+/*
+ * fork(): the child maps the same huge pages.  dst->page_table_lock is
+ * held, as for copy_page_range().
+ */
+int copy_hugetlb_page_range(struct mm_struct *dst, struct mm_struct *src,
+			    struct vm_area *vma)
+{
+	pte_t *src_pte, *dst_pte, entry;
+	unsigned long addr;
+
+	for (addr = vma->vm_start; addr < vma->vm_end; addr += HPAGE_SIZE) {
+		dst_pte = huge_pte_alloc(dst, addr);
+		if (!dst_pte)
+			return -ENOMEM;
+		spin_lock(&src->page_table_lock);
+		src_pte = huge_pte_offset(src, addr);
+		entry = src_pte ? *src_pte : __pte(0);
+		spin_unlock(&src->page_table_lock);
+		if (pte_none(entry))
+			continue;
+		set_pte(dst_pte, entry);
+		dst->rss += HPAGE_PTES;
+	}
+	return 0;
+}
+
+/*
+ * get_user_pages() for a huge page vma: hand out the small pages the
+ * range is made of.  A hole can only be left by a truncate, and ends the
+ * walk.
+ */
+int follow_hugetlb_page(struct mm_struct *mm, struct vm_area *vma,
+			struct page **pages, struct vm_area **vmas,
+			unsigned long *start, int *len, int i)
+{
+	unsigned long vaddr = *start;
+	int remainder = *len;
+
+	spin_lock(&mm->page_table_lock);
+	while (remainder && vaddr < vma->vm_end) {
+		pte_t *pte = huge_pte_offset(mm, vaddr);
+		struct page *page;
+
+		if (!pte || pte_none(*pte)) {
+			remainder = 0;
+			if (!i)
+				i = -EFAULT;
+			break;
+		}
+		if (pages) {
+			page = pte_page(*pte) + ((vaddr & ~HPAGE_MASK) >> PAGE_SHIFT);
+			get_page(page);
+			pages[i] = page;
+		}
+		if (vmas)
+			vmas[i] = vma;
+		vaddr += PAGE_SIZE;
+		remainder--;
+		i++;
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	*start = vaddr;
+	*len = remainder;
+	return i;
+}
+
+/*
+ * Unmap part of a huge page vma.  The pages themselves belong to the
+ * file and are freed when it is truncated.
+ */
+void zap_hugepage_range(struct vm_area *vma, unsigned long start,
+			unsigned long len)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr, end = start + len;
+	pte_t *pte;
+
+	if ((start | len) & ~HPAGE_MASK)
+		BUG();
+
+	spin_lock(&mm->page_table_lock);
+	for (addr = start; addr < end; addr += HPAGE_SIZE) {
+		pte = huge_pte_offset(mm, addr);
+		if (!pte || pte_none(*pte))
+			continue;
+		pte_clear(pte);
+		if (mm->rss > HPAGE_PTES)
+			mm->rss -= HPAGE_PTES;
+		else
+			mm->rss = 0;
+	}
+	flush_tlb_range(mm, start, end);
+	spin_unlock(&mm->page_table_lock);
+}
+
+/*
+ * Map the whole vma at mmap time, allocating the pages of the file that
+ * are not there yet.  Called with mmap_sem held for writing and the
+ * inode semaphore held.
+ */
+int hugetlb_prefault(struct vm_area *vma)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct inode *inode = vma->vm_file->f_dentry->d_inode;
+	unsigned long addr, idx;
+	struct page *page;
+	pte_t *pte;
+	int flush = 0;
+	int ret = 0;
+
+	idx = vma->vm_pgoff >> HUGETLB_PAGE_ORDER;
+	for (addr = vma->vm_start; addr < vma->vm_end; addr += HPAGE_SIZE, idx++) {
+		page = hugetlbfs_get_page(inode, idx);
+		if (!page) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		spin_lock(&mm->page_table_lock);
+		pte = huge_pte_alloc(mm, addr);
+		if (!pte) {
+			spin_unlock(&mm->page_table_lock);
+			ret = -ENOMEM;
+			break;
+		}
+		/*
+		 * An earlier mapping of this range can have left an empty
+		 * page table behind; the vma covers all of it now.
+		 */
+		if (!pte_none(*pte) && !(pte_val(*pte) & _PAGE_PSE)) {
+			pte_t *table = pte_offset((pmd_t *) pte, 0);
+
+			pmd_clear((pmd_t *) pte);
+			pte_free(table);
+			flush = 1;
+		}
+		if (pte_none(*pte)) {
+			set_pte(pte, make_huge_pte(vma, page));
+			mm->rss += HPAGE_PTES;
+		}
+		spin_unlock(&mm->page_table_lock);
+	}
+
+	if (flush)
+		flush_tlb_range(mm, vma->vm_start, vma->vm_end);
+	return ret;
+}
+
+static int __init hugetlb_setup(char *s)
+{
+	htlbpage_max = simple_strtoul(s, NULL, 0);
+	return 1;
+}
+__setup("hugepages=", hugetlb_setup);
+
+static int __init hugetlb_init(void)
+{
+	if (!cpu_has_pse) {
+		htlbpage_max = 0;
+		printk(KERN_INFO "hugetlb: no PSE, huge pages disabled\n");
+		return 0;
+	}
+	set_hugetlb_mem_size(htlbpage_max);
+	printk(KERN_INFO "hugetlb: %d huge pages of %lu kB\n",
+	       htlbzone_pages, HPAGE_SIZE >> 10);
+	return 0;
+}
+__initcall(hugetlb_init);
@@ -18,6 +18,9 @@
  * Removed tests for max-bomb-segments, which was breaking elvtune
  *  when run without -bN
  *
+ * Deadline and anticipatory elevators, selectable per queue with
+ * BLKELVSET.
+ *
  */
 
 #include <linux/fs.h>
@@ -179,14 +182,163 @@ int elevator_noop_merge(request_queue_t *q, struct request **req,
 
 void elevator_noop_merge_req(struct request *req, struct request *next) {}
 
-int blkelvget_ioctl(elevator_t * elevator, blkelv_ioctl_arg_t * arg)
+/*
+ * Deadline elevator.
+ *
+ * Drivers take their work straight off q->queue_head, so the sorted
+ * queues of the two directions share that one list: all reads in front
+ * of all writes, each run in ascending sector order.  Every request
+ * expires read_latency/write_latency msecs after it was created.  An
+ * expired request becomes a zero sequence point that nothing may be
+ * queued in front of, so its wait is bounded by the requests that were
+ * already ahead of it, in the order they arrived.
+ */
+static inline int deadline_expired(elevator_t *elevator, struct request *rq)
+{
+	int expire = elevator_request_latency(elevator, rq->cmd);
+
+	return time_after(jiffies, rq->start_time + expire * HZ / 1000);
+}
+
+int elevator_deadline_merge(request_queue_t *q, struct request **req,
+			    struct list_head * head,
+			    struct buffer_head *bh, int rw,
+			    int max_sectors)
+{
+	struct list_head *entry = &q->queue_head;
+	unsigned int count = bh->b_size >> 9;
+	struct request *__rq;
+
+	while ((entry = entry->prev) != head) {
+		__rq = blkdev_entry_to_request(entry);
+
+		if (__rq->elevator_sequence > 0 &&
+		    deadline_expired(&q->elevator, __rq))
+			__rq->elevator_sequence = 0;
+
+		if (!__rq->waiting && __rq->rq_dev == bh->b_rdev &&
+		    __rq->cmd == rw && __rq->nr_sectors + count <= max_sectors) {
+			if (__rq->sector + __rq->nr_sectors == bh->b_rsector) {
+				*req = __rq;
+				return ELEVATOR_BACK_MERGE;
+			} else if (__rq->sector - count == bh->b_rsector) {
+				*req = __rq;
+				return ELEVATOR_FRONT_MERGE;
+			}
+		}
+
+		/*
+		 * we can't insert beyond a zero sequence point
+		 */
+		if (__rq->elevator_sequence <= 0)
+			break;
+
+		if (*req)
+			continue;
+
+		/*
+		 * reads pass writes, writes stay behind reads, and within
+		 * a direction we go after the first request that sorts
+		 * before us
+		 */
+		if (__rq->cmd == rw) {
+			if (!BHRQ_IN_ORDER(bh, __rq))
+				*req = __rq;
+		} else if (rw != READ)
+			*req = __rq;
+	}
+
+	if (*req)
+		return ELEVATOR_NO_MERGE;
+
+	/*
+	 * we passed everything we were allowed to pass
+	 */
+	if (entry != head) {
+		*req = blkdev_entry_to_request(entry);
+		return ELEVATOR_NO_MERGE;
+	}
+	return ELEVATOR_HEAD_INSERT;
+}
+
+void elevator_deadline_merge_req(struct request *req, struct request *next)
 {
+	if (next->elevator_sequence < req->elevator_sequence)
+		req->elevator_sequence = next->elevator_sequence;
+	if (time_before(next->start_time, req->start_time))
+		req->start_time = next->start_time;
+}
+
+/*
+ * Anticipation.  When a read completes and no other read is queued, keep
+ * the queue plugged for a moment instead of seeking away to the writes.
+ * A process doing dependent reads sends the next one right away and
+ * unplugs the queue through tq_disk as soon as it waits for it; the
+ * timer unplugs it if nobody came.  Reads sort in front of writes, so
+ * the first queued request tells whether a read is pending.
+ *
+ * The timer runs without q->queue_lock; generic_unplug_device() takes it.
+ */
+static void elevator_antic_timeout(unsigned long data)
+{
+	generic_unplug_device((void *) data);
+}
+
+/*
+ * Called with q->queue_lock held.
+ */
+void elevator_deadline_completed_req(request_queue_t *q, struct request *rq)
+{
+	elevator_t *elevator = &q->elevator;
+
+	if (rq->cmd != READ || !elevator->antic_expire || q->plugged)
+		return;
+	if (list_empty(&q->queue_head))
+		return;
+	if (blkdev_entry_to_request(q->queue_head.next)->cmd == READ)
+		return;
+
+	q->plugged = 1;
+	queue_task(&q->plug_tq, &tq_disk);
+
+	elevator->antic_timer.data = (unsigned long) q;
+	elevator->antic_timer.function = elevator_antic_timeout;
+	mod_timer(&elevator->antic_timer, jiffies + elevator->antic_expire);
+}
+
+/*
+ * Requests already queued were placed by the old elevator.  Make them
+ * zero sequence points so that the new one only orders what comes after
+ * them.  The queue ID and the timer stay with the queue.
+ *
+ * Called with q->queue_lock held.
+ */
+static void elevator_switch(request_queue_t *q, elevator_t *type)
+{
+	elevator_t *elevator = &q->elevator;
+	struct list_head *entry;
+
+	list_for_each(entry, &q->queue_head)
+		blkdev_entry_to_request(entry)->elevator_sequence = 0;
+
+	elevator->read_latency			= type->read_latency;
+	elevator->write_latency			= type->write_latency;
+	elevator->elevator_merge_fn		= type->elevator_merge_fn;
+	elevator->elevator_merge_req_fn		= type->elevator_merge_req_fn;
+	elevator->elevator_completed_req_fn	= type->elevator_completed_req_fn;
+	elevator->elevator_ID			= type->elevator_ID;
+	elevator->antic_expire			= type->antic_expire;
+}
+
+int blkelvget_ioctl(request_queue_t * q, blkelv_ioctl_arg_t * arg)
+{
+	elevator_t *elevator = &q->elevator;
 	blkelv_ioctl_arg_t output;
 
 	output.queue_ID			= elevator->queue_ID;
 	output.read_latency		= elevator->read_latency;
 	output.write_latency		= elevator->write_latency;
-	output.max_bomb_segments	= 0;
+	output.max_bomb_segments	= elevator->elevator_ID;
 
 	if (copy_to_user(arg, &output, sizeof(blkelv_ioctl_arg_t)))
 		return -EFAULT;
@@ -194,10 +346,21 @@ int blkelvget_ioctl(elevator_t * elevator, blkelv_ioctl_arg_t * arg)
 	return 0;
 }
 
-int blkelvset_ioctl(elevator_t * elevator, const blkelv_ioctl_arg_t * arg)
+/*
+ * A request that changes the elevator installs it with its default
+ * latencies; tune them with a second BLKELVSET.  Queues set up with
+ * blk_queue_make_request() alone have no elevator, no queue_lock and
+ * no antic_timer, and are refused.
+ */
+int blkelvset_ioctl(request_queue_t * q, const blkelv_ioctl_arg_t * arg)
 {
+	elevator_t *elevator = &q->elevator;
 	blkelv_ioctl_arg_t input;
+	elevator_t type;
+	unsigned long flags;
 
+	if (!q->request_fn)
+		return -EINVAL;
 	if (copy_from_user(&input, arg, sizeof(blkelv_ioctl_arg_t)))
 		return -EFAULT;
 
@@ -206,6 +369,37 @@ int blkelvset_ioctl(elevator_t * elevator, const blkelv_ioctl_arg_t * arg)
 	if (input.write_latency < 0)
 		return -EINVAL;
 
+	if (input.max_bomb_segments &&
+	    input.max_bomb_segments != elevator->elevator_ID) {
+		switch (input.max_bomb_segments) {
+			case ELV_ID_NOOP:
+				type = ELEVATOR_NOOP;
+				break;
+			case ELV_ID_LINUS:
+				type = ELEVATOR_LINUS;
+				break;
+			case ELV_ID_DEADLINE:
+				type = ELEVATOR_DEADLINE;
+				break;
+			case ELV_ID_ANTICIPATORY:
+				type = ELEVATOR_ANTICIPATORY;
+				break;
+			default:
+				return -EINVAL;
+		}
+
+		spin_lock_irqsave(q->queue_lock, flags);
+		elevator_switch(q, &type);
+		spin_unlock_irqrestore(q->queue_lock, flags);
+
+		/*
+		 * the old elevator may have left the queue plugged
+		 */
+		del_timer_sync(&elevator->antic_timer);
+		generic_unplug_device(q);
+		return 0;
+	}
+
 	elevator->read_latency		= input.read_latency;
 	elevator->write_latency		= input.write_latency;
 	return 0;
@@ -217,4 +411,5 @@ void elevator_init(elevator_t * elevator, elevator_t type)
 
 	*elevator = type;
 	elevator->queue_ID = queue_ID++;
+	init_timer(&elevator->antic_timer);
 }
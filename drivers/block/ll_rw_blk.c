@@ -182,6 +182,7 @@ void blk_cleanup_queue(request_queue_t * q)
 	if (count)
 		printk("blk_cleanup_queue: leaked requests (%d)\n", count);
 
+	del_timer_sync(&q->elevator.antic_timer);
 	memset(q, 0, sizeof(*q));
 }
 
@@ -214,6 +215,26 @@ void blk_queue_headactive(request_queue_t * q, int active)
 	q->head_active = active;
 }
 
+/**
+ * blk_queue_private_lock - give a request queue a lock of its own
+ * @q:       The queue which this applies to.
+ *
+ * Description:
+ *    By default every queue set up with blk_init_queue() is protected by
+ *    the global $io_request_lock, so I/O submission to all devices in the
+ *    system serializes on it.  A driver that only ever touches its queue
+ *    through q->queue_lock may call this right after blk_init_queue(),
+ *    before any I/O is queued, so that the queue is protected by a lock
+ *    embedded in it instead.  The request_fn is then called with that
+ *    lock held and interrupts disabled, and the driver must hold it when
+ *    dequeueing or completing requests.
+ **/
+void blk_queue_private_lock(request_queue_t * q)
+{
+	spin_lock_init(&q->__queue_lock);
+	q->queue_lock = &q->__queue_lock;
+}
+
 /**
  * blk_queue_make_request - define an alternate make_request function for a device
  * @q:  the request queue for the device to be affected
@@ -370,9 +391,9 @@ void generic_unplug_device(void *data)
 	request_queue_t *q = (request_queue_t *) data;
 	unsigned long flags;
 
-	spin_lock_irqsave(&io_request_lock, flags);
+	spin_lock_irqsave(q->queue_lock, flags);
 	__generic_unplug_device(q);
-	spin_unlock_irqrestore(&io_request_lock, flags);
+	spin_unlock_irqrestore(q->queue_lock, flags);
 }
 
 /** blk_grow_request_list
@@ -396,7 +417,7 @@ int blk_grow_request_list(request_queue_t *q, int nr_requests)
 	 * this causes system hangs during boot.
 	 * As a temporary fix, make the the function non-blocking.
 	 */
-	spin_lock_irqsave(&io_request_lock, flags);
+	spin_lock_irqsave(q->queue_lock, flags);
 	while (q->nr_requests < nr_requests) {
 		struct request *rq;
 		int rw;
@@ -414,7 +435,7 @@ int blk_grow_request_list(request_queue_t *q, int nr_requests)
 	q->batch_requests = q->nr_requests / 4;
 	if (q->batch_requests > 32)
 		q->batch_requests = 32;
-	spin_unlock_irqrestore(&io_request_lock, flags);
+	spin_unlock_irqrestore(q->queue_lock, flags);
 	return q->nr_requests;
 }
 
@@ -439,7 +460,7 @@ static void blk_init_free_list(request_queue_t *q)
 
 	init_waitqueue_head(&q->wait_for_requests[0]);
 	init_waitqueue_head(&q->wait_for_requests[1]);
-	spin_lock_init(&q->queue_lock);
+	spin_lock_init(&q->__queue_lock);
 }
 
 static int __make_request(request_queue_t * q, int rw, struct buffer_head * bh);
@@ -465,8 +486,9 @@ static int __make_request(request_queue_t * q, int rw, struct buffer_head * bh);
  *    requests on the queue, it is responsible for arranging that the requests
  *    get dealt with eventually.
  *
- *    A global spin lock $io_request_lock must be held while manipulating the
- *    requests on the request queue.
+ *    The spin lock q->queue_lock must be held while manipulating the
+ *    requests on the request queue.  This is the global $io_request_lock
+ *    unless the driver calls blk_queue_private_lock().
  *
  *    The request on the head of the queue is by default assumed to be
  *    potentially active, and it is not considered for re-ordering or merging
@@ -479,6 +501,7 @@ static int __make_request(request_queue_t * q, int rw, struct buffer_head * bh);
  **/
 void blk_init_queue(request_queue_t * q, request_fn_proc * rfn)
 {
+	q->queue_lock		= &io_request_lock;
 	INIT_LIST_HEAD(&q->queue_head);
 	elevator_init(&q->elevator, ELEVATOR_LINUS);
 	blk_init_free_list(q);
@@ -505,7 +528,7 @@ void blk_init_queue(request_queue_t * q, request_fn_proc * rfn)
 
 #define blkdev_free_rq(list) list_entry((list)->next, struct request, queue);
 /*
- * Get a free request. io_request_lock must be held and interrupts
+ * Get a free request. q->queue_lock must be held and interrupts
  * disabled on the way in.  Returns NULL if there are no free requests.
  */
 static struct request *get_request(request_queue_t *q, int rw)
@@ -596,9 +619,9 @@ static struct request *__get_request_wait(request_queue_t *q, int rw)
 		set_current_state(TASK_UNINTERRUPTIBLE);
 		if (q->rq[rw].count == 0)
 			schedule();
-		spin_lock_irq(&io_request_lock);
+		spin_lock_irq(q->queue_lock);
 		rq = get_request(q, rw);
-		spin_unlock_irq(&io_request_lock);
+		spin_unlock_irq(q->queue_lock);
 	} while (rq == NULL);
 	remove_wait_queue(&q->wait_for_requests[rw], &wait);
 	current->state = TASK_RUNNING;
@@ -789,7 +812,7 @@ EXPORT_SYMBOL(req_finished_io);
 
 /*
  * add-request adds a request to the linked list.
- * io_request_lock is held and interrupts disabled, as we muck with the
+ * q->queue_lock is held and interrupts disabled, as we muck with the
  * request queue list.
  *
  * By this point, req->cmd is always either READ/WRITE, never READA,
@@ -801,7 +824,7 @@ static inline void add_request(request_queue_t * q, struct request * req,
 	drive_stat_acct(req->rq_dev, req->cmd, req->nr_sectors, 1);
 
 	if (!q->plugged && q->head_active && insert_here == &q->queue_head) {
-		spin_unlock_irq(&io_request_lock);
+		spin_unlock_irq(q->queue_lock);
 		BUG();
 	}
 
@@ -813,7 +836,7 @@ static inline void add_request(request_queue_t * q, struct request * req,
 }
 
 /*
- * Must be called with io_request_lock held and interrupts disabled
+ * Must be called with req->q->queue_lock held and interrupts disabled
  */
 void blkdev_release_request(struct request *req)
 {
@@ -956,7 +979,7 @@ again:
 	 * Now we acquire the request spinlock, we have to be mega careful
 	 * not to schedule or do something nonatomic
 	 */
-	spin_lock_irq(&io_request_lock);
+	spin_lock_irq(q->queue_lock);
 
 	insert_here = head->prev;
 	if (list_empty(head)) {
@@ -1017,6 +1040,14 @@ again:
 				insert_here = &req->queue;
 			break;
 
+		/*
+		 * elevator wants the new request in front of everything
+		 * that is not already active
+		 */
+		case ELEVATOR_HEAD_INSERT:
+			insert_here = head;
+			break;
+
 		default:
 			printk("elevator returned crap (%d)\n", el_ret);
 			BUG();
@@ -1032,7 +1063,7 @@ get_rq:
 		 */
 		if (rw_ahead) {
 			if (q->rq[rw].count < q->batch_requests) {
-				spin_unlock_irq(&io_request_lock);
+				spin_unlock_irq(q->queue_lock);
 				goto end_io;
 			}
 			req = get_request(q, rw);
@@ -1041,7 +1072,7 @@ get_rq:
 		} else {
 			req = get_request(q, rw);
 			if (req == NULL) {
-				spin_unlock_irq(&io_request_lock);
+				spin_unlock_irq(q->queue_lock);
 				freereq = __get_request_wait(q, rw);
 				goto again;
 			}
@@ -1069,7 +1100,7 @@ get_rq:
 out:
 	if (freereq)
 		blkdev_release_request(freereq);
-	spin_unlock_irq(&io_request_lock);
+	spin_unlock_irq(q->queue_lock);
 	return 0;
 end_io:
 	bh->b_end_io(bh, test_bit(BH_Uptodate, &bh->b_state));
@@ -1376,10 +1407,14 @@ int end_that_request_first (struct request *req, int uptodate, char *name)
 
 void end_that_request_last(struct request *req)
 {
+	request_queue_t *q = req->q;
+
 	if (req->waiting != NULL)
 		complete(req->waiting);
 	req_finished_io(req);
 
+	if (q && q->elevator.elevator_completed_req_fn)
+		q->elevator.elevator_completed_req_fn(q, req);
 	blkdev_release_request(req);
 }
 
@@ -1516,6 +1551,7 @@ EXPORT_SYMBOL(blk_init_queue);
 EXPORT_SYMBOL(blk_get_queue);
 EXPORT_SYMBOL(blk_cleanup_queue);
 EXPORT_SYMBOL(blk_queue_headactive);
+EXPORT_SYMBOL(blk_queue_private_lock);
 EXPORT_SYMBOL(blk_queue_make_request);
 EXPORT_SYMBOL(generic_make_request);
 EXPORT_SYMBOL(blkdev_release_request);
@@ -1231,6 +1231,7 @@ static int __init init_blkmtd(void)
   /* setup the page cache info */
   
   mtd_rawdevice->as.nrpages = 0;
+  spin_lock_init(&mtd_rawdevice->as.page_lock);
   INIT_LIST_HEAD(&mtd_rawdevice->as.clean_pages);
   INIT_LIST_HEAD(&mtd_rawdevice->as.dirty_pages);
   INIT_LIST_HEAD(&mtd_rawdevice->as.locked_pages);
@@ -175,8 +175,8 @@ void cpqfcTSWorkerThread( void *host)
 	 */
   exit_mm(current);
 
-  current->session = 1;
-  current->pgrp = 1;
+  change_pid(&current->session, 1);
+  change_pid(&current->pgrp, 1);
 	
   /* Become as one with the init task */
 	
@@ -1425,7 +1425,7 @@ EXPORT_SYMBOL(create_empty_buffers);
  * anyone who might pick it with bread() afterwards...
  */
 
-static void unmap_underlying_metadata(struct buffer_head * bh)
+void unmap_underlying_metadata(struct buffer_head * bh)
 {
 	struct buffer_head *old_bh;
 
@@ -1437,6 +1437,7 @@ static void unmap_underlying_metadata(struct buffer_head * bh)
 		__brelse(old_bh);
 	}
 }
+EXPORT_SYMBOL(unmap_underlying_metadata);
 
 /*
  * NOTE! All mapped/uptodate combinations are valid:
@@ -2925,8 +2926,8 @@ int bdflush(void *startup)
 	 *	display semi-sane things. Not real crucial though...  
 	 */
 
-	tsk->session = 1;
-	tsk->pgrp = 1;
+	change_pid(&tsk->session, 1);
+	change_pid(&tsk->pgrp, 1);
 	strcpy(tsk->comm, "bdflush");
 
 	/* avoid getting signals */
@@ -2975,8 +2976,8 @@ int kupdate(void *startup)
 	struct task_struct * tsk = current;
 	int interval;
 
-	tsk->session = 1;
-	tsk->pgrp = 1;
+	change_pid(&tsk->session, 1);
+	change_pid(&tsk->pgrp, 1);
 	strcpy(tsk->comm, "kupdated");
 
 	/* sigstop and sigcont will stop and wakeup kupdate */
@@ -0,0 +1,844 @@
+/*
+ *  linux/fs/eventpoll.c
+ *
+ *  Efficient event notification for large descriptor sets.
+ *
+ *  select() and poll() hand the whole interest set to the kernel on every
+ *  call and walk every descriptor to find the few that are ready.  An
+ *  epoll set instead stays registered: each watched file gets a callback
+ *  hooked onto its wait queues, the callback moves the item onto a ready
+ *  list, and sys_epoll_wait() only has to look at that list.  The cost of
+ *  a wait is therefore proportional to the number of ready descriptors,
+ *  not to the size of the set.
+ *
+ *  Locking:
+ *	epsem		serialises teardown, either of a watched file
+ *			(eventpoll_release_file) or of the epoll file
+ *			itself (ep_free).
+ *	ep->sem		protects the item tree; taken for writing by
+ *			sys_epoll_ctl() and teardown, for reading while
+ *			ready events are copied out.
+ *	ep->lock	irq-safe spinlock protecting the ready list.  The
+ *			wakeup callbacks run under foreign wait queue
+ *			locks, possibly from interrupts.
+ *	file->f_ep_lock	protects file->f_ep_links.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/signal.h>
+#include <linux/errno.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/smp_lock.h>
+#include <linux/string.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/wait.h>
+#include <linux/eventpoll.h>
+#include <asm/uaccess.h>
+#include <asm/semaphore.h>
+
+#define EVENTPOLLFS_MAGIC 0x03111965
+
+/* Upper bound on the events returned by a single sys_epoll_wait() */
+#define EP_MAX_EVENTS (INT_MAX / sizeof(struct epoll_event))
+
+/* Events that are always reported, whether asked for or not */
+#define EP_ALWAYS_EVENTS (POLLERR | POLLHUP)
+
+struct eventpoll {
+	/* Protects the item tree, see above */
+	struct rw_semaphore sem;
+
+	/* Protects rdllist */
+	spinlock_t lock;
+
+	/* Tasks sleeping in sys_epoll_wait() */
+	struct wait_queue_head_t wq;
+
+	/* Tasks polling the epoll file itself */
+	struct wait_queue_head_t poll_wait;
+
+	/* Items with pending events */
+	struct list_head rdllist;
+
+	/* All items of this set, keyed by (file, fd) */
+	rb_root_t rbr;
+};
+
+/* One hook on one wait queue of a watched file */
+struct eppoll_entry {
+	/* Link in epitem->pwqlist */
+	struct list_head llink;
+
+	struct epitem *base;
+	wait_queue_t wait;
+	struct wait_queue_head_t *whead;
+};
+
+/* One watched descriptor */
+struct epitem {
+	rb_node_t rbn;
+
+	/* Link in eventpoll->rdllist */
+	struct list_head rdllink;
+
+	/* Link in the private transfer list of ep_events_transfer() */
+	struct list_head txlink;
+
+	/* Wait queue hooks, and their count (-1 if hooking failed) */
+	struct list_head pwqlist;
+	int nwait;
+
+	struct eventpoll *ep;
+	int fd;
+	struct file *file;
+
+	/* Interest mask and user data */
+	struct epoll_event event;
+
+	/* Events seen during the last transfer */
+	unsigned int revents;
+
+	/* Link in file->f_ep_links */
+	struct list_head fllink;
+};
+
+/* Argument passed through poll_table to ep_ptable_queue_proc() */
+struct ep_pqueue {
+	poll_table pt;
+	struct epitem *epi;
+};
+
+static DECLARE_MUTEX(epsem);
+
+static struct kmem_cache_s *epi_cache;
+static struct kmem_cache_s *pwq_cache;
+
+static struct vfsmount *eventpoll_mnt;
+
+static int ep_eventpoll_close(struct inode *inode, struct file *file);
+static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait);
+
+static struct file_operations eventpoll_fops = {
+	release:	ep_eventpoll_close,
+	poll:		ep_eventpoll_poll,
+};
+
+static inline int is_file_epoll(struct file *f)
+{
+	return f->f_op == &eventpoll_fops;
+}
+
+static inline int ep_is_linked(struct list_head *p)
+{
+	return !list_empty(p);
+}
+
+static inline int ep_cmp(struct file *f1, int fd1, struct file *f2, int fd2)
+{
+	return (f1 > f2 ? 1 : (f1 < f2 ? -1 : fd1 - fd2));
+}
+
+static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
+{
+	int kcmp;
+	rb_node_t *n = ep->rbr.rb_node;
+	struct epitem *epi;
+
+	while (n) {
+		epi = rb_entry(n, struct epitem, rbn);
+		kcmp = ep_cmp(file, fd, epi->file, epi->fd);
+		if (kcmp > 0)
+			n = n->rb_right;
+		else if (kcmp < 0)
+			n = n->rb_left;
+		else
+			return epi;
+	}
+	return NULL;
+}
+
+static void ep_rbtree_insert(struct eventpoll *ep, struct epitem *epi)
+{
+	int kcmp;
+	rb_node_t **p = &ep->rbr.rb_node, *parent = NULL;
+	struct epitem *epic;
+
+	while (*p) {
+		parent = *p;
+		epic = rb_entry(parent, struct epitem, rbn);
+		kcmp = ep_cmp(epi->file, epi->fd, epic->file, epic->fd);
+		if (kcmp > 0)
+			p = &parent->rb_right;
+		else
+			p = &parent->rb_left;
+	}
+	rb_link_node(&epi->rbn, parent, p);
+	rb_insert_color(&epi->rbn, &ep->rbr);
+}
+
+/*
+ * Wakeup callback hooked onto the wait queues of watched files.  Runs
+ * with the foreign wait queue lock held, maybe from an interrupt, so it
+ * must not sleep and must not look at the file: just queue the item and
+ * let sys_epoll_wait() find out what happened.
+ */
+static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync)
+{
+	int pwake = 0;
+	unsigned long flags;
+	struct eppoll_entry *pwq = list_entry(wait, struct eppoll_entry, wait);
+	struct epitem *epi = pwq->base;
+	struct eventpoll *ep = epi->ep;
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (!ep_is_linked(&epi->rdllink))
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+	if (waitqueue_active(&ep->wq))
+		wake_up(&ep->wq);
+	if (waitqueue_active(&ep->poll_wait))
+		pwake++;
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	if (pwake)
+		wake_up(&ep->poll_wait);
+	return 1;
+}
+
+/*
+ * poll_table callback used while the item is being inserted: the file's
+ * ->poll() calls it once for every wait queue it would sleep on.
+ */
+static void ep_ptable_queue_proc(struct file *file, struct wait_queue_head_t *whead,
+				 poll_table *pt)
+{
+	struct epitem *epi = ((struct ep_pqueue *) pt)->epi;
+	struct eppoll_entry *pwq;
+
+	if (epi->nwait < 0)
+		return;
+	pwq = kmem_cache_alloc(pwq_cache, SLAB_KERNEL);
+	if (!pwq) {
+		/* Make ep_insert() fail */
+		epi->nwait = -1;
+		return;
+	}
+	init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
+	pwq->whead = whead;
+	pwq->base = epi;
+	add_wait_queue(whead, &pwq->wait);
+	list_add_tail(&pwq->llink, &epi->pwqlist);
+	epi->nwait++;
+}
+
+/*
+ * Unhook the item from all the wait queues it sits on.  Once this
+ * returns, ep_poll_callback() can no longer run for the item.
+ */
+static void ep_unregister_pollwait(struct epitem *epi)
+{
+	struct list_head *lsthead = &epi->pwqlist;
+	struct eppoll_entry *pwq;
+
+	while (!list_empty(lsthead)) {
+		pwq = list_entry(lsthead->next, struct eppoll_entry, llink);
+		list_del(&pwq->llink);
+		remove_wait_queue(pwq->whead, &pwq->wait);
+		kmem_cache_free(pwq_cache, pwq);
+	}
+	epi->nwait = 0;
+}
+
+/*
+ * Remove an item from the set and free it.  Called with ep->sem held
+ * for writing.
+ */
+static void ep_remove(struct eventpoll *ep, struct epitem *epi)
+{
+	unsigned long flags;
+	struct file *file = epi->file;
+
+	ep_unregister_pollwait(epi);
+
+	spin_lock(&file->f_ep_lock);
+	if (ep_is_linked(&epi->fllink))
+		list_del_init(&epi->fllink);
+	spin_unlock(&file->f_ep_lock);
+
+	rb_erase(&epi->rbn, &ep->rbr);
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (ep_is_linked(&epi->rdllink))
+		list_del_init(&epi->rdllink);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	kmem_cache_free(epi_cache, epi);
+}
+
+static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
+		     struct file *tfile, int fd)
+{
+	unsigned int revents;
+	unsigned long flags;
+	int pwake = 0;
+	struct epitem *epi;
+	struct ep_pqueue epq;
+
+	epi = kmem_cache_alloc(epi_cache, SLAB_KERNEL);
+	if (!epi)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&epi->rdllink);
+	INIT_LIST_HEAD(&epi->txlink);
+	INIT_LIST_HEAD(&epi->fllink);
+	INIT_LIST_HEAD(&epi->pwqlist);
+	epi->nwait = 0;
+	epi->ep = ep;
+	epi->file = tfile;
+	epi->fd = fd;
+	epi->event = *event;
+	epi->revents = 0;
+
+	/*
+	 * Hook onto the file's wait queues and fetch its current state in
+	 * one go.  From here on ep_poll_callback() may run for the item.
+	 */
+	epq.epi = epi;
+	init_poll_funcptr(&epq.pt, ep_ptable_queue_proc);
+	revents = tfile->f_op->poll(tfile, &epq.pt);
+
+	if (epi->nwait < 0) {
+		ep_unregister_pollwait(epi);
+		kmem_cache_free(epi_cache, epi);
+		return -ENOMEM;
+	}
+
+	spin_lock(&tfile->f_ep_lock);
+	list_add_tail(&epi->fllink, &tfile->f_ep_links);
+	spin_unlock(&tfile->f_ep_lock);
+
+	ep_rbtree_insert(ep, epi);
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+		if (waitqueue_active(&ep->wq))
+			wake_up(&ep->wq);
+		if (waitqueue_active(&ep->poll_wait))
+			pwake++;
+	}
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	if (pwake)
+		wake_up(&ep->poll_wait);
+	return 0;
+}
+
+static int ep_modify(struct eventpoll *ep, struct epitem *epi,
+		     struct epoll_event *event)
+{
+	unsigned int revents;
+	unsigned long flags;
+	int pwake = 0;
+
+	epi->event.events = event->events;
+	epi->event.data = event->data;
+
+	revents = epi->file->f_op->poll(epi->file, NULL);
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+		if (waitqueue_active(&ep->wq))
+			wake_up(&ep->wq);
+		if (waitqueue_active(&ep->poll_wait))
+			pwake++;
+	}
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	if (pwake)
+		wake_up(&ep->poll_wait);
+	return 0;
+}
+
+/*
+ * Copy up to 'maxevents' ready events to user space.  The ready items
+ * are first moved to a private list, so that callbacks firing while we
+ * poll the files requeue them on rdllist instead of being lost.  Level
+ * triggered items that are still ready go back on rdllist afterwards, so
+ * the next sys_epoll_wait() reports them again.
+ */
+static int ep_events_transfer(struct eventpoll *ep, struct epoll_event *events,
+			      int maxevents)
+{
+	int eventcnt = 0, error = 0;
+	unsigned long flags;
+	struct list_head txlist, *lnk;
+	struct epitem *epi;
+	struct epoll_event uevent;
+
+	INIT_LIST_HEAD(&txlist);
+
+	down_read(&ep->sem);
+
+	spin_lock_irqsave(&ep->lock, flags);
+	while (!list_empty(&ep->rdllist) && eventcnt < maxevents) {
+		epi = list_entry(ep->rdllist.next, struct epitem, rdllink);
+		list_del_init(&epi->rdllink);
+		list_add_tail(&epi->txlink, &txlist);
+		eventcnt++;
+	}
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	eventcnt = 0;
+	list_for_each(lnk, &txlist) {
+		epi = list_entry(lnk, struct epitem, txlink);
+		epi->revents = epi->file->f_op->poll(epi->file, NULL) &
+			epi->event.events;
+		if (!epi->revents || error)
+			continue;
+		uevent.events = epi->revents;
+		uevent.data = epi->event.data;
+		if (__copy_to_user(&events[eventcnt], &uevent, sizeof(uevent))) {
+			error = -EFAULT;
+			continue;
+		}
+		eventcnt++;
+		if (epi->event.events & EPOLLET)
+			epi->revents = 0;
+	}
+
+	spin_lock_irqsave(&ep->lock, flags);
+	while (!list_empty(&txlist)) {
+		epi = list_entry(txlist.next, struct epitem, txlink);
+		list_del_init(&epi->txlink);
+		if (epi->revents && !ep_is_linked(&epi->rdllink))
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+	}
+	if (!list_empty(&ep->rdllist) && waitqueue_active(&ep->wq))
+		wake_up(&ep->wq);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	up_read(&ep->sem);
+
+	return eventcnt ? eventcnt : error;
+}
+
+static int ep_poll(struct eventpoll *ep, struct epoll_event *events,
+		   int maxevents, long timeout)
+{
+	int res, eavail;
+	unsigned long flags;
+	long jtimeout;
+	wait_queue_t wait;
+
+	/* Round up to the next tick, as sys_poll() does */
+	jtimeout = timeout < 0 || timeout >= (MAX_SCHEDULE_TIMEOUT - 999) / HZ ?
+		MAX_SCHEDULE_TIMEOUT : (timeout * HZ + 999) / 1000;
+
+retry:
+	spin_lock_irqsave(&ep->lock, flags);
+
+	res = 0;
+	if (list_empty(&ep->rdllist)) {
+		init_waitqueue_entry(&wait, current);
+		add_wait_queue(&ep->wq, &wait);
+
+		for (;;) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (!list_empty(&ep->rdllist) || !jtimeout)
+				break;
+			if (signal_pending(current)) {
+				res = -EINTR;
+				break;
+			}
+
+			spin_unlock_irqrestore(&ep->lock, flags);
+			jtimeout = schedule_timeout(jtimeout);
+			spin_lock_irqsave(&ep->lock, flags);
+		}
+		remove_wait_queue(&ep->wq, &wait);
+
+		set_current_state(TASK_RUNNING);
+	}
+
+	eavail = !list_empty(&ep->rdllist);
+
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	/*
+	 * Every queued item may have turned out not to be ready any more
+	 * by the time we polled it; go back to sleep if time is left.
+	 */
+	if (!res && eavail &&
+	    !(res = ep_events_transfer(ep, events, maxevents)) && jtimeout)
+		goto retry;
+
+	return res;
+}
+
+static void ep_free(struct eventpoll *ep)
+{
+	rb_node_t *rbp;
+
+	/*
+	 * Unhook everything first so no callback can touch the set, then
+	 * drop the items.  epsem keeps eventpoll_release_file() from
+	 * freeing items under us.
+	 */
+	down(&epsem);
+	down_write(&ep->sem);
+	while ((rbp = ep->rbr.rb_node) != NULL)
+		ep_remove(ep, rb_entry(rbp, struct epitem, rbn));
+	up_write(&ep->sem);
+	up(&epsem);
+}
+
+/*
+ * A watched file is going away: drop it from every set it is in.
+ */
+void eventpoll_release_file(struct file *file)
+{
+	struct list_head *lsthead = &file->f_ep_links;
+	struct eventpoll *ep;
+	struct epitem *epi;
+
+	down(&epsem);
+	while (!list_empty(lsthead)) {
+		epi = list_entry(lsthead->next, struct epitem, fllink);
+		ep = epi->ep;
+		down_write(&ep->sem);
+		ep_remove(ep, epi);
+		up_write(&ep->sem);
+	}
+	up(&epsem);
+}
+
+static int ep_eventpoll_close(struct inode *inode, struct file *file)
+{
+	struct eventpoll *ep = file->private_data;
+
+	if (ep) {
+		ep_free(ep);
+		kfree(ep);
+	}
+	return 0;
+}
+
+static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
+{
+	unsigned int pollflags = 0;
+	unsigned long flags;
+	struct eventpoll *ep = file->private_data;
+
+	poll_wait(file, &ep->poll_wait, wait);
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (!list_empty(&ep->rdllist))
+		pollflags = POLLIN | POLLRDNORM;
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	return pollflags;
+}
+
+static int eventpollfs_delete_dentry(struct dentry *dentry)
+{
+	return 1;
+}
+
+static struct dentry_operations eventpollfs_dentry_operations = {
+	d_delete:	eventpollfs_delete_dentry,
+};
+
+static struct inode *ep_eventpoll_inode(void)
+{
+	struct inode *inode = new_inode(eventpoll_mnt->mnt_sb);
+
+	if (!inode)
+		return NULL;
+	inode->i_fop = &eventpoll_fops;
+
+	/* See get_pipe_inode() */
+	inode->i_state = I_DIRTY;
+	inode->i_mode = S_IRUSR | S_IWUSR;
+	inode->i_uid = current->fsuid;
+	inode->i_gid = current->fsgid;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_blksize = PAGE_SIZE;
+	return inode;
+}
+
+/*
+ * Create a new epoll set.  'size' is only a hint of the number of
+ * descriptors the caller expects to watch.
+ */
+asmlinkage long sys_epoll_create(int size)
+{
+	struct qstr this;
+	char name[32];
+	struct dentry *dentry;
+	struct inode *inode;
+	struct file *file;
+	struct eventpoll *ep;
+	int error, fd;
+
+	if (size <= 0)
+		return -EINVAL;
+
+	error = -ENOMEM;
+	ep = kmalloc(sizeof(*ep), GFP_KERNEL);
+	if (!ep)
+		goto no_ep;
+	init_rwsem(&ep->sem);
+	spin_lock_init(&ep->lock);
+	init_waitqueue_head(&ep->wq);
+	init_waitqueue_head(&ep->poll_wait);
+	INIT_LIST_HEAD(&ep->rdllist);
+	ep->rbr = RB_ROOT;
+
+	error = -ENFILE;
+	file = get_empty_filp();
+	if (!file)
+		goto free_ep;
+
+	inode = ep_eventpoll_inode();
+	if (!inode)
+		goto close_file;
+
+	error = get_unused_fd();
+	if (error < 0)
+		goto close_file_inode;
+	fd = error;
+
+	error = -ENOMEM;
+	sprintf(name, "[%lu]", inode->i_ino);
+	this.name = (const unsigned char *) name;
+	this.len = strlen(name);
+	this.hash = inode->i_ino;
+	dentry = d_alloc(eventpoll_mnt->mnt_sb->s_root, &this);
+	if (!dentry)
+		goto close_file_inode_fd;
+	dentry->d_op = &eventpollfs_dentry_operations;
+	d_add(dentry, inode);
+	file->f_vfsmnt = mntget(eventpoll_mnt);
+	file->f_dentry = dentry;
+
+	file->f_pos = 0;
+	file->f_flags = O_RDONLY;
+	file->f_op = &eventpoll_fops;
+	file->f_mode = FMODE_READ;
+	file->f_version = 0;
+	file->private_data = ep;
+
+	fd_install(fd, file);
+	return fd;
+
+close_file_inode_fd:
+	put_unused_fd(fd);
+close_file_inode:
+	iput(inode);
+close_file:
+	put_filp(file);
+free_ep:
+	kfree(ep);
+no_ep:
+	return error;
+}
+
+asmlinkage long sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	int error;
+	struct file *file, *tfile;
+	struct eventpoll *ep;
+	struct epitem *epi;
+	struct epoll_event epds;
+
+	error = -EFAULT;
+	if (op != EPOLL_CTL_DEL &&
+	    copy_from_user(&epds, event, sizeof(struct epoll_event)))
+		goto out;
+
+	error = -EBADF;
+	file = fget(epfd);
+	if (!file)
+		goto out;
+
+	tfile = fget(fd);
+	if (!tfile)
+		goto out_fput;
+
+	/* The target file must support poll */
+	error = -EPERM;
+	if (!tfile->f_op || !tfile->f_op->poll)
+		goto out_tfput;
+
+	/*
+	 * epfd must be an epoll file.  Epoll files cannot be watched by
+	 * another set, which keeps wakeup chains from looping back on
+	 * themselves.
+	 */
+	error = -EINVAL;
+	if (!is_file_epoll(file) || is_file_epoll(tfile))
+		goto out_tfput;
+
+	ep = file->private_data;
+
+	down_write(&ep->sem);
+
+	epi = ep_find(ep, tfile, fd);
+
+	error = -EINVAL;
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		if (!epi) {
+			epds.events |= EP_ALWAYS_EVENTS;
+			error = ep_insert(ep, &epds, tfile, fd);
+		} else
+			error = -EEXIST;
+		break;
+	case EPOLL_CTL_DEL:
+		if (epi) {
+			ep_remove(ep, epi);
+			error = 0;
+		} else
+			error = -ENOENT;
+		break;
+	case EPOLL_CTL_MOD:
+		if (epi) {
+			epds.events |= EP_ALWAYS_EVENTS;
+			error = ep_modify(ep, epi, &epds);
+		} else
+			error = -ENOENT;
+		break;
+	}
+
+	up_write(&ep->sem);
+
+out_tfput:
+	fput(tfile);
+out_fput:
+	fput(file);
+out:
+	return error;
+}
+
+/*
+ * Wait for events on an epoll set.  'timeout' is in milliseconds, -1
+ * means forever.
+ */
+asmlinkage long sys_epoll_wait(int epfd, struct epoll_event *events,
+			       int maxevents, int timeout)
+{
+	int error;
+	struct file *file;
+	struct eventpoll *ep;
+
+	if (maxevents <= 0 || maxevents > EP_MAX_EVENTS)
+		return -EINVAL;
+
+	if (verify_area(VERIFY_WRITE, events, maxevents * sizeof(struct epoll_event)))
+		return -EFAULT;
+
+	error = -EBADF;
+	file = fget(epfd);
+	if (!file)
+		goto out;
+
+	error = -EINVAL;
+	if (!is_file_epoll(file))
+		goto out_fput;
+
+	ep = file->private_data;
+
+	error = ep_poll(ep, events, maxevents, timeout);
+
+out_fput:
+	fput(file);
+out:
+	return error;
+}
+
+static int eventpollfs_statfs(struct super_block *sb, struct statfs *buf)
+{
+	buf->f_type = EVENTPOLLFS_MAGIC;
+	buf->f_bsize = 1024;
+	buf->f_namelen = 255;
+	return 0;
+}
+
+static struct super_operations eventpollfs_ops = {
+	statfs:		eventpollfs_statfs,
+};
+
+/* Never mounted by userland, see the comment in fs/pipe.c */
+static struct super_block *eventpollfs_read_super(struct super_block *sb,
+						  void *data, int silent)
+{
+	struct inode *root = new_inode(sb);
+	if (!root)
+		return NULL;
+	root->i_mode = S_IFDIR | S_IRUSR | S_IWUSR;
+	root->i_uid = root->i_gid = 0;
+	root->i_atime = root->i_mtime = root->i_ctime = CURRENT_TIME;
+	sb->s_blocksize = 1024;
+	sb->s_blocksize_bits = 10;
+	sb->s_magic = EVENTPOLLFS_MAGIC;
+	sb->s_op = &eventpollfs_ops;
+	sb->s_root = d_alloc(NULL, &(const struct qstr)
+			     { (const unsigned char *) "eventpoll:", 10, 0 });
+	if (!sb->s_root) {
+		iput(root);
+		return NULL;
+	}
+	sb->s_root->d_sb = sb;
+	sb->s_root->d_parent = sb->s_root;
+	d_instantiate(sb->s_root, root);
+	return sb;
+}
+
+static DECLARE_FSTYPE(eventpoll_fs_type, "eventpollfs", eventpollfs_read_super,
+		      FS_NOMOUNT);
+
+static int __init eventpoll_init(void)
+{
+	int error;
+
+	error = -ENOMEM;
+	epi_cache = kmem_cache_create("eventpoll_epi", sizeof(struct epitem),
+				      0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if (!epi_cache)
+		goto out;
+	pwq_cache = kmem_cache_create("eventpoll_pwq", sizeof(struct eppoll_entry),
+				      0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if (!pwq_cache)
+		goto free_epi;
+
+	error = register_filesystem(&eventpoll_fs_type);
+	if (error)
+		goto free_pwq;
+
+	eventpoll_mnt = kern_mount(&eventpoll_fs_type);
+	error = PTR_ERR(eventpoll_mnt);
+	if (IS_ERR(eventpoll_mnt))
+		goto unregister;
+
+	return 0;
+
+unregister:
+	unregister_filesystem(&eventpoll_fs_type);
+free_pwq:
+	kmem_cache_destroy(pwq_cache);
+free_epi:
+	kmem_cache_destroy(epi_cache);
+out:
+	return error;
+}
+
+module_init(eventpoll_init)
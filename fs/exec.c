@@ -282,11 +282,16 @@ void put_dirty_page(struct task_struct * tsk, struct page *page, unsigned long a
 	pgd_t * pgd;
 	pmd_t * pmd;
 	pte_t * pte;
+	struct pte_chain * pte_chain;
 
 	if (page_count(page) != 1)
 		printk(KERN_ERR "pg_map disagrees with %p at %08lx\n", page, address);
 	pgd = pgd_offset(tsk->mm, address);
 
+	pte_chain = pte_chain_alloc(GFP_KERNEL);
+	if (!pte_chain)
+		goto out_sig;
+
 	spin_lock(&tsk->mm->page_table_lock);
 	pmd = pmd_alloc(tsk->mm, pgd, address);
 	if (!pmd)
@@ -300,13 +305,17 @@ void put_dirty_page(struct task_struct * tsk, struct page *page, unsigned long a
 	flush_dcache_page(page);
 	flush_page_to_ram(page);
 	set_pte(pte, pte_mkdirty(pte_mkwrite(mk_pte(page, PAGE_COPY))));
+	pte_chain = page_add_rmap(page, pte, tsk->mm, address, pte_chain);
 	tsk->mm->rss++;
 	spin_unlock(&tsk->mm->page_table_lock);
+	pte_chain_free(pte_chain);
 
 	/* no need for flush_tlb */
 	return;
 out:
 	spin_unlock(&tsk->mm->page_table_lock);
+	pte_chain_free(pte_chain);
+out_sig:
 	__free_page(page);
 	force_sig(SIGKILL, tsk);
 	return;
@@ -545,7 +554,7 @@ static inline void de_thread(struct task_struct *tsk)
 	}
 
 	/* Minor oddity: this might stay the same. */
-	tsk->tgid = tsk->pid;
+	change_pid(&tsk->tgid, tsk->pid);
 }
 
 int flush_old_exec(struct linux_binprm * bprm)
@@ -346,12 +346,175 @@ error_return:
 	return;
 }
 
+/*
+ * Reservation windows.
+ *
+ * A regular file being written gets a window of blocks in one group,
+ * and ext2_new_block takes its blocks from there while it can.  Files
+ * growing side by side then each fill their own window instead of
+ * interleaving their blocks.  The windows of a filesystem never overlap
+ * and are kept in an rbtree ordered by block, protected by
+ * s_rsv_window_lock.  Nothing is marked in the bitmaps, so allocations
+ * made without a window may still take reserved blocks.
+ *
+ * A window more than half used by the time it runs out is followed by
+ * one twice its size, up to EXT2_MAX_RESERVE_BLOCKS.
+ */
+
+/* The first window ending at or after block, NULL if there is none */
+static struct ext2_reserve_window *rsv_window_search(rb_root_t *root,
+						      unsigned long block)
+{
+	rb_node_t *n = root->rb_node;
+	struct ext2_reserve_window *rsv, *ret = NULL;
+
+	while (n) {
+		rsv = rb_entry(n, struct ext2_reserve_window, rsv_node);
+		if (rsv->rsv_end < block)
+			n = n->rb_right;
+		else {
+			ret = rsv;
+			n = n->rb_left;
+		}
+	}
+	return ret;
+}
+
+static void rsv_window_add(struct super_block *sb,
+			   struct ext2_reserve_window *rsv)
+{
+	rb_root_t *root = &sb->u.ext2_sb.s_rsv_window_root;
+	rb_node_t **p = &root->rb_node, *parent = NULL;
+	struct ext2_reserve_window *this;
+
+	while (*p) {
+		parent = *p;
+		this = rb_entry(parent, struct ext2_reserve_window, rsv_node);
+		if (rsv->rsv_start < this->rsv_start)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&rsv->rsv_node, parent, p);
+	rb_insert_color(&rsv->rsv_node, root);
+}
+
+static void rsv_window_remove(struct super_block *sb,
+			      struct ext2_reserve_window *rsv)
+{
+	rb_erase(&rsv->rsv_node, &sb->u.ext2_sb.s_rsv_window_root);
+	rsv->rsv_start = rsv->rsv_end = 0;
+}
+
+/*
+ * Called when a writer closes the file, on truncate and when the inode
+ * goes away.
+ */
+void ext2_discard_reservation(struct inode *inode)
+{
+	struct ext2_reserve_window *rsv = &inode->u.ext2_i.i_rsv_window;
+	spinlock_t *lock = &inode->i_sb->u.ext2_sb.s_rsv_window_lock;
+
+	spin_lock(lock);
+	if (rsv->rsv_end)
+		rsv_window_remove(inode->i_sb, rsv);
+	spin_unlock(lock);
+}
+
+/*
+ * Move rsv to a new window in group 'group', starting at the first
+ * free block at or after bit 'goal' that isn't reserved by anybody
+ * else.  Returns the bit the window starts at, or -1 if the rest of
+ * the group has no room for one.
+ */
+static int alloc_new_reservation(struct super_block *sb, int group,
+				 char *bitmap, int goal,
+				 struct ext2_reserve_window *rsv)
+{
+	rb_root_t *root = &sb->u.ext2_sb.s_rsv_window_root;
+	unsigned long group_first = group * EXT2_BLOCKS_PER_GROUP(sb) +
+		le32_to_cpu(sb->u.ext2_sb.s_es->s_first_data_block);
+	int last = EXT2_BLOCKS_PER_GROUP(sb) - 1;
+	int size = rsv->rsv_goal_size;
+	int start = goal, end, bit;
+	struct ext2_reserve_window *next;
+
+	if (rsv->rsv_end) {
+		if (rsv->rsv_alloc_hit > (rsv->rsv_end - rsv->rsv_start + 1) / 2) {
+			size *= 2;
+			if (size > EXT2_MAX_RESERVE_BLOCKS)
+				size = EXT2_MAX_RESERVE_BLOCKS;
+			rsv->rsv_goal_size = size;
+		}
+		rsv_window_remove(sb, rsv);
+	}
+
+	while (start <= last) {
+		end = start + size - 1;
+		if (end > last)
+			end = last;
+		next = rsv_window_search(root, group_first + start);
+		if (next && next->rsv_start <= group_first + end) {
+			start = next->rsv_end + 1 - group_first;
+			continue;
+		}
+		bit = ext2_find_next_zero_bit(bitmap, end + 1, start);
+		if (bit > end) {
+			start = end + 1;
+			continue;
+		}
+		if (bit > start) {
+			start = bit;
+			continue;
+		}
+		rsv->rsv_start = group_first + start;
+		rsv->rsv_end = group_first + end;
+		rsv->rsv_alloc_hit = 0;
+		rsv_window_add(sb, rsv);
+		return start;
+	}
+	return -1;
+}
+
+/*
+ * Find a free bit in the reservation window of the inode, in group
+ * 'group' of bitmap bh, at or after bit 'goal' if that is inside the
+ * window.  When the goal is outside the window or the window is used
+ * up, a new one is reserved from the goal on.  Returns -1 if that
+ * fails too.  Called with the superblock locked.
+ */
+static int ext2_alloc_reserved(struct super_block *sb, int group,
+			       struct buffer_head *bh, int goal,
+			       struct ext2_reserve_window *rsv)
+{
+	unsigned long group_first = group * EXT2_BLOCKS_PER_GROUP(sb) +
+		le32_to_cpu(sb->u.ext2_sb.s_es->s_first_data_block);
+	int j = -1;
+
+	spin_lock(&sb->u.ext2_sb.s_rsv_window_lock);
+	if (rsv->rsv_end && rsv->rsv_start <= group_first + goal &&
+	    group_first + goal <= rsv->rsv_end) {
+		int end = rsv->rsv_end - group_first;
+
+		j = ext2_find_next_zero_bit(bh->b_data, end + 1, goal);
+		if (j > end)
+			j = -1;
+	}
+	if (j < 0)
+		j = alloc_new_reservation(sb, group, bh->b_data, goal, rsv);
+	if (j >= 0)
+		rsv->rsv_alloc_hit++;
+	spin_unlock(&sb->u.ext2_sb.s_rsv_window_lock);
+	return j;
+}
+
 /*
  * ext2_new_block uses a goal block to assist allocation.  If the goal is
  * free, or there is a free block within 32 blocks of the goal, that block
  * is allocated.  Otherwise a forward search is made for a free block; within 
  * each block group the search first looks for an entire free byte in the block
  * bitmap, and then for any free bit if that fails.
+ * Regular files allocate from their reservation window first, see above.
  * This function also updates quota and i_blocks field.
  */
 int ext2_new_block (struct inode * inode, unsigned long goal,
@@ -365,6 +528,7 @@ int ext2_new_block (struct inode * inode, unsigned long goal,
 	struct super_block * sb;
 	struct ext2_group_desc * gdp;
 	struct ext2_super_block * es;
+	struct ext2_reserve_window * rsv = NULL;
 #ifdef EXT2FS_DEBUG
 	static int goal_hits = 0, goal_attempts = 0;
 #endif
@@ -374,6 +538,8 @@ int ext2_new_block (struct inode * inode, unsigned long goal,
 		printk ("ext2_new_block: nonexistent device");
 		return 0;
 	}
+	if (S_ISREG(inode->i_mode) && !test_opt(sb, NORESERVATION))
+		rsv = &inode->u.ext2_i.i_rsv_window;
 
 	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
@@ -412,6 +578,13 @@ repeat:
 
 		ext2_debug ("goal is at %d:%d.\n", i, j);
 
+		if (rsv) {
+			k = ext2_alloc_reserved(sb, i, bh, j, rsv);
+			if (k >= 0) {
+				j = k;
+				goto got_block;
+			}
+		}
 		if (!ext2_test_bit(j, bh->b_data)) {
 			ext2_debug("goal bit allocated, %d hits\n",++goal_hits);
 			goto got_block;
@@ -482,6 +655,11 @@ repeat:
 		goto io_error;
 	
 	bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+	if (rsv) {
+		j = ext2_alloc_reserved(sb, i, bh, 0, rsv);
+		if (j >= 0)
+			goto got_block;
+	}
 	r = memscan(bh->b_data, 0, EXT2_BLOCKS_PER_GROUP(sb) >> 3);
 	j = (r - bh->b_data) << 3;
 	if (j < EXT2_BLOCKS_PER_GROUP(sb))
@@ -543,8 +721,12 @@ got_block:
 		int	prealloc_goal;
 		unsigned long next_block = tmp + 1;
 
-		prealloc_goal = es->s_prealloc_blocks ?
-			es->s_prealloc_blocks : EXT2_DEFAULT_PREALLOC_BLOCKS;
+		if (inode->u.ext2_i.i_alloc_run)
+			prealloc_goal = inode->u.ext2_i.i_alloc_run;
+		else
+			prealloc_goal = es->s_prealloc_blocks ?
+				es->s_prealloc_blocks :
+				EXT2_DEFAULT_PREALLOC_BLOCKS;
 
 		*prealloc_block = next_block;
 		/* Writer: end */
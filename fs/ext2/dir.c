@@ -24,6 +24,7 @@
 #include <linux/fs.h>
 #include <linux/ext2_fs.h>
 #include <linux/pagemap.h>
+#include <linux/slab.h>
 
 typedef struct ext2_dir_entry_2 ext2_dirent;
 
@@ -294,6 +295,393 @@ done:
 	return 0;
 }
 
+/*
+ * Hashed directory index (htree), in the on-disk format ext3 uses; see
+ * fs/ext3/namei.c for the layout.  The root lives behind ".." in the
+ * first block, so an indexed directory still reads as a plain one, and
+ * kernels that don't know about the index clear EXT2_INDEX_FL when they
+ * change it.  Index and leaf blocks are reached through the page cache
+ * like the rest of the directory, one chunk at a time.
+ */
+
+#define ERR_BAD_DX_DIR	-75000
+
+#define swap(x, y) do { typeof(x) z = x; x = y; y = z; } while (0)
+
+struct fake_dirent
+{
+	__u32 inode;
+	__u16 rec_len;
+	__u8 name_len;
+	__u8 file_type;
+};
+
+struct dx_countlimit
+{
+	__u16 limit;
+	__u16 count;
+};
+
+struct dx_entry
+{
+	__u32 hash;
+	__u32 block;
+};
+
+struct dx_root
+{
+	struct fake_dirent dot;
+	char dot_name[4];
+	struct fake_dirent dotdot;
+	char dotdot_name[4];
+	struct dx_root_info
+	{
+		__u32 reserved_zero;
+		__u8 hash_version;
+		__u8 info_length; /* 8 */
+		__u8 indirect_levels;
+		__u8 unused_flags;
+	}
+	info;
+	struct dx_entry	entries[0];
+};
+
+struct dx_node
+{
+	struct fake_dirent fake;
+	struct dx_entry	entries[0];
+};
+
+struct dx_frame
+{
+	struct page *page;
+	char *data;			/* start of the index block */
+	struct dx_entry *entries;
+	struct dx_entry *at;
+};
+
+struct dx_map_entry
+{
+	u32 hash;
+	u16 offs;
+	u16 size;
+};
+
+static inline unsigned dx_get_block (struct dx_entry *entry)
+{
+	return le32_to_cpu(entry->block) & 0x00ffffff;
+}
+
+static inline void dx_set_block (struct dx_entry *entry, unsigned value)
+{
+	entry->block = cpu_to_le32(value);
+}
+
+static inline unsigned dx_get_hash (struct dx_entry *entry)
+{
+	return le32_to_cpu(entry->hash);
+}
+
+static inline void dx_set_hash (struct dx_entry *entry, unsigned value)
+{
+	entry->hash = cpu_to_le32(value);
+}
+
+static inline unsigned dx_get_count (struct dx_entry *entries)
+{
+	return le16_to_cpu(((struct dx_countlimit *) entries)->count);
+}
+
+static inline unsigned dx_get_limit (struct dx_entry *entries)
+{
+	return le16_to_cpu(((struct dx_countlimit *) entries)->limit);
+}
+
+static inline void dx_set_count (struct dx_entry *entries, unsigned value)
+{
+	((struct dx_countlimit *) entries)->count = cpu_to_le16(value);
+}
+
+static inline void dx_set_limit (struct dx_entry *entries, unsigned value)
+{
+	((struct dx_countlimit *) entries)->limit = cpu_to_le16(value);
+}
+
+static inline unsigned dx_root_limit (struct inode *dir, unsigned infosize)
+{
+	unsigned entry_space = ext2_chunk_size(dir) - EXT2_DIR_REC_LEN(1) -
+		EXT2_DIR_REC_LEN(2) - infosize;
+	return entry_space / sizeof(struct dx_entry);
+}
+
+static inline unsigned dx_node_limit (struct inode *dir)
+{
+	unsigned entry_space = ext2_chunk_size(dir) - EXT2_DIR_REC_LEN(0);
+	return entry_space / sizeof(struct dx_entry);
+}
+
+/*
+ * Without the dir_index feature nobody maintains the index, so any
+ * modification makes the directory a linear one again.
+ */
+static inline void ext2_update_dx_flag(struct inode *dir)
+{
+	if (!EXT2_HAS_COMPAT_FEATURE(dir->i_sb, EXT2_FEATURE_COMPAT_DIR_INDEX))
+		dir->u.ext2_i.i_flags &= ~EXT2_INDEX_FL;
+}
+
+/*
+ * Map directory block 'block'.  Returns its page, mapped, and the start
+ * of the block in *data.
+ */
+static struct page *ext2_get_dir_block(struct inode *dir, unsigned long block,
+				       char **data)
+{
+	int bits = dir->i_sb->s_blocksize_bits;
+	int shift = PAGE_CACHE_SHIFT - bits;
+	struct page *page = ext2_get_page(dir, block >> shift);
+
+	if (!IS_ERR(page))
+		*data = (char *) page_address(page) +
+			((block & ((1 << shift) - 1)) << bits);
+	return page;
+}
+
+/*
+ * A whole block of a directory page is rewritten between these two.
+ */
+static int ext2_prepare_block(struct page *page, char *data)
+{
+	unsigned from = data - (char *) page_address(page);
+	unsigned to = from + ext2_chunk_size(page->mapping->host);
+	int err;
+
+	lock_page(page);
+	err = page->mapping->a_ops->prepare_write(NULL, page, from, to);
+	if (err)
+		UnlockPage(page);
+	return err;
+}
+
+static int ext2_commit_block(struct page *page, char *data)
+{
+	unsigned from = data - (char *) page_address(page);
+	unsigned to = from + ext2_chunk_size(page->mapping->host);
+	int err;
+
+	err = ext2_commit_chunk(page, from, to);
+	UnlockPage(page);
+	return err;
+}
+
+/*
+ * Add a block to the end of the directory, prepared for writing.  The
+ * directory grows when the block is committed.
+ */
+static struct page *ext2_append_block(struct inode *dir, u32 *block,
+				      char **data)
+{
+	struct page *page;
+	int err;
+
+	*block = dir->i_size >> dir->i_sb->s_blocksize_bits;
+	page = ext2_get_dir_block(dir, *block, data);
+	if (IS_ERR(page))
+		return page;
+	err = ext2_prepare_block(page, *data);
+	if (err) {
+		ext2_put_page(page);
+		return ERR_PTR(err);
+	}
+	return page;
+}
+
+/*
+ * Walk the index down to the leaf the name of dentry hashes to.  Fails
+ * with ERR_BAD_DX_DIR when the index is not one we can use, and the
+ * caller should fall back to treating the directory as a linear one.
+ */
+static struct dx_frame *dx_probe(struct inode *dir, struct dentry *dentry,
+				 struct ext2_dx_hash_info *hinfo,
+				 struct dx_frame *frame_in, int *err)
+{
+	unsigned count, limit, indirect, nblocks;
+	struct dx_entry *at, *entries, *p, *q, *m;
+	struct dx_root *root;
+	struct dx_frame *frame = frame_in;
+	struct page *page;
+	char *data;
+	u32 hash;
+
+	frame->page = NULL;
+	page = ext2_get_dir_block(dir, 0, &data);
+	if (IS_ERR(page)) {
+		*err = PTR_ERR(page);
+		return NULL;
+	}
+	root = (struct dx_root *) data;
+	if (root->info.hash_version != DX_HASH_TEA &&
+	    root->info.hash_version != DX_HASH_HALF_MD4 &&
+	    root->info.hash_version != DX_HASH_LEGACY) {
+		ext2_warning(dir->i_sb, __FUNCTION__,
+			     "Unrecognised inode hash code %d",
+			     root->info.hash_version);
+		goto bad;
+	}
+	if (root->info.unused_flags & 1) {
+		ext2_warning(dir->i_sb, __FUNCTION__,
+			     "Unimplemented inode hash flags: %#06x",
+			     root->info.unused_flags);
+		goto bad;
+	}
+	if ((indirect = root->info.indirect_levels) > 1) {
+		ext2_warning(dir->i_sb, __FUNCTION__,
+			     "Unimplemented inode hash depth: %#06x",
+			     root->info.indirect_levels);
+		goto bad;
+	}
+	hinfo->hash_version = root->info.hash_version;
+	hinfo->seed = EXT2_SB(dir->i_sb)->s_hash_seed;
+	ext2fs_dirhash((const char *) dentry->d_name.name,
+		       dentry->d_name.len, hinfo);
+	hash = hinfo->hash;
+
+	nblocks = dir->i_size >> dir->i_sb->s_blocksize_bits;
+	entries = (struct dx_entry *) (((char *)&root->info) +
+				       root->info.info_length);
+	limit = dx_root_limit(dir, root->info.info_length);
+	while (1) {
+		count = dx_get_count(entries);
+		if (dx_get_limit(entries) != limit || !count || count > limit) {
+			ext2_warning(dir->i_sb, __FUNCTION__,
+				     "Corrupt index in directory #%lu",
+				     dir->i_ino);
+			goto bad;
+		}
+		p = entries + 1;
+		q = entries + count - 1;
+		while (p <= q) {
+			m = p + (q - p)/2;
+			if (dx_get_hash(m) > hash)
+				q = m - 1;
+			else
+				p = m + 1;
+		}
+		at = p - 1;
+		if (dx_get_block(at) >= nblocks) {
+			ext2_warning(dir->i_sb, __FUNCTION__,
+				     "Index in directory #%lu points past "
+				     "its end", dir->i_ino);
+			goto bad;
+		}
+		frame->page = page;
+		frame->data = data;
+		frame->entries = entries;
+		frame->at = at;
+		if (!indirect--)
+			return frame;
+		frame++;
+		page = ext2_get_dir_block(dir, dx_get_block(at), &data);
+		if (IS_ERR(page)) {
+			*err = PTR_ERR(page);
+			goto fail;
+		}
+		entries = ((struct dx_node *) data)->entries;
+		limit = dx_node_limit(dir);
+	}
+bad:
+	ext2_put_page(page);
+	*err = ERR_BAD_DX_DIR;
+fail:
+	while (frame > frame_in) {
+		frame--;
+		ext2_put_page(frame->page);
+	}
+	return NULL;
+}
+
+static void dx_release(struct dx_frame *frames)
+{
+	if (frames[0].page == NULL)
+		return;
+	if (((struct dx_root *) frames[0].data)->info.indirect_levels)
+		ext2_put_page(frames[1].page);
+	ext2_put_page(frames[0].page);
+}
+
+/*
+ * Step to the next leaf if it continues the hash range of the current
+ * one, reading in the index node on the way if need be.  Returns 1 if
+ * the search should go on, 0 if not and -1 on error.
+ */
+static int ext2_htree_next_block(struct inode *dir, u32 hash,
+				 struct dx_frame *frame,
+				 struct dx_frame *frames, int *err)
+{
+	struct dx_frame *p = frame;
+	struct page *page;
+	char *data;
+	int num_frames = 0;
+
+	while (1) {
+		if (++(p->at) < p->entries + dx_get_count(p->entries))
+			break;
+		if (p == frames)
+			return 0;
+		num_frames++;
+		p--;
+	}
+	if ((dx_get_hash(p->at) & ~1) != hash)
+		return 0;
+	while (num_frames--) {
+		page = ext2_get_dir_block(dir, dx_get_block(p->at), &data);
+		if (IS_ERR(page)) {
+			*err = PTR_ERR(page);
+			return -1;
+		}
+		p++;
+		ext2_put_page(p->page);
+		p->page = page;
+		p->data = data;
+		p->at = p->entries = ((struct dx_node *) data)->entries;
+	}
+	return 1;
+}
+
+static ext2_dirent *ext2_dx_find_entry(struct inode *dir,
+			struct dentry *dentry, struct page **res_page, int *err)
+{
+	const char *name = (const char *) dentry->d_name.name;
+	int namelen = dentry->d_name.len;
+	struct ext2_dx_hash_info hinfo;
+	struct dx_frame frames[2], *frame;
+	struct page *page;
+	ext2_dirent *de;
+	char *data, *top;
+
+	if (!(frame = dx_probe(dir, dentry, &hinfo, frames, err)))
+		return NULL;
+	*err = -ENOENT;
+	do {
+		page = ext2_get_dir_block(dir, dx_get_block(frame->at), &data);
+		if (IS_ERR(page)) {
+			*err = PTR_ERR(page);
+			break;
+		}
+		de = (ext2_dirent *) data;
+		top = data + ext2_chunk_size(dir) - EXT2_DIR_REC_LEN(namelen);
+		for (; (char *) de <= top; de = ext2_next_entry(de))
+			if (ext2_match(namelen, name, de)) {
+				dx_release(frames);
+				*res_page = page;
+				return de;
+			}
+		ext2_put_page(page);
+	} while (ext2_htree_next_block(dir, hinfo.hash, frame, frames, err) == 1);
+	dx_release(frames);
+	return NULL;
+}
+
 /*
  *	ext2_find_entry()
  *
@@ -316,6 +704,19 @@ struct ext2_dir_entry_2 * ext2_find_entry (struct inode * dir,
 	/* OFFSET_CACHE */
 	*res_page = NULL;
 
+	if (ext2_is_dx(dir)) {
+		int err;
+
+		de = ext2_dx_find_entry(dir, dentry, res_page, &err);
+		/*
+		 * On success, or if the error was file not found,
+		 * return.  Otherwise, fall back to doing a search the
+		 * old fashioned way.
+		 */
+		if (de || err != ERR_BAD_DX_DIR)
+			return de;
+	}
+
 	start = dir->u.ext2_i.i_dir_start_lookup;
 	if (start >= npages)
 		start = 0;
@@ -390,53 +791,39 @@ void ext2_set_link(struct inode *dir, struct ext2_dir_entry_2 *de,
 	UnlockPage(page);
 	ext2_put_page(page);
 	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
-	dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
+	ext2_update_dx_flag(dir);
 	mark_inode_dirty(dir);
 }
 
 /*
- *	Parent is locked.
+ * Put an entry for dentry into [kaddr, kaddr + len) of a directory page,
+ * which stays mapped.  Returns -ENOSPC when there is no room there.
  */
-int ext2_add_link (struct dentry *dentry, struct inode *inode)
+static int ext2_add_dirent(struct page *page, char *kaddr, unsigned len,
+			   struct dentry *dentry, struct inode *inode)
 {
-	struct inode *dir = dentry->d_parent->d_inode;
+	struct inode *dir = page->mapping->host;
 	const char *name = dentry->d_name.name;
 	int namelen = dentry->d_name.len;
 	unsigned reclen = EXT2_DIR_REC_LEN(namelen);
 	unsigned short rec_len, name_len;
-	struct page *page = NULL;
-	ext2_dirent * de;
-	unsigned long npages = dir_pages(dir);
-	unsigned long n;
-	char *kaddr;
+	ext2_dirent * de = (ext2_dirent *) kaddr;
+	char *top = kaddr + len - reclen;
 	unsigned from, to;
 	int err;
 
-	/* We take care of directory expansion in the same loop */
-	for (n = 0; n <= npages; n++) {
-		page = ext2_get_page(dir, n);
-		err = PTR_ERR(page);
-		if (IS_ERR(page))
-			goto out;
-		kaddr = page_address(page);
-		de = (ext2_dirent *)kaddr;
-		kaddr += PAGE_CACHE_SIZE - reclen;
-		while ((char *)de <= kaddr) {
-			err = -EEXIST;
-			if (ext2_match (namelen, name, de))
-				goto out_page;
-			name_len = EXT2_DIR_REC_LEN(de->name_len);
-			rec_len = le16_to_cpu(de->rec_len);
-			if (!de->inode && rec_len >= reclen)
-				goto got_it;
-			if (rec_len >= name_len + reclen)
-				goto got_it;
-			de = (ext2_dirent *) ((char *) de + rec_len);
-		}
-		ext2_put_page(page);
+	while ((char *)de <= top) {
+		if (ext2_match (namelen, name, de))
+			return -EEXIST;
+		name_len = EXT2_DIR_REC_LEN(de->name_len);
+		rec_len = le16_to_cpu(de->rec_len);
+		if (!de->inode && rec_len >= reclen)
+			goto got_it;
+		if (rec_len >= name_len + reclen)
+			goto got_it;
+		de = (ext2_dirent *) ((char *) de + rec_len);
 	}
-	BUG();
-	return -EINVAL;
+	return -ENOSPC;
 
 got_it:
 	from = (char*)de - (char*)page_address(page);
@@ -457,13 +844,491 @@ got_it:
 	ext2_set_de_type (de, inode);
 	err = ext2_commit_chunk(page, from, to);
 	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
-	dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
+	ext2_update_dx_flag(dir);
 	mark_inode_dirty(dir);
 	/* OFFSET_CACHE */
 out_unlock:
 	UnlockPage(page);
+	return err;
+}
+
+/*
+ * Create map of hash values, offsets, and sizes, stored at end of block.
+ * Returns number of entries mapped.
+ */
+static int dx_make_map(ext2_dirent *de, int size,
+		       struct ext2_dx_hash_info *hinfo,
+		       struct dx_map_entry *map_tail)
+{
+	int count = 0;
+	char *base = (char *) de;
+	struct ext2_dx_hash_info h = *hinfo;
+
+	while ((char *) de < base + size) {
+		if (de->name_len && de->inode) {
+			ext2fs_dirhash(de->name, de->name_len, &h);
+			map_tail--;
+			map_tail->hash = h.hash;
+			map_tail->offs = (u16) ((char *) de - base);
+			map_tail->size = EXT2_DIR_REC_LEN(de->name_len);
+			count++;
+		}
+		de = ext2_next_entry(de);
+	}
+	return count;
+}
+
+static void dx_sort_map(struct dx_map_entry *map, unsigned count)
+{
+	struct dx_map_entry *p, *q, *top = map + count - 1;
+	int more;
+	/* Combsort until bubble sort doesn't suck */
+	while (count > 2) {
+		count = count*10/13;
+		if (count - 9 < 2) /* 9, 10 -> 11 */
+			count = 11;
+		for (p = top, q = p - count; q >= map; p--, q--)
+			if (p->hash < q->hash)
+				swap(*p, *q);
+	}
+	/* Garden variety bubble sort */
+	do {
+		more = 0;
+		q = top;
+		while (q-- > map) {
+			if (q[1].hash >= q[0].hash)
+				continue;
+			swap(*(q+1), *q);
+			more = 1;
+		}
+	} while(more);
+}
+
+static void dx_insert_block(struct dx_frame *frame, u32 hash, u32 block)
+{
+	struct dx_entry *entries = frame->entries;
+	struct dx_entry *old = frame->at, *new = old + 1;
+	int count = dx_get_count(entries);
+
+	memmove(new + 1, new, (char *)(entries + count) - (char *)(new));
+	dx_set_hash(new, hash);
+	dx_set_block(new, block);
+	dx_set_count(entries, count + 1);
+}
+
+/*
+ * Copy the count entries of map from one block to the start of another,
+ * packed.  Returns pointer to last entry copied.
+ */
+static ext2_dirent *dx_move_dirents(char *from, char *to,
+				    struct dx_map_entry *map, int count)
+{
+	unsigned rec_len = 0;
+
+	while (count--) {
+		ext2_dirent *de = (ext2_dirent *) (from + map->offs);
+		rec_len = EXT2_DIR_REC_LEN(de->name_len);
+		memcpy (to, de, rec_len);
+		((ext2_dirent *) to)->rec_len = cpu_to_le16(rec_len);
+		map++;
+		to += rec_len;
+	}
+	return (ext2_dirent *) (to - rec_len);
+}
+
+/*
+ * Free the count entries of map in a block which stays in use, merging
+ * each into the entry before it like ext2_delete_entry() does.  The
+ * entries left behind keep their offsets, so a readdir going through
+ * the block meanwhile neither skips nor repeats them.
+ */
+static void dx_free_dirents(char *base, unsigned size,
+			    struct dx_map_entry *map, int count)
+{
+	ext2_dirent *de, *prev = NULL;
+
+	while (count--)
+		((ext2_dirent *) (base + map++->offs))->inode = 0;
+	for (de = (ext2_dirent *) base; (char *) de < base + size;
+	     de = ext2_next_entry(de)) {
+		if (prev && !de->inode)
+			prev->rec_len = cpu_to_le16(le16_to_cpu(prev->rec_len) +
+						    le16_to_cpu(de->rec_len));
+		else
+			prev = de;
+	}
+}
+
+/*
+ * Split the full leaf frame->at points to in two by hash.  The half of
+ * its entries hinfo->hash falls in moves to a new block, packed, and
+ * *block is set to that block; the other half stays where it is.  If it
+ * is the lower half that moves, the index entry of the old block is
+ * pointed at the new one and the old block is entered after it.
+ *
+ * The new block is filled and entered in the index before the old one
+ * loses its copies, so that failing in between leaves every name
+ * reachable.
+ */
+static int ext2_dx_split(struct inode *dir, struct dx_frame *frame,
+			 struct ext2_dx_hash_info *hinfo, u32 *block)
+{
+	unsigned blocksize = ext2_chunk_size(dir);
+	unsigned count, continued, split, move, size, first, nr;
+	u32 oldblock = dx_get_block(frame->at), newblock, hash2;
+	struct dx_map_entry *map;
+	struct page *page, *page2;
+	char *buf, *data, *data2;
+	ext2_dirent *de;
+	int i, err;
+
+	buf = kmalloc(2 * blocksize, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	page = ext2_get_dir_block(dir, oldblock, &data);
+	err = PTR_ERR(page);
+	if (IS_ERR(page))
+		goto out;
+	memcpy(buf, data, blocksize);
+
+	/* create map in the end of the scratch buffer */
+	map = (struct dx_map_entry *) (buf + 2 * blocksize);
+	count = dx_make_map((ext2_dirent *) buf, blocksize, hinfo, map);
+	map -= count;
+	dx_sort_map(map, count);
+	/* Split the existing block in the middle, size-wise */
+	size = 0;
+	move = 0;
+	for (i = count-1; i >= 0; i--) {
+		/* is more than half of this entry in 2nd half of the block? */
+		if (size + map[i].size/2 > blocksize/2)
+			break;
+		size += map[i].size;
+		move++;
+	}
+	/* map index at which we will split */
+	split = count - move;
+	if (!split)
+		split = 1;
+	hash2 = map[split].hash;
+	continued = hash2 == map[split - 1].hash;
+	if (hinfo->hash >= hash2) {
+		first = split;
+		nr = count - split;
+	} else {
+		first = 0;
+		nr = split;
+	}
+
+	page2 = ext2_append_block(dir, &newblock, &data2);
+	err = PTR_ERR(page2);
+	if (IS_ERR(page2))
+		goto out_page;
+	de = dx_move_dirents(buf, data2, map + first, nr);
+	de->rec_len = cpu_to_le16(data2 + blocksize - (char *) de);
+	err = ext2_commit_block(page2, data2);
+	ext2_put_page(page2);
+	if (err)
+		goto out_page;
+
+	err = ext2_prepare_block(frame->page, frame->data);
+	if (err)
+		goto out_page;
+	if (first) {
+		dx_insert_block(frame, hash2 + continued, newblock);
+	} else {
+		dx_set_block(frame->at, newblock);
+		dx_insert_block(frame, hash2 + continued, oldblock);
+	}
+	err = ext2_commit_block(frame->page, frame->data);
+	if (err)
+		goto out_page;
+
+	err = ext2_prepare_block(page, data);
+	if (err)
+		goto out_page;
+	dx_free_dirents(data, blocksize, map + first, nr);
+	err = ext2_commit_block(page, data);
+
+	*block = newblock;
 out_page:
 	ext2_put_page(page);
+out:
+	kfree(buf);
+	return err;
+}
+
+/*
+ * Add a name to an indexed directory: find the leaf its hash belongs
+ * in, and split the leaf when it is full.  When the index block above
+ * the leaf is full as well, it is split first, or the root grows a
+ * level of index nodes.
+ */
+static int ext2_dx_add_link(struct dentry *dentry, struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	unsigned blocksize = ext2_chunk_size(dir);
+	struct ext2_dx_hash_info hinfo;
+	struct dx_frame frames[2], *frame;
+	struct dx_entry *entries, *at;
+	struct page *page, *page2;
+	char *data, *data2;
+	u32 block;
+	int err;
+
+	frame = dx_probe(dir, dentry, &hinfo, frames, &err);
+	if (!frame)
+		return err;
+	entries = frame->entries;
+	at = frame->at;
+
+	page = ext2_get_dir_block(dir, dx_get_block(at), &data);
+	err = PTR_ERR(page);
+	if (IS_ERR(page))
+		goto cleanup;
+	err = ext2_add_dirent(page, data, blocksize, dentry, inode);
+	ext2_put_page(page);
+	if (err != -ENOSPC)
+		goto cleanup;
+
+	if (dx_get_count(entries) == dx_get_limit(entries)) {
+		u32 newblock;
+		unsigned icount = dx_get_count(entries);
+		int levels = frame - frames;
+		struct dx_entry *entries2;
+		struct dx_node *node2;
+
+		if (levels && (dx_get_count(frames->entries) ==
+			       dx_get_limit(frames->entries))) {
+			ext2_warning(dir->i_sb, __FUNCTION__,
+				     "Directory index full!");
+			err = -ENOSPC;
+			goto cleanup;
+		}
+		page2 = ext2_append_block(dir, &newblock, &data2);
+		err = PTR_ERR(page2);
+		if (IS_ERR(page2))
+			goto cleanup;
+		node2 = (struct dx_node *) data2;
+		entries2 = node2->entries;
+		memset(&node2->fake, 0, sizeof(node2->fake));
+		node2->fake.rec_len = cpu_to_le16(blocksize);
+		if (levels) {
+			unsigned icount1 = icount/2, icount2 = icount - icount1;
+			unsigned hash2 = dx_get_hash(entries + icount1);
+
+			memcpy((char *) entries2, (char *) (entries + icount1),
+			       icount2 * sizeof(struct dx_entry));
+			dx_set_count(entries2, icount2);
+			dx_set_limit(entries2, dx_node_limit(dir));
+			err = ext2_commit_block(page2, data2);
+			if (err)
+				goto out_page2;
+
+			err = ext2_prepare_block(frames[0].page, frames[0].data);
+			if (err)
+				goto out_page2;
+			dx_insert_block(frames + 0, hash2, newblock);
+			err = ext2_commit_block(frames[0].page, frames[0].data);
+			if (err)
+				goto out_page2;
+
+			err = ext2_prepare_block(frame->page, frame->data);
+			if (err)
+				goto out_page2;
+			dx_set_count(entries, icount1);
+			err = ext2_commit_block(frame->page, frame->data);
+			if (err)
+				goto out_page2;
+
+			/* Which index block gets the new entry? */
+			if (at - entries >= icount1) {
+				frame->at = at = at - entries - icount1 + entries2;
+				frame->entries = entries = entries2;
+				frame->data = data2;
+				swap(frame->page, page2);
+			}
+			ext2_put_page(page2);
+		} else {
+			memcpy((char *) entries2, (char *) entries,
+			       icount * sizeof(struct dx_entry));
+			dx_set_limit(entries2, dx_node_limit(dir));
+			err = ext2_commit_block(page2, data2);
+			if (err)
+				goto out_page2;
+
+			/* Set up root */
+			err = ext2_prepare_block(frames[0].page, frames[0].data);
+			if (err)
+				goto out_page2;
+			dx_set_count(entries, 1);
+			dx_set_block(entries + 0, newblock);
+			((struct dx_root *) frames[0].data)->info.indirect_levels = 1;
+
+			/*
+			 * Add new access path frame; from here on dx_release()
+			 * puts page2.
+			 */
+			frame = frames + 1;
+			frame->at = at = at - entries + entries2;
+			frame->entries = entries = entries2;
+			frame->page = page2;
+			frame->data = data2;
+
+			err = ext2_commit_block(frames[0].page, frames[0].data);
+			if (err)
+				goto cleanup;
+		}
+	}
+	err = ext2_dx_split(dir, frame, &hinfo, &block);
+	if (err)
+		goto cleanup;
+	page = ext2_get_dir_block(dir, block, &data);
+	err = PTR_ERR(page);
+	if (IS_ERR(page))
+		goto cleanup;
+	err = ext2_add_dirent(page, data, blocksize, dentry, inode);
+	ext2_put_page(page);
+	goto cleanup;
+
+out_page2:
+	ext2_put_page(page2);
+cleanup:
+	dx_release(frames);
+	return err;
+}
+
+/*
+ * Index a directory whose one block has filled up: the entries after
+ * ".." move to a second block, and the first becomes the root of the
+ * index.  Returns ERR_BAD_DX_DIR, having changed nothing, if the
+ * directory can't be indexed.
+ */
+static int ext2_make_indexed_dir(struct dentry *dentry, struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	unsigned blocksize = ext2_chunk_size(dir);
+	struct ext2_dx_hash_info hinfo;
+	struct page *page, *page2;
+	struct dx_root *root;
+	struct dx_entry *entries;
+	ext2_dirent *de, *de2;
+	char *data, *data2, *top;
+	unsigned len;
+	u32 block;
+	int err;
+
+	hinfo.hash_version = EXT2_SB(dir->i_sb)->s_def_hash_version;
+	hinfo.seed = NULL;
+	if (ext2fs_dirhash(NULL, 0, &hinfo))
+		return ERR_BAD_DX_DIR;
+
+	page = ext2_get_dir_block(dir, 0, &data);
+	if (IS_ERR(page))
+		return PTR_ERR(page);
+	root = (struct dx_root *) data;
+	if (le16_to_cpu(root->dot.rec_len) != EXT2_DIR_REC_LEN(1) ||
+	    root->dot.name_len != 1 || root->dot_name[0] != '.' ||
+	    root->dotdot.name_len != 2 ||
+	    le16_to_cpu(root->dotdot.rec_len) >=
+			blocksize - EXT2_DIR_REC_LEN(1)) {
+		ext2_put_page(page);
+		return ERR_BAD_DX_DIR;
+	}
+
+	/* Move the dirents after ".." out to a new block */
+	de = ext2_next_entry((ext2_dirent *) &root->dotdot);
+	len = data + blocksize - (char *) de;
+	page2 = ext2_append_block(dir, &block, &data2);
+	err = PTR_ERR(page2);
+	if (IS_ERR(page2))
+		goto out;
+	memcpy(data2, de, len);
+	de = (ext2_dirent *) data2;
+	top = data2 + len;
+	while ((char *)(de2 = ext2_next_entry(de)) < top)
+		de = de2;
+	de->rec_len = cpu_to_le16(data2 + blocksize - (char *) de);
+	err = ext2_commit_block(page2, data2);
+	ext2_put_page(page2);
+	if (err)
+		goto out;
+
+	/* and make the first block the root of the index */
+	err = ext2_prepare_block(page, data);
+	if (err)
+		goto out;
+	root->dotdot.rec_len = cpu_to_le16(blocksize - EXT2_DIR_REC_LEN(1));
+	memset(&root->info, 0, sizeof(root->info));
+	root->info.info_length = sizeof(root->info);
+	root->info.hash_version = hinfo.hash_version;
+	entries = root->entries;
+	dx_set_block(entries, block);
+	dx_set_count(entries, 1);
+	dx_set_limit(entries, dx_root_limit(dir, sizeof(root->info)));
+	err = ext2_commit_block(page, data);
+	dir->u.ext2_i.i_flags |= EXT2_INDEX_FL;
+	mark_inode_dirty(dir);
+	ext2_put_page(page);
+	if (err)
+		return err;
+	return ext2_dx_add_link(dentry, inode);
+
+out:
+	ext2_put_page(page);
+	return err;
+}
+
+/*
+ *	Parent is locked.
+ */
+int ext2_add_link (struct dentry *dentry, struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	unsigned chunk_size = ext2_chunk_size(dir);
+	struct page *page = NULL;
+	unsigned long npages = dir_pages(dir);
+	unsigned long n;
+	int err;
+
+	if (ext2_is_dx(dir)) {
+		err = ext2_dx_add_link(dentry, inode);
+		if (err != ERR_BAD_DX_DIR)
+			return err;
+		dir->u.ext2_i.i_flags &= ~EXT2_INDEX_FL;
+		mark_inode_dirty(dir);
+	} else if (dir->i_size == chunk_size &&
+		   EXT2_HAS_COMPAT_FEATURE(dir->i_sb,
+					   EXT2_FEATURE_COMPAT_DIR_INDEX)) {
+		/* Index the directory once its first block is full */
+		page = ext2_get_page(dir, 0);
+		err = PTR_ERR(page);
+		if (IS_ERR(page))
+			goto out;
+		err = ext2_add_dirent(page, page_address(page), chunk_size,
+				      dentry, inode);
+		ext2_put_page(page);
+		if (err != -ENOSPC)
+			goto out;
+		err = ext2_make_indexed_dir(dentry, inode);
+		if (err != ERR_BAD_DX_DIR)
+			goto out;
+	}
+
+	/* We take care of directory expansion in the same loop */
+	for (n = 0; n <= npages; n++) {
+		page = ext2_get_page(dir, n);
+		err = PTR_ERR(page);
+		if (IS_ERR(page))
+			goto out;
+		err = ext2_add_dirent(page, page_address(page),
+				      PAGE_CACHE_SIZE, dentry, inode);
+		ext2_put_page(page);
+		if (err != -ENOSPC)
+			goto out;
+	}
+	BUG();
+	return -EINVAL;
 out:
 	return err;
 }
@@ -500,7 +1365,7 @@ int ext2_delete_entry (struct ext2_dir_entry_2 * dir, struct page * page )
 	UnlockPage(page);
 	ext2_put_page(page);
 	inode->i_ctime = inode->i_mtime = CURRENT_TIME;
-	inode->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
+	ext2_update_dx_flag(inode);
 	mark_inode_dirty(inode);
 	return err;
 }
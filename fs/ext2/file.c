@@ -21,6 +21,8 @@
 #include <linux/fs.h>
 #include <linux/ext2_fs.h>
 #include <linux/sched.h>
+#include <linux/pagemap.h>
+#include <linux/swap.h>
 
 /*
  * Called when an inode is released. Note that this is different
@@ -29,11 +31,38 @@
  */
 static int ext2_release_file (struct inode * inode, struct file * filp)
 {
-	if (filp->f_mode & FMODE_WRITE)
+	if (filp->f_mode & FMODE_WRITE) {
 		ext2_discard_prealloc (inode);
+		ext2_discard_reservation (inode);
+	}
 	return 0;
 }
 
+/*
+ * Delayed pages carry no dirty buffers, so balance_dirty() does not see
+ * them.  Once the delayed blocks of the filesystem pass their share of
+ * memory, a writer starts writeback of its own file and so waits on the
+ * request queue like any other.
+ */
+static ssize_t ext2_file_write(struct file *file, const char *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+	struct super_block *sb = inode->i_sb;
+	unsigned long delayed;
+	ssize_t ret;
+
+	ret = generic_file_write(file, buf, count, ppos);
+	if (ret <= 0 || !test_opt(sb, DELALLOC))
+		return ret;
+	delayed = sb->u.ext2_sb.s_delalloc_blocks >>
+		  (PAGE_CACHE_SHIFT - inode->i_blkbits);
+	if (delayed * 100 >
+	    nr_free_buffer_pages() * EXT2_DELALLOC_DIRTY_RATIO)
+		filemap_fdatasync(inode->i_mapping);
+	return ret;
+}
+
 /*
  * We have mostly NULL's here: the current defaults are ok for
  * the ext2 filesystem.
@@ -41,7 +70,7 @@ static int ext2_release_file (struct inode * inode, struct file * filp)
 struct file_operations ext2_file_operations = {
 	llseek:		generic_file_llseek,
 	read:		generic_file_read,
-	write:		generic_file_write,
+	write:		ext2_file_write,
 	ioctl:		ext2_ioctl,
 	mmap:		generic_file_mmap,
 	open:		generic_file_open,
@@ -390,6 +390,7 @@ repeat:
 	if (S_ISLNK(mode))
 		inode->u.ext2_i.i_flags &= ~(EXT2_IMMUTABLE_FL|EXT2_APPEND_FL);
 	inode->u.ext2_i.i_block_group = group;
+	inode->u.ext2_i.i_rsv_window.rsv_goal_size = EXT2_DEFAULT_RESERVE_BLOCKS;
 	if (inode->u.ext2_i.i_flags & EXT2_SYNC_FL)
 		inode->i_flags |= S_SYNC;
 	insert_inode_hash(inode);
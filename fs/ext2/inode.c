@@ -44,6 +44,7 @@ static int ext2_update_inode(struct inode * inode, int do_sync);
 void ext2_put_inode (struct inode * inode)
 {
 	ext2_discard_prealloc (inode);
+	ext2_discard_reservation (inode);
 }
 
 /*
@@ -112,7 +113,15 @@ static int ext2_alloc_block (struct inode * inode, unsigned long goal, int *err)
 		ext2_discard_prealloc (inode);
 		ext2_debug ("preallocation miss (%lu/%lu).\n",
 			    alloc_hits, ++alloc_attempts);
-		if (S_ISREG(inode->i_mode))
+		/*
+		 * Reservation windows do the job of preallocation
+		 * without taking the blocks out of the bitmaps.  A
+		 * delayed allocation run still takes all its blocks
+		 * in one search; see ext2_delalloc_map_run().
+		 */
+		if (S_ISREG(inode->i_mode) &&
+		    (test_opt(inode->i_sb, NORESERVATION) ||
+		     inode->u.ext2_i.i_alloc_run))
 			result = ext2_new_block (inode, goal, 
 				 &inode->u.ext2_i.i_prealloc_count,
 				 &inode->u.ext2_i.i_prealloc_block, err);
@@ -565,6 +574,8 @@ out:
 	if (ext2_splice_branch(inode, iblock, chain, partial, left) < 0)
 		goto changed;
 
+	if (test_and_clear_bit(BH_Ext2Delay, &bh_result->b_state))
+		ext2_delalloc_release(inode->i_sb, 1);
 	bh_result->b_state |= (1UL << BH_New);
 	goto got_it;
 
@@ -576,8 +587,486 @@ changed:
 	goto reread;
 }
 
+/*
+ * Probably it should be a library function... search for first non-zero word
+ * or memcmp with zero_page, whatever is better for particular architecture.
+ * Linus?
+ */
+static inline int all_zeroes(u32 *p, u32 *q)
+{
+	while (p < q)
+		if (*p++)
+			return 0;
+	return 1;
+}
+
+/*
+ * Delayed allocation.  With the "delalloc" mount option a write() into a
+ * hole of a regular file only fills the page cache: the buffers are
+ * marked BH_Ext2Delay and left unmapped, and the page is dirtied instead
+ * of its buffers.  Blocks are assigned when ext2_writepage() is called
+ * for the page by kupdate, sync, fsync or the VM, through the same
+ * get_block(create) path that mmap-dirtied pages take.  The first page of
+ * a run takes blocks for the dirty pages queued behind it as well, with
+ * a single bitmap search.
+ *
+ * Delayed blocks are counted in s_delalloc_blocks so that running out of
+ * space is still reported by write(): close to full we stop delaying and
+ * allocate at write() time again.  Quota is charged at allocation, so
+ * inodes under quota are not delayed either.
+ */
+static int ext2_delalloc_reserve(struct inode *inode, int nr)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext2_super_block *es = sb->u.ext2_sb.s_es;
+	unsigned long free = le32_to_cpu(es->s_free_blocks_count);
+	unsigned long root = le32_to_cpu(es->s_r_blocks_count);
+	int ret = 0;
+
+	if (sb->u.ext2_sb.s_resuid != current->fsuid &&
+	    (sb->u.ext2_sb.s_resgid == 0 ||
+	     !in_group_p (sb->u.ext2_sb.s_resgid)) &&
+	    !capable(CAP_SYS_RESOURCE))
+		free = free > root ? free - root : 0;
+
+	/*
+	 * Count every delayed block twice, for itself and for the indirect
+	 * blocks it may need, and keep back enough for one new chain.
+	 */
+	spin_lock(&sb->u.ext2_sb.s_delalloc_lock);
+	if (free >= 2 * (sb->u.ext2_sb.s_delalloc_blocks + nr) + 3) {
+		sb->u.ext2_sb.s_delalloc_blocks += nr;
+		ret = 1;
+	}
+	spin_unlock(&sb->u.ext2_sb.s_delalloc_lock);
+	return ret;
+}
+
+void ext2_delalloc_release(struct super_block *sb, int nr)
+{
+	spin_lock(&sb->u.ext2_sb.s_delalloc_lock);
+	sb->u.ext2_sb.s_delalloc_blocks -= nr;
+	spin_unlock(&sb->u.ext2_sb.s_delalloc_lock);
+}
+
+/*
+ * Forget the delayed buffers of a page from @offset on.
+ */
+static void ext2_delalloc_drop(struct page *page, unsigned long offset)
+{
+	struct buffer_head *bh, *head = page->buffers;
+	unsigned long curr_off = 0;
+	int nr = 0;
+
+	if (!head)
+		return;
+	bh = head;
+	do {
+		if (offset <= curr_off &&
+		    test_and_clear_bit(BH_Ext2Delay, &bh->b_state))
+			nr++;
+		curr_off += bh->b_size;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	if (nr)
+		ext2_delalloc_release(page->mapping->host->i_sb, nr);
+}
+
+/*
+ * Number of delayed buffers in a row on @page, starting with the one
+ * for page-relative block @i.
+ */
+static int ext2_delalloc_count(struct page *page, int i)
+{
+	struct buffer_head *bh = page->buffers;
+	int n = 0;
+
+	if (!bh)
+		return 0;
+	for (; i > 0; i--)
+		bh = bh->b_this_page;
+	do {
+		if (!buffer_ext2_delay(bh))
+			break;
+		n++;
+		bh = bh->b_this_page;
+	} while (bh != page->buffers);
+	return n;
+}
+
+/*
+ * Map the delayed buffers of a locked page from page-relative block @i
+ * on, stopping at the first one which is not delayed.  Returns how many
+ * were mapped, or an error if the first one could not be.
+ */
+static int ext2_delalloc_map_page(struct inode *inode, struct page *page,
+				  int i)
+{
+	struct buffer_head *bh = page->buffers;
+	unsigned long block;
+	int n = 0, err;
+
+	block = (page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits)) + i;
+	for (; i > 0; i--)
+		bh = bh->b_this_page;
+	do {
+		if (!buffer_ext2_delay(bh))
+			break;
+		err = ext2_get_block(inode, block, bh, 1);
+		if (err)
+			return n ? n : err;
+		if (buffer_new(bh))
+			unmap_underlying_metadata(bh);
+		n++;
+		block++;
+		bh = bh->b_this_page;
+	} while (bh != page->buffers);
+	return n;
+}
+
+/*
+ * Map every delayed buffer of a locked page.  Returns the first error;
+ * whatever could not be mapped stays delayed.
+ */
+static int ext2_delalloc_map_all(struct inode *inode, struct page *page)
+{
+	struct buffer_head *bh, *head = page->buffers;
+	int i = 0, n, err = 0;
+
+	bh = head;
+	do {
+		if (buffer_ext2_delay(bh)) {
+			n = ext2_delalloc_map_page(inode, page, i);
+			if (n < 0 && !err)
+				err = n;
+		}
+		i++;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	return err;
+}
+
+/*
+ * Allocate the run of delayed blocks starting on @page and going on into
+ * the dirty pages that follow it.  The whole run is preallocated by the
+ * first allocation, so the rest are handed out by ext2_alloc_block()
+ * without touching the bitmaps, and what the run did not use is given
+ * back at the end.  Pages we cannot lock right away end the run; their
+ * own writepage will see to them.
+ */
+static void ext2_delalloc_map_run(struct inode *inode, struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+	int per_page = 1 << (PAGE_CACHE_SHIFT - inode->i_blkbits);
+	unsigned long index = page->index;
+	struct buffer_head *bh;
+	struct page *next;
+	int first, n, err;
+
+	for (first = 0, bh = page->buffers; !buffer_ext2_delay(bh);
+	     first++, bh = bh->b_this_page)
+		;
+
+	n = ext2_delalloc_count(page, first);
+	while (first + n == per_page * (index - page->index + 1) &&
+	       n < EXT2_DELALLOC_MAX_RUN) {
+		index++;
+		next = find_get_page(mapping, index);
+		if (!next)
+			break;
+		if (TryLockPage(next)) {
+			page_cache_release(next);
+			break;
+		}
+		if (next->mapping == mapping && PageDirty(next) &&
+		    next->buffers)
+			n += ext2_delalloc_count(next, 0);
+		UnlockPage(next);
+		page_cache_release(next);
+	}
+	if (n > EXT2_DELALLOC_MAX_RUN)
+		n = EXT2_DELALLOC_MAX_RUN;
+
+	lock_kernel();
+	inode->u.ext2_i.i_alloc_run =
+		n + n / EXT2_ADDR_PER_BLOCK(inode->i_sb) + 1;
+	err = ext2_delalloc_map_page(inode, page, first);
+	if (err < 0)
+		goto out;
+	n -= err;
+	for (index = page->index + 1; n > 0 && err == per_page - first;
+	     index++) {
+		next = find_get_page(mapping, index);
+		if (!next)
+			break;
+		if (TryLockPage(next)) {
+			page_cache_release(next);
+			break;
+		}
+		err = 0;
+		if (next->mapping == mapping && PageDirty(next) &&
+		    next->buffers)
+			err = ext2_delalloc_map_page(inode, next, 0);
+		UnlockPage(next);
+		page_cache_release(next);
+		if (err < 0)
+			break;
+		n -= err;
+		first = 0;
+	}
+out:
+	inode->u.ext2_i.i_alloc_run = 0;
+	ext2_discard_prealloc(inode);
+	unlock_kernel();
+}
+
+static int ext2_page_delayed(struct page *page)
+{
+	struct buffer_head *bh, *head = page->buffers;
+
+	if (!head)
+		return 0;
+	bh = head;
+	do {
+		if (buffer_ext2_delay(bh))
+			return 1;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	return 0;
+}
+
+/*
+ * prepare_write for delalloc mounts.  Holes within [from,to), which all
+ * lie below the i_size the write leaves behind, become delayed buffers.
+ * Holes outside it stay holes and are zeroed in the page, and the rest
+ * of the page is read in, so that the page is wholly uptodate once
+ * written.  Returns 1 if there is no hole to delay or no room to do so,
+ * and the caller should go the usual way.
+ */
+static int ext2_delalloc_prepare_write(struct inode *inode, struct page *page,
+				       unsigned from, unsigned to)
+{
+	unsigned blocksize = 1 << inode->i_blkbits;
+	unsigned block_start, block_end;
+	unsigned long block;
+	struct buffer_head *bh, *head, *wait[MAX_BUF_PER_PAGE], **wait_bh = wait;
+	int holes = 0, err;
+	char *kaddr;
+
+	if (!page->buffers)
+		create_empty_buffers(page, inode->i_dev, blocksize);
+	head = page->buffers;
+
+	block = page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits);
+	for (bh = head, block_start = 0; bh != head || !block_start;
+	     block_start = block_end, bh = bh->b_this_page, block++) {
+		block_end = block_start + blocksize;
+		if (!buffer_mapped(bh) && !buffer_ext2_delay(bh)) {
+			err = ext2_get_block(inode, block, bh, 0);
+			if (err)
+				return err;
+			if (!buffer_mapped(bh) &&
+			    block_end > from && block_start < to)
+				holes++;
+		}
+	}
+	if (!holes && !ext2_page_delayed(page))
+		return 1;
+	if (holes && !ext2_delalloc_reserve(inode, holes)) {
+		/*
+		 * The usual way zeroes the new blocks around the write,
+		 * so give the delayed data its blocks before that.
+		 */
+		err = ext2_delalloc_map_all(inode, page);
+		return err ? err : 1;
+	}
+
+	kaddr = kmap(page);
+	for (bh = head, block_start = 0; bh != head || !block_start;
+	     block_start = block_end, bh = bh->b_this_page) {
+		block_end = block_start + blocksize;
+		if (buffer_ext2_delay(bh))
+			continue;
+		if (!buffer_mapped(bh)) {
+			if (block_end > from && block_start < to)
+				set_bit(BH_Ext2Delay, &bh->b_state);
+			if (Page_Uptodate(page) || buffer_uptodate(bh)) {
+				set_bit(BH_Uptodate, &bh->b_state);
+				continue;
+			}
+			if (block_end > to)
+				memset(kaddr + (block_start > to ?
+						block_start : to), 0,
+				       block_end - (block_start > to ?
+						    block_start : to));
+			if (block_start < from)
+				memset(kaddr + block_start, 0,
+				       (block_end < from ? block_end : from) -
+				       block_start);
+			if (block_end <= from || block_start >= to)
+				set_bit(BH_Uptodate, &bh->b_state);
+			flush_dcache_page(page);
+			continue;
+		}
+		if (Page_Uptodate(page)) {
+			set_bit(BH_Uptodate, &bh->b_state);
+			continue;
+		}
+		if (!buffer_uptodate(bh) &&
+		    (block_start < from || block_end > to)) {
+			ll_rw_block(READ, 1, &bh);
+			*wait_bh++ = bh;
+		}
+	}
+	err = 0;
+	while (wait_bh > wait) {
+		wait_on_buffer(*--wait_bh);
+		if (!buffer_uptodate(*wait_bh))
+			err = -EIO;
+	}
+	if (err) {
+		ext2_delalloc_drop(page, 0);
+		ClearPageUptodate(page);
+		kunmap(page);
+	}
+	return err;
+}
+
+/*
+ * A page holding delayed buffers is dirtied as a whole; its buffers
+ * stay clean since they have nowhere to go yet.  generic_osync_inode()
+ * only writes the buffers on the inode's data queue, so a synchronous
+ * write maps the page now and commits it the usual way instead.
+ */
+static int ext2_delalloc_commit_write(struct file *file, struct page *page,
+				      unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	loff_t pos = ((loff_t)page->index << PAGE_CACHE_SHIFT) + to;
+	unsigned block_start, block_end;
+	struct buffer_head *bh, *head = page->buffers;
+	int partial = 0, err;
+
+	if (IS_SYNC(inode) || (file->f_flags & O_SYNC)) {
+		err = ext2_delalloc_map_all(inode, page);
+		if (err) {
+			kunmap(page);
+			return err;
+		}
+		return generic_commit_write(file, page, from, to);
+	}
+
+	for (bh = head, block_start = 0; bh != head || !block_start;
+	     block_start = block_end, bh = bh->b_this_page) {
+		block_end = block_start + bh->b_size;
+		if (block_end <= from || block_start >= to) {
+			if (!buffer_uptodate(bh))
+				partial = 1;
+		} else
+			set_bit(BH_Uptodate, &bh->b_state);
+	}
+	if (!partial)
+		SetPageUptodate(page);
+	set_page_dirty(page);
+	kunmap(page);
+	if (pos > inode->i_size) {
+		inode->i_size = pos;
+		mark_inode_dirty(inode);
+	}
+	return 0;
+}
+
+/*
+ * writepage for delalloc mounts.  Delayed buffers get their blocks and
+ * the page is written out like block_write_full_page() does, except
+ * that a hole is only filled if something other than zeroes was stored
+ * into it through mmap, and nothing past i_size is ever allocated: a
+ * write() dirties the whole page, not just the blocks it covered.
+ */
+static int ext2_delalloc_writepage(struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	unsigned long end_index = inode->i_size >> PAGE_CACHE_SHIFT;
+	unsigned blocksize = 1 << inode->i_blkbits;
+	unsigned offset = PAGE_CACHE_SIZE;
+	unsigned block_start, block_end;
+	unsigned long block;
+	struct buffer_head *bh, *head, *arr[MAX_BUF_PER_PAGE];
+	int nr = 0, i, err = 0;
+	char *kaddr;
+
+	if (page->index >= end_index) {
+		offset = inode->i_size & (PAGE_CACHE_SIZE-1);
+		if (page->index > end_index || !offset) {
+			ext2_delalloc_drop(page, 0);
+			UnlockPage(page);
+			return -EIO;
+		}
+	}
+	if (!page->buffers)
+		create_empty_buffers(page, inode->i_dev, blocksize);
+	head = page->buffers;
+
+	if (ext2_page_delayed(page)) {
+		ext2_delalloc_map_run(inode, page);
+		err = ext2_delalloc_map_all(inode, page);
+		/*
+		 * Anything left could not be allocated; it goes the way of
+		 * a failed write of an mmapped page.
+		 */
+		ext2_delalloc_drop(page, 0);
+	}
+
+	kaddr = kmap(page);
+	if (offset < PAGE_CACHE_SIZE) {
+		memset(kaddr + offset, 0, PAGE_CACHE_SIZE - offset);
+		flush_dcache_page(page);
+	}
+	block = page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits);
+	for (bh = head, block_start = 0; bh != head || !block_start;
+	     block_start = block_end, bh = bh->b_this_page, block++) {
+		block_end = block_start + blocksize;
+		if (block_start >= offset)
+			continue;
+		if (!Page_Uptodate(page) && !buffer_uptodate(bh))
+			continue;
+		if (!buffer_mapped(bh)) {
+			if (err || all_zeroes((u32 *)(kaddr + block_start),
+					(u32 *)(kaddr + (block_end < offset ?
+							 block_end : offset))))
+				continue;
+			err = ext2_get_block(inode, block, bh, 1);
+			if (err)
+				continue;
+			if (buffer_new(bh))
+				unmap_underlying_metadata(bh);
+		}
+		arr[nr++] = bh;
+	}
+	kunmap(page);
+
+	for (i = 0; i < nr; i++) {
+		lock_buffer(arr[i]);
+		set_buffer_async_io(arr[i]);
+		set_bit(BH_Uptodate, &arr[i]->b_state);
+		clear_bit(BH_Dirty, &arr[i]->b_state);
+	}
+	if (err)
+		ClearPageUptodate(page);
+	else
+		SetPageUptodate(page);
+	if (!nr)
+		UnlockPage(page);
+	/* Done - end_buffer_io_async will unlock */
+	for (i = 0; i < nr; i++)
+		submit_bh(WRITE, arr[i]);
+	return err;
+}
+
 static int ext2_writepage(struct page *page)
 {
+	if (test_opt(page->mapping->host->i_sb, DELALLOC))
+		return ext2_delalloc_writepage(page);
 	return block_write_full_page(page,ext2_get_block);
 }
 static int ext2_readpage(struct file *file, struct page *page)
@@ -586,10 +1075,43 @@ static int ext2_readpage(struct file *file, struct page *page)
 }
 static int ext2_prepare_write(struct file *file, struct page *page, unsigned from, unsigned to)
 {
+	struct inode *inode = page->mapping->host;
+
+	if (test_opt(inode->i_sb, DELALLOC) && S_ISREG(inode->i_mode) &&
+	    !IS_QUOTAINIT(inode) && !IS_SYNC(inode) &&
+	    !(file->f_flags & O_SYNC)) {
+		int err = ext2_delalloc_prepare_write(inode, page, from, to);
+		if (err <= 0)
+			return err;
+	}
 	return block_prepare_write(page,from,to,ext2_get_block);
 }
+static int ext2_commit_write(struct file *file, struct page *page, unsigned from, unsigned to)
+{
+	if (ext2_page_delayed(page))
+		return ext2_delalloc_commit_write(file, page, from, to);
+	return generic_commit_write(file, page, from, to);
+}
+static int ext2_flushpage(struct page *page, unsigned long offset)
+{
+	ext2_delalloc_drop(page, offset);
+	return block_flushpage(page, offset);
+}
+static int ext2_releasepage(struct page *page, int gfp_mask)
+{
+	/*
+	 * Delayed buffers are neither dirty nor locked, but freeing them
+	 * would lose both the data and the reservation they hold.
+	 */
+	return !ext2_page_delayed(page);
+}
 static int ext2_bmap(struct address_space *mapping, long block)
 {
+	/* Delayed blocks have no address until they are written back */
+	if (test_opt(mapping->host->i_sb, DELALLOC)) {
+		filemap_fdatasync(mapping);
+		filemap_fdatawait(mapping);
+	}
 	return generic_block_bmap(mapping,block,ext2_get_block);
 }
 static int ext2_direct_IO(int rw, struct inode * inode, struct kiobuf * iobuf, unsigned long blocknr, int blocksize)
@@ -601,24 +1123,13 @@ struct address_space_operations ext2_aops = {
 	writepage: ext2_writepage,
 	sync_page: block_sync_page,
 	prepare_write: ext2_prepare_write,
-	commit_write: generic_commit_write,
+	commit_write: ext2_commit_write,
+	flushpage: ext2_flushpage,
+	releasepage: ext2_releasepage,
 	bmap: ext2_bmap,
 	direct_IO: ext2_direct_IO,
 };
 
-/*
- * Probably it should be a library function... search for first non-zero word
- * or memcmp with zero_page, whatever is better for particular architecture.
- * Linus?
- */
-static inline int all_zeroes(u32 *p, u32 *q)
-{
-	while (p < q)
-		if (*p++)
-			return 0;
-	return 1;
-}
-
 /**
  *	ext2_find_shared - find the indirect blocks for partial truncation.
  *	@inode:	  inode in question
@@ -805,6 +1316,7 @@ void ext2_truncate (struct inode * inode)
 		return;
 
 	ext2_discard_prealloc(inode);
+	ext2_discard_reservation(inode);
 
 	blocksize = inode->i_sb->s_blocksize;
 	iblock = (inode->i_size + blocksize-1)
@@ -965,6 +1477,7 @@ void ext2_read_inode (struct inode * inode)
 		inode->u.ext2_i.i_dir_acl = le32_to_cpu(raw_inode->i_dir_acl);
 	inode->i_generation = le32_to_cpu(raw_inode->i_generation);
 	inode->u.ext2_i.i_prealloc_count = 0;
+	inode->u.ext2_i.i_rsv_window.rsv_goal_size = EXT2_DEFAULT_RESERVE_BLOCKS;
 	inode->u.ext2_i.i_block_group = block_group;
 
 	/*
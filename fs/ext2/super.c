@@ -152,6 +152,7 @@ static struct super_operations ext2_sops = {
 	write_inode:	ext2_write_inode,
 	put_inode:	ext2_put_inode,
 	delete_inode:	ext2_delete_inode,
+	clear_inode:	ext2_discard_reservation,
 	put_super:	ext2_put_super,
 	write_super:	ext2_write_super,
 	statfs:		ext2_statfs,
@@ -180,6 +181,14 @@ static int parse_options (char * options, unsigned long * sb_block,
 		else if (!strcmp (this_char, "nouid32")) {
 			set_opt (*mount_options, NO_UID32);
 		}
+		else if (!strcmp (this_char, "noreservation"))
+			set_opt (*mount_options, NORESERVATION);
+		else if (!strcmp (this_char, "reservation"))
+			clear_opt (*mount_options, NORESERVATION);
+		else if (!strcmp (this_char, "delalloc"))
+			set_opt (*mount_options, DELALLOC);
+		else if (!strcmp (this_char, "nodelalloc"))
+			clear_opt (*mount_options, DELALLOC);
 		else if (!strcmp (this_char, "check")) {
 			if (!value || !*value || !strcmp (value, "none"))
 				clear_opt (*mount_options, CHECK);
@@ -563,6 +572,9 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 		log2 (EXT2_ADDR_PER_BLOCK(sb));
 	sb->u.ext2_sb.s_desc_per_block_bits =
 		log2 (EXT2_DESC_PER_BLOCK(sb));
+	for (i = 0; i < 4; i++)
+		sb->u.ext2_sb.s_hash_seed[i] = le32_to_cpu(es->s_hash_seed[i]);
+	sb->u.ext2_sb.s_def_hash_version = es->s_def_hash_version;
 	if (sb->s_magic != EXT2_SUPER_MAGIC) {
 		if (!silent)
 			printk ("VFS: Can't find an ext2 filesystem on dev "
@@ -634,6 +646,10 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 	sb->u.ext2_sb.s_loaded_inode_bitmaps = 0;
 	sb->u.ext2_sb.s_loaded_block_bitmaps = 0;
 	sb->u.ext2_sb.s_gdb_count = db_count;
+	sb->u.ext2_sb.s_rsv_window_root = RB_ROOT;
+	spin_lock_init(&sb->u.ext2_sb.s_rsv_window_lock);
+	sb->u.ext2_sb.s_delalloc_blocks = 0;
+	spin_lock_init(&sb->u.ext2_sb.s_delalloc_lock);
 	/*
 	 * set up enough so that it can read an inode
 	 */
@@ -800,6 +816,11 @@ int ext2_statfs (struct super_block * sb, struct statfs * buf)
 	buf->f_bsize = sb->s_blocksize;
 	buf->f_blocks = le32_to_cpu(sb->u.ext2_sb.s_es->s_blocks_count) - overhead;
 	buf->f_bfree = ext2_count_free_blocks (sb);
+	/* Delayed blocks are as good as allocated */
+	if (buf->f_bfree > sb->u.ext2_sb.s_delalloc_blocks)
+		buf->f_bfree -= sb->u.ext2_sb.s_delalloc_blocks;
+	else
+		buf->f_bfree = 0;
 	buf->f_bavail = buf->f_bfree - le32_to_cpu(sb->u.ext2_sb.s_es->s_r_blocks_count);
 	if (buf->f_bfree < le32_to_cpu(sb->u.ext2_sb.s_es->s_r_blocks_count))
 		buf->f_bavail = 0;
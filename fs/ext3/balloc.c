@@ -452,6 +452,31 @@ static int ext3_test_allocatable(int nr, struct buffer_head *bh)
 	return !ext3_test_bit(nr, bh2jh(bh)->b_committed_data);
 }
 
+/*
+ * The bitmap search --- search forward alternately through the actual
+ * bitmap and the last-committed copy until we find a bit free in both.
+ */
+static int bitmap_search_next_usable_block(int here, struct buffer_head *bh,
+					   int maxblocks)
+{
+	int next;
+
+	while (here < maxblocks) {
+		next  = ext3_find_next_zero_bit ((unsigned long *) bh->b_data, 
+						 maxblocks, here);
+		if (next >= maxblocks)
+			return -1;
+		if (ext3_test_allocatable(next, bh))
+			return next;
+
+		J_ASSERT_BH(bh, bh2jh(bh)->b_committed_data);
+		here = ext3_find_next_zero_bit
+			((unsigned long *) bh2jh(bh)->b_committed_data, 
+			 maxblocks, next);
+	}
+	return -1;
+}
+
 /*
  * Find an allocatable block in a bitmap.  We honour both the bitmap and
  * its last-committed copy (if that exists), and perform the "most
@@ -502,32 +527,174 @@ static int find_next_usable_block(int start,
 	if (next < maxblocks && ext3_test_allocatable(next, bh))
 		return next;
 	
-	/* The bitmap search --- search forward alternately
-	 * through the actual bitmap and the last-committed copy
-	 * until we find a bit free in both. */
+	return bitmap_search_next_usable_block(here, bh, maxblocks);
+}
 
-	while (here < maxblocks) {
-		next  = ext3_find_next_zero_bit ((unsigned long *) bh->b_data, 
-						 maxblocks, here);
-		if (next >= maxblocks)
-			return -1;
-		if (ext3_test_allocatable(next, bh))
-			return next;
+/*
+ * Reservation windows.
+ *
+ * A regular file being written gets a window of blocks in one group,
+ * and ext3_new_block takes its blocks from there while it can.  Files
+ * growing side by side then each fill their own window instead of
+ * interleaving their blocks.  The windows of a filesystem never overlap
+ * and are kept in an rbtree ordered by block, protected by
+ * s_rsv_window_lock.  Nothing is marked in the bitmaps or journalled,
+ * and allocations made without a window may still take reserved blocks.
+ *
+ * A window more than half used by the time it runs out is followed by
+ * one twice its size, up to EXT3_MAX_RESERVE_BLOCKS.
+ */
 
-		J_ASSERT_BH(bh, bh2jh(bh)->b_committed_data);
-		here = ext3_find_next_zero_bit
-			((unsigned long *) bh2jh(bh)->b_committed_data, 
-			 maxblocks, next);
+/* The first window ending at or after block, NULL if there is none */
+static struct ext3_reserve_window *rsv_window_search(rb_root_t *root,
+						      unsigned long block)
+{
+	rb_node_t *n = root->rb_node;
+	struct ext3_reserve_window *rsv, *ret = NULL;
+
+	while (n) {
+		rsv = rb_entry(n, struct ext3_reserve_window, rsv_node);
+		if (rsv->rsv_end < block)
+			n = n->rb_right;
+		else {
+			ret = rsv;
+			n = n->rb_left;
+		}
+	}
+	return ret;
+}
+
+static void rsv_window_add(struct super_block *sb,
+			   struct ext3_reserve_window *rsv)
+{
+	rb_root_t *root = &EXT3_SB(sb)->s_rsv_window_root;
+	rb_node_t **p = &root->rb_node, *parent = NULL;
+	struct ext3_reserve_window *this;
+
+	while (*p) {
+		parent = *p;
+		this = rb_entry(parent, struct ext3_reserve_window, rsv_node);
+		if (rsv->rsv_start < this->rsv_start)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&rsv->rsv_node, parent, p);
+	rb_insert_color(&rsv->rsv_node, root);
+}
+
+static void rsv_window_remove(struct super_block *sb,
+			      struct ext3_reserve_window *rsv)
+{
+	rb_erase(&rsv->rsv_node, &EXT3_SB(sb)->s_rsv_window_root);
+	rsv->rsv_start = rsv->rsv_end = 0;
+}
+
+/*
+ * Called when a writer closes the file, on truncate and when the inode
+ * goes away.
+ */
+void ext3_discard_reservation(struct inode *inode)
+{
+	struct ext3_reserve_window *rsv = &inode->u.ext3_i.i_rsv_window;
+	spinlock_t *lock = &EXT3_SB(inode->i_sb)->s_rsv_window_lock;
+
+	spin_lock(lock);
+	if (rsv->rsv_end)
+		rsv_window_remove(inode->i_sb, rsv);
+	spin_unlock(lock);
+}
+
+/*
+ * Move rsv to a new window in group 'group', starting at the first
+ * allocatable block at or after bit 'goal' that isn't reserved by
+ * anybody else.  Returns the bit the window starts at, or -1 if the
+ * rest of the group has no room for one.
+ */
+static int alloc_new_reservation(struct super_block *sb, int group,
+				 struct buffer_head *bh, int goal,
+				 struct ext3_reserve_window *rsv)
+{
+	rb_root_t *root = &EXT3_SB(sb)->s_rsv_window_root;
+	unsigned long group_first = group * EXT3_BLOCKS_PER_GROUP(sb) +
+		le32_to_cpu(EXT3_SB(sb)->s_es->s_first_data_block);
+	int last = EXT3_BLOCKS_PER_GROUP(sb) - 1;
+	int size = rsv->rsv_goal_size;
+	int start = goal, end, bit;
+	struct ext3_reserve_window *next;
+
+	if (rsv->rsv_end) {
+		if (rsv->rsv_alloc_hit > (rsv->rsv_end - rsv->rsv_start + 1) / 2) {
+			size *= 2;
+			if (size > EXT3_MAX_RESERVE_BLOCKS)
+				size = EXT3_MAX_RESERVE_BLOCKS;
+			rsv->rsv_goal_size = size;
+		}
+		rsv_window_remove(sb, rsv);
+	}
+
+	while (start <= last) {
+		end = start + size - 1;
+		if (end > last)
+			end = last;
+		next = rsv_window_search(root, group_first + start);
+		if (next && next->rsv_start <= group_first + end) {
+			start = next->rsv_end + 1 - group_first;
+			continue;
+		}
+		bit = bitmap_search_next_usable_block(start, bh, end + 1);
+		if (bit < 0) {
+			start = end + 1;
+			continue;
+		}
+		if (bit > start) {
+			start = bit;
+			continue;
+		}
+		rsv->rsv_start = group_first + start;
+		rsv->rsv_end = group_first + end;
+		rsv->rsv_alloc_hit = 0;
+		rsv_window_add(sb, rsv);
+		return start;
 	}
 	return -1;
 }
 
+/*
+ * Find an allocatable bit in the reservation window of the inode, in
+ * group 'group' of bitmap bh, at or after bit 'goal' if that is inside
+ * the window.  When the goal is outside the window or the window is
+ * used up, a new one is reserved from the goal on.  Returns -1 if that
+ * fails too.  Called with the superblock locked.
+ */
+static int ext3_alloc_reserved(struct super_block *sb, int group,
+			       struct buffer_head *bh, int goal,
+			       struct ext3_reserve_window *rsv)
+{
+	unsigned long group_first = group * EXT3_BLOCKS_PER_GROUP(sb) +
+		le32_to_cpu(EXT3_SB(sb)->s_es->s_first_data_block);
+	int j = -1;
+
+	spin_lock(&EXT3_SB(sb)->s_rsv_window_lock);
+	if (rsv->rsv_end && rsv->rsv_start <= group_first + goal &&
+	    group_first + goal <= rsv->rsv_end)
+		j = bitmap_search_next_usable_block(goal, bh,
+					rsv->rsv_end - group_first + 1);
+	if (j < 0)
+		j = alloc_new_reservation(sb, group, bh, goal, rsv);
+	if (j >= 0)
+		rsv->rsv_alloc_hit++;
+	spin_unlock(&EXT3_SB(sb)->s_rsv_window_lock);
+	return j;
+}
+
 /*
  * ext3_new_block uses a goal block to assist allocation.  If the goal is
  * free, or there is a free block within 32 blocks of the goal, that block
  * is allocated.  Otherwise a forward search is made for a free block; within 
  * each block group the search first looks for an entire free byte in the block
  * bitmap, and then for any free bit if that fails.
+ * Regular files allocate from their reservation window first, see above.
  * This function also updates quota and i_blocks field.
  */
 int ext3_new_block (handle_t *handle, struct inode * inode,
@@ -546,6 +713,7 @@ int ext3_new_block (handle_t *handle, struct inode * inode,
 	struct super_block * sb;
 	struct ext3_group_desc * gdp;
 	struct ext3_super_block * es;
+	struct ext3_reserve_window * rsv = NULL;
 #ifdef EXT3FS_DEBUG
 	static int goal_hits = 0, goal_attempts = 0;
 #endif
@@ -555,6 +723,8 @@ int ext3_new_block (handle_t *handle, struct inode * inode,
 		printk ("ext3_new_block: nonexistent device");
 		return 0;
 	}
+	if (S_ISREG(inode->i_mode) && !test_opt(sb, NORESERVATION))
+		rsv = &inode->u.ext3_i.i_rsv_window;
 
 	/*
 	 * Check quota for allocation of this block.
@@ -603,6 +773,13 @@ int ext3_new_block (handle_t *handle, struct inode * inode,
 
 		ext3_debug ("goal is at %d:%d.\n", i, j);
 
+		if (rsv) {
+			k = ext3_alloc_reserved(sb, i, bh, j, rsv);
+			if (k >= 0) {
+				j = k;
+				goto got_block;
+			}
+		}
 		if (ext3_test_allocatable(j, bh)) {
 #ifdef EXT3FS_DEBUG
 			goal_hits++;
@@ -637,6 +814,11 @@ int ext3_new_block (handle_t *handle, struct inode * inode,
 				goto io_error;
 	
 			bh = sb->u.ext3_sb.s_block_bitmap[bitmap_nr];
+			if (rsv) {
+				j = ext3_alloc_reserved(sb, i, bh, 0, rsv);
+				if (j >= 0)
+					goto got_block;
+			}
 			j = find_next_usable_block(-1, bh, 
 						   EXT3_BLOCKS_PER_GROUP(sb));
 			if (j >= 0) 
@@ -0,0 +1,723 @@
+/*
+ *  linux/fs/ext3/extents.c
+ *
+ * Extent-based block mapping for ext3 regular files.
+ *
+ * This file is released under the GPL v2.
+ *
+ * An extent-mapped inode keeps a small b-tree in i_block instead of the
+ * direct and indirect block pointers.  The root lives in the inode and
+ * holds four entries; deeper nodes fill whole blocks.  Leaves hold
+ * extents, each mapping up to EXT3_EXT_MAX_LEN contiguous logical blocks
+ * onto contiguous physical blocks with a single record, so a large file
+ * written sequentially needs a handful of tree blocks where the indirect
+ * scheme needs one pointer per block.
+ *
+ * Every node is updated through the journal exactly as indirect blocks
+ * are, and the root through ext3_mark_inode_dirty().  Allocation and
+ * truncation are serialised against each other by truncate_sem.
+ */
+
+#include <linux/fs.h>
+#include <linux/sched.h>
+#include <linux/jbd.h>
+#include <linux/ext3_fs.h>
+#include <linux/ext3_jbd.h>
+#include <linux/locks.h>
+#include <linux/smp_lock.h>
+
+#define EXT3_EXT_MAX_BLOCK	0xffffffffUL
+
+#define EXT_FIRST_EXTENT(h) \
+	((struct ext3_extent *) ((char *) (h) + \
+				 sizeof(struct ext3_extent_header)))
+#define EXT_FIRST_INDEX(h) \
+	((struct ext3_extent_idx *) ((char *) (h) + \
+				     sizeof(struct ext3_extent_header)))
+#define EXT_LAST_EXTENT(h) \
+	(EXT_FIRST_EXTENT(h) + le16_to_cpu((h)->eh_entries) - 1)
+#define EXT_LAST_INDEX(h) \
+	(EXT_FIRST_INDEX(h) + le16_to_cpu((h)->eh_entries) - 1)
+
+/*
+ * The route from the root to a leaf.  path[0] is the root in the inode
+ * (p_bh == NULL), path[depth] is the leaf.  p_idx and p_ext point at the
+ * entry covering the block looked up, p_ext is NULL if the leaf has no
+ * entry at or before it.
+ */
+struct ext3_ext_path {
+	unsigned long			p_block;
+	struct ext3_extent_header	*p_hdr;
+	struct ext3_extent_idx		*p_idx;
+	struct ext3_extent		*p_ext;
+	struct buffer_head		*p_bh;
+};
+
+static inline struct ext3_extent_header *ext_inode_hdr(struct inode *inode)
+{
+	return (struct ext3_extent_header *) inode->u.ext3_i.i_data;
+}
+
+static inline int ext_depth(struct inode *inode)
+{
+	return le16_to_cpu(ext_inode_hdr(inode)->eh_depth);
+}
+
+static inline int ext3_ext_space_root(struct inode *inode)
+{
+	return (sizeof(inode->u.ext3_i.i_data) -
+		sizeof(struct ext3_extent_header)) /
+		sizeof(struct ext3_extent);
+}
+
+static inline int ext3_ext_space_block(struct inode *inode)
+{
+	return (inode->i_sb->s_blocksize -
+		sizeof(struct ext3_extent_header)) /
+		sizeof(struct ext3_extent);
+}
+
+static inline int ext3_ext_node_full(struct ext3_ext_path *path)
+{
+	return le16_to_cpu(path->p_hdr->eh_entries) ==
+	       le16_to_cpu(path->p_hdr->eh_max);
+}
+
+static inline void ext3_ext_add_entries(struct ext3_extent_header *eh, int n)
+{
+	eh->eh_entries = cpu_to_le16(le16_to_cpu(eh->eh_entries) + n);
+}
+
+void ext3_ext_tree_init(struct inode *inode)
+{
+	struct ext3_extent_header *eh = ext_inode_hdr(inode);
+
+	eh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	eh->eh_entries = 0;
+	eh->eh_max = cpu_to_le16(ext3_ext_space_root(inode));
+	eh->eh_depth = 0;
+	eh->eh_generation = 0;
+}
+
+static int ext3_ext_check_header(struct inode *inode,
+				 struct ext3_extent_header *eh,
+				 int depth, int max)
+{
+	if (le16_to_cpu(eh->eh_magic) != EXT3_EXT_MAGIC ||
+	    le16_to_cpu(eh->eh_depth) != depth ||
+	    le16_to_cpu(eh->eh_max) == 0 ||
+	    le16_to_cpu(eh->eh_max) > max ||
+	    le16_to_cpu(eh->eh_entries) > le16_to_cpu(eh->eh_max) ||
+	    (depth && eh->eh_entries == 0)) {
+		ext3_error(inode->i_sb, "ext3_ext_check_header",
+			   "bad extent node in inode #%lu: magic %x, "
+			   "entries %u, max %u, depth %u (expected %d)",
+			   inode->i_ino, le16_to_cpu(eh->eh_magic),
+			   le16_to_cpu(eh->eh_entries),
+			   le16_to_cpu(eh->eh_max),
+			   le16_to_cpu(eh->eh_depth), depth);
+		return -EIO;
+	}
+	return 0;
+}
+
+static void ext3_ext_drop_refs(struct ext3_ext_path *path)
+{
+	int i;
+
+	for (i = 0; i <= EXT3_EXT_MAX_DEPTH; i++) {
+		brelse(path[i].p_bh);
+		path[i].p_bh = NULL;
+	}
+}
+
+/*
+ * Binary search for the last entry whose key is not above @block.  The
+ * first entry is taken when @block lies before all of them; for a leaf
+ * that means p_ext stays NULL.
+ */
+static void ext3_ext_binsearch_idx(struct ext3_ext_path *path,
+				   unsigned long block)
+{
+	struct ext3_extent_idx *l, *r, *m;
+
+	l = EXT_FIRST_INDEX(path->p_hdr) + 1;
+	r = EXT_LAST_INDEX(path->p_hdr);
+	while (l <= r) {
+		m = l + (r - l) / 2;
+		if (block < le32_to_cpu(m->ei_block))
+			r = m - 1;
+		else
+			l = m + 1;
+	}
+	path->p_idx = l - 1;
+}
+
+static void ext3_ext_binsearch(struct ext3_ext_path *path,
+			       unsigned long block)
+{
+	struct ext3_extent *l, *r, *m;
+
+	path->p_ext = NULL;
+	if (path->p_hdr->eh_entries == 0)
+		return;
+	l = EXT_FIRST_EXTENT(path->p_hdr);
+	r = EXT_LAST_EXTENT(path->p_hdr);
+	while (l <= r) {
+		m = l + (r - l) / 2;
+		if (block < le32_to_cpu(m->ee_block))
+			r = m - 1;
+		else
+			l = m + 1;
+	}
+	if (l != EXT_FIRST_EXTENT(path->p_hdr))
+		path->p_ext = l - 1;
+}
+
+/*
+ * Walk from the root down to the leaf which would hold @block.  On
+ * success the caller owns the node buffers in @path and must release
+ * them with ext3_ext_drop_refs().
+ */
+static int ext3_ext_find_extent(struct inode *inode, unsigned long block,
+				struct ext3_ext_path *path)
+{
+	struct ext3_extent_header *eh = ext_inode_hdr(inode);
+	struct buffer_head *bh;
+	int depth = ext_depth(inode);
+	int i, err;
+
+	memset(path, 0, sizeof(*path) * (EXT3_EXT_MAX_DEPTH + 1));
+	if (depth > EXT3_EXT_MAX_DEPTH)
+		depth = -1;	/* let the header check complain */
+	err = ext3_ext_check_header(inode, eh, depth,
+				    ext3_ext_space_root(inode));
+	if (err)
+		return err;
+	path[0].p_hdr = eh;
+
+	for (i = 0; i < depth; i++) {
+		ext3_ext_binsearch_idx(path + i, block);
+		path[i + 1].p_block = le32_to_cpu(path[i].p_idx->ei_leaf);
+		bh = sb_bread(inode->i_sb, path[i + 1].p_block);
+		if (!bh) {
+			err = -EIO;
+			goto fail;
+		}
+		path[i + 1].p_bh = bh;
+		path[i + 1].p_hdr = (struct ext3_extent_header *) bh->b_data;
+		err = ext3_ext_check_header(inode, path[i + 1].p_hdr,
+					    depth - i - 1,
+					    ext3_ext_space_block(inode));
+		if (err)
+			goto fail;
+	}
+	ext3_ext_binsearch(path + depth, block);
+	return 0;
+
+fail:
+	ext3_ext_drop_refs(path);
+	return err;
+}
+
+/*
+ * The root is journaled as part of the inode, everything below it as
+ * ordinary metadata blocks.
+ */
+static int ext3_ext_get_access(handle_t *handle, struct ext3_ext_path *path)
+{
+	if (path->p_bh) {
+		BUFFER_TRACE(path->p_bh, "get_write_access");
+		return ext3_journal_get_write_access(handle, path->p_bh);
+	}
+	return 0;
+}
+
+static int ext3_ext_dirty(handle_t *handle, struct inode *inode,
+			  struct ext3_ext_path *path)
+{
+	if (path->p_bh) {
+		BUFFER_TRACE(path->p_bh, "call ext3_journal_dirty_metadata");
+		return ext3_journal_dirty_metadata(handle, path->p_bh);
+	}
+	return ext3_mark_inode_dirty(handle, inode);
+}
+
+/*
+ * Pick a goal for a new block at @block: right after the data of the
+ * extent before it if there is one, otherwise next to the leaf, and for
+ * an empty file at the start of the inode's own group.
+ */
+static unsigned long ext3_ext_find_goal(struct inode *inode,
+					struct ext3_ext_path *path,
+					unsigned long block)
+{
+	struct super_block *sb = inode->i_sb;
+	int depth = ext_depth(inode);
+	struct ext3_extent *ex = path[depth].p_ext;
+
+	if (ex)
+		return le32_to_cpu(ex->ee_start) +
+		       (block - le32_to_cpu(ex->ee_block));
+	for (; depth > 0; depth--)
+		if (path[depth].p_block)
+			return path[depth].p_block;
+	return inode->u.ext3_i.i_block_group * EXT3_BLOCKS_PER_GROUP(sb) +
+	       le32_to_cpu(EXT3_SB(sb)->s_es->s_first_data_block);
+}
+
+/*
+ * Allocate and journal a fresh tree block, filled from @src when that is
+ * given.  Returns the buffer with the header set up for a node @depth
+ * levels above the leaves.
+ */
+static struct buffer_head *ext3_ext_new_node(handle_t *handle,
+					     struct inode *inode,
+					     unsigned long goal, int depth,
+					     void *src, int n, int *err)
+{
+	struct buffer_head *bh;
+	struct ext3_extent_header *neh;
+	unsigned long newblock;
+
+	newblock = ext3_new_block(handle, inode, goal, 0, 0, err);
+	if (!newblock)
+		return NULL;
+
+	bh = sb_getblk(inode->i_sb, newblock);
+	lock_buffer(bh);
+	BUFFER_TRACE(bh, "call get_create_access");
+	*err = ext3_journal_get_create_access(handle, bh);
+	if (*err) {
+		unlock_buffer(bh);
+		brelse(bh);
+		ext3_free_blocks(handle, inode, newblock, 1);
+		return NULL;
+	}
+	memset(bh->b_data, 0, inode->i_sb->s_blocksize);
+	neh = (struct ext3_extent_header *) bh->b_data;
+	neh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	neh->eh_entries = cpu_to_le16(n);
+	neh->eh_max = cpu_to_le16(ext3_ext_space_block(inode));
+	neh->eh_depth = cpu_to_le16(depth);
+	if (n)
+		memcpy(EXT_FIRST_EXTENT(neh), src,
+		       n * sizeof(struct ext3_extent));
+	BUFFER_TRACE(bh, "marking uptodate");
+	mark_buffer_uptodate(bh, 1);
+	unlock_buffer(bh);
+
+	BUFFER_TRACE(bh, "call ext3_journal_dirty_metadata");
+	*err = ext3_journal_dirty_metadata(handle, bh);
+	return bh;
+}
+
+/*
+ * The root is full: move its entries into a new block and leave a
+ * single index to that block behind, one level higher.
+ */
+static int ext3_ext_grow_indepth(handle_t *handle, struct inode *inode,
+				 struct ext3_ext_path *path,
+				 unsigned long block)
+{
+	struct ext3_extent_header *root = ext_inode_hdr(inode);
+	struct ext3_extent_idx *ix;
+	struct buffer_head *bh;
+	int depth = ext_depth(inode);
+	int err;
+
+	if (depth == EXT3_EXT_MAX_DEPTH)
+		return -EFBIG;
+
+	bh = ext3_ext_new_node(handle, inode,
+			       ext3_ext_find_goal(inode, path, block), depth,
+			       EXT_FIRST_EXTENT(root),
+			       le16_to_cpu(root->eh_entries), &err);
+	if (!bh)
+		return err;
+
+	ix = EXT_FIRST_INDEX(root);
+	/* ee_block and ei_block share the first word of an entry */
+	ix->ei_block = EXT_FIRST_EXTENT(root)->ee_block;
+	ix->ei_leaf = cpu_to_le32(bh->b_blocknr);
+	ix->ei_leaf_hi = 0;
+	ix->ei_unused = 0;
+	root->eh_entries = cpu_to_le16(1);
+	root->eh_depth = cpu_to_le16(depth + 1);
+	brelse(bh);
+	if (err)
+		return err;
+	return ext3_mark_inode_dirty(handle, inode);
+}
+
+/*
+ * Split the node at path[at], whose parent is known to have room.  A
+ * node filled by appending keeps all its entries (a leaf) or gives up
+ * only its last one (an index), so that sequentially written files end
+ * up with full nodes; otherwise the upper half moves to the new node.
+ */
+static int ext3_ext_split(handle_t *handle, struct inode *inode,
+			  struct ext3_ext_path *path, int at,
+			  unsigned long block)
+{
+	struct ext3_ext_path *curp = path + at;
+	struct ext3_ext_path *parent = path + at - 1;
+	struct ext3_extent_header *eh = curp->p_hdr;
+	struct ext3_extent_idx *ix;
+	struct buffer_head *bh;
+	int n = le16_to_cpu(eh->eh_entries);
+	int depth = ext_depth(inode);
+	unsigned long key;
+	int m, err;
+
+	if (at == depth)
+		m = curp->p_ext == EXT_LAST_EXTENT(eh) ? n : n / 2;
+	else
+		m = curp->p_idx == EXT_LAST_INDEX(eh) ? n - 1 : n / 2;
+	key = m < n ? le32_to_cpu(EXT_FIRST_EXTENT(eh)[m].ee_block) : block;
+
+	bh = ext3_ext_new_node(handle, inode,
+			       ext3_ext_find_goal(inode, path, block),
+			       depth - at, EXT_FIRST_EXTENT(eh) + m, n - m,
+			       &err);
+	if (!bh)
+		return err;
+	if (err)
+		goto out;
+
+	if (m < n) {
+		err = ext3_ext_get_access(handle, curp);
+		if (err)
+			goto out;
+		eh->eh_entries = cpu_to_le16(m);
+		err = ext3_ext_dirty(handle, inode, curp);
+		if (err)
+			goto out;
+	}
+
+	err = ext3_ext_get_access(handle, parent);
+	if (err)
+		goto out;
+	ix = parent->p_idx + 1;
+	memmove(ix + 1, ix, (EXT_LAST_INDEX(parent->p_hdr) - parent->p_idx) *
+			    sizeof(struct ext3_extent_idx));
+	ix->ei_block = cpu_to_le32(key);
+	ix->ei_leaf = cpu_to_le32(bh->b_blocknr);
+	ix->ei_leaf_hi = 0;
+	ix->ei_unused = 0;
+	ext3_ext_add_entries(parent->p_hdr, 1);
+	err = ext3_ext_dirty(handle, inode, parent);
+out:
+	brelse(bh);
+	return err;
+}
+
+/*
+ * A new first entry in a leaf may lower the key the leaf is filed under
+ * in its parent, and so on up while we stay at the front of each node.
+ */
+static int ext3_ext_correct_indexes(handle_t *handle, struct inode *inode,
+				    struct ext3_ext_path *path,
+				    unsigned long block)
+{
+	int k, err;
+
+	for (k = ext_depth(inode) - 1; k >= 0; k--) {
+		if (le32_to_cpu(path[k].p_idx->ei_block) <= block)
+			break;
+		err = ext3_ext_get_access(handle, path + k);
+		if (err)
+			return err;
+		path[k].p_idx->ei_block = cpu_to_le32(block);
+		err = ext3_ext_dirty(handle, inode, path + k);
+		if (err)
+			return err;
+		if (path[k].p_idx != EXT_FIRST_INDEX(path[k].p_hdr))
+			break;
+	}
+	return 0;
+}
+
+/*
+ * Map logical @block onto physical @newblock.  @path has been looked up
+ * for @block and is looked up again whenever the tree has to change
+ * shape to make room.
+ */
+static int ext3_ext_insert_extent(handle_t *handle, struct inode *inode,
+				  struct ext3_ext_path *path,
+				  unsigned long block, unsigned long newblock)
+{
+	struct ext3_extent_header *eh;
+	struct ext3_extent *ex;
+	int depth, level, len, err;
+
+repeat:
+	depth = ext_depth(inode);
+	eh = path[depth].p_hdr;
+	ex = path[depth].p_ext;
+
+	/* The common case: the block extends the extent before it */
+	if (ex) {
+		len = le16_to_cpu(ex->ee_len);
+		if (le32_to_cpu(ex->ee_block) + len == block &&
+		    le32_to_cpu(ex->ee_start) + len == newblock &&
+		    len < EXT3_EXT_MAX_LEN) {
+			err = ext3_ext_get_access(handle, path + depth);
+			if (err)
+				return err;
+			ex->ee_len = cpu_to_le16(len + 1);
+			return ext3_ext_dirty(handle, inode, path + depth);
+		}
+	}
+
+	if (ext3_ext_node_full(path + depth)) {
+		for (level = depth - 1; level >= 0; level--)
+			if (!ext3_ext_node_full(path + level))
+				break;
+		if (level < 0)
+			err = ext3_ext_grow_indepth(handle, inode, path, block);
+		else
+			err = ext3_ext_split(handle, inode, path, level + 1,
+					     block);
+		ext3_ext_drop_refs(path);
+		if (!err)
+			err = ext3_ext_find_extent(inode, block, path);
+		if (err)
+			return err;
+		goto repeat;
+	}
+
+	err = ext3_ext_get_access(handle, path + depth);
+	if (err)
+		return err;
+	ex = ex ? ex + 1 : EXT_FIRST_EXTENT(eh);
+	memmove(ex + 1, ex, (EXT_FIRST_EXTENT(eh) +
+			     le16_to_cpu(eh->eh_entries) - ex) *
+			    sizeof(struct ext3_extent));
+	ex->ee_block = cpu_to_le32(block);
+	ex->ee_len = cpu_to_le16(1);
+	ex->ee_start_hi = 0;
+	ex->ee_start = cpu_to_le32(newblock);
+	ext3_ext_add_entries(eh, 1);
+	err = ext3_ext_dirty(handle, inode, path + depth);
+	if (!err && ex == EXT_FIRST_EXTENT(eh))
+		err = ext3_ext_correct_indexes(handle, inode, path, block);
+	return err;
+}
+
+/*
+ * The extent counterpart of ext3_get_block_handle().  Lookups share
+ * truncate_sem; allocations hold it exclusively since splitting a node
+ * moves entries that a concurrent lookup could be reading.
+ */
+int ext3_ext_get_block(handle_t *handle, struct inode *inode, long iblock,
+		       struct buffer_head *bh_result, int create)
+{
+	struct ext3_ext_path path[EXT3_EXT_MAX_DEPTH + 1];
+	struct ext3_extent *ex;
+	unsigned long block = iblock;
+	unsigned long newblock;
+	loff_t new_size;
+	int err;
+
+	J_ASSERT(handle != NULL || create == 0);
+
+	if (iblock < 0) {
+		ext3_warning(inode->i_sb, "ext3_ext_get_block", "block < 0");
+		return -EIO;
+	}
+
+	lock_kernel();
+	if (create)
+		down_write(&inode->u.ext3_i.truncate_sem);
+	else
+		down_read(&inode->u.ext3_i.truncate_sem);
+
+	err = ext3_ext_find_extent(inode, block, path);
+	if (err)
+		goto out;
+
+	ex = path[ext_depth(inode)].p_ext;
+	if (ex && block < le32_to_cpu(ex->ee_block) +
+			  le16_to_cpu(ex->ee_len)) {
+		newblock = le32_to_cpu(ex->ee_start) +
+			   (block - le32_to_cpu(ex->ee_block));
+		bh_result->b_state &= ~(1UL << BH_New);
+		goto got_it;
+	}
+	if (!create)
+		goto out_drop;
+
+	newblock = ext3_new_block(handle, inode,
+				  ext3_ext_find_goal(inode, path, block),
+				  0, 0, &err);
+	if (!newblock)
+		goto out_drop;
+	err = ext3_ext_insert_extent(handle, inode, path, block, newblock);
+	if (err) {
+		ext3_free_blocks(handle, inode, newblock, 1);
+		goto out_drop;
+	}
+
+	/* As in ext3_get_block_handle(), the BKL covers this update */
+	new_size = inode->i_size;
+	if (new_size > inode->u.ext3_i.i_disksize)
+		inode->u.ext3_i.i_disksize = new_size;
+	bh_result->b_state |= (1UL << BH_New);
+
+got_it:
+	bh_result->b_dev = inode->i_dev;
+	bh_result->b_blocknr = newblock;
+	bh_result->b_state |= (1UL << BH_Mapped);
+out_drop:
+	ext3_ext_drop_refs(path);
+out:
+	if (create)
+		up_write(&inode->u.ext3_i.truncate_sem);
+	else
+		up_read(&inode->u.ext3_i.truncate_sem);
+	unlock_kernel();
+	return err;
+}
+
+/*
+ * Cut the tail off the rightmost extent, or drop it altogether if it
+ * lies wholly past @first, then release any nodes this left empty.  At
+ * most one block group's worth of data is freed per call, so that each
+ * step fits in the credits ext3_ext_truncate() reserves for it.
+ */
+static int ext3_ext_rm_tail(handle_t *handle, struct inode *inode,
+			    struct ext3_ext_path *path, unsigned long first)
+{
+	struct super_block *sb = inode->i_sb;
+	int depth = ext_depth(inode);
+	struct ext3_extent_header *eh = path[depth].p_hdr;
+	struct ext3_extent *ex = path[depth].p_ext;
+	unsigned long start, pblock, last, group_start, from, count, i;
+	struct buffer_head *bh;
+	int level, err;
+
+	if (ex) {
+		start = le32_to_cpu(ex->ee_block);
+		count = le16_to_cpu(ex->ee_len);
+		pblock = le32_to_cpu(ex->ee_start);
+		from = first > start ? first - start : 0;
+
+		last = pblock + count - 1;
+		group_start = last - (last -
+			le32_to_cpu(EXT3_SB(sb)->s_es->s_first_data_block)) %
+			EXT3_BLOCKS_PER_GROUP(sb);
+		if (pblock + from < group_start)
+			from = group_start - pblock;
+
+		err = ext3_ext_get_access(handle, path + depth);
+		if (err)
+			return err;
+		if (from)
+			ex->ee_len = cpu_to_le16(from);
+		else
+			ext3_ext_add_entries(eh, -1);
+		err = ext3_ext_dirty(handle, inode, path + depth);
+		if (err)
+			return err;
+
+		/* Revoke before the blocks can show up free in the bitmap */
+		for (i = from; i < count; i++) {
+			bh = sb_get_hash_table(sb, pblock + i);
+			ext3_forget(handle, 0, inode, bh, pblock + i);
+		}
+		ext3_free_blocks(handle, inode, pblock + from, count - from);
+	}
+
+	for (level = depth; level > 0; level--) {
+		if (path[level].p_hdr->eh_entries)
+			break;
+		/* On the rightmost path the parent entry is the last one */
+		err = ext3_ext_get_access(handle, path + level - 1);
+		if (err)
+			return err;
+		ext3_ext_add_entries(path[level - 1].p_hdr, -1);
+		err = ext3_ext_dirty(handle, inode, path + level - 1);
+		if (err)
+			return err;
+		ext3_forget(handle, 1, inode, path[level].p_bh,
+			    path[level].p_block);
+		path[level].p_bh = NULL;
+		ext3_free_blocks(handle, inode, path[level].p_block, 1);
+	}
+
+	/* An emptied root goes back to being a leaf */
+	if (level == 0 && ext_inode_hdr(inode)->eh_entries == 0) {
+		ext3_ext_tree_init(inode);
+		return ext3_mark_inode_dirty(handle, inode);
+	}
+	return 0;
+}
+
+/*
+ * Make sure the handle can pay for one ext3_ext_rm_tail() step: the
+ * leaf, the inode, a bitmap, a group descriptor and the superblock,
+ * plus a parent, bitmap and descriptor for every node it might free.
+ * Like the indirect truncate, we restart the transaction when it cannot
+ * be extended; every step leaves the tree consistent.
+ */
+static int ext3_ext_truncate_credits(handle_t *handle, struct inode *inode)
+{
+	int needed = EXT3_RESERVE_TRANS_BLOCKS + 3 * ext_depth(inode);
+
+	if (handle->h_buffer_credits >= needed)
+		return 0;
+	if (!ext3_journal_extend(handle, needed))
+		return 0;
+	ext3_mark_inode_dirty(handle, inode);
+	jbd_debug(2, "restarting handle %p\n", handle);
+	return ext3_journal_restart(handle, EXT3_DATA_TRANS_BLOCKS + needed);
+}
+
+/*
+ * Release every block at or past i_size, from the end of the file
+ * backwards.  Called by ext3_truncate() with truncate_sem held for
+ * writing and the inode on the orphan list.
+ */
+void ext3_ext_truncate(handle_t *handle, struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext3_ext_path path[EXT3_EXT_MAX_DEPTH + 1];
+	struct ext3_extent *ex;
+	unsigned long first;
+	int err;
+
+	first = (inode->i_size + sb->s_blocksize - 1) >>
+		EXT3_BLOCK_SIZE_BITS(sb);
+
+	for (;;) {
+		if (is_handle_aborted(handle))
+			return;
+		if (ext3_ext_truncate_credits(handle, inode))
+			return;
+		if (ext3_ext_find_extent(inode, EXT3_EXT_MAX_BLOCK, path))
+			return;
+		ex = path[ext_depth(inode)].p_ext;
+		if (ex ? le32_to_cpu(ex->ee_block) +
+			 le16_to_cpu(ex->ee_len) <= first
+		       : ext_depth(inode) == 0) {
+			ext3_ext_drop_refs(path);
+			return;
+		}
+		err = ext3_ext_rm_tail(handle, inode, path, first);
+		ext3_ext_drop_refs(path);
+		if (err)
+			return;
+	}
+}
+
+/*
+ * Tree blocks one page's worth of allocations may touch: an insert can
+ * split every level and push the root down, dirtying an old and a new
+ * node at each of them.  This takes the place of the indirect blocks in
+ * ext3_writepage_trans_blocks().
+ */
+int ext3_ext_index_trans_blocks(struct inode *inode)
+{
+	return 2 * (ext_depth(inode) + 2);
+}
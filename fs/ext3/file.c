@@ -33,8 +33,10 @@
  */
 static int ext3_release_file (struct inode * inode, struct file * filp)
 {
-	if (filp->f_mode & FMODE_WRITE)
+	if (filp->f_mode & FMODE_WRITE) {
 		ext3_discard_prealloc (inode);
+		ext3_discard_reservation (inode);
+	}
 	return 0;
 }
 
@@ -483,7 +483,8 @@ repeat:
 	inode->i_blksize = PAGE_SIZE;
 	inode->i_blocks = 0;
 	inode->i_mtime = inode->i_atime = inode->i_ctime = CURRENT_TIME;
-	inode->u.ext3_i.i_flags = dir->u.ext3_i.i_flags & ~EXT3_INDEX_FL;
+	inode->u.ext3_i.i_flags = dir->u.ext3_i.i_flags &
+				  ~(EXT3_INDEX_FL | EXT3_EXTENTS_FL);
 	if (S_ISLNK(mode))
 		inode->u.ext3_i.i_flags &= ~(EXT3_IMMUTABLE_FL|EXT3_APPEND_FL);
 #ifdef EXT3_FRAGMENTS
@@ -498,7 +499,29 @@ repeat:
 #ifdef EXT3_PREALLOCATE
 	inode->u.ext3_i.i_prealloc_count = 0;
 #endif
+	inode->u.ext3_i.i_rsv_window.rsv_goal_size = EXT3_DEFAULT_RESERVE_BLOCKS;
 	inode->u.ext3_i.i_block_group = i;
+
+	if (S_ISREG(mode) && test_opt(sb, EXTENTS)) {
+		inode->u.ext3_i.i_flags |= EXT3_EXTENTS_FL;
+		ext3_ext_tree_init(inode);
+		if (!EXT3_HAS_INCOMPAT_FEATURE(sb,
+				EXT3_FEATURE_INCOMPAT_EXTENTS)) {
+			/* The first extent-mapped file locks out
+			 * kernels which cannot read it. */
+			err = ext3_journal_get_write_access(handle,
+						sb->u.ext3_sb.s_sbh);
+			if (err) goto fail;
+			ext3_update_dynamic_rev(sb);
+			EXT3_SET_INCOMPAT_FEATURE(sb,
+					EXT3_FEATURE_INCOMPAT_EXTENTS);
+			sb->s_dirt = 1;
+			handle->h_sync = 1;
+			err = ext3_journal_dirty_metadata(handle,
+						sb->u.ext3_sb.s_sbh);
+			if (err) goto fail;
+		}
+	}
 	
 	if (inode->u.ext3_i.i_flags & EXT3_SYNC_FL)
 		inode->i_flags |= S_SYNC;
@@ -48,9 +48,9 @@
  * still needs to be revoked.
  */
 
-static int ext3_forget(handle_t *handle, int is_metadata,
-		       struct inode *inode, struct buffer_head *bh,
-		       int blocknr)
+int ext3_forget(handle_t *handle, int is_metadata,
+		struct inode *inode, struct buffer_head *bh,
+		int blocknr)
 {
 	int err;
 
@@ -155,6 +155,7 @@ static int ext3_journal_test_restart(handle_t *handle, struct inode *inode)
 void ext3_put_inode (struct inode * inode)
 {
 	ext3_discard_prealloc (inode);
+	ext3_discard_reservation (inode);
 }
 
 /*
@@ -727,11 +728,16 @@ static int ext3_get_block_handle(handle_t *handle, struct inode *inode,
 	Indirect *partial;
 	unsigned long goal;
 	int left;
-	int depth = ext3_block_to_path(inode, iblock, offsets);
+	int depth;
 	loff_t new_size;
 
 	J_ASSERT(handle != NULL || create == 0);
 
+	if (inode->u.ext3_i.i_flags & EXT3_EXTENTS_FL)
+		return ext3_ext_get_block(handle, inode, iblock,
+					  bh_result, create);
+
+	depth = ext3_block_to_path(inode, iblock, offsets);
 	if (depth == 0)
 		goto out;
 
@@ -1859,6 +1865,7 @@ void ext3_truncate(struct inode * inode)
 		return;
 
 	ext3_discard_prealloc(inode);
+	ext3_discard_reservation(inode);
 
 	handle = start_transaction(inode);
 	if (IS_ERR(handle))
@@ -1870,10 +1877,13 @@ void ext3_truncate(struct inode * inode)
 
 	ext3_block_truncate_page(handle, inode->i_mapping, inode->i_size);
 		
-
-	n = ext3_block_to_path(inode, last_block, offsets);
-	if (n == 0)
-		goto out_stop;	/* error */
+	/* Extent-mapped files can reach past what block_to_path covers */
+	n = 0;
+	if (!(inode->u.ext3_i.i_flags & EXT3_EXTENTS_FL)) {
+		n = ext3_block_to_path(inode, last_block, offsets);
+		if (n == 0)
+			goto out_stop;	/* error */
+	}
 
 	/*
 	 * OK.  This truncate is going to happen.  We add the inode to the
@@ -1902,6 +1912,11 @@ void ext3_truncate(struct inode * inode)
 	 */
 	down_write(&inode->u.ext3_i.truncate_sem);
 
+	if (inode->u.ext3_i.i_flags & EXT3_EXTENTS_FL) {
+		ext3_ext_truncate(handle, inode);
+		goto truncated;
+	}
+
 	if (n == 1) {		/* direct blocks */
 		ext3_free_data(handle, inode, NULL, i_data+offsets[0],
 			       i_data + EXT3_NDIR_BLOCKS);
@@ -1964,6 +1979,7 @@ do_indirects:
 		case EXT3_TIND_BLOCK:
 			;
 	}
+truncated:
 	up_write(&inode->u.ext3_i.truncate_sem);
 	inode->i_mtime = inode->i_ctime = CURRENT_TIME;
 	ext3_mark_inode_dirty(handle, inode);
@@ -2118,6 +2134,7 @@ void ext3_read_inode(struct inode * inode)
 #ifdef EXT3_PREALLOCATE
 	inode->u.ext3_i.i_prealloc_count = 0;
 #endif
+	inode->u.ext3_i.i_rsv_window.rsv_goal_size = EXT3_DEFAULT_RESERVE_BLOCKS;
 	inode->u.ext3_i.i_block_group = iloc.block_group;
 
 	/*
@@ -2444,6 +2461,9 @@ int ext3_writepage_trans_blocks(struct inode *inode)
 	int bpp = ext3_journal_blocks_per_page(inode);
 	int indirects = (EXT3_NDIR_BLOCKS % bpp) ? 5 : 3;
 	int ret;
+
+	if (inode->u.ext3_i.i_flags & EXT3_EXTENTS_FL)
+		indirects = ext3_ext_index_trans_blocks(inode);
 	
 	if (ext3_should_journal_data(inode))
 		ret = 3 * (bpp + indirects) + 2;
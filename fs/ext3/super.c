@@ -452,6 +452,7 @@ static struct super_operations ext3_sops = {
 	dirty_inode:	ext3_dirty_inode,	/* BKL not held.  We take it */
 	put_inode:	ext3_put_inode,		/* BKL not held.  Don't need */
 	delete_inode:	ext3_delete_inode,	/* BKL not held.  We take it */
+	clear_inode:	ext3_discard_reservation, /* BKL not held.  Don't need */
 	put_super:	ext3_put_super,		/* BKL held */
 	write_super:	ext3_write_super,	/* BKL held */
 	write_super_lockfs: ext3_write_super_lockfs, /* BKL not held. Take it */
@@ -516,6 +517,20 @@ static int parse_options (char * options, unsigned long * sb_block,
 		else if (!strcmp (this_char, "nouid32")) {
 			set_opt (*mount_options, NO_UID32);
 		}
+		else if (!strcmp (this_char, "noreservation"))
+			set_opt (*mount_options, NORESERVATION);
+		else if (!strcmp (this_char, "reservation"))
+			clear_opt (*mount_options, NORESERVATION);
+		else if (!strcmp (this_char, "extents"))
+			set_opt (*mount_options, EXTENTS);
+		else if (!strcmp (this_char, "noextents"))
+			clear_opt (*mount_options, EXTENTS);
+		else if (!strcmp (this_char, "journal_checksum"))
+			set_opt (*mount_options, JOURNAL_CHECKSUM);
+		else if (!strcmp (this_char, "journal_async_commit")) {
+			set_opt (*mount_options, JOURNAL_CHECKSUM);
+			set_opt (*mount_options, JOURNAL_ASYNC_COMMIT);
+		}
 		else if (!strcmp (this_char, "abort"))
 			set_opt (*mount_options, ABORT);
 		else if (!strcmp (this_char, "check")) {
@@ -1066,6 +1081,9 @@ struct super_block * ext3_read_super (struct super_block * sb, void * data,
 	sbi->s_mount_state = le16_to_cpu(es->s_state);
 	sbi->s_addr_per_block_bits = log2(EXT3_ADDR_PER_BLOCK(sb));
 	sbi->s_desc_per_block_bits = log2(EXT3_DESC_PER_BLOCK(sb));
+	for (i=0; i < 4; i++)
+		sbi->s_hash_seed[i] = le32_to_cpu(es->s_hash_seed[i]);
+	sbi->s_def_hash_version = es->s_def_hash_version;
 
 	if (sbi->s_blocks_per_group > blocksize * 8) {
 		printk (KERN_ERR
@@ -1120,6 +1138,8 @@ struct super_block * ext3_read_super (struct super_block * sb, void * data,
 	sbi->s_loaded_inode_bitmaps = 0;
 	sbi->s_loaded_block_bitmaps = 0;
 	sbi->s_gdb_count = db_count;
+	sbi->s_rsv_window_root = RB_ROOT;
+	spin_lock_init(&sbi->s_rsv_window_lock);
 	get_random_bytes(&sbi->s_next_generation, sizeof(u32));
 	/*
 	 * set up enough so that it can read an inode
@@ -1178,6 +1198,35 @@ struct super_block * ext3_read_super (struct super_block * sb, void * data,
 		break;
 	}
 
+	/*
+	 * The log is empty now, so the commit block format can be
+	 * switched either way.  Async commits rely on the checksum and
+	 * are an incompat feature; older kernels refuse the journal
+	 * until a mount without them clears it again.
+	 */
+	if (test_opt(sb, JOURNAL_CHECKSUM)) {
+		if (!journal_set_features(sbi->s_journal,
+				JFS_FEATURE_COMPAT_CHECKSUM, 0,
+				test_opt(sb, JOURNAL_ASYNC_COMMIT) ?
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT : 0)) {
+			printk(KERN_ERR "EXT3-fs: Journal does not support "
+			       "commit block checksums\n");
+			goto failed_mount3;
+		}
+	}
+	if (!test_opt(sb, JOURNAL_ASYNC_COMMIT))
+		journal_clear_features(sbi->s_journal, 0, 0,
+				       JFS_FEATURE_INCOMPAT_ASYNC_COMMIT);
+	if (!test_opt(sb, JOURNAL_CHECKSUM))
+		journal_clear_features(sbi->s_journal,
+				       JFS_FEATURE_COMPAT_CHECKSUM, 0, 0);
+	/*
+	 * Recovery must know about async commits before there are any.
+	 * Orphan cleanup commits even on a read-only mount, and
+	 * journal_load() has written the journal superblock already.
+	 */
+	journal_update_superblock(sbi->s_journal, 1);
+
 	/*
 	 * The journal_load will have done any necessary log recovery,
 	 * so we can safely mount the rest of the filesystem now.
@@ -1700,6 +1749,8 @@ int ext3_remount (struct super_block * sb, int * flags, char * data)
 			 */
 			ext3_clear_journal_err(sb, es);
 			sbi->s_mount_state = le16_to_cpu(es->s_state);
+			/* Commit block features go to disk before we commit */
+			journal_update_superblock(sbi->s_journal, 1);
 			if (!ext3_setup_super (sb, es, 0))
 				sb->s_flags &= ~MS_RDONLY;
 		}
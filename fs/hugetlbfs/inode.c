@@ -0,0 +1,438 @@
+/*
+ * hugetlbfs: a ram filesystem whose files are backed by huge pages.
+ *
+ * Modelled on ramfs.  Files can only be mmap()ed, shared, at huge page
+ * aligned addresses and offsets; the mapping is populated right away
+ * and a file grows to cover whatever is mapped of it.  ftruncate() to
+ * a multiple of the huge page size gives pages back to the pool.
+ *
+ * The filesystem is also mounted internally, for SHM_HUGETLB segments.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/pagemap.h>
+#include <linux/file.h>
+#include <linux/hugetlb.h>
+
+#include <asm/uaccess.h>
+
+static struct super_operations hugetlbfs_ops;
+static struct inode_operations hugetlbfs_dir_inode_operations;
+static struct inode_operations hugetlbfs_inode_operations;
+
+static struct vfsmount *hugetlbfs_vfsmount;
+
+/*
+ * Make room for 'nr' huge pages in the file's page array.
+ */
+static int hugetlbfs_grow(struct inode *inode, unsigned long nr)
+{
+	struct hugetlbfs_inode_info *info = HUGETLBFS_I(inode), *new;
+	unsigned long old = info ? info->nr_hpages : 0;
+
+	if (nr <= old)
+		return 0;
+	new = kmalloc(sizeof(*new) + nr * sizeof(struct page *), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+	new->nr_hpages = nr;
+	new->nr_present = 0;
+	memset(new->hpages + old, 0, (nr - old) * sizeof(struct page *));
+	if (info) {
+		memcpy(new->hpages, info->hpages, old * sizeof(struct page *));
+		new->nr_present = info->nr_present;
+		kfree(info);
+	}
+	inode->u.generic_ip = new;
+	return 0;
+}
+
+/*
+ * The huge page at huge page offset 'idx' of the file, allocated from
+ * the pool if it is not there yet.  Called with inode->i_sem held.
+ */
+struct page *hugetlbfs_get_page(struct inode *inode, unsigned long idx)
+{
+	struct hugetlbfs_inode_info *info;
+	struct page *page;
+
+	if (hugetlbfs_grow(inode, idx + 1))
+		return NULL;
+	info = HUGETLBFS_I(inode);
+	page = info->hpages[idx];
+	if (!page) {
+		page = alloc_huge_page();
+		if (!page)
+			return NULL;
+		info->hpages[idx] = page;
+		info->nr_present++;
+	}
+	return page;
+}
+
+static void hugetlbfs_truncate_pages(struct inode *inode, unsigned long start)
+{
+	struct hugetlbfs_inode_info *info = HUGETLBFS_I(inode);
+	unsigned long idx;
+
+	if (!info)
+		return;
+	for (idx = start; idx < info->nr_hpages; idx++) {
+		if (!info->hpages[idx])
+			continue;
+		free_huge_page(info->hpages[idx]);
+		info->hpages[idx] = NULL;
+		info->nr_present--;
+	}
+}
+
+/*
+ * vmtruncate() has already unmapped everything past the new size.
+ */
+static void hugetlbfs_truncate(struct inode *inode)
+{
+	hugetlbfs_truncate_pages(inode, inode->i_size >> HPAGE_SHIFT);
+}
+
+static int hugetlbfs_setattr(struct dentry *dentry, struct iattr *attr)
+{
+	struct inode *inode = dentry->d_inode;
+	int error;
+
+	error = inode_change_ok(inode, attr);
+	if (error)
+		return error;
+	if ((attr->ia_valid & ATTR_SIZE) && (attr->ia_size & ~HPAGE_MASK))
+		return -EINVAL;
+	return inode_setattr(inode, attr);
+}
+
+static void hugetlbfs_delete_inode(struct inode *inode)
+{
+	hugetlbfs_truncate_pages(inode, 0);
+	kfree(HUGETLBFS_I(inode));
+	inode->u.generic_ip = NULL;
+	clear_inode(inode);
+}
+
+int hugetlbfs_file_mmap(struct file *file, struct vm_area *vma)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+	loff_t len;
+	int error;
+
+	if (!(vma->vm_flags & VM_MAYSHARE))
+		return -EINVAL;
+	if ((vma->vm_start | vma->vm_end) & ~HPAGE_MASK)
+		return -EINVAL;
+	if (vma->vm_pgoff & ((1 << HUGETLB_PAGE_ORDER) - 1))
+		return -EINVAL;
+
+	len = ((loff_t) vma->vm_pgoff << PAGE_SHIFT) + vma->vm_end - vma->vm_start;
+
+	down(&inode->i_sem);
+	UPDATE_ATIME(inode);
+	vma->vm_flags |= VM_HUGETLB | VM_RESERVED;
+	vma->vm_ops = NULL;
+	if (inode->i_size < len)
+		inode->i_size = len;
+	error = hugetlb_prefault(vma);
+	if (error)
+		zap_hugepage_range(vma, vma->vm_start, vma->vm_end - vma->vm_start);
+	up(&inode->i_sem);
+	return error;
+}
+
+unsigned long hugetlb_get_unmapped_area(struct file *file, unsigned long addr,
+	unsigned long len, unsigned long pgoff, unsigned long flags)
+{
+	struct vm_area *vma;
+
+	if (len & ~HPAGE_MASK)
+		return -EINVAL;
+	if (len > TASK_SIZE)
+		return -ENOMEM;
+
+	if (addr) {
+		addr = (addr + HPAGE_SIZE - 1) & HPAGE_MASK;
+		vma = find_vma(current->mm, addr);
+		if (TASK_SIZE - len >= addr &&
+		    (!vma || addr + len <= vma->vm_start))
+			return addr;
+	}
+	addr = (TASK_UNMAPPED_BASE + HPAGE_SIZE - 1) & HPAGE_MASK;
+
+	for (vma = find_vma(current->mm, addr); ; vma = vma->vm_next) {
+		/* At this point:  (!vma || addr < vma->vm_end). */
+		if (TASK_SIZE - len < addr)
+			return -ENOMEM;
+		if (!vma || addr + len <= vma->vm_start)
+			return addr;
+		addr = (vma->vm_end + HPAGE_SIZE - 1) & HPAGE_MASK;
+	}
+}
+
+static int hugetlbfs_statfs(struct super_block *sb, struct statfs *buf)
+{
+	buf->f_type = HUGETLBFS_MAGIC;
+	buf->f_bsize = HPAGE_SIZE;
+	buf->f_namelen = 255;
+	return 0;
+}
+
+static struct inode *hugetlbfs_get_inode(struct super_block *sb, int mode, int dev)
+{
+	struct inode * inode = new_inode(sb);
+
+	if (inode) {
+		inode->i_mode = mode;
+		inode->i_uid = current->fsuid;
+		inode->i_gid = current->fsgid;
+		inode->i_blksize = HPAGE_SIZE;
+		inode->i_blocks = 0;
+		inode->i_rdev = NODEV;
+		inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+		switch (mode & S_IFMT) {
+		default:
+			init_special_inode(inode, mode, dev);
+			break;
+		case S_IFREG:
+			inode->i_op = &hugetlbfs_inode_operations;
+			inode->i_fop = &hugetlbfs_file_operations;
+			break;
+		case S_IFDIR:
+			inode->i_op = &hugetlbfs_dir_inode_operations;
+			inode->i_fop = &dcache_dir_ops;
+			break;
+		}
+	}
+	return inode;
+}
+
+/*
+ * The directory side is that of ramfs: the dcache is all there is.
+ */
+static struct dentry * hugetlbfs_lookup(struct inode *dir, struct dentry *dentry)
+{
+	d_add(dentry, NULL);
+	return NULL;
+}
+
+static int hugetlbfs_mknod(struct inode *dir, struct dentry *dentry, int mode, int dev)
+{
+	struct inode * inode = hugetlbfs_get_inode(dir->i_sb, mode, dev);
+	int error = -ENOSPC;
+
+	if (inode) {
+		d_instantiate(dentry, inode);
+		dget(dentry);		/* Extra count - pin the dentry in core */
+		error = 0;
+	}
+	return error;
+}
+
+static int hugetlbfs_mkdir(struct inode * dir, struct dentry * dentry, int mode)
+{
+	return hugetlbfs_mknod(dir, dentry, mode | S_IFDIR, 0);
+}
+
+static int hugetlbfs_create(struct inode *dir, struct dentry *dentry, int mode)
+{
+	return hugetlbfs_mknod(dir, dentry, mode | S_IFREG, 0);
+}
+
+static int hugetlbfs_link(struct dentry *old_dentry, struct inode * dir, struct dentry * dentry)
+{
+	struct inode *inode = old_dentry->d_inode;
+
+	if (S_ISDIR(inode->i_mode))
+		return -EPERM;
+
+	inode->i_nlink++;
+	atomic_inc(&inode->i_count);	/* New dentry reference */
+	dget(dentry);		/* Extra pinning count for the created dentry */
+	d_instantiate(dentry, inode);
+	return 0;
+}
+
+static int hugetlbfs_empty(struct dentry *dentry)
+{
+	struct list_head *list;
+
+	spin_lock(&dcache_lock);
+	list = dentry->d_subdirs.next;
+
+	while (list != &dentry->d_subdirs) {
+		struct dentry *de = list_entry(list, struct dentry, d_child);
+
+		if (de->d_inode && !d_unhashed(de)) {
+			spin_unlock(&dcache_lock);
+			return 0;
+		}
+		list = list->next;
+	}
+	spin_unlock(&dcache_lock);
+	return 1;
+}
+
+static int hugetlbfs_unlink(struct inode * dir, struct dentry *dentry)
+{
+	int retval = -ENOTEMPTY;
+
+	if (hugetlbfs_empty(dentry)) {
+		struct inode *inode = dentry->d_inode;
+
+		inode->i_nlink--;
+		dput(dentry);			/* Undo the count from "create" */
+		retval = 0;
+	}
+	return retval;
+}
+
+#define hugetlbfs_rmdir hugetlbfs_unlink
+
+static int hugetlbfs_rename(struct inode * old_dir, struct dentry *old_dentry, struct inode * new_dir,struct dentry *new_dentry)
+{
+	int error = -ENOTEMPTY;
+
+	if (hugetlbfs_empty(new_dentry)) {
+		struct inode *inode = new_dentry->d_inode;
+		if (inode) {
+			inode->i_nlink--;
+			dput(new_dentry);
+		}
+		error = 0;
+	}
+	return error;
+}
+
+struct file_operations hugetlbfs_file_operations = {
+	mmap:			hugetlbfs_file_mmap,
+	get_unmapped_area:	hugetlb_get_unmapped_area,
+};
+
+static struct inode_operations hugetlbfs_inode_operations = {
+	truncate:	hugetlbfs_truncate,
+	setattr:	hugetlbfs_setattr,
+};
+
+static struct inode_operations hugetlbfs_dir_inode_operations = {
+	create:		hugetlbfs_create,
+	lookup:		hugetlbfs_lookup,
+	link:		hugetlbfs_link,
+	unlink:		hugetlbfs_unlink,
+	mkdir:		hugetlbfs_mkdir,
+	rmdir:		hugetlbfs_rmdir,
+	mknod:		hugetlbfs_mknod,
+	rename:		hugetlbfs_rename,
+};
+
+static struct super_operations hugetlbfs_ops = {
+	statfs:		hugetlbfs_statfs,
+	put_inode:	force_delete,
+	delete_inode:	hugetlbfs_delete_inode,
+};
+
+static struct super_block *hugetlbfs_read_super(struct super_block * sb, void * data, int silent)
+{
+	struct inode * inode;
+	struct dentry * root;
+
+	sb->s_blocksize = PAGE_CACHE_SIZE;
+	sb->s_blocksize_bits = PAGE_CACHE_SHIFT;
+	sb->s_magic = HUGETLBFS_MAGIC;
+	sb->s_op = &hugetlbfs_ops;
+	inode = hugetlbfs_get_inode(sb, S_IFDIR | 0755, 0);
+	if (!inode)
+		return NULL;
+
+	root = d_alloc_root(inode);
+	if (!root) {
+		iput(inode);
+		return NULL;
+	}
+	sb->s_root = root;
+	return sb;
+}
+
+/*
+ * An unlinked file on the internal mount, for a SHM_HUGETLB segment.
+ * The size is rounded up to whole huge pages, and there have to be
+ * enough of them free in the pool right now.
+ */
+struct file *hugetlb_file_setup(char *name, loff_t size)
+{
+	int error;
+	struct file *file;
+	struct inode *inode;
+	struct dentry *dentry, *root;
+	struct qstr this;
+
+	if (!hugetlbfs_vfsmount)
+		return ERR_PTR(-ENOENT);
+
+	size = (size + HPAGE_SIZE - 1) & HPAGE_MASK;
+	if ((size >> HPAGE_SHIFT) > hugetlb_free_pages())
+		return ERR_PTR(-ENOMEM);
+
+	this.name = (const unsigned char *) name;
+	this.len = strlen(name);
+	this.hash = 0;
+	root = hugetlbfs_vfsmount->mnt_root;
+	dentry = d_alloc(root, &this);
+	if (!dentry)
+		return ERR_PTR(-ENOMEM);
+
+	error = -ENFILE;
+	file = get_empty_filp();
+	if (!file)
+		goto put_dentry;
+
+	error = -ENOSPC;
+	inode = hugetlbfs_get_inode(root->d_sb, S_IFREG | S_IRWXUGO, 0);
+	if (!inode)
+		goto close_file;
+
+	d_instantiate(dentry, inode);
+	inode->i_size = size;
+	inode->i_nlink = 0;	/* It is unlinked */
+	file->f_vfsmnt = mntget(hugetlbfs_vfsmount);
+	file->f_dentry = dentry;
+	file->f_op = &hugetlbfs_file_operations;
+	file->f_mode = FMODE_WRITE | FMODE_READ;
+	return file;
+
+close_file:
+	put_filp(file);
+put_dentry:
+	dput(dentry);
+	return ERR_PTR(error);
+}
+
+static DECLARE_FSTYPE(hugetlbfs_fs_type, "hugetlbfs", hugetlbfs_read_super, FS_LITTER);
+
+static int __init init_hugetlbfs_fs(void)
+{
+	struct vfsmount *mnt;
+	int error;
+
+	error = register_filesystem(&hugetlbfs_fs_type);
+	if (error)
+		return error;
+
+	mnt = kern_mount(&hugetlbfs_fs_type);
+	if (IS_ERR(mnt)) {
+		printk(KERN_ERR "could not kern_mount hugetlbfs\n");
+		unregister_filesystem(&hugetlbfs_fs_type);
+		return PTR_ERR(mnt);
+	}
+	hugetlbfs_vfsmount = mnt;
+	return 0;
+}
+
+module_init(init_hugetlbfs_fs)
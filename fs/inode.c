@@ -110,6 +110,7 @@ static void init_once(void * foo, struct kmem_cache_s * cachep, unsigned long fl
 		sema_init(&inode->i_sem, 1);
 		sema_init(&inode->i_zombie, 1);
 		spin_lock_init(&inode->i_data.i_shared_lock);
+		spin_lock_init(&inode->i_data.page_lock);
 	}
 }
 
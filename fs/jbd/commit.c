@@ -33,6 +33,54 @@ void journal_end_buffer_io_sync(struct buffer_head *bh, int uptodate)
 	unlock_buffer(bh);
 }
 
+/*
+ * Build the commit record for a transaction and start writing it.
+ * With the CHECKSUM feature it carries the checksum of everything the
+ * transaction has written to the log; recovery will not trust a commit
+ * record that does not match, which is what lets an ASYNC_COMMIT
+ * journal send it down before the rest of the transaction has reached
+ * the disk.  Called with the journal locked.
+ */
+static struct journal_head *
+journal_submit_commit_record(journal_t *journal, transaction_t *transaction,
+			     __u32 crc32_sum)
+{
+	struct journal_head *descriptor;
+	struct buffer_head *bh;
+	commit_header_t *tmp;
+
+	descriptor = journal_get_descriptor_buffer(journal);
+	if (!descriptor)
+		return NULL;
+
+	bh = jh2bh(descriptor);
+	memset(bh->b_data, 0, bh->b_size);
+	tmp = (commit_header_t *)bh->b_data;
+	tmp->h_magic = htonl(JFS_MAGIC_NUMBER);
+	tmp->h_blocktype = htonl(JFS_COMMIT_BLOCK);
+	tmp->h_sequence = htonl(transaction->t_tid);
+	if (JFS_HAS_COMPAT_FEATURE(journal, JFS_FEATURE_COMPAT_CHECKSUM)) {
+		tmp->h_chksum_type = JFS_CRC32_CHKSUM;
+		tmp->h_chksum_size = JFS_CRC32_CHKSUM_SIZE;
+		tmp->h_chksum[0] = htonl(crc32_sum);
+	}
+
+	JBUFFER_TRACE(descriptor, "write commit block");
+	clear_bit(BH_Dirty, &bh->b_state);
+	bh->b_end_io = journal_end_buffer_io_sync;
+	submit_bh(WRITE, bh);
+	return descriptor;
+}
+
+static void journal_wait_on_commit_record(struct journal_head *descriptor)
+{
+	struct buffer_head *bh = jh2bh(descriptor);
+
+	wait_on_buffer(bh);
+	put_bh(bh);		/* One for getblk() */
+	journal_unlock_journal_head(descriptor);
+}
+
 /*
  * journal_commit_transaction
  *
@@ -56,6 +104,13 @@ void journal_commit_transaction(journal_t *journal)
 	int first_tag = 0;
 	int tag_flag;
 	int i;
+	struct journal_head *cblock = NULL;
+	__u32 crc32_sum = ~0;
+	int csum, async;
+	struct timeval start_time;
+	unsigned long commit_time, nr_logged;
+
+	do_gettimeofday(&start_time);
 
 	/*
 	 * First job: lock down the current transaction and wait for
@@ -319,6 +374,22 @@ sync_datalist_empty:
 	 */
 	commit_transaction->t_state = T_COMMIT;
 
+	/*
+	 * The revoke records went out in phase 1 and are first in the
+	 * log, so they start the checksum.
+	 */
+	csum = JFS_HAS_COMPAT_FEATURE(journal, JFS_FEATURE_COMPAT_CHECKSUM);
+	async = csum && JFS_HAS_INCOMPAT_FEATURE(journal,
+					JFS_FEATURE_INCOMPAT_ASYNC_COMMIT);
+	if (csum && (jh = commit_transaction->t_log_list)) {
+		do {
+			struct buffer_head *bh = jh2bh(jh);
+			crc32_sum = journal_crc32(crc32_sum, bh->b_data,
+						  bh->b_size);
+			jh = jh->b_tnext;
+		} while (jh != commit_transaction->t_log_list);
+	}
+
 	descriptor = 0;
 	bufs = 0;
 	while (commit_transaction->t_buffers) {
@@ -454,6 +525,9 @@ start_journal_io:
 			unlock_journal(journal);
 			for (i=0; i<bufs; i++) {
 				struct buffer_head *bh = wbuf[i];
+				if (csum)
+					crc32_sum = journal_crc32(crc32_sum,
+							bh->b_data, bh->b_size);
 				clear_bit(BH_Dirty, &bh->b_state);
 				bh->b_end_io = journal_end_buffer_io_sync;
 				submit_bh(WRITE, bh);
@@ -469,6 +543,15 @@ start_journal_io:
 		}
 	}
 
+	/* With an async commit the commit record follows the rest
+	   straight away; its checksum stands in for the wait below. */
+	if (async && !is_journal_aborted(journal)) {
+		cblock = journal_submit_commit_record(journal,
+					commit_transaction, crc32_sum);
+		if (!cblock)
+			__journal_abort_hard(journal);
+	}
+
 	/* Lo and behold: we have just managed to send a transaction to
            the log.  Before we can commit it, wait for the IO so far to
            complete.  Control buffers being written are on the
@@ -566,51 +649,26 @@ start_journal_io:
 
 	jbd_debug(3, "JBD: commit phase 6\n");
 
-	if (is_journal_aborted(journal)) {
-		unlock_journal(journal);
-		goto skip_commit;
-	}
-
-	/* Done it all: now write the commit record.  We should have
-	 * cleaned up our previous buffers by now, so if we are in abort
-	 * mode we can now just skip the rest of the journal write
-	 * entirely. */
-
-	descriptor = journal_get_descriptor_buffer(journal);
-	if (!descriptor) {
-		__journal_abort_hard(journal);
-		unlock_journal(journal);
-		goto skip_commit;
-	}
+	/* Done it all: now write the commit record, unless an async
+	 * commit has sent it already.  We should have cleaned up our
+	 * previous buffers by now, so if we are in abort mode we can
+	 * now just skip the rest of the journal write entirely. */
 
-	/* AKPM: buglet - add `i' to tmp! */
-	for (i = 0; i < jh2bh(descriptor)->b_size; i += 512) {
-		journal_header_t *tmp =
-			(journal_header_t*)jh2bh(descriptor)->b_data;
-		tmp->h_magic = htonl(JFS_MAGIC_NUMBER);
-		tmp->h_blocktype = htonl(JFS_COMMIT_BLOCK);
-		tmp->h_sequence = htonl(commit_transaction->t_tid);
+	if (!async && !is_journal_aborted(journal)) {
+		cblock = journal_submit_commit_record(journal,
+					commit_transaction, crc32_sum);
+		if (!cblock)
+			__journal_abort_hard(journal);
 	}
-
 	unlock_journal(journal);
-	JBUFFER_TRACE(descriptor, "write commit block");
-	{
-		struct buffer_head *bh = jh2bh(descriptor);
-		clear_bit(BH_Dirty, &bh->b_state);
-		bh->b_end_io = journal_end_buffer_io_sync;
-		submit_bh(WRITE, bh);
-		wait_on_buffer(bh);
-		put_bh(bh);		/* One for getblk() */
-		journal_unlock_journal_head(descriptor);
-	}
+	if (cblock)
+		journal_wait_on_commit_record(cblock);
 
 	/* End of a transaction!  Finally, we can do checkpoint
            processing: any buffers committed as a result of this
            transaction can be removed from any checkpoint list it was on
            before. */
 
-skip_commit: /* The journal should be unlocked by now. */
-
 	/* Call any callbacks that had been registered for handles in this
 	 * transaction.  It is up to the callback to free any allocated
 	 * memory.
@@ -718,6 +776,34 @@ skip_commit: /* The journal should be unlocked by now. */
 
 	jbd_debug(3, "JBD: commit phase 8\n");
 
+	/* Account the commit for /proc/fs/jbd and sync batching */
+	commit_time = jbd_usecs_since(&start_time);
+	if (journal->j_average_commit_time)
+		journal->j_average_commit_time =
+			(commit_time + journal->j_average_commit_time * 3) / 4;
+	else
+		journal->j_average_commit_time = commit_time;
+
+	nr_logged = journal->j_head - commit_transaction->t_log_start;
+	if (journal->j_head < commit_transaction->t_log_start)
+		nr_logged += journal->j_last - journal->j_first;
+
+	journal->j_stats.js_commits++;
+	journal->j_stats.js_handles += commit_transaction->t_handle_count;
+	journal->j_stats.js_blocks += nr_logged;
+	journal->j_stats.js_commit_time += commit_time;
+	if (commit_time > journal->j_stats.js_max_commit_time)
+		journal->j_stats.js_max_commit_time = commit_time;
+	if (commit_transaction->t_sync_count) {
+		int n = commit_transaction->t_sync_count;
+
+		journal->j_stats.js_sync_commits++;
+		journal->j_stats.js_sync_handles += n;
+		for (i = 0; i < JBD_BATCH_BUCKETS - 1 && n > 1; i++)
+			n >>= 1;
+		journal->j_stats.js_batch[i]++;
+	}
+
 	J_ASSERT (commit_transaction->t_state == T_COMMIT);
 	commit_transaction->t_state = T_FINISHED;
 
@@ -36,6 +36,7 @@
 #include <linux/slab.h>
 #include <asm/uaccess.h>
 #include <linux/proc_fs.h>
+#include <asm/div64.h>
 
 EXPORT_SYMBOL(journal_start);
 EXPORT_SYMBOL(journal_try_start);
@@ -66,6 +67,7 @@ EXPORT_SYMBOL(journal_update_format);
 EXPORT_SYMBOL(journal_check_used_features);
 EXPORT_SYMBOL(journal_check_available_features);
 EXPORT_SYMBOL(journal_set_features);
+EXPORT_SYMBOL(journal_clear_features);
 EXPORT_SYMBOL(journal_create);
 EXPORT_SYMBOL(journal_load);
 EXPORT_SYMBOL(journal_destroy);
@@ -85,6 +87,8 @@ EXPORT_SYMBOL(journal_bmap);
 EXPORT_SYMBOL(journal_force_commit);
 
 static int journal_convert_superblock_v1(journal_t *, journal_superblock_t *);
+static void journal_register_stats(journal_t *);
+static void journal_unregister_stats(journal_t *);
 
 /*
  * journal_datalist_lock is used to protect data buffers:
@@ -847,6 +851,7 @@ static int journal_reset (journal_t *journal)
 	journal_start_thread(journal);
 	unlock_journal(journal);
 
+	journal_register_stats(journal);
 	return 0;
 }
 
@@ -1093,6 +1098,8 @@ recovery_error:
 
 void journal_destroy (journal_t *journal)
 {
+	journal_unregister_stats(journal);
+
 	/* Wait for the commit thread to wake up and die. */
 	journal_kill_thread(journal);
 
@@ -1206,6 +1213,28 @@ int journal_set_features (journal_t *journal, unsigned long compat,
 	return 1;
 }
 
+/* Published API: Clear a given set of journal features on the
+ * superblock.  Only safe while the log is empty, as it is straight
+ * after journal_load(). */
+
+void journal_clear_features (journal_t *journal, unsigned long compat,
+			     unsigned long ro, unsigned long incompat)
+{
+	journal_superblock_t *sb;
+
+	if (journal->j_format_version == 1)
+		return;
+
+	jbd_debug(1, "Clearing features 0x%lx/0x%lx/0x%lx\n",
+		  compat, ro, incompat);
+
+	sb = journal->j_superblock;
+
+	sb->s_feature_compat    &= ~cpu_to_be32(compat);
+	sb->s_feature_ro_compat &= ~cpu_to_be32(ro);
+	sb->s_feature_incompat  &= ~cpu_to_be32(incompat);
+}
+
 
 /*
  * Published API:
@@ -1352,6 +1381,34 @@ int journal_wipe (journal_t *journal, int write)
 	return err;
 }
 
+/*
+ * CRC32 (big-endian, polynomial 0x04c11db7) used for commit block
+ * checksums.  The table is built when the module loads.
+ */
+static __u32 journal_crc32_table[256];
+
+static void __init journal_init_crc32(void)
+{
+	__u32 crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = (__u32) i << 24;
+		for (j = 0; j < 8; j++)
+			crc = (crc << 1) ^ (crc & 0x80000000 ? 0x04c11db7 : 0);
+		journal_crc32_table[i] = crc;
+	}
+}
+
+__u32 journal_crc32(__u32 crc, const char *p, size_t len)
+{
+	const unsigned char *q = (const unsigned char *) p;
+
+	while (len--)
+		crc = (crc << 8) ^ journal_crc32_table[(crc >> 24) ^ *q++];
+	return crc;
+}
+
 /*
  * journal_dev_name: format a character string to describe on what
  * device this journal is present.
@@ -1867,6 +1924,115 @@ static void __exit remove_jbd_proc_entry(void)
 
 #endif
 
+/*
+ * Per-journal commit statistics in /proc/fs/jbd/<device>
+ */
+#ifdef CONFIG_PROC_FS
+
+static struct proc_dir_entry *proc_jbd_stats;
+
+static unsigned long journal_stats_avg(unsigned long sum, unsigned long n)
+{
+	return n ? sum / n : 0;
+}
+
+static int journal_read_stats(char *page, char **start, off_t off,
+			      int count, int *eof, void *data)
+{
+	journal_t *journal = data;
+	struct journal_stats_s *js = &journal->j_stats;
+	__u64 avg = js->js_commit_time;
+	int len, i;
+
+	if (js->js_commits)
+		do_div(avg, js->js_commits);
+	len = sprintf(page,
+		"commit block: %s\n"
+		"transactions: %lu\n"
+		"handles per transaction: %lu\n"
+		"blocks per transaction: %lu\n"
+		"sync transactions: %lu\n"
+		"sync handles per transaction: %lu\n"
+		"sync handles held back: %lu\n"
+		"average commit time: %luus\n"
+		"recent commit time: %luus\n"
+		"longest commit time: %luus\n"
+		"sync batches:",
+		JFS_HAS_INCOMPAT_FEATURE(journal,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT) ? "async" :
+		JFS_HAS_COMPAT_FEATURE(journal,
+				JFS_FEATURE_COMPAT_CHECKSUM) ? "checksum" :
+		"sync",
+		js->js_commits,
+		journal_stats_avg(js->js_handles, js->js_commits),
+		journal_stats_avg(js->js_blocks, js->js_commits),
+		js->js_sync_commits,
+		journal_stats_avg(js->js_sync_handles, js->js_sync_commits),
+		js->js_batch_waits,
+		(unsigned long) avg,
+		journal->j_average_commit_time,
+		js->js_max_commit_time);
+	for (i = 0; i < JBD_BATCH_BUCKETS; i++) {
+		if (i == 0)
+			len += sprintf(page + len, " 1:%lu", js->js_batch[i]);
+		else if (i == JBD_BATCH_BUCKETS - 1)
+			len += sprintf(page + len, " %d+:%lu",
+				       1 << i, js->js_batch[i]);
+		else
+			len += sprintf(page + len, " %d-%d:%lu", 1 << i,
+				       (2 << i) - 1, js->js_batch[i]);
+	}
+	len += sprintf(page + len, "\n");
+
+	if (len <= off + count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	if (len < 0)
+		len = 0;
+	return len;
+}
+
+static void journal_register_stats(journal_t *journal)
+{
+	if (proc_jbd_stats && !journal->j_proc_entry)
+		journal->j_proc_entry =
+			create_proc_read_entry(kdevname(journal->j_fs_dev), 0,
+					       proc_jbd_stats,
+					       journal_read_stats, journal);
+}
+
+static void journal_unregister_stats(journal_t *journal)
+{
+	if (journal->j_proc_entry) {
+		remove_proc_entry(journal->j_proc_entry->name,
+				  proc_jbd_stats);
+		journal->j_proc_entry = NULL;
+	}
+}
+
+static void __init create_jbd_stats_dir(void)
+{
+	proc_jbd_stats = proc_mkdir("jbd", proc_root_fs);
+}
+
+static void __exit remove_jbd_stats_dir(void)
+{
+	if (proc_jbd_stats)
+		remove_proc_entry("jbd", proc_root_fs);
+}
+
+#else
+
+static void journal_register_stats(journal_t *journal) {}
+static void journal_unregister_stats(journal_t *journal) {}
+#define create_jbd_stats_dir() do {} while (0)
+#define remove_jbd_stats_dir() do {} while (0)
+
+#endif
+
 /*
  * Module startup and shutdown
  */
@@ -1895,7 +2061,9 @@ static int __init journal_init(void)
 	ret = journal_init_caches();
 	if (ret != 0)
 		journal_destroy_caches();
+	journal_init_crc32();
 	create_jbd_proc_entry();
+	create_jbd_stats_dir();
 	return ret;
 }
 
@@ -1906,6 +2074,7 @@ static void __exit journal_exit(void)
 	if (n)
 		printk(KERN_EMERG "JBD: leaked %d journal_heads!\n", n);
 #endif
+	remove_jbd_stats_dir();
 	remove_jbd_proc_entry();
 	journal_destroy_caches();
 }
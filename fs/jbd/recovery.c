@@ -207,6 +207,35 @@ do {									\
 		var -= ((journal)->j_last - (journal)->j_first);	\
 } while (0)
 
+/*
+ * Add a descriptor block and the log blocks it describes to the
+ * running checksum of a transaction, moving *next_log_block past them.
+ */
+static int calc_chksums(journal_t *journal, struct buffer_head *bh,
+			unsigned long *next_log_block, __u32 *crc32_sum)
+{
+	int i, num_blks, err;
+	unsigned long io_block;
+	struct buffer_head *obh;
+
+	num_blks = count_tags(bh, journal->j_blocksize);
+	*crc32_sum = journal_crc32(*crc32_sum, bh->b_data, bh->b_size);
+	for (i = 0; i < num_blks; i++) {
+		io_block = (*next_log_block)++;
+		wrap(journal, *next_log_block);
+		err = jread(&obh, journal, io_block);
+		if (err) {
+			printk(KERN_ERR "JBD: IO error %d recovering block "
+			       "%lu in log\n", err, io_block);
+			return err;
+		}
+		*crc32_sum = journal_crc32(*crc32_sum, obh->b_data,
+					   obh->b_size);
+		brelse(obh);
+	}
+	return 0;
+}
+
 /*
  * journal_recover
  *
@@ -319,6 +348,8 @@ static int do_one_pass(journal_t *journal,
 	struct buffer_head *	bh;
 	unsigned int		sequence;
 	int			blocktype;
+	__u32			crc32_sum = ~0;
+	int			csum, async;
 	
 	/* Precompute the maximum metadata descriptors in a descriptor block */
 	int			MAX_BLOCKS_PER_DESC;
@@ -339,6 +370,13 @@ static int do_one_pass(journal_t *journal,
 	if (pass == PASS_SCAN)
 		info->start_transaction = first_commit_ID;
 
+	/* Only the scan needs to check commit block checksums: the
+	 * later passes stop where it did. */
+	csum = pass == PASS_SCAN &&
+		JFS_HAS_COMPAT_FEATURE(journal, JFS_FEATURE_COMPAT_CHECKSUM);
+	async = JFS_HAS_INCOMPAT_FEATURE(journal,
+					 JFS_FEATURE_INCOMPAT_ASYNC_COMMIT);
+
 	jbd_debug(1, "Starting recovery pass %d\n", pass);
 
 	/*
@@ -410,6 +448,14 @@ static int do_one_pass(journal_t *journal,
 			/* If it is a valid descriptor block, replay it
 			 * in pass REPLAY; otherwise, just skip over the
 			 * blocks it describes. */
+			if (csum) {
+				err = calc_chksums(journal, bh,
+						   &next_log_block, &crc32_sum);
+				brelse(bh);
+				if (err)
+					goto failed;
+				continue;
+			}
 			if (pass != PASS_REPLAY) {
 				next_log_block +=
 					count_tags(bh, journal->j_blocksize);
@@ -506,7 +552,27 @@ static int do_one_pass(journal_t *journal,
 		case JFS_COMMIT_BLOCK:
 			/* Found an expected commit block: not much to
 			 * do other than move on to the next sequence
-			 * number. */
+			 * number.  If it carries a checksum, though, the
+			 * transaction only counts as committed if that
+			 * matches what we found in the log: an async
+			 * commit may have reached the disk before the
+			 * rest of its transaction did. */
+			if (csum) {
+				commit_header_t *cbh =
+					(commit_header_t *)bh->b_data;
+
+				if (cbh->h_chksum_type == JFS_CRC32_CHKSUM ?
+				    ntohl(cbh->h_chksum[0]) != crc32_sum :
+				    async) {
+					printk(KERN_WARNING "JBD: transaction "
+					       "%u has a bad commit checksum, "
+					       "ending the log there\n",
+					       next_commit_ID);
+					brelse(bh);
+					goto done;
+				}
+				crc32_sum = ~0;
+			}
 			brelse(bh);
 			next_commit_ID++;
 			continue;
@@ -514,6 +580,9 @@ static int do_one_pass(journal_t *journal,
 		case JFS_REVOKE_BLOCK:
 			/* If we aren't in the REVOKE pass, then we can
 			 * just skip over this block. */
+			if (csum)
+				crc32_sum = journal_crc32(crc32_sum,
+						bh->b_data, bh->b_size);
 			if (pass != PASS_REVOKE) {
 				brelse(bh);
 				continue;
@@ -5,20 +5,26 @@
  */
 
 #include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
 #include <linux/file.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/fcntl.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
 
 /*
- * We use a start+len construction, which provides full use of the 
- * allocated memory.
- * -- Florian Coosmann (FGC)
- * 
+ * The pipe is a ring of page references, PIPE_DEF_BUFFERS of them
+ * unless resized with F_SETPIPE_SZ.  A write of up to PIPE_BUF bytes is
+ * either appended to the last buffer as a whole or goes into a fresh
+ * page of its own, so it is never split.  Readers and writers move as
+ * many pages as they can before they wake the other side.
+ *
  * Reads with count = 0 should always return 0.
  * -- Julian Bradfield 1999-06-07.
  */
@@ -36,11 +42,48 @@ void pipe_wait(struct inode * inode)
 	down(PIPE_SEM(*inode));
 }
 
+/* Queue a page reference at the tail; the caller checked for room */
+void pipe_buf_add(struct inode *inode, struct page *page,
+		  unsigned int offset, unsigned int len, unsigned int flags)
+{
+	struct pipe_buffer *buf;
+
+	PIPE_NRBUFS(*inode)++;
+	buf = PIPE_TAIL_BUF(*inode);
+	buf->page = page;
+	buf->offset = offset;
+	buf->len = len;
+	buf->flags = flags;
+	PIPE_LEN(*inode) += len;
+}
+
+/*
+ * Eat 'chars' bytes off the head buffer.  Returns 1 if that freed a
+ * slot, which is what blocked writers wait for.
+ */
+int pipe_buf_consume(struct inode *inode, unsigned int chars)
+{
+	struct pipe_buffer *buf = PIPE_HEAD_BUF(*inode);
+
+	buf->offset += chars;
+	buf->len -= chars;
+	PIPE_LEN(*inode) -= chars;
+	if (buf->len)
+		return 0;
+
+	page_cache_release(buf->page);
+	buf->page = NULL;
+	PIPE_CURBUF(*inode) = (PIPE_CURBUF(*inode) + 1) & (PIPE_BUFFERS(*inode) - 1);
+	PIPE_NRBUFS(*inode)--;
+	return 1;
+}
+
 static ssize_t
 pipe_read(struct file *filp, char *buf, size_t count, loff_t *ppos)
 {
 	struct inode *inode = filp->f_dentry->d_inode;
-	ssize_t size, read, ret;
+	ssize_t read, ret;
+	int do_wakeup;
 
 	/* Seeks are not allowed on pipes.  */
 	ret = -ESPIPE;
@@ -58,74 +101,69 @@ pipe_read(struct file *filp, char *buf, size_t count, loff_t *ppos)
 	if (down_interruptible(PIPE_SEM(*inode)))
 		goto out_nolock;
 
-	if (PIPE_EMPTY(*inode)) {
-do_more_read:
-		ret = 0;
-		if (!PIPE_WRITERS(*inode))
-			goto out;
+	ret = 0;
+	do_wakeup = 0;
+	for (;;) {
+		if (!PIPE_EMPTY(*inode)) {
+			struct pipe_buffer *pbuf = PIPE_HEAD_BUF(*inode);
+			size_t chars = pbuf->len;
+			char *kaddr;
+			int error;
 
-		ret = -EAGAIN;
-		if (filp->f_flags & O_NONBLOCK)
-			goto out;
+			if (chars > count)
+				chars = count;
 
-		for (;;) {
-			PIPE_WAITING_READERS(*inode)++;
-			pipe_wait(inode);
-			PIPE_WAITING_READERS(*inode)--;
-			ret = -ERESTARTSYS;
-			if (signal_pending(current))
-				goto out;
-			ret = 0;
-			if (!PIPE_EMPTY(*inode))
+			kaddr = kmap(pbuf->page);
+			error = copy_to_user(buf, kaddr + pbuf->offset, chars);
+			kunmap(pbuf->page);
+			if (error) {
+				ret = -EFAULT;
 				break;
-			if (!PIPE_WRITERS(*inode))
-				goto out;
+			}
+			do_wakeup |= pipe_buf_consume(inode, chars);
+			read += chars;
+			count -= chars;
+			buf += chars;
+			if (!count)
+				break;
+			continue;
 		}
-	}
-
-	/* Read what data is available.  */
-	ret = -EFAULT;
-	while (count > 0 && (size = PIPE_LEN(*inode))) {
-		char *pipebuf = PIPE_BASE(*inode) + PIPE_START(*inode);
-		ssize_t chars = PIPE_MAX_RCHUNK(*inode);
-
-		if (chars > count)
-			chars = count;
-		if (chars > size)
-			chars = size;
-
-		if (copy_to_user(buf, pipebuf, chars))
-			goto out;
-
-		read += chars;
-		PIPE_START(*inode) += chars;
-		PIPE_START(*inode) &= (PIPE_SIZE - 1);
-		PIPE_LEN(*inode) -= chars;
-		count -= chars;
-		buf += chars;
-	}
-
-	/* Cache behaviour optimization */
-	if (!PIPE_LEN(*inode))
-		PIPE_START(*inode) = 0;
-
-	if (count && PIPE_WAITING_WRITERS(*inode) && !(filp->f_flags & O_NONBLOCK)) {
+		if (!PIPE_WRITERS(*inode))
+			break;
 		/*
-		 * We know that we are going to sleep: signal
-		 * writers synchronously that there is more
-		 * room.
+		 * A writer waiting for room will refill the pipe as soon
+		 * as we let it, so keep going even if we already got data.
 		 */
-		wake_up_interruptible_sync(PIPE_WAIT(*inode));
-		if (!PIPE_EMPTY(*inode))
-			BUG();
-		goto do_more_read;
+		if (!PIPE_WAITING_WRITERS(*inode)) {
+			if (read)
+				break;
+			if (filp->f_flags & O_NONBLOCK) {
+				ret = -EAGAIN;
+				break;
+			}
+		}
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+		if (do_wakeup) {
+			/*
+			 * We know that we are going to sleep: signal
+			 * writers synchronously that there is more
+			 * room.
+			 */
+			wake_up_interruptible_sync(PIPE_WAIT(*inode));
+			do_wakeup = 0;
+		}
+		PIPE_WAITING_READERS(*inode)++;
+		pipe_wait(inode);
+		PIPE_WAITING_READERS(*inode)--;
 	}
-	/* Signal writers asynchronously that there is more room.  */
-	wake_up_interruptible(PIPE_WAIT(*inode));
-
-	ret = read;
-out:
 	up(PIPE_SEM(*inode));
+
+	/* Signal writers asynchronously that there is more room.  */
+	if (do_wakeup)
+		wake_up_interruptible(PIPE_WAIT(*inode));
 out_nolock:
 	if (read)
 		ret = read;
@@ -138,7 +176,9 @@ static ssize_t
 pipe_write(struct file *filp, const char *buf, size_t count, loff_t *ppos)
 {
 	struct inode *inode = filp->f_dentry->d_inode;
-	ssize_t free, written, ret;
+	ssize_t written, ret;
+	size_t chars;
+	int do_wakeup;
 
 	/* Seeks are not allowed on pipes.  */
 	ret = -ESPIPE;
@@ -159,82 +199,101 @@ pipe_write(struct file *filp, const char *buf, size_t count, loff_t *ppos)
 	if (!PIPE_READERS(*inode))
 		goto sigpipe;
 
-	/* If count <= PIPE_BUF, we have to make it atomic.  */
-	free = (count <= PIPE_BUF ? count : 1);
-
-	/* Wait, or check for, available space.  */
-	if (filp->f_flags & O_NONBLOCK) {
-		ret = -EAGAIN;
-		if (PIPE_FREE(*inode) < free)
-			goto out;
-	} else {
-		while (PIPE_FREE(*inode) < free) {
-			PIPE_WAITING_WRITERS(*inode)++;
-			pipe_wait(inode);
-			PIPE_WAITING_WRITERS(*inode)--;
-			ret = -ERESTARTSYS;
-			if (signal_pending(current))
+	/*
+	 * Append the odd part of the write to the last buffer if it all
+	 * fits there; the rest goes out in whole pages.
+	 */
+	do_wakeup = 0;
+	chars = count & (PAGE_SIZE - 1);
+	if (chars && !PIPE_EMPTY(*inode)) {
+		struct pipe_buffer *pbuf = PIPE_TAIL_BUF(*inode);
+		unsigned int end = pbuf->offset + pbuf->len;
+
+		if ((pbuf->flags & PIPE_BUF_PRIVATE) && end + chars <= PAGE_SIZE) {
+			char *kaddr;
+			int error;
+
+			kaddr = kmap(pbuf->page);
+			error = copy_from_user(kaddr + end, buf, chars);
+			kunmap(pbuf->page);
+			ret = -EFAULT;
+			if (error)
 				goto out;
 
-			if (!PIPE_READERS(*inode))
-				goto sigpipe;
+			pbuf->len += chars;
+			PIPE_LEN(*inode) += chars;
+			written += chars;
+			count -= chars;
+			buf += chars;
+			do_wakeup = 1;
 		}
 	}
 
-	/* Copy into available space.  */
-	ret = -EFAULT;
 	while (count > 0) {
-		int space;
-		char *pipebuf = PIPE_BASE(*inode) + PIPE_END(*inode);
-		ssize_t chars = PIPE_MAX_WCHUNK(*inode);
+		if (!PIPE_READERS(*inode))
+			goto sigpipe;
 
-		if ((space = PIPE_FREE(*inode)) != 0) {
+		if (!PIPE_FULL(*inode)) {
+			struct page *page;
+			char *kaddr;
+			int error;
+
+			ret = -ENOMEM;
+			page = alloc_page(GFP_HIGHUSER);
+			if (!page)
+				break;
+
+			chars = PAGE_SIZE;
 			if (chars > count)
 				chars = count;
-			if (chars > space)
-				chars = space;
 
-			if (copy_from_user(pipebuf, buf, chars))
-				goto out;
+			kaddr = kmap(page);
+			error = copy_from_user(kaddr, buf, chars);
+			kunmap(page);
+			if (error) {
+				__free_page(page);
+				ret = -EFAULT;
+				break;
+			}
 
+			pipe_buf_add(inode, page, 0, chars, PIPE_BUF_PRIVATE);
 			written += chars;
-			PIPE_LEN(*inode) += chars;
 			count -= chars;
 			buf += chars;
-			space = PIPE_FREE(*inode);
+			do_wakeup = 1;
 			continue;
 		}
 
-		ret = written;
+		ret = -EAGAIN;
 		if (filp->f_flags & O_NONBLOCK)
 			break;
-
-		do {
+		ret = -ERESTARTSYS;
+		if (signal_pending(current))
+			break;
+		if (do_wakeup) {
 			/*
 			 * Synchronous wake-up: it knows that this process
 			 * is going to give up this CPU, so it doesn't have
 			 * to do idle reschedules.
 			 */
 			wake_up_interruptible_sync(PIPE_WAIT(*inode));
-			PIPE_WAITING_WRITERS(*inode)++;
-			pipe_wait(inode);
-			PIPE_WAITING_WRITERS(*inode)--;
-			if (signal_pending(current))
-				goto out;
-			if (!PIPE_READERS(*inode))
-				goto sigpipe;
-		} while (!PIPE_FREE(*inode));
-		ret = -EFAULT;
+			do_wakeup = 0;
+		}
+		PIPE_WAITING_WRITERS(*inode)++;
+		pipe_wait(inode);
+		PIPE_WAITING_WRITERS(*inode)--;
 	}
 
-	/* Signal readers asynchronously that there is more data.  */
-	wake_up_interruptible(PIPE_WAIT(*inode));
-
-	inode->i_ctime = inode->i_mtime = CURRENT_TIME;
-	mark_inode_dirty(inode);
+	if (written) {
+		inode->i_ctime = inode->i_mtime = CURRENT_TIME;
+		mark_inode_dirty(inode);
+	}
 
 out:
 	up(PIPE_SEM(*inode));
+	/* Signal readers asynchronously that there is more data.  */
+	if (do_wakeup)
+		wake_up_interruptible(PIPE_WAIT(*inode));
 out_nolock:
 	if (written)
 		ret = written;
@@ -282,9 +341,11 @@ pipe_poll(struct file *filp, poll_table *wait)
 	poll_wait(filp, PIPE_WAIT(*inode), wait);
 
 	/* Reading only -- no need for acquiring the semaphore.  */
-	mask = POLLIN | POLLRDNORM;
-	if (PIPE_EMPTY(*inode))
-		mask = POLLOUT | POLLWRNORM;
+	mask = 0;
+	if (!PIPE_EMPTY(*inode))
+		mask |= POLLIN | POLLRDNORM;
+	if (!PIPE_FULL(*inode))
+		mask |= POLLOUT | POLLWRNORM;
 	if (!PIPE_WRITERS(*inode) && filp->f_version != PIPE_WCOUNTER(*inode))
 		mask |= POLLHUP;
 	if (!PIPE_READERS(*inode))
@@ -303,10 +364,7 @@ pipe_release(struct inode *inode, int decr, int decw)
 	PIPE_READERS(*inode) -= decr;
 	PIPE_WRITERS(*inode) -= decw;
 	if (!PIPE_READERS(*inode) && !PIPE_WRITERS(*inode)) {
-		struct pipe_inode_info *info = inode->i_pipe;
-		inode->i_pipe = NULL;
-		free_page((unsigned long) info->base);
-		kfree(info);
+		free_pipe_info(inode);
 	} else {
 		wake_up_interruptible(PIPE_WAIT(*inode));
 	}
@@ -436,31 +494,162 @@ struct file_operations rdwr_pipe_fops = {
 	release:	pipe_rdwr_release,
 };
 
+/*
+ * Pipe pages a user may have in all their pipes together before they are
+ * refused a larger ring.  Default sized pipes are charged but always
+ * granted.
+ */
+int pipe_user_pages_max = 16384;
+
+/*
+ * Rings bigger than a page come from vmalloc(): kmalloc() stops at
+ * 128KB, well short of what pipe_user_pages_max lets one pipe have.
+ */
+static struct pipe_buffer *pipe_alloc_bufs(unsigned int nr)
+{
+	size_t size = nr * sizeof(struct pipe_buffer);
+
+	if (size > PAGE_SIZE)
+		return vmalloc(size);
+	return kmalloc(size, GFP_KERNEL);
+}
+
+static void pipe_free_bufs(struct pipe_buffer *bufs, unsigned int nr)
+{
+	if (nr * sizeof(struct pipe_buffer) > PAGE_SIZE)
+		vfree(bufs);
+	else
+		kfree(bufs);
+}
+
 struct inode* pipe_new(struct inode* inode)
 {
-	unsigned long page;
+	struct pipe_inode_info *info;
 
-	page = __get_free_page(GFP_USER);
-	if (!page)
+	info = kmalloc(sizeof(struct pipe_inode_info), GFP_KERNEL);
+	if (!info)
 		return NULL;
+	info->bufs = pipe_alloc_bufs(PIPE_DEF_BUFFERS);
+	if (!info->bufs)
+		goto fail_info;
 
-	inode->i_pipe = kmalloc(sizeof(struct pipe_inode_info), GFP_KERNEL);
-	if (!inode->i_pipe)
-		goto fail_page;
-
+	inode->i_pipe = info;
 	init_waitqueue_head(PIPE_WAIT(*inode));
-	PIPE_BASE(*inode) = (char*) page;
-	PIPE_START(*inode) = PIPE_LEN(*inode) = 0;
+	PIPE_NRBUFS(*inode) = PIPE_CURBUF(*inode) = PIPE_LEN(*inode) = 0;
+	PIPE_BUFFERS(*inode) = PIPE_DEF_BUFFERS;
 	PIPE_READERS(*inode) = PIPE_WRITERS(*inode) = 0;
 	PIPE_WAITING_READERS(*inode) = PIPE_WAITING_WRITERS(*inode) = 0;
 	PIPE_RCOUNTER(*inode) = PIPE_WCOUNTER(*inode) = 1;
 
+	info->user = get_current_user();
+	atomic_add(PIPE_DEF_BUFFERS, &info->user->pipe_bufs);
+
 	return inode;
-fail_page:
-	free_page(page);
+fail_info:
+	kfree(info);
 	return NULL;
 }
 
+void free_pipe_info(struct inode* inode)
+{
+	struct pipe_inode_info *info = inode->i_pipe;
+
+	while (!PIPE_EMPTY(*inode))
+		pipe_buf_consume(inode, PIPE_HEAD_BUF(*inode)->len);
+	inode->i_pipe = NULL;
+
+	atomic_sub(info->buffers, &info->user->pipe_bufs);
+	free_uid(info->user);
+	pipe_free_bufs(info->bufs, info->buffers);
+	kfree(info);
+}
+
+/*
+ * Resize the ring to hold at least 'size' bytes, rounded up to a power
+ * of two pages.  It can't shrink below what is queued right now.
+ */
+static long pipe_set_size(struct inode *inode, unsigned long size)
+{
+	struct pipe_inode_info *info = inode->i_pipe;
+	struct pipe_buffer *bufs;
+	unsigned long pages, max;
+	unsigned int nr, i;
+	long ret;
+
+	/*
+	 * Count in pages, so that neither a huge request nor a huge
+	 * limit can overflow; the size in bytes has to fit the return
+	 * value.
+	 */
+	max = pipe_user_pages_max > 0 ? pipe_user_pages_max : 1;
+	if (max > LONG_MAX >> (PAGE_SHIFT + 1))
+		max = LONG_MAX >> (PAGE_SHIFT + 1);
+	pages = size >> PAGE_SHIFT;
+	if (size & ~PAGE_MASK)
+		pages++;
+	if (pages > max)
+		pages = max;
+	for (nr = 1; nr < pages; nr <<= 1)
+		;
+
+	down(PIPE_SEM(*inode));
+	ret = (long) nr << PAGE_SHIFT;
+	if (nr == info->buffers)
+		goto out;
+
+	/*
+	 * Only check the limit when growing: it may have been lowered
+	 * below what the user already has.
+	 */
+	if (nr > info->buffers && !capable(CAP_SYS_RESOURCE) &&
+	    atomic_read(&info->user->pipe_bufs) + nr - info->buffers >
+	    pipe_user_pages_max) {
+		ret = -EPERM;
+		goto out;
+	}
+	ret = -EBUSY;
+	if (nr < info->nrbufs)
+		goto out;
+	ret = -ENOMEM;
+	bufs = pipe_alloc_bufs(nr);
+	if (!bufs)
+		goto out;
+
+	/* Unwrap the ring while copying it */
+	for (i = 0; i < info->nrbufs; i++)
+		bufs[i] = *PIPE_BUF_NR(*inode, i);
+	pipe_free_bufs(info->bufs, info->buffers);
+	info->bufs = bufs;
+	info->curbuf = 0;
+
+	atomic_add(nr - info->buffers, &info->user->pipe_bufs);
+	info->buffers = nr;
+	ret = (long) nr << PAGE_SHIFT;
+
+	/* Writers may have room now */
+	wake_up_interruptible(PIPE_WAIT(*inode));
+out:
+	up(PIPE_SEM(*inode));
+	return ret;
+}
+
+long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+
+	if (!S_ISFIFO(inode->i_mode) || !inode->i_pipe)
+		return -EBADF;
+
+	switch (cmd) {
+		case F_SETPIPE_SZ:
+			return pipe_set_size(inode, arg);
+		case F_GETPIPE_SZ:
+			return PIPE_BUFFERS(*inode) << PAGE_SHIFT;
+		default:
+			return -EINVAL;
+	}
+}
+
 static struct vfsmount *pipe_mnt;
 static int pipefs_delete_dentry(struct dentry *dentry)
 {
@@ -572,9 +761,7 @@ close_f12_inode_i_j:
 close_f12_inode_i:
 	put_unused_fd(i);
 close_f12_inode:
-	free_page((unsigned long) PIPE_BASE(*inode));
-	kfree(inode->i_pipe);
-	inode->i_pipe = NULL;
+	free_pipe_info(inode);
 	iput(inode);
 close_f12:
 	put_filp(f2);
@@ -70,6 +70,7 @@
 #include <linux/smp.h>
 #include <linux/signal.h>
 #include <linux/highmem.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -489,7 +490,10 @@ int proc_pid_statm(struct task_struct *task, char * buffer)
 			pgd_t *pgd = pgd_offset(mm, vma->vm_start);
 			int pages = 0, shared = 0, dirty = 0, total = 0;
 
-			statm_pgd_range(pgd, vma->vm_start, vma->vm_end, &pages, &shared, &dirty, &total);
+			if (is_vm_hugetlb_page(vma))	/* all mapped, all shared */
+				total = pages = shared = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+			else
+				statm_pgd_range(pgd, vma->vm_start, vma->vm_end, &pages, &shared, &dirty, &total);
 			resident += pages;
 			share += shared;
 			dt += dirty;
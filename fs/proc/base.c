@@ -143,6 +143,48 @@ static int proc_pid_environ(struct task_struct *task, char * buffer)
 	return res;
 }
 
+/*
+ * Read-ahead statistics of the regular files the task has open, one
+ * line per file descriptor.  Like fd/, only the owner may read them.
+ */
+static int proc_pid_readahead(struct task_struct *task, char * buffer)
+{
+	struct files_struct *files;
+	struct file *file;
+	char *p = buffer;
+	unsigned int fd;
+
+	task_lock(task);
+	files = task->files;
+	if (files)
+		atomic_inc(&files->count);
+	task_unlock(task);
+	if (!files)
+		return 0;
+
+	read_lock(&files->file_lock);
+	for (fd = 0; fd < files->max_fds; fd++) {
+		struct file_ra_state *ra;
+		struct file_ra_stream *s, *last;
+
+		file = fcheck_files(files, fd);
+		if (!file || !S_ISREG(file->f_dentry->d_inode->i_mode))
+			continue;
+		if (p - buffer > PAGE_SIZE - 80)
+			break;
+		ra = &file->f_ra;
+		last = ra->streams;
+		for (s = ra->streams; s < ra->streams + RA_STREAMS; s++)
+			if (s->stamp > last->stamp)
+				last = s;
+		p += sprintf(p, "%u %lu %lu %lu %lu\n", fd, ra->hits,
+			     ra->misses, ra->windows, last->ahead_size);
+	}
+	read_unlock(&files->file_lock);
+	put_files_struct(files);
+	return p - buffer;
+}
+
 static int proc_pid_cmdline(struct task_struct *task, char * buffer)
 {
 	struct mm_struct *mm;
@@ -540,6 +582,7 @@ enum pid_directory_inos {
 	PROC_PID_MAPS,
 	PROC_PID_CPU,
 	PROC_PID_MOUNTS,
+	PROC_PID_READAHEAD,
 	PROC_PID_FD_DIR = 0x8000,	/* 0x8000-0xffff */
 };
 
@@ -560,6 +603,7 @@ static struct pid_entry base_stuff[] = {
   E(PROC_PID_ROOT,	"root",		S_IFLNK|S_IRWXUGO),
   E(PROC_PID_EXE,	"exe",		S_IFLNK|S_IRWXUGO),
   E(PROC_PID_MOUNTS,	"mounts",	S_IFREG|S_IRUGO),
+  E(PROC_PID_READAHEAD,	"readahead",	S_IFREG|S_IRUSR),
   {0,0,NULL,0}
 };
 #undef E
@@ -928,6 +972,10 @@ static struct dentry *proc_base_lookup(struct inode *dir, struct dentry *dentry)
 		case PROC_PID_MOUNTS:
 			inode->i_fop = &proc_mounts_operations;
 			break;
+		case PROC_PID_READAHEAD:
+			inode->i_fop = &proc_info_file_operations;
+			inode->u.proc_i.op.proc_read = proc_pid_readahead;
+			break;
 		default:
 			printk("procfs: impossible type (%d)",p->type);
 			iput(inode);
@@ -247,6 +247,8 @@ static void elf_kcore_store_hdr(char *bufp, int num_vma, int dataoff)
 	for (m=vmlist; m; m=m->next) {
 		if (m->flags & VM_IOREMAP) /* don't dump ioremap'd stuff! (TA) */
 			continue;
+		if (m->flags & VM_LAZYFREE) /* already unmapped */
+			continue;
 
 		phdr = (struct elf_phdr *) bufp;
 		bufp += sizeof(struct elf_phdr);
@@ -426,7 +428,7 @@ static ssize_t read_kcore(struct file *file, char *buffer, size_t buflen, loff_t
 				curstart = vmstart + vmsize;
 				cursize -= vmsize;
 				/* don't dump ioremap'd stuff! (TA) */
-				if (m->flags & VM_IOREMAP)
+				if (m->flags & (VM_IOREMAP|VM_LAZYFREE))
 					continue;
 				memcpy(elf_buf + (vmstart - start),
 					(char *)vmstart, vmsize);
@@ -277,8 +277,12 @@ sys_select(int n, fd_set *inp, fd_set *outp, fd_set *exp, struct timeval *tvp)
 			goto out_nofds;
 
 		if ((unsigned long) sec < MAX_SELECT_SECONDS) {
-			timeout = ROUND_UP(usec, 1000000/HZ);
-			timeout += sec * (unsigned long) HZ;
+			if (precise_timeouts)
+				timeout = precise_timeout(sec, usec);
+			else {
+				timeout = ROUND_UP(usec, 1000000/HZ);
+				timeout += sec * (unsigned long) HZ;
+			}
 		}
 	}
 
@@ -422,9 +426,13 @@ asmlinkage long sys_poll(struct pollfd * ufds, unsigned int nfds, long timeout)
 
 	if (timeout) {
 		/* Careful about overflow in the intermediate values */
-		if ((unsigned long) timeout < MAX_SCHEDULE_TIMEOUT / HZ)
-			timeout = (unsigned long)(timeout*HZ+999)/1000+1;
-		else /* Negative or overflow */
+		if ((unsigned long) timeout < MAX_SCHEDULE_TIMEOUT / HZ) {
+			if (precise_timeouts)
+				timeout = precise_timeout(timeout / 1000,
+						(timeout % 1000) * 1000);
+			else
+				timeout = (unsigned long)(timeout*HZ+999)/1000+1;
+		} else /* Negative or overflow */
 			timeout = MAX_SCHEDULE_TIMEOUT;
 	}
 
@@ -0,0 +1,421 @@
+/*
+ *  linux/fs/splice.c
+ *
+ *  Moving data between pipes and files without a trip through user
+ *  space.  A pipe buffer is a reference on a page, so data spliced into
+ *  a pipe from the page cache is shared with it rather than copied, and
+ *  data spliced out of a pipe is handed to ->sendpage() when the output
+ *  has one, which for TCP means it is never copied at all.  Other files,
+ *  sockets on the receiving side among them, go through a kernel page
+ *  with their ordinary ->read() and ->write().
+ *
+ *  tee() links the buffers of one pipe into another without consuming
+ *  them.
+ */
+
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+
+#include <asm/uaccess.h>
+
+static inline struct inode *get_pipe(struct file *file)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+
+	if (S_ISFIFO(inode->i_mode) && inode->i_pipe)
+		return inode;
+	return NULL;
+}
+
+/*
+ * Wait for a free buffer slot.  Called and returns with the pipe
+ * semaphore held.
+ */
+static int pipe_wait_room(struct inode *pipe, unsigned int flags)
+{
+	for (;;) {
+		if (!PIPE_READERS(*pipe)) {
+			send_sig(SIGPIPE, current, 0);
+			return -EPIPE;
+		}
+		if (!PIPE_FULL(*pipe))
+			return 0;
+		if (flags & SPLICE_F_NONBLOCK)
+			return -EAGAIN;
+		if (signal_pending(current))
+			return -ERESTARTSYS;
+		PIPE_WAITING_WRITERS(*pipe)++;
+		pipe_wait(pipe);
+		PIPE_WAITING_WRITERS(*pipe)--;
+	}
+}
+
+/*
+ * Wait for data.  Returns 1 if there is some, 0 if there never will be
+ * because the writers are gone.  Called with the pipe semaphore held.
+ */
+static int pipe_wait_data(struct inode *pipe, unsigned int flags)
+{
+	for (;;) {
+		if (!PIPE_EMPTY(*pipe))
+			return 1;
+		if (!PIPE_WRITERS(*pipe))
+			return 0;
+		if (flags & SPLICE_F_NONBLOCK)
+			return -EAGAIN;
+		if (signal_pending(current))
+			return -ERESTARTSYS;
+		PIPE_WAITING_READERS(*pipe)++;
+		pipe_wait(pipe);
+		PIPE_WAITING_READERS(*pipe)--;
+	}
+}
+
+/*
+ * do_generic_file_read() actor: queue a reference on the page cache
+ * page itself.  Stops the read by taking nothing once the pipe is full.
+ */
+static int pipe_splice_actor(read_descriptor_t * desc, struct page *page,
+			     unsigned long offset, unsigned long size)
+{
+	struct inode *pipe = (struct inode *) desc->buf;
+
+	if (PIPE_FULL(*pipe))
+		return 0;
+	if (size > desc->count)
+		size = desc->count;
+
+	page_cache_get(page);
+	pipe_buf_add(pipe, page, offset, size, 0);
+	desc->count -= size;
+	desc->written += size;
+	return size;
+}
+
+/*
+ * Input without a page cache: read it into pages of our own.  Stop at
+ * the first short read rather than block on the input again with the
+ * pipe locked.
+ */
+static ssize_t splice_read_copy(struct file *in, loff_t *ppos,
+				struct inode *pipe, size_t len)
+{
+	mm_segment_t old_fs;
+	ssize_t ret = 0, read = 0;
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	while (len && !PIPE_FULL(*pipe)) {
+		struct page *page;
+		size_t chars = PAGE_SIZE;
+
+		if (chars > len)
+			chars = len;
+
+		ret = -ENOMEM;
+		page = alloc_page(GFP_HIGHUSER);
+		if (!page)
+			break;
+
+		ret = in->f_op->read(in, kmap(page), chars, ppos);
+		kunmap(page);
+		if (ret <= 0) {
+			__free_page(page);
+			break;
+		}
+
+		pipe_buf_add(pipe, page, 0, ret, PIPE_BUF_PRIVATE);
+		read += ret;
+		len -= ret;
+		if (ret < chars)
+			break;
+	}
+	set_fs(old_fs);
+
+	return read ? read : ret;
+}
+
+static long do_splice_to(struct file *in, loff_t *ppos, struct inode *pipe,
+			 size_t len, unsigned int flags)
+{
+	struct inode *inode = in->f_dentry->d_inode;
+	long ret;
+
+	if (!(in->f_mode & FMODE_READ))
+		return -EBADF;
+	if (!in->f_op || !in->f_op->read)
+		return -EINVAL;
+	ret = locks_verify_area(FLOCK_VERIFY_READ, inode, in, *ppos, len);
+	if (ret)
+		return ret;
+
+	if (down_interruptible(PIPE_SEM(*pipe)))
+		return -ERESTARTSYS;
+
+	ret = pipe_wait_room(pipe, flags);
+	if (ret)
+		goto out;
+
+	if (S_ISREG(inode->i_mode) && inode->i_mapping->a_ops->readpage &&
+	    !(in->f_flags & O_DIRECT)) {
+		read_descriptor_t desc;
+
+		desc.written = 0;
+		desc.count = len;
+		desc.buf = (char *) pipe;
+		desc.error = 0;
+		do_generic_file_read(in, ppos, &desc, pipe_splice_actor);
+
+		ret = desc.written;
+		if (!ret)
+			ret = desc.error;
+	} else
+		ret = splice_read_copy(in, ppos, pipe, len);
+
+out:
+	up(PIPE_SEM(*pipe));
+	if (ret > 0)
+		wake_up_interruptible(PIPE_WAIT(*pipe));
+	return ret;
+}
+
+static long do_splice_from(struct inode *pipe, struct file *out, loff_t *ppos,
+			   size_t len, unsigned int flags)
+{
+	struct inode *inode = out->f_dentry->d_inode;
+	long ret, written = 0;
+	int do_wakeup = 0;
+
+	if (!(out->f_mode & FMODE_WRITE))
+		return -EBADF;
+	if (!out->f_op || !out->f_op->write)
+		return -EINVAL;
+	ret = locks_verify_area(FLOCK_VERIFY_WRITE, inode, out, *ppos, len);
+	if (ret)
+		return ret;
+
+	if (down_interruptible(PIPE_SEM(*pipe)))
+		return -ERESTARTSYS;
+
+	ret = pipe_wait_data(pipe, flags);
+	if (ret <= 0)
+		goto out;
+
+	while (len && !PIPE_EMPTY(*pipe)) {
+		struct pipe_buffer *buf = PIPE_HEAD_BUF(*pipe);
+		size_t chars = buf->len;
+
+		if (chars > len)
+			chars = len;
+
+		if (out->f_op->sendpage) {
+			int more = (flags & SPLICE_F_MORE) ||
+				   (chars < len && PIPE_NRBUFS(*pipe) > 1);
+
+			ret = out->f_op->sendpage(out, buf->page, buf->offset,
+						  chars, ppos, more);
+		} else {
+			mm_segment_t old_fs;
+			char *kaddr;
+
+			old_fs = get_fs();
+			set_fs(KERNEL_DS);
+			kaddr = kmap(buf->page);
+			ret = out->f_op->write(out, kaddr + buf->offset, chars, ppos);
+			kunmap(buf->page);
+			set_fs(old_fs);
+		}
+		if (ret <= 0)
+			break;
+
+		do_wakeup |= pipe_buf_consume(pipe, ret);
+		written += ret;
+		len -= ret;
+		if (ret < chars)
+			break;
+	}
+
+out:
+	up(PIPE_SEM(*pipe));
+	if (do_wakeup)
+		wake_up_interruptible(PIPE_WAIT(*pipe));
+	return written ? written : ret;
+}
+
+/*
+ * Move up to 'len' bytes between a pipe and a file or socket.  Exactly
+ * one side must be a pipe; the offset of the other side is taken from
+ * and returned to *off if given, its file position is used otherwise.
+ */
+asmlinkage long sys_splice(int fd_in, loff_t *off_in, int fd_out,
+			   loff_t *off_out, size_t len, unsigned int flags)
+{
+	struct file *in, *out;
+	struct inode *pipe;
+	loff_t pos, *ppos;
+	long ret;
+
+	if (!len)
+		return 0;
+
+	ret = -EBADF;
+	in = fget(fd_in);
+	if (!in)
+		goto out;
+	out = fget(fd_out);
+	if (!out)
+		goto fput_in;
+
+	ret = -EINVAL;
+	if ((pipe = get_pipe(in)) != NULL) {
+		if (get_pipe(out))
+			goto fput_out;
+		ret = -ESPIPE;
+		if (off_in)
+			goto fput_out;
+		ret = -EBADF;
+		if (!(in->f_mode & FMODE_READ))
+			goto fput_out;
+
+		ppos = &out->f_pos;
+		if (off_out) {
+			ret = -EFAULT;
+			if (copy_from_user(&pos, off_out, sizeof(loff_t)))
+				goto fput_out;
+			ppos = &pos;
+		}
+		ret = do_splice_from(pipe, out, ppos, len, flags);
+		if (off_out && copy_to_user(off_out, &pos, sizeof(loff_t)))
+			ret = -EFAULT;
+	} else if ((pipe = get_pipe(out)) != NULL) {
+		ret = -ESPIPE;
+		if (off_out)
+			goto fput_out;
+		ret = -EBADF;
+		if (!(out->f_mode & FMODE_WRITE))
+			goto fput_out;
+
+		ppos = &in->f_pos;
+		if (off_in) {
+			ret = -EFAULT;
+			if (copy_from_user(&pos, off_in, sizeof(loff_t)))
+				goto fput_out;
+			ppos = &pos;
+		}
+		ret = do_splice_to(in, ppos, pipe, len, flags);
+		if (off_in && copy_to_user(off_in, &pos, sizeof(loff_t)))
+			ret = -EFAULT;
+	}
+
+fput_out:
+	fput(out);
+fput_in:
+	fput(in);
+out:
+	return ret;
+}
+
+/*
+ * Link up to 'len' bytes from the head of one pipe onto the tail of
+ * another.  The pages are shared, so the copies are never appended to;
+ * appending to the original only writes beyond what was linked.
+ */
+static long link_pipe(struct inode *ipipe, struct inode *opipe, size_t len)
+{
+	unsigned int i;
+	long ret = 0;
+
+	for (i = 0; len && i < PIPE_NRBUFS(*ipipe) && !PIPE_FULL(*opipe); i++) {
+		struct pipe_buffer *buf;
+		size_t chars;
+
+		buf = PIPE_BUF_NR(*ipipe, i);
+		chars = buf->len;
+		if (chars > len)
+			chars = len;
+
+		page_cache_get(buf->page);
+		pipe_buf_add(opipe, buf->page, buf->offset, chars, 0);
+		ret += chars;
+		len -= chars;
+	}
+	return ret;
+}
+
+static long do_tee(struct inode *ipipe, struct inode *opipe, size_t len,
+		   unsigned int flags)
+{
+	long ret;
+
+	/*
+	 * Wait for data on one side and room on the other separately,
+	 * pipe_wait() can only drop one semaphore.  Then take both and
+	 * retry if somebody got in between.
+	 */
+	for (;;) {
+		if (down_interruptible(PIPE_SEM(*ipipe)))
+			return -ERESTARTSYS;
+		ret = pipe_wait_data(ipipe, flags);
+		up(PIPE_SEM(*ipipe));
+		if (ret <= 0)
+			return ret;
+
+		if (down_interruptible(PIPE_SEM(*opipe)))
+			return -ERESTARTSYS;
+		ret = pipe_wait_room(opipe, flags);
+		up(PIPE_SEM(*opipe));
+		if (ret)
+			return ret;
+
+		double_down(PIPE_SEM(*ipipe), PIPE_SEM(*opipe));
+		ret = link_pipe(ipipe, opipe, len);
+		double_up(PIPE_SEM(*ipipe), PIPE_SEM(*opipe));
+		if (ret) {
+			wake_up_interruptible(PIPE_WAIT(*opipe));
+			return ret;
+		}
+	}
+}
+
+/*
+ * Duplicate up to 'len' bytes of one pipe into another, leaving them
+ * in the first one to be read or spliced elsewhere.
+ */
+asmlinkage long sys_tee(int fdin, int fdout, size_t len, unsigned int flags)
+{
+	struct file *in, *out;
+	struct inode *ipipe, *opipe;
+	long ret;
+
+	if (!len)
+		return 0;
+
+	ret = -EBADF;
+	in = fget(fdin);
+	if (!in)
+		goto out;
+	out = fget(fdout);
+	if (!out)
+		goto fput_in;
+
+	ret = -EINVAL;
+	ipipe = get_pipe(in);
+	opipe = get_pipe(out);
+	if (!ipipe || !opipe || ipipe == opipe)
+		goto fput_out;
+	ret = -EBADF;
+	if (!(in->f_mode & FMODE_READ) || !(out->f_mode & FMODE_WRITE))
+		goto fput_out;
+
+	ret = do_tee(ipipe, opipe, len, flags);
+
+fput_out:
+	fput(out);
+fput_in:
+	fput(in);
+out:
+	return ret;
+}
@@ -42,8 +42,11 @@ static inline mmu_gather_t *tlb_gather_mmu(struct mm_struct *mm)
 	mmu_gather_t *tlb = &mmu_gathers[smp_processor_id()];
 
 	tlb->mm = mm;
-	/* Use fast mode if there is only one user of this mm (this process) */
-	tlb->nr = (atomic_read(&(mm)->mm_users) == 1) ? ~0UL : 0UL;
+	/*
+	 * Use fast mode if there is only one user of this mm (this process),
+	 * or none left (exit_mmap): no other cpu can be using the ptes.
+	 */
+	tlb->nr = (atomic_read(&(mm)->mm_users) <= 1) ? ~0UL : 0UL;
 	return tlb;
 }
 
@@ -5,6 +5,17 @@
 #include <linux/threads.h>
 #include <linux/irq.h>
 
+/* Why a cpu sent IPIs, see ipi_sent() */
+enum {
+	IPI_TLB_MM,		/* flush_tlb_mm() */
+	IPI_TLB_RANGE,		/* flush_tlb_range(), unmapping */
+	IPI_TLB_PAGE,		/* flush_tlb_page() */
+	IPI_TLB_LAZY,		/* flushes not sent to lazy tlb cpus */
+	IPI_RESCHEDULE,
+	IPI_CALL_FUNCTION,	/* smp_call_function(), flush_tlb_all() */
+	NR_IPI_REASONS
+};
+
 /* assembly code in softirq.h is sensitive to the offsets of these fields */
 typedef struct {
 	unsigned int __softirq_pending;
@@ -13,6 +24,7 @@ typedef struct {
 	unsigned int __syscall_count;
 	struct task_struct * __ksoftirqd_task; /* waitqueue is too large */
 	unsigned int __nmi_count;	/* arch dependent */
+	unsigned int __ipi_sent[NR_IPI_REASONS];	/* arch dependent */
 } ____cacheline_aligned irq_cpustat_t;
 
 #include <linux/irq_cpustat.h>	/* Standard mappings for irq_cpustat_t above */
@@ -38,6 +38,7 @@ static inline void switch_mm(struct mm_struct *prev, struct mm_struct *next, str
 #ifdef CONFIG_SMP
 		cpu_tlbstate[cpu].state = TLBSTATE_OK;
 		cpu_tlbstate[cpu].active_mm = next;
+		cpu_tlbstate[cpu].flush_pending = 0;
 #endif
 		set_bit(cpu, &next->cpu_vm_mask);
 		set_bit(cpu, &next->context.cpuvalid);
@@ -49,10 +50,13 @@ static inline void switch_mm(struct mm_struct *prev, struct mm_struct *next, str
 		cpu_tlbstate[cpu].state = TLBSTATE_OK;
 		if(cpu_tlbstate[cpu].active_mm != next)
 			out_of_line_bug();
-		if(!test_and_set_bit(cpu, &next->cpu_vm_mask)) {
+		if(!test_and_set_bit(cpu, &next->cpu_vm_mask) ||
+		   cpu_tlbstate[cpu].flush_pending) {
 			/* We were in lazy tlb mode and leave_mm disabled 
-			 * tlb flush IPI delivery. We must reload %cr3.
+			 * tlb flush IPI delivery, or a flush skipped us.
+			 * We must reload %cr3.
 			 */
+			cpu_tlbstate[cpu].flush_pending = 0;
 			load_cr3(next->pgd);
 		}
 		if (!test_and_set_bit(cpu, &next->context.cpuvalid))
@@ -65,6 +65,18 @@ typedef struct { unsigned long pgprot; } pgprot_t;
 /* to align the pointer to the (next) page boundary */
 #define PAGE_ALIGN(addr)	(((addr)+PAGE_SIZE-1)&PAGE_MASK)
 
+/* Huge pages are mapped by a single PSE page directory entry */
+#ifdef CONFIG_HUGETLB_PAGE
+#ifdef CONFIG_X86_PAE
+#define HPAGE_SHIFT	21
+#else
+#define HPAGE_SHIFT	22
+#endif
+#define HPAGE_SIZE	(1UL << HPAGE_SHIFT)
+#define HPAGE_MASK	(~(HPAGE_SIZE - 1))
+#define HUGETLB_PAGE_ORDER	(HPAGE_SHIFT - PAGE_SHIFT)
+#endif
+
 /*
  * This handles the memory map.. We could make this a config
  * option, but too many people screw it up, and too few need
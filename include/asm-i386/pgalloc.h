@@ -209,21 +209,23 @@ extern void flush_tlb_all(void);
 extern void flush_tlb_current_task(void);
 extern void flush_tlb_mm(struct mm_struct *);
 extern void flush_tlb_page(struct vm_area *, unsigned long);
+extern void flush_tlb_range(struct mm_struct *, unsigned long, unsigned long);
 
 #define flush_tlb()	flush_tlb_current_task()
 
-static inline void flush_tlb_range(struct mm_struct * mm, unsigned long start, unsigned long end)
-{
-	flush_tlb_mm(mm);
-}
-
 #define TLBSTATE_OK	1
 #define TLBSTATE_LAZY	2
 
+/*
+ * flush_pending: a page or range flush for active_mm was not sent to
+ * this cpu because it was in lazy tlb mode; %cr3 must be reloaded
+ * before it runs a task of that mm again.
+ */
 struct tlb_state
 {
 	struct mm_struct *active_mm;
 	int state;
+	int flush_pending;
 };
 extern struct tlb_state cpu_tlbstate[NR_CPUS];
 
@@ -129,10 +129,11 @@ struct request_queue
 	unsigned long		bounce_pfn;
 
 	/*
-	 * Is meant to protect the queue in the future instead of
-	 * io_request_lock
+	 * Protects the queue.  Points to io_request_lock unless the
+	 * driver asked for a lock of its own with blk_queue_private_lock()
 	 */
-	spinlock_t		queue_lock;
+	spinlock_t		* queue_lock;
+	spinlock_t		__queue_lock;
 
 	/*
 	 * Tasks wait here for free read and write requests
@@ -201,6 +202,7 @@ extern int blk_grow_request_list(request_queue_t *q, int nr_requests);
 extern void blk_init_queue(request_queue_t *, request_fn_proc *);
 extern void blk_cleanup_queue(request_queue_t *);
 extern void blk_queue_headactive(request_queue_t *, int);
+extern void blk_queue_private_lock(request_queue_t *);
 extern void blk_queue_make_request(request_queue_t *, make_request_fn *);
 extern void generic_unplug_device(void *);
 extern inline int blk_seg_merge_ok(struct buffer_head *, struct buffer_head *);
@@ -12,6 +12,8 @@ typedef void (elevator_merge_cleanup_fn) (request_queue_t *, struct request *, i
 
 typedef void (elevator_merge_req_fn) (struct request *, struct request *);
 
+typedef void (elevator_completed_req_fn) (request_queue_t *, struct request *);
+
 struct elevator_s
 {
 	int read_latency;
@@ -19,8 +21,13 @@ struct elevator_s
 
 	elevator_merge_fn *elevator_merge_fn;
 	elevator_merge_req_fn *elevator_merge_req_fn;
+	elevator_completed_req_fn *elevator_completed_req_fn;
+
+	int elevator_ID;
+	int antic_expire;
 
 	unsigned int queue_ID;
+	struct timer_list antic_timer;
 };
 
 int elevator_noop_merge(request_queue_t *, struct request **, struct list_head *, struct buffer_head *, int, int);
@@ -31,6 +38,10 @@ int elevator_linus_merge(request_queue_t *, struct request **, struct list_head
 void elevator_linus_merge_cleanup(request_queue_t *, struct request *, int);
 void elevator_linus_merge_req(struct request *, struct request *);
 
+int elevator_deadline_merge(request_queue_t *, struct request **, struct list_head *, struct buffer_head *, int, int);
+void elevator_deadline_merge_req(struct request *, struct request *);
+void elevator_deadline_completed_req(request_queue_t *, struct request *);
+
 typedef struct blkelv_ioctl_arg_s {
 	int queue_ID;
 	int read_latency;
@@ -41,8 +52,18 @@ typedef struct blkelv_ioctl_arg_s {
 #define BLKELVGET   _IOR(0x12,106,sizeof(blkelv_ioctl_arg_t))
 #define BLKELVSET   _IOW(0x12,107,sizeof(blkelv_ioctl_arg_t))
 
-extern int blkelvget_ioctl(elevator_t *, blkelv_ioctl_arg_t *);
-extern int blkelvset_ioctl(elevator_t *, const blkelv_ioctl_arg_t *);
+/*
+ * BLKELVSET selects the elevator of a queue through max_bomb_segments,
+ * which is otherwise unused.  0 keeps the current one; BLKELVGET
+ * reports the current one there.
+ */
+#define ELV_ID_NOOP		1
+#define ELV_ID_LINUS		2
+#define ELV_ID_DEADLINE		3
+#define ELV_ID_ANTICIPATORY	4
+
+extern int blkelvget_ioctl(request_queue_t *, blkelv_ioctl_arg_t *);
+extern int blkelvset_ioctl(request_queue_t *, const blkelv_ioctl_arg_t *);
 
 extern void elevator_init(elevator_t *, elevator_t);
 
@@ -52,6 +73,7 @@ extern void elevator_init(elevator_t *, elevator_t);
 #define ELEVATOR_NO_MERGE	0
 #define ELEVATOR_FRONT_MERGE	1
 #define ELEVATOR_BACK_MERGE	2
+#define ELEVATOR_HEAD_INSERT	3	/* no merge, queue in front */
 
 /*
  * This is used in the elevator algorithm.  We don't prioritise reads
@@ -89,6 +111,8 @@ static inline int elevator_request_latency(elevator_t * elevator, int rw)
 									\
 	elevator_noop_merge,		/* elevator_merge_fn */		\
 	elevator_noop_merge_req,	/* elevator_merge_req_fn */	\
+	NULL,				/* elevator_completed_req_fn */	\
+	ELV_ID_NOOP,			/* elevator_ID */		\
 	})
 
 #define ELEVATOR_LINUS							\
@@ -98,6 +122,42 @@ static inline int elevator_request_latency(elevator_t * elevator, int rw)
 									\
 	elevator_linus_merge,		/* elevator_merge_fn */		\
 	elevator_linus_merge_req,	/* elevator_merge_req_fn */	\
+	NULL,				/* elevator_completed_req_fn */	\
+	ELV_ID_LINUS,			/* elevator_ID */		\
+	})
+
+/*
+ * The deadline elevator takes its latencies as request expiry times in
+ * milliseconds.  The anticipatory variant additionally idles the queue
+ * for antic_expire jiffies after a read completes, waiting for the next
+ * read of the same process instead of seeking away to a write.
+ */
+#define ELV_DEADLINE_READ_EXPIRE	500
+#define ELV_DEADLINE_WRITE_EXPIRE	5000
+#define ELV_ANTIC_EXPIRE		(HZ / 100 + 1)
+
+#define ELEVATOR_DEADLINE						\
+((elevator_t) {								\
+	ELV_DEADLINE_READ_EXPIRE,	/* read expire, msecs */	\
+	ELV_DEADLINE_WRITE_EXPIRE,	/* write expire, msecs */	\
+									\
+	elevator_deadline_merge,	/* elevator_merge_fn */		\
+	elevator_deadline_merge_req,	/* elevator_merge_req_fn */	\
+	NULL,				/* elevator_completed_req_fn */	\
+	ELV_ID_DEADLINE,		/* elevator_ID */		\
+	0,				/* antic_expire */		\
+	})
+
+#define ELEVATOR_ANTICIPATORY						\
+((elevator_t) {								\
+	ELV_DEADLINE_READ_EXPIRE,	/* read expire, msecs */	\
+	ELV_DEADLINE_WRITE_EXPIRE,	/* write expire, msecs */	\
+									\
+	elevator_deadline_merge,	/* elevator_merge_fn */		\
+	elevator_deadline_merge_req,	/* elevator_merge_req_fn */	\
+	elevator_deadline_completed_req, /* elevator_completed_req_fn */ \
+	ELV_ID_ANTICIPATORY,		/* elevator_ID */		\
+	ELV_ANTIC_EXPIRE,		/* antic_expire */		\
 	})
 
 #endif
@@ -0,0 +1,61 @@
+/*
+ *  include/linux/eventpoll.h
+ *
+ *  Efficient event notification for large descriptor sets.
+ */
+
+#ifndef _LINUX_EVENTPOLL_H
+#define _LINUX_EVENTPOLL_H
+
+#include <linux/types.h>
+
+/* Valid opcodes to issue to sys_epoll_ctl() */
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+/*
+ * Event bits are the POLL* ones from <asm/poll.h>.  EPOLLET asks for
+ * edge triggered reporting: a descriptor is returned once per readiness
+ * change instead of on every sys_epoll_wait() while it stays ready.
+ */
+#define EPOLLET (1U << 31)
+
+struct epoll_event {
+	__u32 events;
+	__u64 data;
+};
+
+#ifdef __KERNEL__
+
+#include <linux/linkage.h>
+#include <linux/fs.h>
+
+/* Called from get_empty_filp() and init_private_file() */
+static inline void eventpoll_init_file(struct file *file)
+{
+	INIT_LIST_HEAD(&file->f_ep_links);
+	spin_lock_init(&file->f_ep_lock);
+}
+
+extern void eventpoll_release_file(struct file *file);
+
+/*
+ * Called from fput() when the last reference goes away.  Most files were
+ * never added to an epoll set, so keep the common case inline and cheap.
+ */
+static inline void eventpoll_release(struct file *file)
+{
+	if (list_empty(&file->f_ep_links))
+		return;
+	eventpoll_release_file(file);
+}
+
+asmlinkage long sys_epoll_create(int size);
+asmlinkage long sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+asmlinkage long sys_epoll_wait(int epfd, struct epoll_event *events,
+			       int maxevents, int timeout);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_EVENTPOLL_H */
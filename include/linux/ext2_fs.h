@@ -33,6 +33,23 @@
 #define EXT2_PREALLOCATE
 #define EXT2_DEFAULT_PREALLOC_BLOCKS	8
 
+/*
+ * Sizes of the per-inode reservation windows, in blocks
+ */
+#define EXT2_DEFAULT_RESERVE_BLOCKS	8
+#define EXT2_MAX_RESERVE_BLOCKS		1024
+
+/*
+ * Longest run of delayed blocks allocated in one go at writeback
+ */
+#define EXT2_DELALLOC_MAX_RUN		1024
+
+/*
+ * Percentage of memory the delayed blocks of a filesystem may take
+ * before writers start writeback themselves, bdflush's default nfract
+ */
+#define EXT2_DELALLOC_DIRTY_RATIO	30
+
 /*
  * The second extended file system version
  */
@@ -198,6 +215,7 @@ struct ext2_group_desc
 #define EXT2_ECOMPR_FL			0x00000800 /* Compression error */
 /* End compression flags --- maybe not all used */	
 #define EXT2_BTREE_FL			0x00001000 /* btree format dir */
+#define EXT2_INDEX_FL			0x00001000 /* hash-indexed directory */
 #define EXT2_RESERVED_FL		0x80000000 /* reserved for ext2 lib */
 
 #define EXT2_FL_USER_VISIBLE		0x00001FFF /* User visible flags */
@@ -314,6 +332,8 @@ struct ext2_inode {
 #define EXT2_MOUNT_ERRORS_PANIC		0x0040	/* Panic on errors */
 #define EXT2_MOUNT_MINIX_DF		0x0080	/* Mimics the Minix statfs */
 #define EXT2_MOUNT_NO_UID32		0x0200  /* Disable 32-bit UIDs */
+#define EXT2_MOUNT_NORESERVATION	0x0400	/* No reservation windows */
+#define EXT2_MOUNT_DELALLOC		0x0800	/* Allocate blocks at writeback */
 
 #define clear_opt(o, opt)		o &= ~EXT2_MOUNT_##opt
 #define set_opt(o, opt)			o |= EXT2_MOUNT_##opt
@@ -392,7 +412,18 @@ struct ext2_super_block {
 	__u8	s_prealloc_blocks;	/* Nr of blocks to try to preallocate*/
 	__u8	s_prealloc_dir_blocks;	/* Nr to preallocate for dirs */
 	__u16	s_padding1;
-	__u32	s_reserved[204];	/* Padding to the end of the block */
+	/*
+	 * Journaling support valid if EXT3_FEATURE_COMPAT_HAS_JOURNAL set.
+	 */
+	__u8	s_journal_uuid[16];	/* uuid of journal superblock */
+	__u32	s_journal_inum;		/* inode number of journal file */
+	__u32	s_journal_dev;		/* device number of journal file */
+	__u32	s_last_orphan;		/* start of list of inodes to delete */
+	__u32	s_hash_seed[4];		/* HTREE hash seed */
+	__u8	s_def_hash_version;	/* Default hash version to use */
+	__u8	s_reserved_char_pad;
+	__u16	s_reserved_word_pad;
+	__u32	s_reserved[192];	/* Padding to the end of the block */
 };
 
 #ifdef __KERNEL__
@@ -532,7 +563,33 @@ enum {
 #define EXT2_DIR_REC_LEN(name_len)	(((name_len) + 8 + EXT2_DIR_ROUND) & \
 					 ~EXT2_DIR_ROUND)
 
+/*
+ * Hash tree directory indexing, the same format as ext3 uses
+ */
+#define DX_HASH_LEGACY		0
+#define DX_HASH_HALF_MD4	1
+#define DX_HASH_TEA		2
+
 #ifdef __KERNEL__
+#define ext2_is_dx(dir) (EXT2_HAS_COMPAT_FEATURE(dir->i_sb, \
+				      EXT2_FEATURE_COMPAT_DIR_INDEX) && \
+		    (dir->u.ext2_i.i_flags & EXT2_INDEX_FL))
+
+/* hash info structure used by the directory hash */
+struct ext2_dx_hash_info
+{
+	u32		hash;
+	u32		minor_hash;
+	int		hash_version;
+	u32		*seed;
+};
+
+/*
+ * Buffer state bit of file data waiting for its block to be allocated
+ */
+#define BH_Ext2Delay	BH_PrivateStart
+#define buffer_ext2_delay(bh)	test_bit(BH_Ext2Delay, &(bh)->b_state)
+
 /*
  * Function prototypes
  */
@@ -554,6 +611,7 @@ extern void ext2_free_blocks (struct inode *, unsigned long,
 			      unsigned long);
 extern unsigned long ext2_count_free_blocks (struct super_block *);
 extern void ext2_check_blocks_bitmap (struct super_block *);
+extern void ext2_discard_reservation (struct inode *);
 extern struct ext2_group_desc * ext2_get_group_desc(struct super_block * sb,
 						    unsigned int block_group,
 						    struct buffer_head ** bh);
@@ -572,6 +630,10 @@ extern void ext2_set_link(struct inode *, struct ext2_dir_entry_2 *, struct page
 extern int ext2_sync_file (struct file *, struct dentry *, int);
 extern int ext2_fsync_inode (struct inode *, int);
 
+/* hash.c */
+extern int ext2fs_dirhash(const char *name, int len, struct
+			  ext2_dx_hash_info *hinfo);
+
 /* ialloc.c */
 extern struct inode * ext2_new_inode (const struct inode *, int);
 extern void ext2_free_inode (struct inode *);
@@ -586,6 +648,7 @@ extern void ext2_put_inode (struct inode *);
 extern void ext2_delete_inode (struct inode *);
 extern int ext2_sync_inode (struct inode *);
 extern void ext2_discard_prealloc (struct inode *);
+extern void ext2_delalloc_release (struct super_block *, int);
 extern void ext2_truncate (struct inode *);
 
 /* ioctl.c */
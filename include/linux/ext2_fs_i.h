@@ -16,6 +16,20 @@
 #ifndef _LINUX_EXT2_FS_I
 #define _LINUX_EXT2_FS_I
 
+#include <linux/rbtree.h>
+
+/*
+ * A run of blocks set aside for the allocations of one inode.  It is
+ * kept in the per-filesystem tree of windows, not in the bitmaps.
+ */
+struct ext2_reserve_window {
+	rb_node_t	rsv_node;
+	__u32		rsv_start;	/* first block, 0 if no window */
+	__u32		rsv_end;	/* last block */
+	__u32		rsv_goal_size;	/* size of the next window */
+	__u32		rsv_alloc_hit;	/* blocks allocated from this one */
+};
+
 /*
  * second extended file system inode data in memory
  */
@@ -33,7 +47,9 @@ struct ext2_inode_info {
 	__u32	i_next_alloc_goal;
 	__u32	i_prealloc_block;
 	__u32	i_prealloc_count;
+	__u32	i_alloc_run;	/* blocks wanted by a writeback run */
 	__u32	i_dir_start_lookup;
+	struct ext2_reserve_window i_rsv_window;
 	int	i_new_inode:1;	/* Is a freshly allocated inode */
 };
 
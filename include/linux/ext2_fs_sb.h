@@ -56,6 +56,12 @@ struct ext2_sb_info {
 	int s_desc_per_block_bits;
 	int s_inode_size;
 	int s_first_ino;
+	u32 s_hash_seed[4];
+	int s_def_hash_version;
+	rb_root_t s_rsv_window_root;	/* reservation windows by block */
+	spinlock_t s_rsv_window_lock;
+	unsigned long s_delalloc_blocks;	/* written, not yet allocated */
+	spinlock_t s_delalloc_lock;
 };
 
 #endif	/* _LINUX_EXT2_FS_SB */
@@ -33,6 +33,12 @@
 #undef  EXT3_PREALLOCATE /* @@@ Fix this! */
 #define EXT3_DEFAULT_PREALLOC_BLOCKS	8
 
+/*
+ * Sizes of the per-inode reservation windows, in blocks
+ */
+#define EXT3_DEFAULT_RESERVE_BLOCKS	8
+#define EXT3_MAX_RESERVE_BLOCKS		1024
+
 /*
  * The second extended file system version
  */
@@ -203,6 +209,7 @@ struct ext3_group_desc
 #define EXT3_INDEX_FL			0x00001000 /* hash-indexed directory */
 #define EXT3_IMAGIC_FL			0x00002000 /* AFS directory */
 #define EXT3_JOURNAL_DATA_FL		0x00004000 /* file data should be journaled */
+#define EXT3_EXTENTS_FL			0x00080000 /* Inode uses extents */
 #define EXT3_RESERVED_FL		0x80000000 /* reserved for ext3 lib */
 
 #define EXT3_FL_USER_VISIBLE		0x00005FFF /* User visible flags */
@@ -314,6 +321,38 @@ struct ext3_inode {
 
 #endif /* defined(__KERNEL__) || defined(__linux__) */
 
+/*
+ * Extent-mapped inodes keep a tree in i_block instead of the block
+ * pointers.  Every node, the in-inode root included, starts with a
+ * header and is followed by either extents (depth 0, the leaves) or
+ * index entries pointing one level down.
+ */
+#define EXT3_EXT_MAGIC		0xf30a
+#define EXT3_EXT_MAX_DEPTH	5
+#define EXT3_EXT_MAX_LEN	32768	/* Blocks covered by one extent */
+
+struct ext3_extent_header {
+	__u16	eh_magic;	/* EXT3_EXT_MAGIC */
+	__u16	eh_entries;	/* Number of valid entries */
+	__u16	eh_max;		/* Capacity of this node */
+	__u16	eh_depth;	/* Levels below this node, 0 for a leaf */
+	__u32	eh_generation;
+};
+
+struct ext3_extent {
+	__u32	ee_block;	/* First logical block covered */
+	__u16	ee_len;		/* Number of blocks covered */
+	__u16	ee_start_hi;	/* High 16 bits of the physical block */
+	__u32	ee_start;	/* Low 32 bits of the physical block */
+};
+
+struct ext3_extent_idx {
+	__u32	ei_block;	/* Index covers logical blocks from here on */
+	__u32	ei_leaf;	/* Low 32 bits of the next level's block */
+	__u16	ei_leaf_hi;	/* High 16 bits of the next level's block */
+	__u16	ei_unused;
+};
+
 /*
  * File system states
  */
@@ -339,6 +378,10 @@ struct ext3_inode {
   #define EXT3_MOUNT_WRITEBACK_DATA	0x0C00	/* No data ordering */
 #define EXT3_MOUNT_UPDATE_JOURNAL	0x1000	/* Update the journal format */
 #define EXT3_MOUNT_NO_UID32		0x2000  /* Disable 32-bit UIDs */
+#define EXT3_MOUNT_NORESERVATION	0x4000	/* No reservation windows */
+#define EXT3_MOUNT_EXTENTS		0x8000	/* Map new files with extents */
+#define EXT3_MOUNT_JOURNAL_CHECKSUM	0x10000	/* Checksum commit blocks */
+#define EXT3_MOUNT_JOURNAL_ASYNC_COMMIT	0x20000	/* Don't wait before commit */
 
 /* Compatibility, for having both ext2_fs.h and ext3_fs.h included at once */
 #ifndef _LINUX_EXT2_FS_H
@@ -437,8 +480,11 @@ struct ext3_super_block {
 /*E0*/	__u32	s_journal_inum;		/* inode number of journal file */
 	__u32	s_journal_dev;		/* device number of journal file */
 	__u32	s_last_orphan;		/* start of list of inodes to delete */
-
-/*EC*/	__u32	s_reserved[197];	/* Padding to the end of the block */
+/*EC*/	__u32	s_hash_seed[4];		/* HTREE hash seed */
+	__u8	s_def_hash_version;	/* Default hash version to use */
+	__u8	s_reserved_char_pad;
+	__u16	s_reserved_word_pad;
+/*100*/	__u32	s_reserved[192];	/* Padding to the end of the block */
 };
 
 #ifdef __KERNEL__
@@ -511,10 +557,12 @@ struct ext3_super_block {
 #define EXT3_FEATURE_INCOMPAT_FILETYPE		0x0002
 #define EXT3_FEATURE_INCOMPAT_RECOVER		0x0004 /* Needs recovery */
 #define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008 /* Journal device */
+#define EXT3_FEATURE_INCOMPAT_EXTENTS		0x0040 /* extents support */
 
 #define EXT3_FEATURE_COMPAT_SUPP	0
 #define EXT3_FEATURE_INCOMPAT_SUPP	(EXT3_FEATURE_INCOMPAT_FILETYPE| \
-					 EXT3_FEATURE_INCOMPAT_RECOVER)
+					 EXT3_FEATURE_INCOMPAT_RECOVER| \
+					 EXT3_FEATURE_INCOMPAT_EXTENTS)
 #define EXT3_FEATURE_RO_COMPAT_SUPP	(EXT3_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT3_FEATURE_RO_COMPAT_LARGE_FILE| \
 					 EXT3_FEATURE_RO_COMPAT_BTREE_DIR)
@@ -576,7 +624,34 @@ struct ext3_dir_entry_2 {
 #define EXT3_DIR_REC_LEN(name_len)	(((name_len) + 8 + EXT3_DIR_ROUND) & \
 					 ~EXT3_DIR_ROUND)
 
+/*
+ * Hash Tree Directory indexing
+ * (c) Daniel Phillips, 2001
+ */
+
+#ifdef __KERNEL__
+#define is_dx(dir) (EXT3_HAS_COMPAT_FEATURE(dir->i_sb, \
+				      EXT3_FEATURE_COMPAT_DIR_INDEX) && \
+		    (dir->u.ext3_i.i_flags & EXT3_INDEX_FL))
+#endif
+
+/* Legal values for the dx_root hash_version field: */
+
+#define DX_HASH_LEGACY		0
+#define DX_HASH_HALF_MD4	1
+#define DX_HASH_TEA		2
+
 #ifdef __KERNEL__
+
+/* hash info structure used by the directory hash */
+struct dx_hash_info
+{
+	u32		hash;
+	u32		minor_hash;
+	int		hash_version;
+	u32		*seed;
+};
+
 /*
  * Describe an inode's exact location on disk and in memory
  */
@@ -608,6 +683,7 @@ extern void ext3_free_blocks (handle_t *, struct inode *, unsigned long,
 			      unsigned long);
 extern unsigned long ext3_count_free_blocks (struct super_block *);
 extern void ext3_check_blocks_bitmap (struct super_block *);
+extern void ext3_discard_reservation (struct inode *);
 extern struct ext3_group_desc * ext3_get_group_desc(struct super_block * sb,
 						    unsigned int block_group,
 						    struct buffer_head ** bh);
@@ -616,9 +692,20 @@ extern struct ext3_group_desc * ext3_get_group_desc(struct super_block * sb,
 extern int ext3_check_dir_entry(const char *, struct inode *,
 				struct ext3_dir_entry_2 *, struct buffer_head *,
 				unsigned long);
+/* extents.c */
+extern void ext3_ext_tree_init (struct inode *);
+extern int ext3_ext_get_block (handle_t *, struct inode *, long,
+			       struct buffer_head *, int);
+extern void ext3_ext_truncate (handle_t *, struct inode *);
+extern int ext3_ext_index_trans_blocks (struct inode *);
+
 /* fsync.c */
 extern int ext3_sync_file (struct file *, struct dentry *, int);
 
+/* hash.c */
+extern int ext3fs_dirhash(const char *name, int len, struct
+			  dx_hash_info *hinfo);
+
 /* ialloc.c */
 extern struct inode * ext3_new_inode (handle_t *, const struct inode *, int);
 extern void ext3_free_inode (handle_t *, struct inode *);
@@ -642,6 +729,8 @@ extern void ext3_discard_prealloc (struct inode *);
 extern void ext3_dirty_inode(struct inode *);
 extern int ext3_change_inode_journal_flag(struct inode *, int);
 extern void ext3_truncate (struct inode *);
+extern int ext3_forget (handle_t *, int, struct inode *,
+			struct buffer_head *, int);
 
 /* ioctl.c */
 extern int ext3_ioctl (struct inode *, struct file *, unsigned int,
@@ -17,6 +17,19 @@
 #define _LINUX_EXT3_FS_I
 
 #include <linux/rwsem.h>
+#include <linux/rbtree.h>
+
+/*
+ * A run of blocks set aside for the allocations of one inode.  It is
+ * kept in the per-filesystem tree of windows, not in the bitmaps.
+ */
+struct ext3_reserve_window {
+	rb_node_t	rsv_node;
+	__u32		rsv_start;	/* first block, 0 if no window */
+	__u32		rsv_end;	/* last block */
+	__u32		rsv_goal_size;	/* size of the next window */
+	__u32		rsv_alloc_hit;	/* blocks allocated from this one */
+};
 
 /*
  * second extended file system inode data in memory
@@ -42,6 +55,7 @@ struct ext3_inode_info {
 	__u32	i_prealloc_count;
 #endif
 	__u32	i_dir_start_lookup;
+	struct ext3_reserve_window i_rsv_window;
 	
 	struct list_head i_orphan;	/* unlinked but open inodes */
 
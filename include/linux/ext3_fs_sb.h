@@ -62,6 +62,10 @@ struct ext3_sb_info {
 	int s_inode_size;
 	int s_first_ino;
 	u32 s_next_generation;
+	u32 s_hash_seed[4];
+	int s_def_hash_version;
+	rb_root_t s_rsv_window_root;	/* reservation windows by block */
+	spinlock_t s_rsv_window_lock;
 
 	/* Journaling */
 	struct inode * s_journal_inode;
@@ -38,6 +38,11 @@
 
 #define EXT3_DATA_TRANS_BLOCKS		(3 * EXT3_SINGLEDATA_TRANS_BLOCKS - 2)
 
+/* Adding an entry to an indexed directory can split a leaf and an index
+ * block: two new blocks, the old leaf, the index node and the root. */
+
+#define EXT3_INDEX_EXTRA_TRANS_BLOCKS	8
+
 extern int ext3_writepage_trans_blocks(struct inode *inode);
 
 /* Delete operations potentially hit one directory's namespace plus an
@@ -403,6 +403,7 @@ struct address_space {
 	struct list_head	dirty_pages;	/* list of dirty pages */
 	struct list_head	locked_pages;	/* list of locked pages */
 	unsigned long		nrpages;	/* number of total pages */
+	spinlock_t		page_lock;	/* protects the lists and nrpages */
 	struct address_space_operations *a_ops;	/* methods */
 	struct inode		*host;		/* owner: inode, block_device */
 	struct vm_area	*i_mmap;	/* list of private mappings */
@@ -520,6 +521,31 @@ struct fown_struct {
 	int signum;		/* posix.1b rt signal to be delivered on IO */
 };
 
+/*
+ * Read-ahead state of a file, see page_cache_readahead() in mm/filemap.c.
+ * Each stream follows one sequential reader through the file; offsets
+ * and sizes are in pages.
+ */
+#define RA_STREAMS	4
+
+struct file_ra_stream {
+	unsigned long	prev;		/* last page read */
+	unsigned long	start;		/* current window */
+	unsigned long	size;		/* 0 if not sequential */
+	unsigned long	ahead_size;	/* window after the current one */
+	unsigned int	hits;		/* since the last ahead window */
+	unsigned int	misses;
+	unsigned long	stamp;		/* last use, 0 if never used */
+};
+
+struct file_ra_state {
+	struct file_ra_stream	streams[RA_STREAMS];
+	unsigned long		stamp;
+	unsigned long		hits;		/* pages found read ahead */
+	unsigned long		misses;		/* ... and found missing */
+	unsigned long		windows;	/* ahead windows submitted */
+};
+
 struct file {
 	struct list_head	f_list;
 	struct dentry		*f_dentry;
@@ -529,7 +555,8 @@ struct file {
 	unsigned int 		f_flags;
 	mode_t			f_mode;
 	loff_t			f_pos;
-	unsigned long 		f_reada, f_ramax, f_raend, f_ralen, f_rawin;
+	unsigned long 		f_reada;
+	struct file_ra_state	f_ra;
 	struct fown_struct	f_owner;
 	unsigned int		f_uid, f_gid;
 	int			f_error;
@@ -542,6 +569,10 @@ struct file {
 	/* preallocated helper kiobuf to speedup O_DIRECT */
 	struct kiobuf		*f_iobuf;
 	long			f_iobuf_lock;
+
+	/* epoll items watching this file, see fs/eventpoll.c */
+	struct list_head	f_ep_links;
+	spinlock_t		f_ep_lock;
 };
 extern spinlock_t files_lock;
 #define file_list_lock() spin_lock(&files_lock);
@@ -1122,6 +1153,7 @@ extern int fs_may_remount_ro(struct super_block *);
 extern int FASTCALL(try_to_free_buffers(struct page *, unsigned int));
 extern void refile_buffer(struct buffer_head * buf);
 extern void create_empty_buffers(struct page *, kdev_t, unsigned long);
+extern void unmap_underlying_metadata(struct buffer_head *);
 extern void end_buffer_io_sync(struct buffer_head *bh, int uptodate);
 
 /* reiserfs_writepage needs this */
@@ -0,0 +1,22 @@
+#ifndef _LINUX_FUTEX_H
+#define _LINUX_FUTEX_H
+
+/*
+ * Second argument to sys_futex().  The lock word itself is owned by
+ * user space; the kernel only provides somewhere to sleep.
+ */
+#define FUTEX_WAIT	0
+#define FUTEX_WAKE	1
+#define FUTEX_REQUEUE	3
+
+#ifdef __KERNEL__
+
+#include <linux/linkage.h>
+#include <linux/time.h>
+
+asmlinkage long sys_futex(unsigned int *uaddr, int op, int val,
+			  struct timespec *utime, unsigned int *uaddr2);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_FUTEX_H */
@@ -0,0 +1,110 @@
+#ifndef _LINUX_HUGETLB_H
+#define _LINUX_HUGETLB_H
+
+#include <linux/config.h>
+#include <linux/fs.h>
+
+#ifdef CONFIG_HUGETLB_PAGE
+
+#define HUGETLBFS_MAGIC	0x958458f6
+
+struct ctl_table;
+
+static inline int is_vm_hugetlb_page(struct vm_area *vma)
+{
+	return vma->vm_flags & VM_HUGETLB;
+}
+
+/*
+ * The huge page pool and the page table side, in the architecture code.
+ * A huge page is mapped by a single page directory entry in every mm
+ * that maps it, there are no page tables below it to be set up, copied
+ * or freed.
+ */
+int copy_hugetlb_page_range(struct mm_struct *dst, struct mm_struct *src,
+			    struct vm_area *vma);
+int follow_hugetlb_page(struct mm_struct *mm, struct vm_area *vma,
+			struct page **pages, struct vm_area **vmas,
+			unsigned long *start, int *len, int i);
+void zap_hugepage_range(struct vm_area *vma, unsigned long start,
+			unsigned long len);
+int hugetlb_prefault(struct vm_area *vma);
+struct page *alloc_huge_page(void);
+void free_huge_page(struct page *page);
+int hugetlb_free_pages(void);
+int hugetlb_report_meminfo(char *buf);
+int hugetlb_sysctl_handler(struct ctl_table *table, int write,
+			   struct file *file, void *buffer, size_t *length);
+
+extern int htlbpage_max;
+
+/*
+ * munmap() can only cut a huge page vma at a huge page boundary.
+ * 'vma' is the first vma reaching into [start, end).
+ */
+static inline int hugetlb_unmap_ok(struct vm_area *vma, unsigned long start,
+				   unsigned long end)
+{
+	for (; vma && vma->vm_start < end; vma = vma->vm_next) {
+		if (!is_vm_hugetlb_page(vma))
+			continue;
+		if ((vma->vm_start < start && (start & ~HPAGE_MASK)) ||
+		    (vma->vm_end > end && (end & ~HPAGE_MASK)))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * hugetlbfs keeps the huge pages of a file in an array indexed by huge
+ * page offset, hung off inode->u.generic_ip.  They are not in the page
+ * cache and never on the LRU lists.  Protected by inode->i_sem.
+ */
+struct hugetlbfs_inode_info {
+	unsigned long	nr_hpages;	/* slots in hpages[] */
+	unsigned long	nr_present;	/* huge pages allocated */
+	struct page	*hpages[0];
+};
+
+#define HUGETLBFS_I(inode) \
+	((struct hugetlbfs_inode_info *)(inode)->u.generic_ip)
+
+extern struct file_operations hugetlbfs_file_operations;
+
+int hugetlbfs_file_mmap(struct file *file, struct vm_area *vma);
+unsigned long hugetlb_get_unmapped_area(struct file *file, unsigned long addr,
+	unsigned long len, unsigned long pgoff, unsigned long flags);
+struct page *hugetlbfs_get_page(struct inode *inode, unsigned long idx);
+struct file *hugetlb_file_setup(char *name, loff_t size);
+
+static inline int is_file_hugepages(struct file *file)
+{
+	return file->f_dentry->d_inode->i_sb->s_magic == HUGETLBFS_MAGIC;
+}
+
+/* Memory held by a hugetlbfs file, in small pages */
+static inline unsigned long hugetlbfs_nr_pages(struct inode *inode)
+{
+	struct hugetlbfs_inode_info *info = HUGETLBFS_I(inode);
+
+	return info ? info->nr_present << HUGETLB_PAGE_ORDER : 0;
+}
+
+#else /* !CONFIG_HUGETLB_PAGE */
+
+#define is_vm_hugetlb_page(vma)			0
+#define copy_hugetlb_page_range(dst, src, vma)	({ BUG(); 0; })
+#define follow_hugetlb_page(m, v, p, vs, s, l, i) ({ BUG(); 0; })
+#define zap_hugepage_range(vma, start, len)	BUG()
+#define hugetlb_report_meminfo(buf)		0
+#define hugetlb_unmap_ok(vma, start, end)	1
+
+#define is_file_hugepages(file)			0
+#define hugetlbfs_nr_pages(inode)		0
+#define hugetlbfs_file_mmap(file, vma)		(-ENOSYS)
+#define hugetlb_get_unmapped_area		NULL
+#define hugetlb_file_setup(name, size)		ERR_PTR(-ENOSYS)
+
+#endif /* !CONFIG_HUGETLB_PAGE */
+
+#endif /* _LINUX_HUGETLB_H */
@@ -33,5 +33,6 @@ extern irq_cpustat_t irq_stat[];			/* defined in asm/hardirq.h */
 #define ksoftirqd_task(cpu)	__IRQ_STAT((cpu), __ksoftirqd_task)
   /* arch dependent irq_stat fields */
 #define nmi_count(cpu)		__IRQ_STAT((cpu), __nmi_count)		/* i386, ia64 */
+#define ipi_sent(cpu, why)	__IRQ_STAT((cpu), __ipi_sent[(why)])	/* i386 */
 
 #endif	/* __irq_cpustat_h */
@@ -104,6 +104,30 @@ typedef struct journal_header_s
 	__u32		h_sequence;
 } journal_header_t;
 
+/*
+ * Checksum types and sizes for the commit block
+ */
+#define JFS_CRC32_CHKSUM	1
+#define JFS_CRC32_CHKSUM_SIZE	4
+
+#define JFS_CHECKSUM_BYTES	(32 / sizeof(__u32))
+
+/*
+ * The commit block.  The checksum fields are only used when the
+ * journal has the CHECKSUM feature; they cover every block the
+ * transaction wrote to the log before its commit block, in log order.
+ */
+typedef struct commit_header_s
+{
+	__u32		h_magic;
+	__u32		h_blocktype;
+	__u32		h_sequence;
+	unsigned char	h_chksum_type;
+	unsigned char	h_chksum_size;
+	unsigned char	h_padding[2];
+	__u32		h_chksum[JFS_CHECKSUM_BYTES];
+} commit_header_t;
+
 
 /* 
  * The block tag: used to describe a single buffer in the journal 
@@ -190,12 +214,16 @@ typedef struct journal_superblock_s
 	((j)->j_format_version >= 2 &&					\
 	 ((j)->j_superblock->s_feature_incompat & cpu_to_be32((mask))))
 
+#define JFS_FEATURE_COMPAT_CHECKSUM	0x00000001
+
 #define JFS_FEATURE_INCOMPAT_REVOKE	0x00000001
+#define JFS_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 
 /* Features known to this kernel version: */
-#define JFS_KNOWN_COMPAT_FEATURES	0
+#define JFS_KNOWN_COMPAT_FEATURES	JFS_FEATURE_COMPAT_CHECKSUM
 #define JFS_KNOWN_ROCOMPAT_FEATURES	0
-#define JFS_KNOWN_INCOMPAT_FEATURES	JFS_FEATURE_INCOMPAT_REVOKE
+#define JFS_KNOWN_INCOMPAT_FEATURES	(JFS_FEATURE_INCOMPAT_REVOKE | \
+					 JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -420,12 +448,46 @@ struct transaction_s
 	/* How many handles used this transaction? */
 	int t_handle_count;
 
+	/* ... and how many of them were synchronous? */
+	int t_sync_count;
+
+	/* When was the transaction created?  Sync handles batch up
+	 * against this. */
+	struct timeval		t_start_time;
+
 	/* List of registered callback functions for this transaction.
 	 * Called when the transaction is committed. */
 	struct list_head	t_jcb;
 };
 
 
+/*
+ * Commit statistics, shown in /proc/fs/jbd/<device>.  Updated by the
+ * commit thread, except js_batch_waits, which journal_stop() bumps
+ * without any lock: a lost count is no great harm there.
+ */
+#define JBD_BATCH_BUCKETS	6	/* 1, 2-3, 4-7, 8-15, 16-31, 32+ */
+
+struct journal_stats_s
+{
+	unsigned long	js_commits;		/* transactions committed */
+	unsigned long	js_handles;		/* handles in them */
+	unsigned long	js_blocks;		/* blocks they wrote to the log */
+	unsigned long	js_sync_commits;	/* commits with sync handles */
+	unsigned long	js_sync_handles;	/* sync handles in them */
+	unsigned long	js_batch[JBD_BATCH_BUCKETS];	/* by sync handles */
+	unsigned long	js_batch_waits;		/* sync handles held back */
+	__u64		js_commit_time;		/* usecs spent committing */
+	unsigned long	js_max_commit_time;	/* longest commit, usecs */
+};
+
+/*
+ * A synchronous handle waits for other handles to join its transaction
+ * for about as long as a commit takes, but never longer than this many
+ * microseconds.
+ */
+#define JBD_MAX_BATCH_TIME	15000
+
 /* The journal_t maintains all of the journaling state information for a
  * single filesystem.  It is linked to from the fs superblock structure.
  * 
@@ -561,6 +623,16 @@ struct journal_s
 	/* The revoke table: maintains the list of revoked blocks in the
            current transaction. */
 	struct jbd_revoke_table_s *j_revoke;
+
+	/* Running average of the time a commit takes, in usecs */
+	unsigned long		j_average_commit_time;
+
+	/* The last process to stop a synchronous handle */
+	pid_t			j_last_sync_writer;
+
+	/* Commit statistics and their /proc entry */
+	struct journal_stats_s	j_stats;
+	struct proc_dir_entry *	j_proc_entry;
 };
 
 /* 
@@ -688,6 +760,8 @@ extern int	   journal_check_available_features
 		   (journal_t *, unsigned long, unsigned long, unsigned long);
 extern int	   journal_set_features 
 		   (journal_t *, unsigned long, unsigned long, unsigned long);
+extern void	   journal_clear_features
+		   (journal_t *, unsigned long, unsigned long, unsigned long);
 extern int	   journal_create     (journal_t *);
 extern int	   journal_load       (journal_t *journal);
 extern void	   journal_destroy    (journal_t *);
@@ -703,6 +777,7 @@ extern void	   journal_ack_err    (journal_t *);
 extern int	   journal_clear_err  (journal_t *);
 extern int	   journal_bmap(journal_t *, unsigned long, unsigned long *);
 extern int	   journal_force_commit(journal_t *);
+extern __u32	   journal_crc32(__u32, const char *, size_t);
 
 /*
  * journal_head management
@@ -777,6 +852,25 @@ static inline int is_journal_aborted(journal_t *journal)
 	return journal->j_flags & JFS_ABORT;
 }
 
+/*
+ * Microseconds since @tv, for timing commits.  A clock stepped back
+ * reads as no time at all.
+ */
+static inline unsigned long jbd_usecs_since(struct timeval *tv)
+{
+	struct timeval now;
+	long secs;
+
+	do_gettimeofday(&now);
+	secs = now.tv_sec - tv->tv_sec;
+	if (secs < 0)
+		return 0;
+	if (secs > 2000)
+		secs = 2000;
+	secs = secs * 1000000 + now.tv_usec - tv->tv_usec;
+	return secs < 0 ? 0 : secs;
+}
+
 static inline int is_handle_aborted(handle_t *handle)
 {
 	if (handle->h_aborted)
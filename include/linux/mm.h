@@ -18,9 +18,6 @@ extern unsigned long num_physpages;
 extern unsigned long num_mappedpages;
 extern void * high_memory;
 extern int page_cluster;
-/* The inactive_clean lists are per zone. */
-extern struct list_head active_list;
-extern struct list_head inactive_list;
 
 #include <asm/page.h>
 #include <asm/pgtable.h>
@@ -103,6 +100,7 @@ struct vm_area {
 #define VM_DONTCOPY	0x00020000      /* Do not copy this vma on fork */
 #define VM_DONTEXPAND	0x00040000	/* Cannot expand with mremap() */
 #define VM_RESERVED	0x00080000	/* Don't unmap it from swap_out */
+#define VM_HUGETLB	0x00100000	/* Mapped with huge pages */
 
 #define VM_STACK_FLAGS	0x00000177
 
@@ -116,6 +114,8 @@ struct vm_area {
 extern int vm_min_readahead;
 extern int vm_max_readahead;
 
+extern int sysctl_lazy_fork;
+
 /*
  * mapping from the currently active vm_flags protection bits (the
  * low four bits) to a page protection mask..
@@ -159,9 +159,11 @@ struct page {
 	unsigned long flags;		/* atomic flags, some possibly
 					   updated asynchronously */
 	struct list_head lru;		/* Pageout list, eg. active_list;
-					   protected by pagemap_lru_lock !! */
+					   protected by zone->lru_lock !! */
 	struct page **pprev_hash;	/* Complement to *next_hash. */
 	struct buffer_head * buffers;	/* Buffer maps us to a disk block. */
+	struct pte_chain * pte_chain;	/* Ptes mapping us, under the
+					   PG_chainlock bit. */
 
 	/*
 	 * On machines where all RAM is mapped into kernel address space,
@@ -242,7 +244,8 @@ struct page {
  *
  * There is also a hash table mapping (mapping,index) to the page
  * in memory if present. The lists for this hash table use the fields
- * page->next_hash and page->pprev_hash.
+ * page->next_hash and page->pprev_hash.  See <linux/pagemap.h> for
+ * the locks protecting both.
  *
  * All process pages can do I/O:
  * - inode pages may need to be read from disk,
@@ -265,8 +268,8 @@ struct page {
  * inactive_dirty and inactive_clean lists.
  *
  * Note that the referenced bit, the page->lru list_head and the
- * active, inactive_dirty and inactive_clean lists are protected by
- * the pagemap_lru_lock, and *NOT* by the usual PG_locked bit!
+ * active and inactive lists are protected by the lru_lock of the
+ * page's zone, and *NOT* by the usual PG_locked bit!
  *
  * PG_skip is used on sparc/sparc64 architectures to "skip" certain
  * parts of the address space.
@@ -297,6 +300,7 @@ struct page {
 #define PG_arch_1		13
 #define PG_reserved		14
 #define PG_launder		15	/* written out by VM pressure.. */
+#define PG_chainlock		16	/* lock bit for ->pte_chain */
 
 /* Make it prettier to test the above... */
 #define UnlockPage(page)	unlock_page(page)
@@ -397,6 +401,30 @@ extern void FASTCALL(set_page_dirty(struct page *));
 #define TestSetPageLRU(page)	test_and_set_bit(PG_lru, &(page)->flags)
 #define TestClearPageLRU(page)	test_and_clear_bit(PG_lru, &(page)->flags)
 
+/*
+ * page->pte_chain is protected by a bit spinlock in page->flags.  It
+ * nests inside zone->lru_lock and mm->page_table_lock; the reclaim
+ * side only ever trylocks page_table_lock under it.  Nothing looks at
+ * the chain from interrupts, so UP needs no locking.
+ */
+static inline void pte_chain_lock(struct page *page)
+{
+#ifdef CONFIG_SMP
+	while (test_and_set_bit(PG_chainlock, &page->flags)) {
+		while (test_bit(PG_chainlock, &page->flags))
+			cpu_relax();
+	}
+#endif
+}
+
+static inline void pte_chain_unlock(struct page *page)
+{
+#ifdef CONFIG_SMP
+	smp_mb__before_clear_bit();
+	clear_bit(PG_chainlock, &page->flags);
+#endif
+}
+
 #ifdef CONFIG_HIGHMEM
 #define PageHighMem(page)		test_bit(PG_highmem, &(page)->flags)
 #else
@@ -423,6 +451,7 @@ extern struct page * pg_map;
  */
 extern struct page * FASTCALL(_alloc_pages(unsigned int gfp_mask, unsigned int order));
 extern struct page * FASTCALL(__alloc_pages(unsigned int gfp_mask, unsigned int order, struct pm_zonelist *zonelist));
+extern struct page * alloc_pages_node(int nid, unsigned int gfp_mask, unsigned int order);
 
 static inline struct page * alloc_pages(unsigned int gfp_mask, unsigned int order)
 {
@@ -457,6 +486,7 @@ extern void FASTCALL(__free_pages(struct page *page, unsigned int order));
 extern void FASTCALL(free_pages(unsigned long addr, unsigned int order));
 
 #define __free_page(page) __free_pages((page), 0)
+extern void FASTCALL(__free_page_cold(struct page *page));
 #define free_page(addr) free_pages((addr),0)
 
 extern void show_free_areas(void);
@@ -470,6 +500,7 @@ extern void shmem_lock(struct file * file, int lock);
 extern int shmem_zero_setup(struct vm_area *);
 
 extern void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long size);
+extern void unmap_vmas(struct mm_struct *mm, struct vm_area *vma, unsigned long start, unsigned long end);
 extern int copy_page_range(struct mm_struct *dst, struct mm_struct *src, struct vm_area *vma);
 extern int remap_page_range(unsigned long from, unsigned long to, unsigned long size, pgprot_t prot);
 extern int zeromap_page_range(unsigned long from, unsigned long size, pgprot_t prot);
@@ -597,6 +628,7 @@ extern struct page *filemap_nopage(struct vm_area *, unsigned long, int);
 #define __GFP_IO	0x40	/* Can start low memory physical IO? */
 #define __GFP_HIGHIO	0x80	/* Can start high mem physical IO? */
 #define __GFP_FS	0x100	/* Can call down to low-level FS? */
+#define __GFP_COLD	0x200	/* Cache-cold page wanted */
 
 #define GFP_NOHIGHIO	(__GFP_HIGH | __GFP_WAIT | __GFP_IO)
 #define GFP_NOIO	(__GFP_HIGH | __GFP_WAIT)
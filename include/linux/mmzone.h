@@ -8,12 +8,18 @@
 #include <linux/spinlock.h>
 #include <linux/list.h>
 #include <linux/wait.h>
+#include <linux/cache.h>
+#include <linux/threads.h>
 
 /*
  * Free memory management - zoned buddy allocator.
  */
 
+#ifdef CONFIG_HUGETLB_PAGE
+#define MAX_ORDER 11		/* a 4MB huge page comes in one piece */
+#else
 #define MAX_ORDER 10
+#endif
 
 struct free_area {
 	struct list_head	free_list;
@@ -22,6 +28,25 @@ struct free_area {
 
 struct pm_node;
 
+/*
+ * Each CPU keeps a few free order-0 pages of every zone, taken from and
+ * given back to the buddy lists 'batch' at a time.  Recently freed pages
+ * are likely still in the CPU cache and go on the hot list; the cold
+ * list is for pages that nobody is going to touch with the CPU soon.
+ * The pages are not counted in zone->free_pages.
+ */
+struct per_cpu_pages {
+	int count;		/* pages on the list */
+	int low;		/* refill when we get down to this */
+	int high;		/* give back when we get up to this */
+	int batch;		/* chunk size for refills and give-backs */
+	struct list_head list;
+};
+
+struct per_cpu_pageset {
+	struct per_cpu_pages pcp[2];	/* 0: hot, 1: cold */
+} ____cacheline_aligned;
+
 /*
  * On machines where it is needed (eg PCs) we divide physical memory
  * into multiple physical zones. On a PC we have 3 zones:
@@ -39,6 +64,23 @@ struct pm_zone {
 	unsigned long		pages_min, pages_low, pages_high;
 	int			need_balance;
 
+	struct per_cpu_pageset	pageset[NR_CPUS];
+
+	/*
+	 * Page reclaim: the zone's own active and inactive lists, so
+	 * that freeing one zone never has to wade through the pages of
+	 * another, and how much scanning it has taken.  All under
+	 * lru_lock.
+	 */
+	spinlock_t		lru_lock ____cacheline_aligned;
+	struct list_head	active_list;
+	struct list_head	inactive_list;
+	unsigned long		nr_active;
+	unsigned long		nr_inactive;
+	unsigned long		pages_scanned;		/* inactive pages looked at */
+	unsigned long		pages_deactivated;	/* active -> inactive */
+	unsigned long		pages_reclaimed;	/* freed by shrink_cache */
+
 	/*
 	 * free areas of different sizes
 	 */
@@ -117,9 +159,6 @@ struct pm_zonelist {
  *
  * On NUMA machines, each NUMA node would have a struct pm_node to describe
  * it's memory layout.
- *
- * XXX: we need to move the global memory statistics (active_list, ...)
- *      into the struct pm_node to properly support NUMA.
  */
 struct bootmem;
 struct pm_node {
@@ -139,6 +178,24 @@ struct pm_node {
 extern int numnodes;
 extern struct pm_node *nod_list;
 
+/*
+ * Upper bound on numnodes, for tables that are indexed by node id.
+ */
+#ifdef CONFIG_DISCONTIGMEM
+#define MAX_NR_NODES	16
+#else
+#define MAX_NR_NODES	1
+#endif
+
+/*
+ * The node whose memory is closest to a CPU.  Architectures that know
+ * their topology define cpu_to_node() before this point.
+ */
+#ifndef cpu_to_node
+#define cpu_to_node(cpu)	(0)
+#endif
+#define numa_node_id()		cpu_to_node(smp_processor_id())
+
 #define memclass(pgzone, classzone)	(((pgzone)->zone_pmnod == (classzone)->zone_pmnod) \
 			&& ((pgzone) <= (classzone)))
 
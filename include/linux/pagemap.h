@@ -30,12 +30,19 @@
 
 #define page_cache_get(x)	get_page(x)
 #define page_cache_release(x)	__free_page(x)
+#define page_cache_release_cold(x)	__free_page_cold(x)
 
 static inline struct page *page_cache_alloc(struct address_space *x)
 {
 	return alloc_pages(x->gfp_mask, 0);
 }
 
+/* For pages the CPU won't touch before I/O fills them, read-ahead */
+static inline struct page *page_cache_alloc_cold(struct address_space *x)
+{
+	return alloc_pages(x->gfp_mask | __GFP_COLD, 0);
+}
+
 /*
  * From a kernel address, get the "struct page *"
  */
@@ -70,6 +77,42 @@ static inline unsigned long _page_hashfn(struct address_space * mapping, unsigne
 
 #define page_hash(mapping,index) (page_hash_table+_page_hashfn(mapping,index))
 
+/*
+ * Page cache locking.  mapping->page_lock protects the clean, dirty and
+ * locked lists of one address_space and its nrpages.  The hash chains,
+ * and page->mapping/page->index of hashed pages, are protected by an
+ * array of bucket locks, each covering every PAGE_HASH_LOCKS'th chain.
+ * Lookups only take the bucket lock, so lookups in different files, or
+ * in different parts of one file, rarely touch the same lock.  Adding
+ * or removing a page takes both.
+ *
+ * Ordering:
+ *	zone->lru_lock ->
+ *		mapping->page_lock ->
+ *			page_hash_lock()
+ */
+#define PAGE_HASH_LOCK_BITS	6
+#define PAGE_HASH_LOCKS		(1 << PAGE_HASH_LOCK_BITS)
+
+extern spinlock_cacheline_t page_hash_locks[PAGE_HASH_LOCKS];
+
+static inline spinlock_t *page_hash_lock(struct page **hash)
+{
+	return &page_hash_locks[(hash - page_hash_table) & (PAGE_HASH_LOCKS-1)].lock;
+}
+
+static inline void lock_page_cache(struct address_space *mapping, struct page **hash)
+{
+	spin_lock(&mapping->page_lock);
+	spin_lock(page_hash_lock(hash));
+}
+
+static inline void unlock_page_cache(struct address_space *mapping, struct page **hash)
+{
+	spin_unlock(page_hash_lock(hash));
+	spin_unlock(&mapping->page_lock);
+}
+
 extern struct page * __find_get_page(struct address_space *mapping,
 				unsigned long index, struct page **hash);
 #define find_get_page(mapping, index) \
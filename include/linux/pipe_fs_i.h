@@ -2,11 +2,40 @@
 #define _LINUX_PIPE_FS_I_H
 
 #define PIPEFS_MAGIC 0x50495045
+
+struct page;
+struct file;
+struct user_struct;
+
+/*
+ * A pipe is a ring of buffers, each a reference on part of a page.
+ * Pages written into the pipe belong to it alone and later writes may
+ * be appended to them; pages spliced in from the page cache or shared
+ * with another pipe by tee() are only ever read.
+ */
+struct pipe_buffer {
+	struct page *page;
+	unsigned int offset;
+	unsigned int len;
+	unsigned int flags;
+};
+
+#define PIPE_BUF_PRIVATE	0x01	/* writes may be merged into it */
+
+/*
+ * Ring sizes are a power of two.  Any size keeps PIPE_BUF writes
+ * atomic, as long as PIPE_BUF <= PAGE_SIZE.
+ */
+#define PIPE_DEF_BUFFERS	16
+
 struct pipe_inode_info {
 	struct wait_queue_head_t wait;
-	char *base;
+	unsigned int nrbufs;
+	unsigned int curbuf;
+	unsigned int buffers;
+	struct pipe_buffer *bufs;
+	struct user_struct *user;	/* charged for the ring */
 	unsigned int len;
-	unsigned int start;
 	unsigned int readers;
 	unsigned int writers;
 	unsigned int waiting_readers;
@@ -15,14 +44,11 @@ struct pipe_inode_info {
 	unsigned int w_counter;
 };
 
-/* Differs from PIPE_BUF in that PIPE_SIZE is the length of the actual
-   memory allocation, whereas PIPE_BUF makes atomicity guarantees.  */
-#define PIPE_SIZE		PAGE_SIZE
-
 #define PIPE_SEM(inode)		(&(inode).i_sem)
 #define PIPE_WAIT(inode)	(&(inode).i_pipe->wait)
-#define PIPE_BASE(inode)	((inode).i_pipe->base)
-#define PIPE_START(inode)	((inode).i_pipe->start)
+#define PIPE_NRBUFS(inode)	((inode).i_pipe->nrbufs)
+#define PIPE_CURBUF(inode)	((inode).i_pipe->curbuf)
+#define PIPE_BUFFERS(inode)	((inode).i_pipe->buffers)
 #define PIPE_LEN(inode)		((inode).i_pipe->len)
 #define PIPE_READERS(inode)	((inode).i_pipe->readers)
 #define PIPE_WRITERS(inode)	((inode).i_pipe->writers)
@@ -31,16 +57,33 @@ struct pipe_inode_info {
 #define PIPE_RCOUNTER(inode)	((inode).i_pipe->r_counter)
 #define PIPE_WCOUNTER(inode)	((inode).i_pipe->w_counter)
 
-#define PIPE_EMPTY(inode)	(PIPE_LEN(inode) == 0)
-#define PIPE_FULL(inode)	(PIPE_LEN(inode) == PIPE_SIZE)
-#define PIPE_FREE(inode)	(PIPE_SIZE - PIPE_LEN(inode))
-#define PIPE_END(inode)	((PIPE_START(inode) + PIPE_LEN(inode)) & (PIPE_SIZE-1))
-#define PIPE_MAX_RCHUNK(inode)	(PIPE_SIZE - PIPE_START(inode))
-#define PIPE_MAX_WCHUNK(inode)	(PIPE_SIZE - PIPE_END(inode))
+#define PIPE_EMPTY(inode)	(PIPE_NRBUFS(inode) == 0)
+#define PIPE_FULL(inode)	(PIPE_NRBUFS(inode) == PIPE_BUFFERS(inode))
+
+/* The n-th buffer from the head, and the oldest and newest of them */
+#define PIPE_BUF_NR(inode, n)	\
+	((inode).i_pipe->bufs + ((PIPE_CURBUF(inode) + (n)) & \
+				 (PIPE_BUFFERS(inode) - 1)))
+#define PIPE_HEAD_BUF(inode)	PIPE_BUF_NR(inode, 0)
+#define PIPE_TAIL_BUF(inode)	PIPE_BUF_NR(inode, PIPE_NRBUFS(inode) - 1)
+
+/* Flags for splice() and tee() */
+#define SPLICE_F_MOVE		0x01	/* hint only, pages are always shared */
+#define SPLICE_F_NONBLOCK	0x02	/* don't block on the pipe */
+#define SPLICE_F_MORE		0x04	/* more data follows, for ->sendpage() */
 
 /* Drop the inode semaphore and wait for a pipe event, atomically */
 void pipe_wait(struct inode * inode);
 
 struct inode* pipe_new(struct inode* inode);
+void free_pipe_info(struct inode* inode);
+long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg);
+
+extern int pipe_user_pages_max;
+
+/* Called with the pipe semaphore held */
+void pipe_buf_add(struct inode *inode, struct page *page,
+		  unsigned int offset, unsigned int len, unsigned int flags);
+int pipe_buf_consume(struct inode *inode, unsigned int chars);
 
 #endif
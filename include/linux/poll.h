@@ -11,8 +11,16 @@
 #include <asm/uaccess.h>
 
 struct poll_table_page;
+struct poll_table_struct;
+
+/*
+ * Hooks a poller onto one of the file's wait queues.  select() and poll()
+ * use __pollwait; epoll installs its own callback.
+ */
+typedef void (*poll_queue_proc)(struct file *, struct wait_queue_head_t *, struct poll_table_struct *);
 
 typedef struct poll_table_struct {
+	poll_queue_proc qproc;
 	int error;
 	struct poll_table_page * table;
 } poll_table;
@@ -22,14 +30,20 @@ extern void __pollwait(struct file * filp, struct wait_queue_head_t * wait_addre
 static inline void poll_wait(struct file * filp, struct wait_queue_head_t * wait_address, poll_table *p)
 {
 	if (p && wait_address)
-		__pollwait(filp, wait_address, p);
+		p->qproc(filp, wait_address, p);
 }
 
-static inline void poll_initwait(poll_table* pt)
+static inline void init_poll_funcptr(poll_table *pt, poll_queue_proc qproc)
 {
+	pt->qproc = qproc;
 	pt->error = 0;
 	pt->table = NULL;
 }
+
+static inline void poll_initwait(poll_table* pt)
+{
+	init_poll_funcptr(pt, __pollwait);
+}
 extern void poll_freewait(poll_table* pt);
 
 
@@ -73,7 +73,7 @@ extern unsigned long avenrun[];		/* Load averages */
 #define CT_TO_SECS(x)	((x) / HZ)
 #define CT_TO_USECS(x)	(((x) % HZ) * 1000000/HZ)
 
-extern int nr_running, nr_threads;
+extern int nr_threads;
 extern int last_pid;
 
 #include <linux/fs.h>
@@ -125,6 +125,15 @@ extern int last_pid;
  */
 #define SCHED_YIELD		0x10
 
+/*
+ * Priority of a process goes from 0..MAX_PRIO-1, valid RT
+ * priority is 0..MAX_RT_PRIO-1, and SCHED_OTHER tasks are
+ * in the range MAX_RT_PRIO..MAX_PRIO-1. Priority values
+ * are inverted: lower p->prio value means higher priority.
+ */
+#define MAX_RT_PRIO		100
+#define MAX_PRIO		(MAX_RT_PRIO + 40)
+
 struct sched_param {
 	int sched_priority;
 };
@@ -136,17 +145,16 @@ struct completion;
 #include <linux/spinlock.h>
 
 /*
- * This serializes "schedule()" and also protects
- * the run-queue from deletions/modifications (but
- * _adding_ to the beginning of the run-queue has
- * a separate lock).
+ * This protects the list of processes. The run-queues
+ * are per-CPU and have their own locks in kernel/sched.c.
  */
 extern rwlock_t tasklist_lock;
-extern spinlock_t runqueue_lock;
 extern spinlock_t mmlist_lock;
 
 extern void sched_init(void);
 extern void init_idle(void);
+extern unsigned long nr_running(void);
+extern void rebalance_tick(int idle);
 extern void show_state(void);
 extern void cpu_init (void);
 extern void trap_init(void);
@@ -229,7 +237,6 @@ struct mm_struct {
 	unsigned long rss, total_vm, locked_vm;
 	unsigned long def_flags;
 	unsigned long cpu_vm_mask;
-	unsigned long swap_address;
 
 	unsigned dumpable:1;
 
@@ -270,6 +277,7 @@ struct user_struct {
 	atomic_t __count;	/* reference count */
 	atomic_t processes;	/* How many processes does this user have? */
 	atomic_t files;		/* How many open files does this user have? */
+	atomic_t pipe_bufs;	/* How many pipe pages does this user have? */
 
 	/* Hash table maintenance information */
 	struct user_struct *next, **pprev;
@@ -304,17 +312,19 @@ struct task_struct {
 /*
  * offset 32 begins here on 32-bit platforms. We keep
  * all fields in a single cacheline that are needed for
- * the goodness() loop in schedule().
+ * picking and queueing the task in schedule().
  */
-	long counter;
+	long counter;	/* ticks left in the current time slice */
 	long nice;
 	unsigned long policy;
 	struct mm_struct *mm;
 	int processor;
 	/*
 	 * cpus_runnable is ~0 if the process is not running on any
-	 * CPU. It's (1 << cpu) if it's running on a CPU. This mask
-	 * is updated under the runqueue lock.
+	 * CPU. It's (1 << cpu) if it's running on a CPU. It is set
+	 * under the runqueue lock when the task is picked to run, and
+	 * cleared once it has been switched out. A task that has a CPU
+	 * is never moved to another CPU's run-queue.
 	 *
 	 * To determine whether a process might run on a CPU, this
 	 * mask is AND-ed with cpus_allowed.
@@ -325,7 +335,9 @@ struct task_struct {
 	 * that's just fine.)
 	 */
 	struct list_head run_list;
-	unsigned long sleep_time;
+	int prio;			/* run-queue index, see effective_prio() */
+	struct prio_array *array;	/* run-queue array we are queued on */
+	unsigned long sleep_time;	/* jiffies when we last left the CPU */
 
 	struct task_struct *next_task, *prev_task;
 	struct mm_struct *active_mm;
@@ -459,6 +471,7 @@ struct task_struct {
 #define DEF_NICE	(0)
 
 extern void yield(void);
+extern void set_user_nice(struct task_struct *, long);
 
 /*
  * The default (Linux) execution domain.
@@ -485,6 +498,7 @@ extern struct exec_domain	default_exec_domain;
     cpus_runnable:	-1,						\
     cpus_allowed:	-1,						\
     run_list:		LIST_HEAD_INIT(tsk.run_list),			\
+    prio:		MAX_PRIO-20,					\
     next_task:		&tsk,						\
     prev_task:		&tsk,						\
     p_opptr:		&tsk,						\
@@ -528,7 +542,7 @@ extern struct   mm_struct init_mm;
 extern struct task_struct *init_tasks[NR_CPUS];
 
 /* PID hashing. (shouldnt this be dynamic?) */
-#define PIDHASH_SZ (4096 >> 2)
+#define PIDHASH_SZ (16384 >> 2)
 extern struct task_struct *pidhash[PIDHASH_SZ];
 
 #define pid_hashfn(x)	((((x) >> 8) ^ (x)) & (PIDHASH_SZ - 1))
@@ -560,6 +574,11 @@ static inline struct task_struct *find_task_by_pid(int pid)
 	return p;
 }
 
+/* References on the pid numbers a task uses, in kernel/fork.c */
+extern void attach_pids(struct task_struct *p);
+extern void detach_pids(struct task_struct *p);
+extern void change_pid(pid_t *field, pid_t nr);
+
 #define task_has_cpu(tsk) ((tsk)->cpus_runnable != ~0UL)
 
 static inline void task_set_cpu(struct task_struct *tsk, unsigned int cpu)
@@ -888,17 +907,11 @@ do {									\
 
 #define thread_group_leader(p)	(p->pid == p->tgid)
 
-static inline void del_from_runqueue(struct task_struct * p)
-{
-	nr_running--;
-	p->sleep_time = jiffies;
-	list_del(&p->run_list);
-	p->run_list.next = NULL;
-}
+extern void del_from_runqueue(struct task_struct * p);
 
 static inline int task_on_runqueue(struct task_struct *p)
 {
-	return (p->run_list.next != NULL);
+	return (p->array != NULL);
 }
 
 static inline void unhash_process(struct task_struct *p)
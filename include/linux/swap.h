@@ -2,6 +2,7 @@
 #define _LINUX_SWAP_H
 
 #include <linux/spinlock.h>
+#include <linux/threads.h>
 #include <asm/page.h>
 
 #define SWAP_FLAG_PREFER	0x8000	/* set if swap priority specified */
@@ -61,6 +62,14 @@ union swap_header {
 /*
  * The in-memory structure used to track swap areas.
  */
+/*
+ * Each CPU hands out swap slots sequentially from a cluster of its own.
+ */
+struct swap_cluster {
+	unsigned int next;
+	unsigned int end;
+};
+
 struct swap_info_struct {
 	unsigned int flags;
 	kdev_t swap_device;
@@ -70,8 +79,8 @@ struct swap_info_struct {
 	unsigned short * swap_map;
 	unsigned int lowest_bit;
 	unsigned int highest_bit;
-	unsigned int cluster_next;
-	unsigned int cluster_nr;
+	unsigned int cluster_search;	/* where to look for a free cluster */
+	struct swap_cluster cluster[NR_CPUS];
 	int prio;			/* swap priority */
 	int pages;
 	unsigned long max;
@@ -85,14 +94,10 @@ extern int nr_swap_pages;
 
 extern unsigned int nr_free_pages(void);
 extern unsigned int nr_free_buffer_pages(void);
-extern int nr_active_pages;
-extern int nr_inactive_pages;
+extern void get_zone_counts(unsigned long *, unsigned long *);
 extern atomic_t page_cache_size;
 extern atomic_t buffermem_pages;
 
-extern spinlock_cacheline_t pagecache_lock_cacheline;
-#define pagecache_lock (pagecache_lock_cacheline.lock)
-
 extern void __remove_inode_page(struct page *);
 
 /* Incomplete types for prototype declarations: */
@@ -116,9 +121,27 @@ extern struct wait_queue_head_t kswapd_wait;
 extern int FASTCALL(try_to_free_pages_zone(struct pm_zone *, unsigned int));
 extern int FASTCALL(try_to_free_pages(unsigned int));
 
+/* linux/mm/rmap.c */
+#define SWAP_SUCCESS	0
+#define SWAP_AGAIN	1
+#define SWAP_FAIL	2
+
+struct pte_chain;
+extern struct pte_chain * pte_chain_alloc(int);
+extern void pte_chain_free(struct pte_chain *);
+extern unsigned long pte_chain_size(void);
+extern struct pte_chain * page_add_rmap(struct page *, pte_t *,
+		struct mm_struct *, unsigned long, struct pte_chain *);
+extern void page_remove_rmap(struct page *, pte_t *);
+extern void page_move_rmap(struct page *, pte_t *, pte_t *, unsigned long);
+extern int page_referenced(struct page *);
+extern int try_to_unmap(struct page *);
+extern void pte_chain_init(void);
+
 /* linux/mm/page_io.c */
 extern void rw_swap_page(int, struct page *);
 extern void rw_swap_page_nolock(int, swp_entry_t, char *);
+extern void swap_writepages(struct page **, int);
 
 /* linux/mm/page_alloc.c */
 
@@ -159,14 +182,11 @@ extern struct swap_list_t swap_list;
 asmlinkage long sys_swapoff(const char *);
 asmlinkage long sys_swapon(const char *, int);
 
-extern spinlock_cacheline_t pagemap_lru_lock_cacheline;
-#define pagemap_lru_lock pagemap_lru_lock_cacheline.lock
-
 extern void FASTCALL(mark_page_accessed(struct page *));
 
 /*
  * List add/del helper macros. These must be called
- * with the pagemap_lru_lock held!
+ * with the lru_lock of the page's zone held!
  */
 #define DEBUG_LRU_PAGE(page)			\
 do {						\
@@ -176,32 +196,32 @@ do {						\
 		BUG();				\
 } while (0)
 
-#define add_page_to_active_list(page)		\
+#define add_page_to_active_list(zone, page)	\
 do {						\
 	DEBUG_LRU_PAGE(page);			\
 	SetPageActive(page);			\
-	list_add(&(page)->lru, &active_list);	\
-	nr_active_pages++;			\
+	list_add(&(page)->lru, &(zone)->active_list);	\
+	(zone)->nr_active++;			\
 } while (0)
 
-#define add_page_to_inactive_list(page)		\
+#define add_page_to_inactive_list(zone, page)	\
 do {						\
 	DEBUG_LRU_PAGE(page);			\
-	list_add(&(page)->lru, &inactive_list);	\
-	nr_inactive_pages++;			\
+	list_add(&(page)->lru, &(zone)->inactive_list);	\
+	(zone)->nr_inactive++;			\
 } while (0)
 
-#define del_page_from_active_list(page)		\
+#define del_page_from_active_list(zone, page)	\
 do {						\
 	list_del(&(page)->lru);			\
 	ClearPageActive(page);			\
-	nr_active_pages--;			\
+	(zone)->nr_active--;			\
 } while (0)
 
-#define del_page_from_inactive_list(page)	\
+#define del_page_from_inactive_list(zone, page)	\
 do {						\
 	list_del(&(page)->lru);			\
-	nr_inactive_pages--;			\
+	(zone)->nr_inactive--;			\
 } while (0)
 
 extern spinlock_t swaplock;
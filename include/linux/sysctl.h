@@ -124,6 +124,7 @@ enum
 	KERN_CORE_USES_PID=52,		/* int: use core or core.%pid */
 	KERN_TAINTED=53,	/* int: various kernel tainted flags */
 	KERN_CADPID=54,		/* int: PID of the process to notify on CAD */
+	KERN_PRECISE_TIMEOUTS=55, /* int: end sleeps on the first tick due */
 };
 
 
@@ -143,6 +144,8 @@ enum
 	VM_MAX_MAP_COUNT=11,	/* int: Maximum number of active map areas */
 	VM_MIN_READAHEAD=12,    /* Min file readahead */
 	VM_MAX_READAHEAD=13,    /* Max file readahead */
+	VM_HUGETLB_PAGES=14,	/* int: Number of available huge pages */
+	VM_LAZY_FORK=15,	/* int: don't copy shared mappings on fork */
 };
 
 
@@ -547,6 +550,7 @@ enum
 	FS_LEASES=13,	/* int: leases enabled */
 	FS_DIR_NOTIFY=14,	/* int: directory notification enabled */
 	FS_LEASE_TIME=15,	/* int: maximum time to wait for a lease break */
+	FS_PIPE_USER_PAGES=16,	/* int: pipe pages a user may have */
 };
 
 /* CTL_DEBUG names: */
@@ -4,6 +4,8 @@
 #include <linux/config.h>
 #include <linux/list.h>
 
+struct timer_base;
+
 /*
  * In Linux 2.4, static timers have been removed from the kernel.
  * Timers may be dynamically created and destroyed, and should be initialized
@@ -18,6 +20,7 @@ struct timer_list {
 	unsigned long expires;
 	unsigned long data;
 	void (*function)(unsigned long);
+	struct timer_base *base;	/* CPU wheel it is or was last on */
 };
 
 extern void add_timer(struct timer_list * timer);
@@ -41,10 +44,19 @@ extern void sync_timers(void);
 int mod_timer(struct timer_list *timer, unsigned long expires);
 
 extern void it_real_fn(unsigned long);
+extern void timer_bust_locks(void);
+
+/*
+ * Timeouts for select(), poll() and nanosleep() ending on the first tick
+ * after the time asked for, when precise_timeouts is set.
+ */
+extern int precise_timeouts;
+extern long precise_timeout(unsigned long sec, unsigned long usec);
 
 static inline void init_timer(struct timer_list * timer)
 {
 	timer->list.next = timer->list.prev = NULL;
+	timer->base = NULL;
 }
 
 static inline int timer_pending (const struct timer_list * timer)
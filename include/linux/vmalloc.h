@@ -4,6 +4,7 @@
 #include <linux/sched.h>
 #include <linux/mm.h>
 #include <linux/spinlock.h>
+#include <linux/rbtree.h>
 
 #include <linux/highmem.h>	/* several arch define VMALLOC_END via PKMAP_BASE */
 #include <asm/pgtable.h>
@@ -11,12 +12,17 @@
 /* bits in vm_struct->flags */
 #define VM_IOREMAP	0x00000001	/* ioremap() and friends */
 #define VM_ALLOC	0x00000002	/* vmalloc() */
+#define VM_LAZYFREE	0x00000004	/* vfree()d, waiting for a TLB flush */
 
 struct vm_struct {
 	unsigned long flags;
 	void * addr;
 	unsigned long size;
 	struct vm_struct * next;
+	rb_node_t vm_rb;		/* in the tree of areas, by address */
+	unsigned long gap;		/* free space right below the area */
+	unsigned long max_gap;		/* largest gap in its subtree */
+	struct vm_struct * lazy_next;	/* on the list of lazily freed areas */
 };
 
 extern struct vm_struct * get_vm_area (unsigned long size, unsigned long flags);
@@ -55,8 +61,10 @@ static inline void * vmalloc_32(unsigned long size)
 }
 
 /*
- * vmlist_lock is a read-write spinlock that protects vmlist
- * Used in mm/vmalloc.c (get_vm_area() and vfree()) and fs/proc/kcore.c.
+ * vmlist_lock is a read-write spinlock that protects vmlist and the tree
+ * of areas.  Used in mm/vmalloc.c (get_vm_area() and vfree()) and
+ * fs/proc/kcore.c.  vmlist is sorted by address, and also has the areas
+ * that were freed but whose TLB entries have not been flushed yet.
  */
 extern rwlock_t vmlist_lock;
 
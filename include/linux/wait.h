@@ -28,17 +28,26 @@
 #define WAITQUEUE_DEBUG 0
 #endif
 
+typedef struct __wait_queue wait_queue_t;
+
+/*
+ * Called by __wake_up() for every entry on the queue.  Returns nonzero
+ * if the entry counts as woken for the purposes of exclusive wakeups.
+ */
+typedef int (*wait_queue_func_t)(wait_queue_t *wait, unsigned mode, int sync);
+extern int default_wake_function(wait_queue_t *wait, unsigned mode, int sync);
+
 struct __wait_queue {
 	unsigned int flags;
 #define WQ_FLAG_EXCLUSIVE	0x01
 	struct task_struct * task;
+	wait_queue_func_t func;
 	struct list_head task_list;
 #if WAITQUEUE_DEBUG
 	long __magic;
 	long __waker;
 #endif
 };
-typedef struct __wait_queue wait_queue_t;
 
 /*
  * 'dual' spinlock architecture. Can be switched between spinlock_t and
@@ -136,6 +145,7 @@ struct wait_queue_head_t {
 
 #define __WAITQUEUE_INITIALIZER(name, tsk) {				\
 	task:		tsk,						\
+	func:		default_wake_function,				\
 	task_list:	{ NULL, NULL },					\
 			 __WAITQUEUE_DEBUG_INIT(name)}
 
@@ -172,6 +182,21 @@ static inline void init_waitqueue_entry(wait_queue_t *q, struct task_struct *p)
 #endif
 	q->flags = 0;
 	q->task = p;
+	q->func = default_wake_function;
+#if WAITQUEUE_DEBUG
+	q->__magic = (long)&q->__magic;
+#endif
+}
+
+/*
+ * An entry that runs 'func' on wakeup instead of waking a task.
+ */
+static inline void init_waitqueue_func_entry(wait_queue_t *q,
+					     wait_queue_func_t func)
+{
+	q->flags = 0;
+	q->task = NULL;
+	q->func = func;
 #if WAITQUEUE_DEBUG
 	q->__magic = (long)&q->__magic;
 #endif
@@ -398,6 +398,7 @@ asmlinkage void __init start_kernel(void)
 	vfs_caches_init(num_physpages);
 	buffer_init(num_physpages);
 	page_cache_init(num_physpages);
+	pte_chain_init();
 #if defined(CONFIG_ARCH_S390)
 	ccwcache_init();
 #endif
@@ -22,6 +22,7 @@
 #include <linux/file.h>
 #include <linux/mman.h>
 #include <linux/proc_fs.h>
+#include <linux/hugetlb.h>
 #include <asm/uaccess.h>
 
 #include "util.h"
@@ -43,6 +44,7 @@ struct shmid_kernel /* private to the kernel */
 #define shm_flags	shm_perm.mode
 
 static struct file_operations shm_file_operations;
+static struct file_operations shm_hugetlb_file_operations;
 static struct vm_oprs shm_vm_ops;
 
 static struct ipc_ids shm_ids;
@@ -125,7 +127,8 @@ static void shm_destroy (struct shmid_kernel *shp)
 	shm_tot -= (shp->shm_segsz + PAGE_SIZE - 1) >> PAGE_SHIFT;
 	shm_rmid (shp->id);
 	shm_unlock(shp->id);
-	shmem_lock(shp->shm_file, 0);
+	if (!is_file_hugepages(shp->shm_file))
+		shmem_lock(shp->shm_file, 0);
 	fput (shp->shm_file);
 	kfree (shp);
 }
@@ -159,6 +162,11 @@ static void shm_close (struct vm_area *shmd)
 
 static int shm_mmap(struct file * file, struct vm_area * vma)
 {
+	if (is_file_hugepages(file)) {
+		int error = hugetlbfs_file_mmap(file, vma);
+		if (error)
+			return error;
+	}
 	UPDATE_ATIME(file->f_dentry->d_inode);
 	vma->vm_ops = &shm_vm_ops;
 	shm_inc(file->f_dentry->d_inode->i_ino);
@@ -169,6 +177,11 @@ static struct file_operations shm_file_operations = {
 	mmap:	shm_mmap
 };
 
+static struct file_operations shm_hugetlb_file_operations = {
+	mmap:			shm_mmap,
+	get_unmapped_area:	hugetlb_get_unmapped_area,
+};
+
 static struct vm_oprs shm_vm_ops = {
 	vopen:	shm_open,	/* callback for a new vm-area open */
 	vclose:	shm_close,	/* callback for when the vm-area is released */
@@ -194,7 +207,10 @@ static int newseg (key_t key, int shmflg, size_t size)
 	if (!shp)
 		return -ENOMEM;
 	sprintf (name, "SYSV%08x", key);
-	file = shmem_file_setup(name, size);
+	if (shmflg & SHM_HUGETLB)
+		file = hugetlb_file_setup(name, size);
+	else
+		file = shmem_file_setup(name, size);
 	error = PTR_ERR(file);
 	if (IS_ERR(file))
 		goto no_file;
@@ -214,7 +230,10 @@ static int newseg (key_t key, int shmflg, size_t size)
 	shp->id = shm_buildid(id,shp->shm_perm.seq);
 	shp->shm_file = file;
 	file->f_dentry->d_inode->i_ino = shp->id;
-	file->f_op = &shm_file_operations;
+	if (shmflg & SHM_HUGETLB)
+		file->f_op = &shm_hugetlb_file_operations;
+	else
+		file->f_op = &shm_file_operations;
 	shm_tot += numpages;
 	shm_unlock (id);
 	return shp->id;
@@ -364,6 +383,10 @@ static void shm_get_stat (unsigned long *rss, unsigned long *swp)
 		if(shp == NULL)
 			continue;
 		inode = shp->shm_file->f_dentry->d_inode;
+		if (is_file_hugepages(shp->shm_file)) {
+			*rss += hugetlbfs_nr_pages(inode);
+			continue;
+		}
 		info = SHMEM_I(inode);
 		spin_lock (&info->lock);
 		*rss += inode->i_mapping->nrpages;
@@ -473,11 +496,14 @@ asmlinkage long sys_shmctl (int shmid, int cmd, struct shmid_ds *buf)
 		err = shm_checkid(shp,shmid);
 		if(err)
 			goto out_unlock;
+		/* huge pages are never swapped anyway */
 		if(cmd==SHM_LOCK) {
-			shmem_lock(shp->shm_file, 1);
+			if (!is_file_hugepages(shp->shm_file))
+				shmem_lock(shp->shm_file, 1);
 			shp->shm_flags |= SHM_LOCKED;
 		} else {
-			shmem_lock(shp->shm_file, 0);
+			if (!is_file_hugepages(shp->shm_file))
+				shmem_lock(shp->shm_file, 0);
 			shp->shm_flags &= ~SHM_LOCKED;
 		}
 		shm_unlock(shmid);
@@ -49,6 +49,7 @@ static void release_task(struct task_struct * p)
 		atomic_dec(&p->user->processes);
 		free_uid(p->user);
 		unhash_process(p);
+		detach_pids(p);
 
 		release_thread(p);
 		current->cmin_flt += p->min_flt + p->cmin_flt;
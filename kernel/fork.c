@@ -30,7 +30,6 @@
 
 /* The idle threads do not count.. */
 int nr_threads;
-int nr_running;
 
 int max_threads;
 unsigned long total_forks;	/* Handle normal Linux uptimes. */
@@ -80,65 +79,105 @@ void __init fork_init(unsigned long mempages)
 	init_task.rlim[RLIMIT_NPROC].rlim_max = max_threads/2;
 }
 
-/* Protects next_safe and last_pid. */
+/*
+ * A pid number is busy while some task has it as its pid, thread group,
+ * process group or session.  pid_users[] counts those references and
+ * pid_map has a bit set for every busy number, so get_pid() finds a free
+ * one in the bitmap instead of walking the task list.
+ */
+static unsigned long pid_map[PID_MAX / BITS_PER_LONG];
+static unsigned int pid_users[PID_MAX];
+
+/* Protects last_pid and the pid map. */
 spinlock_t lastpid_lock = SPIN_LOCK_UNLOCKED;
 
-static int get_pid(unsigned long flags)
+static inline void __get_pid_nr(pid_t nr)
 {
-	static int next_safe = PID_MAX;
-	struct task_struct *p;
-	int pid, beginpid;
+	if (!pid_users[nr]++)
+		__set_bit(nr, pid_map);
+}
 
-	if (flags & CLONE_PID)
-		return current->pid;
+static inline void __put_pid_nr(pid_t nr)
+{
+	if (!--pid_users[nr])
+		__clear_bit(nr, pid_map);
+}
+
+static int get_pid(unsigned long flags)
+{
+	int pid;
 
 	spin_lock(&lastpid_lock);
-	beginpid = last_pid;
-	if((++last_pid) & 0xffff8000) {
-		last_pid = 300;		/* Skip daemons etc. */
-		goto inside;
+	if (flags & CLONE_PID) {
+		pid = current->pid;
+		goto out;
 	}
-	if(last_pid >= next_safe) {
-inside:
-		next_safe = PID_MAX;
-		read_lock(&tasklist_lock);
-	repeat:
-		for_each_task(p) {
-			if(p->pid == last_pid	||
-			   p->pgrp == last_pid	||
-			   p->tgid == last_pid	||
-			   p->session == last_pid) {
-				if(++last_pid >= next_safe) {
-					if(last_pid & 0xffff8000)
-						last_pid = 300;
-					next_safe = PID_MAX;
-				}
-				if(unlikely(last_pid == beginpid))
-					goto nomorepids;
-				goto repeat;
-			}
-			if(p->pid > last_pid && next_safe > p->pid)
-				next_safe = p->pid;
-			if(p->pgrp > last_pid && next_safe > p->pgrp)
-				next_safe = p->pgrp;
-			if(p->tgid > last_pid && next_safe > p->tgid)
-				next_safe = p->tgid;
-			if(p->session > last_pid && next_safe > p->session)
-				next_safe = p->session;
-		}
-		read_unlock(&tasklist_lock);
+
+	pid = PID_MAX;
+	if (last_pid + 1 < PID_MAX)
+		pid = find_next_zero_bit(pid_map, PID_MAX, last_pid + 1);
+	if (pid >= PID_MAX) {
+		/* Skip daemons etc. */
+		pid = find_next_zero_bit(pid_map, PID_MAX, 300);
+		if (unlikely(pid >= PID_MAX))
+			goto nomorepids;
 	}
-	pid = last_pid;
+	last_pid = pid;
+out:
+	__get_pid_nr(pid);
 	spin_unlock(&lastpid_lock);
 
 	return pid;
 
 nomorepids:
-	read_unlock(&tasklist_lock);
 	spin_unlock(&lastpid_lock);
 	return 0;
 }
 
+static void put_pid(pid_t pid)
+{
+	spin_lock(&lastpid_lock);
+	__put_pid_nr(pid);
+	spin_unlock(&lastpid_lock);
+}
+
+/*
+ * Take the references of a new task on its thread group, process group
+ * and session, the one on its pid came with get_pid().
+ */
+void attach_pids(struct task_struct *p)
+{
+	spin_lock(&lastpid_lock);
+	__get_pid_nr(p->tgid);
+	__get_pid_nr(p->pgrp);
+	__get_pid_nr(p->session);
+	spin_unlock(&lastpid_lock);
+}
+
+void detach_pids(struct task_struct *p)
+{
+	spin_lock(&lastpid_lock);
+	__put_pid_nr(p->pid);
+	__put_pid_nr(p->tgid);
+	__put_pid_nr(p->pgrp);
+	__put_pid_nr(p->session);
+	spin_unlock(&lastpid_lock);
+}
+
+/*
+ * Point a task's tgid, pgrp or session at another number.  Everything
+ * that changes those after fork() must go through here, or the number
+ * could be handed out again while it is still in use.
+ */
+void change_pid(pid_t *field, pid_t nr)
+{
+	spin_lock(&lastpid_lock);
+	__get_pid_nr(nr);
+	__put_pid_nr(*field);
+	*field = nr;
+	spin_unlock(&lastpid_lock);
+}
+
 static inline int dup_mmap(struct mm_struct * mm)
 {
 	struct vm_area * mpnt, *tmp, **pprev;
@@ -151,7 +190,6 @@ static inline int dup_mmap(struct mm_struct * mm)
 	mm->map_count = 0;
 	mm->rss = 0;
 	mm->cpu_vm_mask = 0;
-	mm->swap_address = 0;
 	pprev = &mm->mmap;
 
 	/*
@@ -275,9 +313,6 @@ inline void __mmdrop(struct mm_struct *mm)
 void mmput(struct mm_struct *mm)
 {
 	if (atomic_dec_and_lock(&mm->mm_users, &mmlist_lock)) {
-		extern struct mm_struct *swap_mm;
-		if (swap_mm == mm)
-			swap_mm = list_entry(mm->mmlist.next, struct mm_struct, mmlist);
 		list_del(&mm->mmlist);
 		mmlist_nr--;
 		spin_unlock(&mmlist_lock);
@@ -640,6 +675,7 @@ int do_fork(unsigned long clone_flags, unsigned long stack_start,
 
 	p->run_list.next = NULL;
 	p->run_list.prev = NULL;
+	p->array = NULL;
 
 	p->p_cptr = NULL;
 	init_waitqueue_head(&p->wait_chldexit);
@@ -681,7 +717,7 @@ int do_fork(unsigned long clone_flags, unsigned long stack_start,
 	retval = -ENOMEM;
 	/* copy all the process information */
 	if (copy_files(clone_flags, p))
-		goto bad_fork_cleanup;
+		goto bad_fork_cleanup_pid;
 	if (copy_fs(clone_flags, p))
 		goto bad_fork_cleanup_files;
 	if (copy_sighand(clone_flags, p))
@@ -743,6 +779,7 @@ int do_fork(unsigned long clone_flags, unsigned long stack_start,
 		list_add(&p->thread_group, &current->thread_group);
 	}
 
+	attach_pids(p);
 	SET_LINKS(p);
 	hash_pid(p);
 	nr_threads++;
@@ -769,6 +806,8 @@ bad_fork_cleanup_fs:
 	exit_fs(p); /* blocking */
 bad_fork_cleanup_files:
 	exit_files(p); /* blocking */
+bad_fork_cleanup_pid:
+	put_pid(p->pid);
 bad_fork_cleanup:
 	put_exec_domain(p->exec_domain);
 	if (p->binfmt && p->binfmt->module)
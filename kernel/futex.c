@@ -0,0 +1,352 @@
+/*
+ *  linux/kernel/futex.c
+ *
+ *  Fast user-space mutexes.
+ *
+ *  A futex is an aligned integer in user memory.  User space takes and
+ *  releases the lock with atomic instructions on that word and only
+ *  enters the kernel when it has to sleep (FUTEX_WAIT) or when there may
+ *  be sleepers to wake up (FUTEX_WAKE).  FUTEX_REQUEUE wakes some waiters
+ *  and moves the rest to another futex without waking them, so that a
+ *  condition variable broadcast does not stampede on the mutex.
+ *
+ *  Waiters are hashed on the physical page and offset of the word, found
+ *  with get_user_pages(), so the same futex is found from every mapping
+ *  of a shared page as well as from a private one.  The page is pinned
+ *  for as long as somebody is waiting on it.
+ */
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/init.h>
+#include <linux/futex.h>
+#include <asm/uaccess.h>
+
+#define FUTEX_HASHBITS	8
+#define FUTEX_HASHSIZE	(1 << FUTEX_HASHBITS)
+
+struct futex_hash_bucket {
+	spinlock_t lock;
+	struct list_head chain;
+} ____cacheline_aligned;
+
+/* A sleeping FUTEX_WAIT caller; lives on its stack */
+struct futex_q {
+	struct list_head list;
+	struct wait_queue_head_t waiters;
+
+	/* Key: pinned page and offset of the word within it */
+	struct page *page;
+	unsigned int offset;
+
+	/* Bucket we are hashed on, changed by FUTEX_REQUEUE */
+	struct futex_hash_bucket *bh;
+};
+
+static struct futex_hash_bucket futex_queues[FUTEX_HASHSIZE];
+
+static inline struct futex_hash_bucket *hash_futex(struct page *page,
+						   unsigned int offset)
+{
+	unsigned long h = (unsigned long) page + offset;
+
+	/* Multiplicative hash, see page_waitqueue() in mm/filemap.c */
+	h *= 0x9e370001UL;
+	return &futex_queues[(h >> (BITS_PER_LONG - FUTEX_HASHBITS)) &
+			     (FUTEX_HASHSIZE - 1)];
+}
+
+/*
+ * Find and pin the page behind a user address.  It is faulted in for
+ * writing, so that a waiter on a futex nobody has stored to yet does not
+ * pin ZERO_PAGE or a page still shared copy-on-write, which the waker's
+ * store would then replace under it.
+ */
+static struct page *pin_page(unsigned long addr)
+{
+	struct mm_struct *mm = current->mm;
+	struct page *page;
+	int err;
+
+	down_read(&mm->mmap_sem);
+	err = get_user_pages(current, mm, addr & PAGE_MASK, 1,
+			     1 /* write */, 0 /* don't force */, &page, NULL);
+	up_read(&mm->mmap_sem);
+
+	if (err < 0)
+		return NULL;
+	return page;
+}
+
+static inline void unpin_page(struct page *page)
+{
+	page_cache_release(page);
+}
+
+/*
+ * Lock the bucket of a queued futex_q.  FUTEX_REQUEUE may move it to
+ * another bucket until we hold the lock, so check and retry.
+ */
+static struct futex_hash_bucket *lock_futex_q(struct futex_q *q)
+{
+	struct futex_hash_bucket *bh;
+
+	for (;;) {
+		bh = q->bh;
+		spin_lock(&bh->lock);
+		if (bh == q->bh)
+			return bh;
+		spin_unlock(&bh->lock);
+	}
+}
+
+static inline void lock_two_buckets(struct futex_hash_bucket *bh1,
+				    struct futex_hash_bucket *bh2)
+{
+	if (bh1 == bh2)
+		spin_lock(&bh1->lock);
+	else if (bh1 < bh2) {
+		spin_lock(&bh1->lock);
+		spin_lock(&bh2->lock);
+	} else {
+		spin_lock(&bh2->lock);
+		spin_lock(&bh1->lock);
+	}
+}
+
+static inline void unlock_two_buckets(struct futex_hash_bucket *bh1,
+				      struct futex_hash_bucket *bh2)
+{
+	spin_unlock(&bh1->lock);
+	if (bh1 != bh2)
+		spin_unlock(&bh2->lock);
+}
+
+/*
+ * Wake up to 'nr' waiters on the given key.  Called with the bucket
+ * lock held; the waiters cannot leave before we drop it.
+ */
+static int __futex_wake(struct futex_hash_bucket *bh, struct page *page,
+			unsigned int offset, int nr)
+{
+	struct list_head *i, *next;
+	int num_woken = 0;
+
+	list_for_each_safe(i, next, &bh->chain) {
+		struct futex_q *this = list_entry(i, struct futex_q, list);
+
+		if (this->page == page && this->offset == offset) {
+			list_del_init(i);
+			wake_up(&this->waiters);
+			if (++num_woken >= nr)
+				break;
+		}
+	}
+	return num_woken;
+}
+
+static int futex_wake(struct page *page, unsigned int offset, int nr)
+{
+	struct futex_hash_bucket *bh = hash_futex(page, offset);
+	int ret;
+
+	spin_lock(&bh->lock);
+	ret = __futex_wake(bh, page, offset, nr);
+	spin_unlock(&bh->lock);
+
+	return ret;
+}
+
+/*
+ * Wake 'nr_wake' waiters on the first key and move up to 'nr_requeue'
+ * of the remaining ones to the second key.  Every waiter holds a
+ * reference on the page of its key, so move those along too.
+ */
+static int futex_requeue(struct page *page1, unsigned int offset1,
+			 struct page *page2, unsigned int offset2,
+			 int nr_wake, int nr_requeue)
+{
+	struct futex_hash_bucket *bh1, *bh2;
+	struct list_head *i, *next;
+	int ret;
+
+	bh1 = hash_futex(page1, offset1);
+	bh2 = hash_futex(page2, offset2);
+
+	lock_two_buckets(bh1, bh2);
+
+	ret = __futex_wake(bh1, page1, offset1, nr_wake);
+	if (nr_requeue <= 0)
+		goto out;
+
+	list_for_each_safe(i, next, &bh1->chain) {
+		struct futex_q *this = list_entry(i, struct futex_q, list);
+
+		if (this->page != page1 || this->offset != offset1)
+			continue;
+
+		list_del(i);
+		list_add_tail(i, &bh2->chain);
+		this->bh = bh2;
+		this->offset = offset2;
+		if (this->page != page2) {
+			/* We hold our own reference on page1: this can't free it */
+			page_cache_get(page2);
+			page_cache_release(this->page);
+			this->page = page2;
+		}
+		ret++;
+		if (--nr_requeue <= 0)
+			break;
+	}
+out:
+	unlock_two_buckets(bh1, bh2);
+	return ret;
+}
+
+static inline void queue_me(struct futex_q *q, struct page *page,
+			    unsigned int offset)
+{
+	struct futex_hash_bucket *bh = hash_futex(page, offset);
+
+	init_waitqueue_head(&q->waiters);
+	q->page = page;
+	q->offset = offset;
+	q->bh = bh;
+
+	spin_lock(&bh->lock);
+	list_add_tail(&q->list, &bh->chain);
+	spin_unlock(&bh->lock);
+}
+
+/* Return 1 if we were still queued (ie. not woken), 0 otherwise */
+static inline int unqueue_me(struct futex_q *q)
+{
+	struct futex_hash_bucket *bh;
+	int ret = 0;
+
+	bh = lock_futex_q(q);
+	if (!list_empty(&q->list)) {
+		list_del(&q->list);
+		ret = 1;
+	}
+	spin_unlock(&bh->lock);
+	return ret;
+}
+
+static int futex_wait(unsigned int *uaddr, struct page *page,
+		      unsigned int offset, int val, unsigned long time)
+{
+	DECLARE_WAITQUEUE(wait, current);
+	struct futex_q q;
+	int ret = 0, curval;
+
+	queue_me(&q, page, offset);
+	add_wait_queue(&q.waiters, &wait);
+
+	/*
+	 * Check the word only after queueing: a FUTEX_WAKE issued after
+	 * user space changed it will find us, and one issued before that
+	 * is answered by the value check.
+	 */
+	if (get_user(curval, uaddr) != 0) {
+		ret = -EFAULT;
+		goto out;
+	}
+	if (curval != val) {
+		ret = -EWOULDBLOCK;
+		goto out;
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	if (!list_empty(&q.list))
+		time = schedule_timeout(time);
+	set_current_state(TASK_RUNNING);
+
+	if (time == 0) {
+		ret = -ETIMEDOUT;
+		goto out;
+	}
+	if (signal_pending(current))
+		ret = -EINTR;
+out:
+	remove_wait_queue(&q.waiters, &wait);
+	/* A wakeup that got here first wins over any error */
+	if (!unqueue_me(&q))
+		ret = 0;
+	/* FUTEX_REQUEUE may have moved us to another page */
+	unpin_page(q.page);
+	return ret;
+}
+
+asmlinkage long sys_futex(unsigned int *uaddr, int op, int val,
+			  struct timespec *utime, unsigned int *uaddr2)
+{
+	unsigned long time = MAX_SCHEDULE_TIMEOUT;
+	unsigned long pos1, pos2;
+	struct page *page1, *page2;
+	int ret;
+
+	if (op == FUTEX_WAIT && utime) {
+		struct timespec t;
+
+		if (copy_from_user(&t, utime, sizeof(t)) != 0)
+			return -EFAULT;
+		if (t.tv_nsec < 0 || t.tv_nsec >= 1000000000L || t.tv_sec < 0)
+			return -EINVAL;
+		time = timespec_to_jiffies(&t) + 1;
+	}
+
+	pos1 = (unsigned long) uaddr;
+	if (pos1 % sizeof(unsigned int))
+		return -EINVAL;
+
+	page1 = pin_page(pos1);
+	if (!page1)
+		return -EFAULT;
+	pos1 &= ~PAGE_MASK;
+
+	switch (op) {
+	case FUTEX_WAIT:
+		/* Drops the page reference */
+		return futex_wait(uaddr, page1, pos1, val, time);
+	case FUTEX_WAKE:
+		ret = futex_wake(page1, pos1, val);
+		break;
+	case FUTEX_REQUEUE:
+		/* The requeue count travels in the timeout argument */
+		pos2 = (unsigned long) uaddr2;
+		ret = -EINVAL;
+		if (pos2 % sizeof(unsigned int))
+			break;
+		ret = -EFAULT;
+		page2 = pin_page(pos2);
+		if (!page2)
+			break;
+		pos2 &= ~PAGE_MASK;
+		ret = futex_requeue(page1, pos1, page2, pos2, val,
+				    (int) (unsigned long) utime);
+		unpin_page(page2);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+	unpin_page(page1);
+
+	return ret;
+}
+
+static int __init init_futex(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < FUTEX_HASHSIZE; i++) {
+		INIT_LIST_HEAD(&futex_queues[i].chain);
+		spin_lock_init(&futex_queues[i].lock);
+	}
+	return 0;
+}
+
+__initcall(init_futex);
@@ -97,8 +97,8 @@ int exec_usermodehelper(char *program_path, char *argv[], char *envp[])
 	int i;
 	struct task_struct *curtask = current;
 
-	curtask->session = 1;
-	curtask->pgrp = 1;
+	change_pid(&curtask->session, 1);
+	change_pid(&curtask->pgrp, 1);
 
 	use_init_fs_context();
 
@@ -81,33 +81,58 @@ struct task_struct * init_tasks[NR_CPUS] = {&init_task, };
 /*
  * The tasklist_lock protects the linked list of processes.
  *
- * The runqueue_lock locks the parts that actually access
- * and change the run-queues, and have to be interrupt-safe.
- *
- * If both locks are to be concurrently held, the runqueue_lock
- * nests inside the tasklist_lock.
+ * Each CPU has its own runqueue, protected by its own lock which
+ * has to be interrupt-safe. A runqueue lock nests inside the
+ * tasklist_lock. If two runqueue locks are to be held at once
+ * they are taken in address order (see double_rq_lock()).
  *
  * task->alloc_lock nests inside tasklist_lock.
  */
-spinlock_t runqueue_lock __cacheline_aligned = SPIN_LOCK_UNLOCKED;  /* inner */
 rwlock_t tasklist_lock __cacheline_aligned = RW_LOCK_UNLOCKED;	/* outer */
 
-static LIST_HEAD(runqueue_head);
+/*
+ * Priority-indexed run-queue arrays. Realtime tasks use priorities
+ * 0..MAX_RT_PRIO-1 (derived from rt_priority), SCHED_OTHER tasks use
+ * MAX_RT_PRIO..MAX_PRIO-1 (derived from the nice value). The bitmap
+ * has one bit per non-empty queue plus a delimiter bit at MAX_PRIO,
+ * so picking the next task is a fixed-size bit search.
+ */
+#define BITMAP_SIZE ((((MAX_PRIO+1+7)/8)+sizeof(long)-1)/sizeof(long))
+
+typedef struct prio_array prio_array_t;
+typedef struct runqueue runqueue_t;
+
+struct prio_array {
+	int nr_active;
+	unsigned long bitmap[BITMAP_SIZE];
+	struct list_head queue[MAX_PRIO];
+};
 
 /*
+ * This is the main, per-CPU runqueue data structure. Runnable tasks
+ * sit in the 'active' array until their time slice (->counter) runs
+ * out, then they move to the 'expired' array with a fresh slice.
+ * When the active array drains the two are switched, which replaces
+ * the old global counter recalculation loop.
+ *
  * We align per-CPU scheduling data on cacheline boundaries,
  * to prevent cacheline ping-pong.
  */
-static union {
-	struct schedule_data {
-		struct task_struct * curr;
-		cycles_t last_schedule;
-	} schedule_data;
-	char __pad [SMP_CACHE_BYTES];
-} aligned_data [NR_CPUS] __cacheline_aligned = { {{&init_task,0}}};
-
-#define cpu_curr(cpu) aligned_data[(cpu)].schedule_data.curr
-#define last_schedule(cpu) aligned_data[(cpu)].schedule_data.last_schedule
+struct runqueue {
+	spinlock_t lock;
+	unsigned long nr_running;
+	struct task_struct *curr, *idle;
+	cycles_t last_schedule;
+	prio_array_t *active, *expired, arrays[2];
+} ____cacheline_aligned;
+
+static struct runqueue runqueues[NR_CPUS] __cacheline_aligned;
+
+#define cpu_rq(cpu)		(runqueues + (cpu))
+#define this_rq()		cpu_rq(smp_processor_id())
+#define task_rq(p)		cpu_rq((p)->processor)
+#define cpu_curr(cpu)		(cpu_rq(cpu)->curr)
+#define last_schedule(cpu)	(cpu_rq(cpu)->last_schedule)
 
 struct kernel_stat kstat;
 extern struct task_struct *child_reaper;
@@ -115,8 +140,20 @@ extern struct task_struct *child_reaper;
 #ifdef CONFIG_SMP
 
 #define idle_task(cpu) (init_tasks[cpu_number_map(cpu)])
-#define can_schedule(p,cpu) \
-	((p)->cpus_runnable & (p)->cpus_allowed & (1 << cpu))
+#define can_schedule(p,cpu) ((p)->cpus_allowed & (1UL << (cpu)))
+
+/*
+ * A task that ran on its CPU less than PROC_CHANGE_PENALTY ticks ago
+ * is considered cache-hot there: the periodic load balancer leaves it
+ * alone, only an idle CPU may pull it over.
+ */
+#define task_hot(p)	((long) (jiffies - (p)->sleep_time) < PROC_CHANGE_PENALTY)
+
+/*
+ * Rebalance an idle CPU every tick, a busy CPU every 200 msecs.
+ */
+#define IDLE_REBALANCE_TICK	(HZ/1000 ?: 1)
+#define BUSY_REBALANCE_TICK	(HZ/5 ?: 1)
 
 #else
 
@@ -128,219 +165,246 @@ extern struct task_struct *child_reaper;
 void scheduling_functions_start_here(void) { }
 
 /*
- * This is the function that decides how desirable a process is..
- * You can weigh different processes against each other depending
- * on what CPU they've run on lately etc to try to handle cache
- * and TLB miss penalties.
+ * Map the scheduling policy and static priority of a task onto its
+ * run-queue index. Lower values run first.
+ */
+static inline int effective_prio(struct task_struct *p)
+{
+	int nice;
+
+	if (p->policy & (SCHED_FIFO | SCHED_RR))
+		return MAX_RT_PRIO-1 - p->rt_priority;
+
+	nice = p->nice;
+	if (nice < -20)
+		nice = -20;
+	if (nice > 19)
+		nice = 19;
+	return MAX_RT_PRIO + 20 + nice;
+}
+
+static inline void dequeue_task(struct task_struct *p, prio_array_t *array)
+{
+	array->nr_active--;
+	list_del(&p->run_list);
+	if (list_empty(array->queue + p->prio))
+		__clear_bit(p->prio, array->bitmap);
+	p->array = NULL;
+}
+
+/*
+ * Careful!
  *
- * Return values:
- *	 -1000: never select this
- *	     0: out of time, recalculate counters (but it might still be
- *		selected)
- *	   +ve: "goodness" value (the larger, the better)
- *	 +1000: realtime process, select this.
+ * This has to add the process to the _end_ of its priority
+ * queue, not the beginning. This is important to get SCHED_FIFO
+ * and SCHED_RR right, where a process that is either pre-empted
+ * or its time slice has expired, should be moved to the tail of
+ * the run queue for its priority - Bhavesh Davda
  */
+static inline void enqueue_task(struct task_struct *p, prio_array_t *array)
+{
+	list_add_tail(&p->run_list, array->queue + p->prio);
+	__set_bit(p->prio, array->bitmap);
+	array->nr_active++;
+	p->array = array;
+}
 
-static inline int goodness(struct task_struct * p, int this_cpu, struct mm_struct *this_mm)
+static inline void activate_task(struct task_struct *p, runqueue_t *rq)
 {
-	int weight;
+	p->prio = effective_prio(p);
+	if (!p->counter)
+		p->counter = NICE_TO_TICKS(p->nice);
+	enqueue_task(p, rq->active);
+	rq->nr_running++;
+}
 
-	/*
-	 * select the current process after every other
-	 * runnable process, but before the idle thread.
-	 * Also, dont trigger a counter recalculation.
-	 */
-	weight = -1;
-	if (p->policy & SCHED_YIELD)
-		goto out;
+static inline void deactivate_task(struct task_struct *p, runqueue_t *rq)
+{
+	rq->nr_running--;
+	p->sleep_time = jiffies;
+	dequeue_task(p, p->array);
+}
 
-	/*
-	 * Non-RT process - normal case first.
-	 */
-	if (p->policy == SCHED_OTHER) {
-		/*
-		 * Give the process a first-approximation goodness value
-		 * according to the number of clock-ticks it has left.
-		 *
-		 * Don't do any other calculations if the time slice is
-		 * over..
-		 */
-		weight = p->counter;
-		if (!weight)
-			goto out;
-			
-#ifdef CONFIG_SMP
-		/* Give a largish advantage to the same processor...   */
-		/* (this is equivalent to penalizing other processors) */
-		if (p->processor == this_cpu)
-			weight += PROC_CHANGE_PENALTY;
-#endif
+/*
+ * A task whose time slice ran out gets a new one. SCHED_RR tasks go
+ * to the end of their priority queue, SCHED_OTHER tasks wait in the
+ * expired array until every other active task had its turn.
+ */
+static inline void expire_task(struct task_struct *p, runqueue_t *rq)
+{
+	prio_array_t *array = p->array;
+
+	if (p->policy == SCHED_FIFO)
+		return;
+	dequeue_task(p, array);
+	p->counter = NICE_TO_TICKS(p->nice);
+	if (p->policy == SCHED_OTHER)
+		array = rq->expired;
+	enqueue_task(p, array);
+}
 
-		/* .. and a slight advantage to the current MM */
-		if (p->mm == this_mm || !p->mm)
-			weight += 1;
-		weight += 20 - p->nice;
-		goto out;
+/*
+ * task_rq_lock - lock the runqueue a given task resides on and disable
+ * interrupts. Note the ordering: we can safely lookup the task_rq without
+ * explicitly disabling preemption.
+ */
+static inline runqueue_t *task_rq_lock(struct task_struct *p, unsigned long *flags)
+{
+	runqueue_t *rq;
+
+repeat_lock_task:
+	local_irq_save(*flags);
+	rq = task_rq(p);
+	spin_lock(&rq->lock);
+	if (unlikely(rq != task_rq(p))) {
+		spin_unlock_irqrestore(&rq->lock, *flags);
+		goto repeat_lock_task;
 	}
+	return rq;
+}
 
-	/*
-	 * Realtime process, select the first one on the
-	 * runqueue (taking priorities within processes
-	 * into account).
-	 */
-	weight = 1000 + p->rt_priority;
-out:
-	return weight;
+static inline void task_rq_unlock(runqueue_t *rq, unsigned long *flags)
+{
+	spin_unlock_irqrestore(&rq->lock, *flags);
 }
 
 /*
- * the 'goodness value' of replacing a process on a given CPU.
- * positive value means 'replace', zero or negative means 'dont'.
+ * Lock two runqueues in address order, so that two CPUs doing this
+ * in opposite directions cannot deadlock. Interrupts must be off.
  */
-static inline int preemption_goodness(struct task_struct * prev, struct task_struct * p, int cpu)
+static inline void double_rq_lock(runqueue_t *rq1, runqueue_t *rq2)
+{
+	if (rq1 == rq2)
+		spin_lock(&rq1->lock);
+	else if (rq1 < rq2) {
+		spin_lock(&rq1->lock);
+		spin_lock(&rq2->lock);
+	} else {
+		spin_lock(&rq2->lock);
+		spin_lock(&rq1->lock);
+	}
+}
+
+static inline void double_rq_unlock(runqueue_t *rq1, runqueue_t *rq2)
 {
-	return goodness(p, cpu, prev->active_mm) - goodness(prev, cpu, prev->active_mm);
+	spin_unlock(&rq1->lock);
+	if (rq1 != rq2)
+		spin_unlock(&rq2->lock);
 }
 
 /*
- * This is ugly, but reschedule_idle() is very timing-critical.
- * We are called with the runqueue spinlock held and we must
- * not claim the tasklist_lock.
+ * Ask the task currently running on some CPU to reschedule.
+ *
+ * If need_resched == -1 then we can skip sending the IPI
+ * altogether, tsk->need_resched is actively watched by the
+ * idle thread.
  */
-static FASTCALL(void reschedule_idle(struct task_struct * p));
-
-static void reschedule_idle(struct task_struct * p)
+static inline void resched_task(struct task_struct *p)
 {
 #ifdef CONFIG_SMP
+	int need_resched;
+
+	need_resched = p->need_resched;
+	p->need_resched = 1;
+	if ((p->processor != smp_processor_id()) && !need_resched)
+		smp_send_reschedule(p->processor);
+#else
+	p->need_resched = 1;
+#endif
+}
+
+#ifdef CONFIG_SMP
+
+static inline int idle_cpu(int cpu)
+{
+	runqueue_t *rq = cpu_rq(cpu);
+
+	return rq->idle && rq->curr == rq->idle && !rq->nr_running;
+}
+
+/*
+ * This is ugly, but wake_target_cpu() is very timing-critical.
+ * It is called without any runqueue lock held, so the answer is
+ * only a hint: the caller locks the runqueues and re-validates.
+ *
+ * It keeps the old reschedule_idle() policy for choosing where a
+ * woken-up task should run: its last CPU if that one is idle (cache
+ * affinity), else the least recently active idle CPU, else its last
+ * CPU, where it will compete at its priority.
+ */
+static int wake_target_cpu(struct task_struct * p, int synchronous)
+{
 	int this_cpu = smp_processor_id();
-	struct task_struct *tsk, *target_tsk;
-	int cpu, best_cpu, i, max_prio;
+	int cpu, best_cpu, target_cpu, i;
 	cycles_t oldest_idle;
 
+	/*
+	 * A synchronous wakeup means the waker is about to sleep,
+	 * so keep the wakee on this CPU.
+	 */
+	if (synchronous && can_schedule(p, this_cpu))
+		return this_cpu;
+
 	/*
 	 * shortcut if the woken up task's last CPU is
 	 * idle now.
 	 */
 	best_cpu = p->processor;
-	if (can_schedule(p, best_cpu)) {
-		tsk = idle_task(best_cpu);
-		if (cpu_curr(best_cpu) == tsk) {
-			int need_resched;
-send_now_idle:
-			/*
-			 * If need_resched == -1 then we can skip sending
-			 * the IPI altogether, tsk->need_resched is
-			 * actively watched by the idle thread.
-			 */
-			need_resched = tsk->need_resched;
-			tsk->need_resched = 1;
-			if ((best_cpu != this_cpu) && !need_resched)
-				smp_send_reschedule(best_cpu);
-			return;
-		}
-	}
+	if (can_schedule(p, best_cpu) && idle_cpu(best_cpu))
+		return best_cpu;
 
 	/*
 	 * We know that the preferred CPU has a cache-affine current
 	 * process, lets try to find a new idle CPU for the woken-up
 	 * process. Select the least recently active idle CPU. (that
-	 * one will have the least active cache context.) Also find
-	 * the executing process which has the least priority.
+	 * one will have the least active cache context.)
 	 */
 	oldest_idle = (cycles_t) -1;
-	target_tsk = NULL;
-	max_prio = 0;
+	target_cpu = -1;
 
 	for (i = 0; i < smp_num_cpus; i++) {
 		cpu = cpu_logical_map(i);
-		if (!can_schedule(p, cpu))
+		if (!can_schedule(p, cpu) || !idle_cpu(cpu))
 			continue;
-		tsk = cpu_curr(cpu);
+#if defined(__i386__) && defined(CONFIG_SMP)
 		/*
-		 * We use the first available idle CPU. This creates
-		 * a priority list between idle CPUs, but this is not
-		 * a problem.
+		 * Check if two siblings are idle in the same
+		 * physical package. Use them if found.
 		 */
-		if (tsk == idle_task(cpu)) {
-#if defined(__i386__) && defined(CONFIG_SMP)
-                        /*
-			 * Check if two siblings are idle in the same
-			 * physical package. Use them if found.
-			 */
-			if (smp_num_siblings == 2) {
-				if (cpu_curr(cpu_sibling_map[cpu]) == 
-			            idle_task(cpu_sibling_map[cpu])) {
-					oldest_idle = last_schedule(cpu);
-					target_tsk = tsk;
-					break;
-				}
-				
-                        }
-#endif		
-			if (last_schedule(cpu) < oldest_idle) {
-				oldest_idle = last_schedule(cpu);
-				target_tsk = tsk;
-			}
-		} else {
-			if (oldest_idle == -1ULL) {
-				int prio = preemption_goodness(tsk, p, cpu);
-
-				if (prio > max_prio) {
-					max_prio = prio;
-					target_tsk = tsk;
-				}
-			}
+		if (smp_num_siblings == 2 && idle_cpu(cpu_sibling_map[cpu])) {
+			target_cpu = cpu;
+			break;
 		}
-	}
-	tsk = target_tsk;
-	if (tsk) {
-		if (oldest_idle != -1ULL) {
-			best_cpu = tsk->processor;
-			goto send_now_idle;
+#endif
+		if (last_schedule(cpu) < oldest_idle) {
+			oldest_idle = last_schedule(cpu);
+			target_cpu = cpu;
 		}
-		tsk->need_resched = 1;
-		if (tsk->processor != this_cpu)
-			smp_send_reschedule(tsk->processor);
 	}
-	return;
-		
+	if (target_cpu >= 0)
+		return target_cpu;
 
-#else /* UP */
-	int this_cpu = smp_processor_id();
-	struct task_struct *tsk;
+	if (can_schedule(p, best_cpu))
+		return best_cpu;
 
-	tsk = cpu_curr(this_cpu);
-	if (preemption_goodness(tsk, p, this_cpu) > 0)
-		tsk->need_resched = 1;
-#endif
+	/* The last CPU is no longer allowed, use the first one that is. */
+	for (i = 0; i < smp_num_cpus; i++) {
+		cpu = cpu_logical_map(i);
+		if (can_schedule(p, cpu) && cpu_rq(cpu)->idle)
+			return cpu;
+	}
+	return best_cpu;
 }
 
-/*
- * Careful!
- *
- * This has to add the process to the _end_ of the 
- * run-queue, not the beginning. The goodness value will
- * determine whether this process will run next. This is
- * important to get SCHED_FIFO and SCHED_RR right, where
- * a process that is either pre-empted or its time slice
- * has expired, should be moved to the tail of the run 
- * queue for its priority - Bhavesh Davda
- */
-static inline void add_to_runqueue(struct task_struct * p)
-{
-	list_add_tail(&p->run_list, &runqueue_head);
-	nr_running++;
-}
+#else
 
-static inline void move_last_runqueue(struct task_struct * p)
-{
-	list_del(&p->run_list);
-	list_add_tail(&p->run_list, &runqueue_head);
-}
+#define wake_target_cpu(p, synchronous)	((p)->processor)
+
+#endif
 
 /*
- * Wake up a process. Put it on the run-queue if it's not
- * already there.  The "current" process is always on the
+ * Wake up a process. Put it on its run-queue if it's not
+ * already there.  The "current" process is always on its
  * run-queue (except when the actual re-schedule is in
  * progress), and as such you're allowed to do the simpler
  * "current->state = TASK_RUNNING" to mark yourself runnable
@@ -349,21 +413,42 @@ static inline void move_last_runqueue(struct task_struct * p)
 static inline int try_to_wake_up(struct task_struct * p, int synchronous)
 {
 	unsigned long flags;
-	int success = 0;
+	int success = 0, cpu;
+	runqueue_t *rq, *target_rq, *new_rq;
+
+repeat:
+	cpu = wake_target_cpu(p, synchronous);
+	target_rq = cpu_rq(cpu);
+	local_irq_save(flags);
+	rq = task_rq(p);
+	double_rq_lock(rq, target_rq);
+	if (unlikely(rq != task_rq(p))) {
+		double_rq_unlock(rq, target_rq);
+		local_irq_restore(flags);
+		goto repeat;
+	}
+	p->state = TASK_RUNNING;
+	if (p->array || p == rq->idle)
+		goto out;
 
 	/*
-	 * We want the common case fall through straight, thus the goto.
+	 * A task that is still switching out on its old CPU
+	 * cannot be moved yet, it is queued where it is.
 	 */
-	spin_lock_irqsave(&runqueue_lock, flags);
-	p->state = TASK_RUNNING;
-	if (task_on_runqueue(p))
-		goto out;
-	add_to_runqueue(p);
-	if (!synchronous || !(p->cpus_allowed & (1 << smp_processor_id())))
-		reschedule_idle(p);
+	new_rq = rq;
+	if (target_rq != rq && !task_has_cpu(p)) {
+		p->processor = cpu;
+		new_rq = target_rq;
+	}
+
+	activate_task(p, new_rq);
+	if ((!synchronous || new_rq != this_rq()) &&
+	    p->prio < new_rq->curr->prio)
+		resched_task(new_rq->curr);
 	success = 1;
 out:
-	spin_unlock_irqrestore(&runqueue_lock, flags);
+	double_rq_unlock(rq, target_rq);
+	local_irq_restore(flags);
 	return success;
 }
 
@@ -372,6 +457,196 @@ inline int wake_up_process(struct task_struct * p)
 	return try_to_wake_up(p, 0);
 }
 
+/*
+ * Take a task that is not running off its run-queue. Used when
+ * a freshly forked task is turned into another CPU's idle thread.
+ */
+void del_from_runqueue(struct task_struct * p)
+{
+	unsigned long flags;
+	runqueue_t *rq;
+
+	rq = task_rq_lock(p, &flags);
+	if (p->array)
+		deactivate_task(p, rq);
+	task_rq_unlock(rq, &flags);
+}
+
+/*
+ * Number of runnable tasks on all run-queues.
+ */
+unsigned long nr_running(void)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++)
+		sum += cpu_rq(cpu_logical_map(i))->nr_running;
+	return sum;
+}
+
+#ifdef CONFIG_SMP
+
+/*
+ * Move a queued task from a remote runqueue to the local one.
+ * Both runqueues must be locked.
+ */
+static inline void pull_task(runqueue_t *src_rq, prio_array_t *src_array,
+			     struct task_struct *p, runqueue_t *this_rq,
+			     int this_cpu)
+{
+	dequeue_task(p, src_array);
+	src_rq->nr_running--;
+	p->processor = this_cpu;
+	this_rq->nr_running++;
+	enqueue_task(p, this_rq->active);
+	/*
+	 * Note that idle threads have a prio of MAX_PRIO, for this test
+	 * to be always true for them.
+	 */
+	if (p->prio < this_rq->curr->prio)
+		this_rq->curr->need_resched = 1;
+}
+
+/*
+ * Current runqueue is empty, or rebalance tick: if there is an
+ * imbalance (current runqueue is too short) then pull from the
+ * busiest runqueue(s).
+ *
+ * We call this with the current runqueue locked,
+ * interrupts disabled.
+ */
+static void load_balance(runqueue_t *this_rq, int idle)
+{
+	int this_cpu = smp_processor_id();
+	int imbalance, this_load, load, max_load, idx, i;
+	runqueue_t *busiest, *rq_src;
+	prio_array_t *array;
+	struct list_head *head, *curr;
+	struct task_struct *tmp;
+
+	/*
+	 * Find the busiest runqueue. The task that is running on
+	 * it counts, but cannot be moved.
+	 */
+	this_load = this_rq->nr_running;
+	busiest = NULL;
+	max_load = 1;
+	for (i = 0; i < smp_num_cpus; i++) {
+		rq_src = cpu_rq(cpu_logical_map(i));
+		if (rq_src == this_rq)
+			continue;
+		load = rq_src->nr_running;
+		if (load > max_load) {
+			max_load = load;
+			busiest = rq_src;
+		}
+	}
+	if (!busiest)
+		return;
+
+	imbalance = (max_load - this_load) / 2;
+
+	/* It needs an at least ~25% imbalance to trigger balancing. */
+	if (imbalance < (idle ? 1 : (max_load + 3) / 4))
+		return;
+
+	/*
+	 * We take the runqueue locks in address order, which may
+	 * mean dropping ours for a moment.
+	 */
+	if (busiest < this_rq) {
+		spin_unlock(&this_rq->lock);
+		spin_lock(&busiest->lock);
+		spin_lock(&this_rq->lock);
+	} else
+		spin_lock(&busiest->lock);
+
+	/* Things might have changed while we were unlocked. */
+	if (busiest->nr_running <= this_rq->nr_running + 1)
+		goto out_unlock;
+
+	/*
+	 * We first consider expired tasks. Those will likely not be
+	 * executed in the near future, and they are most likely to
+	 * be cache-cold, thus switching CPUs has the least effect
+	 * on them.
+	 */
+	if (busiest->expired->nr_active)
+		array = busiest->expired;
+	else
+		array = busiest->active;
+
+new_array:
+	/* Start searching at priority 0: */
+	idx = 0;
+skip_bitmap:
+	if (!idx)
+		idx = sched_find_first_bit(array->bitmap);
+	else
+		idx = find_next_bit(array->bitmap, MAX_PRIO, idx);
+	if (idx >= MAX_PRIO) {
+		if (array == busiest->expired) {
+			array = busiest->active;
+			goto new_array;
+		}
+		goto out_unlock;
+	}
+
+	head = array->queue + idx;
+	curr = head->prev;
+skip_queue:
+	tmp = list_entry(curr, struct task_struct, run_list);
+
+	/*
+	 * We do not migrate tasks that are:
+	 * 1) running (or still switching out) on their CPU,
+	 * 2) not allowed to run on this CPU,
+	 * 3) cache-hot on their current CPU, unless we are idle.
+	 */
+	curr = curr->prev;
+	if (task_has_cpu(tmp) || tmp == busiest->curr ||
+	    !can_schedule(tmp, this_cpu) || (!idle && task_hot(tmp))) {
+		if (curr != head)
+			goto skip_queue;
+		idx++;
+		goto skip_bitmap;
+	}
+	pull_task(busiest, array, tmp, this_rq, this_cpu);
+	if (--imbalance > 0) {
+		if (curr != head)
+			goto skip_queue;
+		idx++;
+		goto skip_bitmap;
+	}
+out_unlock:
+	spin_unlock(&busiest->lock);
+}
+
+/*
+ * Called from update_process_times() on every timer tick. An idle
+ * CPU tries to pull work every tick, a busy one every 200 msecs.
+ */
+void rebalance_tick(int idle)
+{
+	runqueue_t *rq = this_rq();
+	unsigned long flags;
+
+	if (jiffies % (idle ? IDLE_REBALANCE_TICK : BUSY_REBALANCE_TICK))
+		return;
+	spin_lock_irqsave(&rq->lock, flags);
+	load_balance(rq, idle);
+	spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+#else
+
+void rebalance_tick(int idle)
+{
+}
+
+#endif /* CONFIG_SMP */
+
 static void process_timeout(unsigned long __data)
 {
 	struct task_struct * p = (struct task_struct *) __data;
@@ -465,22 +740,6 @@ signed long schedule_timeout(signed long timeout)
 static inline void __schedule_tail(struct task_struct *prev)
 {
 #ifdef CONFIG_SMP
-	int policy;
-
-	/*
-	 * prev->policy can be written from here only before `prev'
-	 * can be scheduled (before setting prev->cpus_runnable to ~0UL).
-	 * Of course it must also be read before allowing prev
-	 * to be rescheduled, but since the write depends on the read
-	 * to complete, wmb() is enough. (the spin_lock() acquired
-	 * before setting cpus_runnable is not enough because the spin_lock()
-	 * common code semantics allows code outside the critical section
-	 * to enter inside the critical section)
-	 */
-	policy = prev->policy;
-	prev->policy = policy & ~SCHED_YIELD;
-	wmb();
-
 	/*
 	 * fast path falls through. We have to clear cpus_runnable before
 	 * checking prev->state to avoid a wakeup race. Protect against
@@ -489,43 +748,23 @@ static inline void __schedule_tail(struct task_struct *prev)
 	task_lock(prev);
 	task_release_cpu(prev);
 	mb();
-	if (prev->state == TASK_RUNNING)
-		goto needs_resched;
+	if (prev->state == TASK_RUNNING && !prev->array)
+		goto needs_requeue;
 
 out_unlock:
 	task_unlock(prev);	/* Synchronise here with release_task() if prev is TASK_ZOMBIE */
 	return;
 
 	/*
-	 * Slow path - we 'push' the previous process and
-	 * reschedule_idle() will attempt to find a new
-	 * processor for it. (but it might preempt the
-	 * current process as well.) We must take the runqueue
-	 * lock and re-check prev->state to be correct. It might
-	 * still happen that this process has a preemption
-	 * 'in progress' already - but this is not a problem and
-	 * might happen in other circumstances as well.
+	 * Slow path - schedule() took a runnable 'prev' off this
+	 * CPU's run-queue because it is no longer allowed to run
+	 * here (->cpus_allowed changed). Now that it is off the
+	 * CPU we can queue it on one where it may run.
 	 */
-needs_resched:
-	{
-		unsigned long flags;
-
-		/*
-		 * Avoid taking the runqueue lock in cases where
-		 * no preemption-check is necessery:
-		 */
-		if ((prev == idle_task(smp_processor_id())) ||
-						(policy & SCHED_YIELD))
-			goto out_unlock;
-
-		spin_lock_irqsave(&runqueue_lock, flags);
-		if ((prev->state == TASK_RUNNING) && !task_has_cpu(prev))
-			reschedule_idle(prev);
-		spin_unlock_irqrestore(&runqueue_lock, flags);
-		goto out_unlock;
-	}
-#else
-	prev->policy &= ~SCHED_YIELD;
+needs_requeue:
+	if (prev != idle_task(smp_processor_id()))
+		try_to_wake_up(prev, 0);
+	goto out_unlock;
 #endif /* CONFIG_SMP */
 }
 
@@ -535,8 +774,9 @@ asmlinkage void schedule_tail(struct task_struct *prev)
 }
 
 /*
- *  'schedule()' is the scheduler function. It's a very simple and nice
- * scheduler: it's not perfect, but certainly works for most things.
+ *  'schedule()' is the scheduler function. It picks the first task
+ * of the highest priority non-empty queue of this CPU's active array,
+ * so its cost does not depend on the number of runnable tasks.
  *
  * The goto is "interesting".
  *
@@ -546,13 +786,11 @@ asmlinkage void schedule_tail(struct task_struct *prev)
  */
 asmlinkage void schedule(void)
 {
-	struct schedule_data * sched_data;
-	struct task_struct *prev, *next, *p;
-	struct list_head *tmp;
-	int this_cpu, c;
-
-
-	spin_lock_prefetch(&runqueue_lock);
+	struct task_struct *prev, *next;
+	runqueue_t *rq;
+	prio_array_t *array;
+	struct list_head *queue;
+	int this_cpu, idx;
 
 	BUG_ON(!current->active_mm);
 need_resched_back:
@@ -566,20 +804,15 @@ need_resched_back:
 
 	release_kernel_lock(prev, this_cpu);
 
-	/*
-	 * 'sched_data' is protected by the fact that we can run
-	 * only one process per CPU.
-	 */
-	sched_data = & aligned_data[this_cpu].schedule_data;
+	rq = cpu_rq(this_cpu);
+	spin_lock_irq(&rq->lock);
 
-	spin_lock_irq(&runqueue_lock);
+	/* SCHED_YIELD only lasts for one re-schedule */
+	prev->policy &= ~SCHED_YIELD;
 
-	/* move an exhausted RR process to be last.. */
-	if (unlikely(prev->policy == SCHED_RR))
-		if (!prev->counter) {
-			prev->counter = NICE_TO_TICKS(prev->nice);
-			move_last_runqueue(prev);
-		}
+	/* give an exhausted process a new time slice.. */
+	if (unlikely(!prev->counter) && prev->array)
+		expire_task(prev, rq);
 
 	switch (prev->state) {
 		case TASK_INTERRUPTIBLE:
@@ -588,57 +821,61 @@ need_resched_back:
 				break;
 			}
 		default:
-			del_from_runqueue(prev);
+			if (prev->array)
+				deactivate_task(prev, rq);
 		case TASK_RUNNING:;
 	}
+#ifdef CONFIG_SMP
+	/*
+	 * prev may not run here any more; __schedule_tail() will
+	 * queue it on an allowed CPU once it is switched out.
+	 */
+	if (unlikely(!can_schedule(prev, this_cpu)) && prev->array)
+		deactivate_task(prev, rq);
+#endif
 	prev->need_resched = 0;
 
 	/*
 	 * this is the scheduler proper:
 	 */
 
-repeat_schedule:
-	/*
-	 * Default process to select..
-	 */
-	next = idle_task(this_cpu);
-	c = -1000;
-	list_for_each(tmp, &runqueue_head) {
-		p = list_entry(tmp, struct task_struct, run_list);
-		if (can_schedule(p, this_cpu)) {
-			int weight = goodness(p, this_cpu, prev->active_mm);
-			if (weight > c)
-				c = weight, next = p;
-		}
+pick_next_task:
+	if (unlikely(!rq->nr_running)) {
+#ifdef CONFIG_SMP
+		load_balance(rq, 1);
+		if (rq->nr_running)
+			goto pick_next_task;
+#endif
+		next = rq->idle;
+		goto switch_tasks;
 	}
 
-	/* Do we need to re-calculate counters? */
-	if (unlikely(!c)) {
-		struct task_struct *p;
-
-		spin_unlock_irq(&runqueue_lock);
-		read_lock(&tasklist_lock);
-		for_each_task(p)
-			p->counter = (p->counter >> 1) + NICE_TO_TICKS(p->nice);
-		read_unlock(&tasklist_lock);
-		spin_lock_irq(&runqueue_lock);
-		goto repeat_schedule;
+	array = rq->active;
+	if (unlikely(!array->nr_active)) {
+		/*
+		 * Switch the active and expired arrays.
+		 */
+		rq->active = rq->expired;
+		rq->expired = array;
+		array = rq->active;
 	}
 
+	idx = sched_find_first_bit(array->bitmap);
+	queue = array->queue + idx;
+	next = list_entry(queue->next, struct task_struct, run_list);
+
+switch_tasks:
 	/*
 	 * from this point on nothing can prevent us from
 	 * switching to the next task, save this fact in
-	 * sched_data.
+	 * the runqueue.
 	 */
-	sched_data->curr = next;
+	rq->curr = next;
 	task_set_cpu(next, this_cpu);
-	spin_unlock_irq(&runqueue_lock);
+	spin_unlock_irq(&rq->lock);
 
-	if (unlikely(prev == next)) {
-		/* We won't go through the normal tail, so do this by hand */
-		prev->policy &= ~SCHED_YIELD;
+	if (unlikely(prev == next))
 		goto same_process;
-	}
 
 #ifdef CONFIG_SMP
  	/*
@@ -648,16 +885,19 @@ repeat_schedule:
 	 * and it's approximate, so we do not have to maintain
 	 * it while holding the runqueue spinlock.
  	 */
- 	sched_data->last_schedule = get_cycles();
+ 	rq->last_schedule = get_cycles();
 
 	/*
-	 * We drop the scheduler lock early (it's a global spinlock),
-	 * thus we have to lock the previous process from getting
-	 * rescheduled during switch_to().
+	 * We drop the runqueue lock early, thus we have to lock
+	 * the previous process from getting rescheduled during
+	 * switch_to().
 	 */
 
 #endif /* CONFIG_SMP */
 
+	/* the load balancer uses this to judge cache affinity */
+	prev->sleep_time = jiffies;
+
 	kstat.context_swtch++;
 	/*
 	 * there are 3 processes which are affected by a context switch:
@@ -711,27 +951,31 @@ same_process:
  * started to run but is not in state TASK_RUNNING.  try_to_wake_up() returns zero
  * in this (rare) case, and we handle it by contonuing to scan the queue.
  */
+int default_wake_function(wait_queue_t *curr, unsigned mode, int sync)
+{
+	struct task_struct *p = curr->task;
+
+	if (!(p->state & mode))
+		return 0;
+	WQ_NOTE_WAKER(curr);
+	return try_to_wake_up(p, sync);
+}
+
 static inline void __wake_up_common (struct wait_queue_head_t *q, unsigned int mode,
 			 	     int nr_exclusive, const int sync)
 {
-	struct list_head *tmp;
-	struct task_struct *p;
+	struct list_head *tmp, *next;
 
 	CHECK_MAGIC_WQHEAD(q);
 	WQ_CHECK_LIST_HEAD(&q->task_list);
 	
-	list_for_each(tmp,&q->task_list) {
-		unsigned int state;
+	list_for_each_safe(tmp, next, &q->task_list) {
                 wait_queue_t *curr = list_entry(tmp, wait_queue_t, task_list);
+		unsigned int flags = curr->flags;
 
 		CHECK_MAGIC(curr->__magic);
-		p = curr->task;
-		state = p->state;
-		if (state & mode) {
-			WQ_NOTE_WAKER(curr);
-			if (try_to_wake_up(p, sync) && (curr->flags&WQ_FLAG_EXCLUSIVE) && !--nr_exclusive)
-				break;
-		}
+		if (curr->func(curr, mode, sync) && (flags&WQ_FLAG_EXCLUSIVE) && !--nr_exclusive)
+			break;
 	}
 }
 
@@ -850,6 +1094,45 @@ long sleep_on_timeout(struct wait_queue_head_t *q, long timeout)
 
 void scheduling_functions_end_here(void) { }
 
+/*
+ * Change the nice value of a task.  A queued task moves to the queue
+ * of its new priority right away; it would only be requeued there the
+ * next time it wakes up otherwise.  Real-time tasks are ordered by
+ * rt_priority, for them nice only sets the time slice.
+ */
+void set_user_nice(struct task_struct *p, long nice)
+{
+	unsigned long flags;
+	prio_array_t *array;
+	runqueue_t *rq;
+	int old_prio;
+
+	rq = task_rq_lock(p, &flags);
+	if (p->policy & (SCHED_FIFO | SCHED_RR)) {
+		p->nice = nice;
+		goto out_unlock;
+	}
+	array = p->array;
+	if (array)
+		dequeue_task(p, array);
+	old_prio = p->prio;
+	p->nice = nice;
+	p->prio = effective_prio(p);
+	if (array) {
+		enqueue_task(p, array);
+		/*
+		 * A task that got more important may preempt the
+		 * current one; the current one may have to give way
+		 * if it got less important.
+		 */
+		if (p->prio < old_prio ||
+		    (p->prio > old_prio && rq->curr == p))
+			resched_task(rq->curr);
+	}
+out_unlock:
+	task_rq_unlock(rq, &flags);
+}
+
 #ifndef __alpha__
 
 /*
@@ -881,7 +1164,7 @@ asmlinkage long sys_nice(int increment)
 		newprio = -20;
 	if (newprio > 19)
 		newprio = 19;
-	current->nice = newprio;
+	set_user_nice(current, newprio);
 	return 0;
 }
 
@@ -901,6 +1184,9 @@ static int setscheduler(pid_t pid, int policy,
 {
 	struct sched_param lp;
 	struct task_struct *p;
+	prio_array_t *array;
+	unsigned long flags;
+	runqueue_t *rq;
 	int retval;
 
 	retval = -EINVAL;
@@ -915,13 +1201,18 @@ static int setscheduler(pid_t pid, int policy,
 	 * We play safe to avoid deadlocks.
 	 */
 	read_lock_irq(&tasklist_lock);
-	spin_lock(&runqueue_lock);
 
 	p = find_process_by_pid(pid);
 
 	retval = -ESRCH;
 	if (!p)
-		goto out_unlock;
+		goto out_unlock_tasklist;
+
+	/*
+	 * To be able to change p->policy safely, the apropriate
+	 * runqueue lock must be held.
+	 */
+	rq = task_rq_lock(p, &flags);
 			
 	if (policy < 0)
 		policy = p->policy;
@@ -950,14 +1241,23 @@ static int setscheduler(pid_t pid, int policy,
 	    !capable(CAP_SYS_NICE))
 		goto out_unlock;
 
+	/*
+	 * A queued task has to be requeued at its new priority.
+	 */
+	array = p->array;
+	if (array)
+		deactivate_task(p, rq);
 	retval = 0;
 	p->policy = policy;
 	p->rt_priority = lp.sched_priority;
+	if (array)
+		activate_task(p, rq);
 
-	current->need_resched = 1;
+	resched_task(rq->curr);
 
 out_unlock:
-	spin_unlock(&runqueue_lock);
+	task_rq_unlock(rq, &flags);
+out_unlock_tasklist:
 	read_unlock_irq(&tasklist_lock);
 
 out_nounlock:
@@ -1028,42 +1328,29 @@ out_unlock:
 
 asmlinkage long sys_sched_yield(void)
 {
+	runqueue_t *rq = this_rq();
+	prio_array_t *array;
+
 	/*
-	 * Trick. sched_yield() first counts the number of truly 
-	 * 'pending' runnable processes, then returns if it's
-	 * only the current processes. (This test does not have
-	 * to be atomic.) In threaded applications this optimization
-	 * gets triggered quite often.
+	 * Trick. If we are the only runnable process on this CPU
+	 * there is nobody to yield to. In threaded applications
+	 * this optimization gets triggered quite often.
 	 */
-
-	int nr_pending = nr_running;
-
-#if CONFIG_SMP
-	int i;
-
-	// Subtract non-idle processes running on other CPUs.
-	for (i = 0; i < smp_num_cpus; i++) {
-		int cpu = cpu_logical_map(i);
-		if (aligned_data[cpu].schedule_data.curr != idle_task(cpu))
-			nr_pending--;
-	}
-#else
-	// on UP this process is on the runqueue as well
-	nr_pending--;
-#endif
-	if (nr_pending) {
+	spin_lock_irq(&rq->lock);
+	array = current->array;
+	if (rq->nr_running > 1 && array) {
 		/*
-		 * This process can only be rescheduled by us,
-		 * so this is safe without any locking.
+		 * SCHED_OTHER processes go behind every other runnable
+		 * process by moving to the expired array, realtime ones
+		 * only to the end of their priority queue.
 		 */
+		dequeue_task(current, array);
 		if (current->policy == SCHED_OTHER)
-			current->policy |= SCHED_YIELD;
+			array = rq->expired;
+		enqueue_task(current, array);
 		current->need_resched = 1;
-
-		spin_lock_irq(&runqueue_lock);
-		move_last_runqueue(current);
-		spin_unlock_irq(&runqueue_lock);
 	}
+	spin_unlock_irq(&rq->lock);
 	return 0;
 }
 
@@ -1259,9 +1546,10 @@ void reparent_to_init(void)
 	/* Set the exit signal to SIGCHLD so we signal init on exit */
 	this_task->exit_signal = SIGCHLD;
 
-	/* We also take the runqueue_lock while altering task fields
-	 * which affect scheduling decisions */
-	spin_lock(&runqueue_lock);
+	/* We also take the runqueue lock while altering task fields
+	 * which affect scheduling decisions. They take effect the
+	 * next time the task is queued. */
+	spin_lock(&this_rq()->lock);
 
 	this_task->ptrace = 0;
 	this_task->nice = DEF_NICE;
@@ -1276,7 +1564,7 @@ void reparent_to_init(void)
 	memcpy(this_task->rlim, init_task.rlim, sizeof(*(this_task->rlim)));
 	this_task->user = INIT_USER;
 
-	spin_unlock(&runqueue_lock);
+	spin_unlock(&this_rq()->lock);
 	write_unlock_irq(&tasklist_lock);
 }
 
@@ -1297,8 +1585,8 @@ void daemonize(void)
 	 */
 	exit_mm(current);
 
-	current->session = 1;
-	current->pgrp = 1;
+	change_pid(&current->session, 1);
+	change_pid(&current->pgrp, 1);
 	current->tty = NULL;
 
 	/* Become as one with the init task */
@@ -1316,16 +1604,20 @@ extern unsigned long wait_init_idle;
 
 void __init init_idle(void)
 {
-	struct schedule_data * sched_data;
-	sched_data = &aligned_data[smp_processor_id()].schedule_data;
+	runqueue_t *rq = this_rq();
 
-	if (current != &init_task && task_on_runqueue(current)) {
+	spin_lock_irq(&rq->lock);
+	if (task_on_runqueue(current)) {
 		printk("UGH! (%d:%d) was on the runqueue, removing.\n",
 			smp_processor_id(), current->pid);
-		del_from_runqueue(current);
+		deactivate_task(current, rq);
 	}
-	sched_data->curr = current;
-	sched_data->last_schedule = get_cycles();
+	/* the idle thread is never queued and loses against everybody */
+	current->prio = MAX_PRIO;
+	rq->curr = rq->idle = current;
+	rq->last_schedule = get_cycles();
+	task_set_cpu(current, smp_processor_id());
+	spin_unlock_irq(&rq->lock);
 	clear_bit(current->processor, &wait_init_idle);
 }
 
@@ -1338,9 +1630,33 @@ void __init sched_init(void)
 	 * process right in SMP mode.
 	 */
 	int cpu = smp_processor_id();
-	int nr;
+	int nr, i, j, k;
+	runqueue_t *rq;
+	prio_array_t *array;
+
+	for (i = 0; i < NR_CPUS; i++) {
+		rq = cpu_rq(i);
+		rq->active = rq->arrays;
+		rq->expired = rq->arrays + 1;
+		spin_lock_init(&rq->lock);
+
+		for (j = 0; j < 2; j++) {
+			array = rq->arrays + j;
+			for (k = 0; k < MAX_PRIO; k++)
+				INIT_LIST_HEAD(array->queue + k);
+			memset(array->bitmap, 0, BITMAP_SIZE * sizeof(long));
+			/* delimiter for bitsearch */
+			__set_bit(MAX_PRIO, array->bitmap);
+		}
+	}
 
+	/*
+	 * Until init_idle() the boot thread is the idle thread of
+	 * this CPU: it runs whenever nothing else is runnable.
+	 */
 	init_task.processor = cpu;
+	rq = cpu_rq(cpu);
+	rq->curr = rq->idle = current;
 
 	for(nr = 0; nr < PIDHASH_SZ; nr++)
 		pidhash[nr] = NULL;
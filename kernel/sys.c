@@ -223,7 +223,7 @@ asmlinkage long sys_setpriority(int which, int who, int niceval)
 		if (niceval < p->nice && !capable(CAP_SYS_NICE))
 			error = -EACCES;
 		else
-			p->nice = niceval;
+			set_user_nice(p, niceval);
 	}
 	read_unlock(&tasklist_lock);
 
@@ -861,7 +861,7 @@ asmlinkage long sys_setpgid(pid_t pid, pid_t pgid)
 	}
 
 ok_pgid:
-	p->pgrp = pgid;
+	change_pid(&p->pgrp, pgid);
 	err = 0;
 out:
 	/* All paths lead to here, thus we are safe. -DaveM */
@@ -925,7 +925,8 @@ asmlinkage long sys_setsid(void)
 	}
 
 	current->leader = 1;
-	current->session = current->pgrp = current->pid;
+	change_pid(&current->session, current->pid);
+	change_pid(&current->pgrp, current->pid);
 	current->tty = NULL;
 	current->tty_old_pgrp = 0;
 	err = current->pgrp;
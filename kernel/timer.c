@@ -22,6 +22,7 @@
 #include <linux/smp_lock.h>
 #include <linux/interrupt.h>
 #include <linux/kernel_stat.h>
+#include <linux/brlock.h>
 
 #include <asm/uaccess.h>
 
@@ -91,67 +92,97 @@ struct timer_vec_root {
 	struct list_head vec[TVR_SIZE];
 };
 
-static struct timer_vec tv5;
-static struct timer_vec tv4;
-static struct timer_vec tv3;
-static struct timer_vec tv2;
-static struct timer_vec_root tv1;
+/*
+ * Each CPU has a wheel of its own.  A timer is queued on the CPU that
+ * armed it and run there from TIMER_SOFTIRQ, so neither the lock nor
+ * the lists bounce between CPUs in the common case.  timer->base says
+ * which wheel a timer is on, or was last on; a timer that was never
+ * queued belongs to the boot CPU's wheel, so that there is always one
+ * lock to serialize against.
+ */
+struct timer_base {
+	spinlock_t lock;
+	unsigned long timer_jiffies;
+	struct timer_list *running_timer;
+	struct list_head *run_timer_list_running;
+	struct timer_vec_root tv1;
+	struct timer_vec tv2;
+	struct timer_vec tv3;
+	struct timer_vec tv4;
+	struct timer_vec tv5;
+} ____cacheline_aligned;
 
-static struct timer_vec * const tvecs[] = {
-	(struct timer_vec *)&tv1, &tv2, &tv3, &tv4, &tv5
-};
+static struct timer_base timer_bases[NR_CPUS];
 
-static struct list_head * run_timer_list_running;
+#define timer_base(t)	((t)->base ? (t)->base : &timer_bases[0])
 
-#define NOOF_TVECS (sizeof(tvecs) / sizeof(tvecs[0]))
+static void run_timer_softirq(struct softirq_action *h);
 
 void init_timervecs (void)
 {
-	int i;
+	int cpu, i;
 
-	for (i = 0; i < TVN_SIZE; i++) {
-		INIT_LIST_HEAD(tv5.vec + i);
-		INIT_LIST_HEAD(tv4.vec + i);
-		INIT_LIST_HEAD(tv3.vec + i);
-		INIT_LIST_HEAD(tv2.vec + i);
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct timer_base *base = timer_bases + cpu;
+
+		spin_lock_init(&base->lock);
+		base->timer_jiffies = jiffies;
+		for (i = 0; i < TVN_SIZE; i++) {
+			INIT_LIST_HEAD(base->tv5.vec + i);
+			INIT_LIST_HEAD(base->tv4.vec + i);
+			INIT_LIST_HEAD(base->tv3.vec + i);
+			INIT_LIST_HEAD(base->tv2.vec + i);
+		}
+		for (i = 0; i < TVR_SIZE; i++)
+			INIT_LIST_HEAD(base->tv1.vec + i);
 	}
-	for (i = 0; i < TVR_SIZE; i++)
-		INIT_LIST_HEAD(tv1.vec + i);
+	open_softirq(TIMER_SOFTIRQ, run_timer_softirq, NULL);
 }
 
-static unsigned long timer_jiffies;
+/*
+ * Unlock the timer wheels for an oops, the console unblank code takes
+ * them.
+ */
+void timer_bust_locks(void)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		spin_lock_init(&timer_bases[cpu].lock);
+}
 
-static inline void internal_add_timer(struct timer_list *timer)
+static inline void internal_add_timer(struct timer_base *base,
+				      struct timer_list *timer)
 {
 	/*
-	 * must be cli-ed when calling this
+	 * must be called with base->lock held
 	 */
 	unsigned long expires = timer->expires;
-	unsigned long idx = expires - timer_jiffies;
+	unsigned long idx = expires - base->timer_jiffies;
 	struct list_head * vec;
 
-	if (run_timer_list_running)
-		vec = run_timer_list_running;
+	if (base->run_timer_list_running)
+		vec = base->run_timer_list_running;
 	else if (idx < TVR_SIZE) {
 		int i = expires & TVR_MASK;
-		vec = tv1.vec + i;
+		vec = base->tv1.vec + i;
 	} else if (idx < 1 << (TVR_BITS + TVN_BITS)) {
 		int i = (expires >> TVR_BITS) & TVN_MASK;
-		vec = tv2.vec + i;
+		vec = base->tv2.vec + i;
 	} else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS)) {
 		int i = (expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK;
-		vec =  tv3.vec + i;
+		vec = base->tv3.vec + i;
 	} else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS)) {
 		int i = (expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK;
-		vec = tv4.vec + i;
+		vec = base->tv4.vec + i;
 	} else if ((signed long) idx < 0) {
 		/* can happen if you add a timer with expires == jiffies,
 		 * or you set a timer to go off in the past
 		 */
-		vec = tv1.vec + tv1.index;
+		vec = base->tv1.vec + base->tv1.index;
 	} else if (idx <= 0xffffffffUL) {
 		int i = (expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK;
-		vec = tv5.vec + i;
+		vec = base->tv5.vec + i;
 	} else {
 		/* Can only get here on architectures with 64-bit jiffies */
 		INIT_LIST_HEAD(&timer->list);
@@ -163,34 +194,33 @@ static inline void internal_add_timer(struct timer_list *timer)
 	list_add(&timer->list, vec->prev);
 }
 
-/* Initialize both explicitly - let's try to have them in the same cache line */
-spinlock_t timerlist_lock = SPIN_LOCK_UNLOCKED;
-
 #ifdef CONFIG_SMP
-volatile struct timer_list * volatile running_timer;
-#define timer_enter(t) do { running_timer = t; mb(); } while (0)
-#define timer_exit() do { running_timer = NULL; } while (0)
-#define timer_is_running(t) (running_timer == t)
-#define timer_synchronize(t) while (timer_is_running(t)) barrier()
+#define timer_enter(b, t) do { (b)->running_timer = t; mb(); } while (0)
+#define timer_exit(b) do { (b)->running_timer = NULL; } while (0)
+#define timer_is_running(b, t) ((b)->running_timer == t)
+#define timer_synchronize(b, t) while (timer_is_running(b, t)) barrier()
 #else
-#define timer_enter(t)		do { } while (0)
-#define timer_exit()		do { } while (0)
+#define timer_enter(b, t)	do { } while (0)
+#define timer_exit(b)		do { } while (0)
+#define timer_is_running(b, t)	0
 #endif
 
-void add_timer(struct timer_list *timer)
+/*
+ * Lock the wheel a timer is on.  The timer may move to another one
+ * while we wait for the lock, in which case we try again.
+ */
+static struct timer_base *lock_timer_base(struct timer_list *timer,
+					  unsigned long *flags)
 {
-	unsigned long flags;
+	struct timer_base *base;
 
-	spin_lock_irqsave(&timerlist_lock, flags);
-	if (timer_pending(timer))
-		goto bug;
-	internal_add_timer(timer);
-	spin_unlock_irqrestore(&timerlist_lock, flags);
-	return;
-bug:
-	spin_unlock_irqrestore(&timerlist_lock, flags);
-	printk("bug: kernel timer added twice at %p.\n",
-			__builtin_return_address(0));
+	for (;;) {
+		base = timer_base(timer);
+		spin_lock_irqsave(&base->lock, *flags);
+		if (base == timer_base(timer))
+			return base;
+		spin_unlock_irqrestore(&base->lock, *flags);
+	}
 }
 
 static inline int detach_timer (struct timer_list *timer)
@@ -201,35 +231,78 @@ static inline int detach_timer (struct timer_list *timer)
 	return 1;
 }
 
-int mod_timer(struct timer_list *timer, unsigned long expires)
+/*
+ * Queue the timer on this CPU's wheel, unless its handler is running
+ * on the old one right now: the handler must not run on two CPUs at
+ * once, and del_timer_sync() only looks for it where the timer is.  The
+ * second lock is only tried, the move is not worth a lock ordering.
+ */
+static inline int __mod_timer(struct timer_list *timer,
+			      unsigned long expires, int add)
 {
-	int ret;
+	struct timer_base *base, *new;
 	unsigned long flags;
+	int ret;
 
-	spin_lock_irqsave(&timerlist_lock, flags);
-	timer->expires = expires;
+	base = lock_timer_base(timer, &flags);
+	if (add && timer_pending(timer))
+		goto bug;
 	ret = detach_timer(timer);
-	internal_add_timer(timer);
-	spin_unlock_irqrestore(&timerlist_lock, flags);
+	timer->expires = expires;
+
+	new = timer_bases + smp_processor_id();
+	if (new != base && !timer_is_running(base, timer) &&
+	    spin_trylock(&new->lock)) {
+		timer->base = new;
+		internal_add_timer(new, timer);
+		spin_unlock(&new->lock);
+	} else {
+		timer->base = base;
+		internal_add_timer(base, timer);
+	}
+	spin_unlock_irqrestore(&base->lock, flags);
 	return ret;
+bug:
+	spin_unlock_irqrestore(&base->lock, flags);
+	printk("bug: kernel timer added twice at %p.\n",
+			__builtin_return_address(0));
+	return 0;
+}
+
+void add_timer(struct timer_list *timer)
+{
+	__mod_timer(timer, timer->expires, 1);
+}
+
+int mod_timer(struct timer_list *timer, unsigned long expires)
+{
+	return __mod_timer(timer, expires, 0);
 }
 
 int del_timer(struct timer_list * timer)
 {
-	int ret;
+	struct timer_base *base;
 	unsigned long flags;
+	int ret;
 
-	spin_lock_irqsave(&timerlist_lock, flags);
+	if (!timer_pending(timer))
+		return 0;
+
+	base = lock_timer_base(timer, &flags);
 	ret = detach_timer(timer);
 	timer->list.next = timer->list.prev = NULL;
-	spin_unlock_irqrestore(&timerlist_lock, flags);
+	spin_unlock_irqrestore(&base->lock, flags);
 	return ret;
 }
 
 #ifdef CONFIG_SMP
+/*
+ * Wait for every timer handler running at the time of the call.
+ */
 void sync_timers(void)
 {
-	spin_unlock_wait(&global_bh_lock);
+	br_write_lock_bh(BR_TIMER_LOCK);
+	br_write_unlock_bh(BR_TIMER_LOCK);
 }
 
 /*
@@ -245,19 +318,20 @@ int del_timer_sync(struct timer_list * timer)
 	int ret = 0;
 
 	for (;;) {
+		struct timer_base *base;
 		unsigned long flags;
 		int running;
 
-		spin_lock_irqsave(&timerlist_lock, flags);
+		base = lock_timer_base(timer, &flags);
 		ret += detach_timer(timer);
 		timer->list.next = timer->list.prev = 0;
-		running = timer_is_running(timer);
-		spin_unlock_irqrestore(&timerlist_lock, flags);
+		running = timer_is_running(base, timer);
+		spin_unlock_irqrestore(&base->lock, flags);
 
 		if (!running)
 			break;
 
-		timer_synchronize(timer);
+		timer_synchronize(base, timer);
 	}
 
 	return ret;
@@ -265,7 +339,8 @@ int del_timer_sync(struct timer_list * timer)
 #endif
 
 
-static inline void cascade_timers(struct timer_vec *tv)
+static inline int cascade_timers(struct timer_base *base,
+				 struct timer_vec *tv)
 {
 	/* cascade all the timers from tv up one level */
 	struct list_head *head, *curr, *next;
@@ -282,28 +357,34 @@ static inline void cascade_timers(struct timer_vec *tv)
 		tmp = list_entry(curr, struct timer_list, list);
 		next = curr->next;
 		list_del(curr); // not needed
-		internal_add_timer(tmp);
+		internal_add_timer(base, tmp);
 		curr = next;
 	}
 	INIT_LIST_HEAD(head);
 	tv->index = (tv->index + 1) & TVN_MASK;
+	return tv->index;
 }
 
-static inline void run_timer_list(void)
+/*
+ * Old style network protocols expect timers not to run while they do,
+ * the read side of BR_TIMER_LOCK stands for that now that timers run
+ * on every CPU at once.
+ */
+static void run_timer_list(struct timer_base *base)
 {
-	spin_lock_irq(&timerlist_lock);
-	while ((long)(jiffies - timer_jiffies) >= 0) {
+	br_read_lock(BR_TIMER_LOCK);
+	spin_lock_irq(&base->lock);
+	while ((long)(jiffies - base->timer_jiffies) >= 0) {
 		LIST_HEAD(queued);
 		struct list_head *head, *curr;
-		if (!tv1.index) {
-			int n = 1;
-			do {
-				cascade_timers(tvecs[n]);
-			} while (tvecs[n]->index == 1 && ++n < NOOF_TVECS);
-		}
-		run_timer_list_running = &queued;
+		if (!base->tv1.index &&
+		    cascade_timers(base, &base->tv2) == 1 &&
+		    cascade_timers(base, &base->tv3) == 1 &&
+		    cascade_timers(base, &base->tv4) == 1)
+			cascade_timers(base, &base->tv5);
+		base->run_timer_list_running = &queued;
 repeat:
-		head = tv1.vec + tv1.index;
+		head = base->tv1.vec + base->tv1.index;
 		curr = head->next;
 		if (curr != head) {
 			struct timer_list *timer;
@@ -316,16 +397,16 @@ repeat:
 
 			detach_timer(timer);
 			timer->list.next = timer->list.prev = NULL;
-			timer_enter(timer);
-			spin_unlock_irq(&timerlist_lock);
+			timer_enter(base, timer);
+			spin_unlock_irq(&base->lock);
 			fn(data);
-			spin_lock_irq(&timerlist_lock);
-			timer_exit();
+			spin_lock_irq(&base->lock);
+			timer_exit(base);
 			goto repeat;
 		}
-		run_timer_list_running = NULL;
-		++timer_jiffies; 
-		tv1.index = (tv1.index + 1) & TVR_MASK;
+		base->run_timer_list_running = NULL;
+		++base->timer_jiffies; 
+		base->tv1.index = (base->tv1.index + 1) & TVR_MASK;
 
 		curr = queued.next;
 		while (curr != &queued) {
@@ -333,10 +414,19 @@ repeat:
 
 			timer = list_entry(curr, struct timer_list, list);
 			curr = curr->next;
-			internal_add_timer(timer);
+			internal_add_timer(base, timer);
 		}			
 	}
-	spin_unlock_irq(&timerlist_lock);
+	spin_unlock_irq(&base->lock);
+	br_read_unlock(BR_TIMER_LOCK);
+}
+
+static void run_timer_softirq(struct softirq_action *h)
+{
+	struct timer_base *base = timer_bases + smp_processor_id();
+
+	if ((long)(jiffies - base->timer_jiffies) >= 0)
+		run_timer_list(base);
 }
 
 spinlock_t tqueue_lock = SPIN_LOCK_UNLOCKED;
@@ -617,6 +707,9 @@ void update_process_times(int user_tick)
 		kstat.per_cpu_system[cpu] += system;
 	} else if (local_bh_count(cpu) || local_irq_count(cpu) > 1)
 		kstat.per_cpu_system[cpu] += system;
+	rebalance_tick(!p->pid);
+	if ((long)(jiffies - timer_bases[cpu].timer_jiffies) >= 0)
+		cpu_raise_softirq(cpu, TIMER_SOFTIRQ);
 }
 
 /*
@@ -693,7 +786,6 @@ static inline void update_times(void)
 void timer_bh(void)
 {
 	update_times();
-	run_timer_list();
 }
 
 void do_timer(struct pt_regs *regs)
@@ -833,6 +925,48 @@ asmlinkage long sys_gettid(void)
 	return current->pid;
 }
 
+/*
+ * Non-zero makes sleeps with a timeout in microseconds end on the first
+ * tick after the time asked for, rather than a whole tick later to be
+ * sure no sleep is short.
+ */
+int precise_timeouts;
+
+/*
+ * Convert a relative timeout to jiffies, counting the part of the
+ * current tick that has already gone by.  xtime and wall_jiffies give
+ * the time of the last tick; if a tick comes in between, we only wait
+ * longer.
+ */
+long precise_timeout(unsigned long sec, unsigned long usec)
+{
+	struct timeval now;
+	unsigned long flags;
+	long last, into_tick;
+
+	if (sec >= MAX_SCHEDULE_TIMEOUT / HZ - 1)
+		return MAX_SCHEDULE_TIMEOUT;
+	if (!sec && !usec)
+		return 0;
+
+	do_gettimeofday(&now);
+	read_lock_irqsave(&xtime_lock, flags);
+	into_tick = (now.tv_sec - xtime.tv_sec) * 1000000 +
+		    now.tv_usec - xtime.tv_usec;
+	last = (jiffies - wall_jiffies) * tick;
+	read_unlock_irqrestore(&xtime_lock, flags);
+
+	into_tick -= last;
+	if (into_tick < 0)
+		into_tick = 0;
+	if (into_tick >= tick)
+		into_tick = tick - 1;
+
+	sec += usec / 1000000;
+	usec = usec % 1000000 + into_tick;
+	return sec * HZ + (usec + tick - 1) / tick;
+}
+
 asmlinkage long sys_nanosleep(struct timespec *rqtp, struct timespec *rmtp)
 {
 	struct timespec t;
@@ -858,7 +992,10 @@ asmlinkage long sys_nanosleep(struct timespec *rqtp, struct timespec *rmtp)
 		return 0;
 	}
 
-	expire = timespec_to_jiffies(&t) + (t.tv_sec || t.tv_nsec);
+	if (precise_timeouts)
+		expire = precise_timeout(t.tv_sec, (t.tv_nsec + 999) / 1000);
+	else
+		expire = timespec_to_jiffies(&t) + (t.tv_sec || t.tv_nsec);
 
 	current->state = TASK_INTERRUPTIBLE;
 	expire = schedule_timeout(expire);
@@ -29,7 +29,8 @@ static spinlock_t uidhash_lock = SPIN_LOCK_UNLOCKED;
 struct user_struct root_user = {
 	__count:	ATOMIC_INIT(1),
 	processes:	ATOMIC_INIT(1),
-	files:		ATOMIC_INIT(0)
+	files:		ATOMIC_INIT(0),
+	pipe_bufs:	ATOMIC_INIT(0)
 };
 
 /*
@@ -101,6 +102,7 @@ struct user_struct * alloc_uid(uid_t uid)
 		atomic_set(&new->__count, 1);
 		atomic_set(&new->processes, 0);
 		atomic_set(&new->files, 0);
+		atomic_set(&new->pipe_bufs, 0);
 
 		/*
 		 * Before adding this, check whether we raced
@@ -13,12 +13,11 @@
 #include <linux/tty.h>
 #include <linux/wait.h>
 #include <linux/vt_kern.h>
-
-extern spinlock_t timerlist_lock;
+#include <linux/timer.h>
 
 void bust_spinlocks(int yes)
 {
-	spin_lock_init(&timerlist_lock);
+	timer_bust_locks();
 	if (yes) {
 		oops_in_progress = 1;
 	} else {
@@ -23,6 +23,7 @@
 #include <linux/init.h>
 #include <linux/mm.h>
 #include <linux/iobuf.h>
+#include <linux/hugetlb.h>
 
 #include <asm/pgalloc.h>
 #include <asm/uaccess.h>
@@ -52,17 +53,18 @@ EXPORT_SYMBOL(vm_max_readahead);
 EXPORT_SYMBOL(vm_min_readahead);
 
 
-spinlock_cacheline_t pagecache_lock_cacheline  = {SPIN_LOCK_UNLOCKED};
+/* Initialised in page_cache_init() */
+spinlock_cacheline_t page_hash_locks[PAGE_HASH_LOCKS];
 /*
- * NOTE: to avoid deadlocking you must never acquire the pagemap_lru_lock 
- *	with the pagecache_lock held.
+ * NOTE: to avoid deadlocking you must never acquire a zone->lru_lock
+ *	with a page cache lock held.
  *
  * Ordering:
  *	swap_lock ->
- *		pagemap_lru_lock ->
- *			pagecache_lock
+ *		zone->lru_lock ->
+ *			mapping->page_lock ->
+ *				page_hash_lock()
  */
-spinlock_cacheline_t pagemap_lru_lock_cacheline = {SPIN_LOCK_UNLOCKED};
 
 #define CLUSTER_PAGES		(1 << page_cluster)
 #define CLUSTER_OFFSET(x)	(((x) >> page_cluster) << page_cluster)
@@ -115,7 +117,7 @@ static inline void remove_page_from_hash_queue(struct page * page)
 /*
  * Remove a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
- * is safe.
+ * is safe.  Both page cache locks of the page must be held.
  */
 void __remove_inode_page(struct page *page)
 {
@@ -127,12 +129,16 @@ void __remove_inode_page(struct page *page)
 
 void remove_inode_page(struct page *page)
 {
+	struct address_space *mapping = page->mapping;
+	struct page **hash;
+
 	if (!PageLocked(page))
 		PAGE_BUG(page);
 
-	spin_lock(&pagecache_lock);
+	hash = page_hash(mapping, page->index);
+	lock_page_cache(mapping, hash);
 	__remove_inode_page(page);
-	spin_unlock(&pagecache_lock);
+	unlock_page_cache(mapping, hash);
 }
 
 static inline int sync_page(struct page *page)
@@ -153,15 +159,17 @@ void set_page_dirty(struct page *page)
 		struct address_space *mapping = page->mapping;
 
 		if (mapping) {
-			spin_lock(&pagecache_lock);
-			mapping = page->mapping;
-			if (mapping) {	/* may have been truncated */
+			int truncated;
+
+			spin_lock(&mapping->page_lock);
+			truncated = page->mapping != mapping;
+			if (!truncated) {
 				list_del(&page->list);
 				list_add(&page->list, &mapping->dirty_pages);
 			}
-			spin_unlock(&pagecache_lock);
+			spin_unlock(&mapping->page_lock);
 
-			if (mapping && mapping->host)
+			if (!truncated && mapping->host)
 				mark_inode_dirty_pages(mapping->host);
 		}
 	}
@@ -177,13 +185,15 @@ void set_page_dirty(struct page *page)
 
 void invalidate_inode_pages(struct inode * inode)
 {
+	struct address_space *mapping = inode->i_mapping;
 	struct list_head *head, *curr;
 	struct page * page;
+	struct pm_zone *zone;
+	spinlock_t *hash_lock;
 
-	head = &inode->i_mapping->clean_pages;
+	head = &mapping->clean_pages;
 
-	spin_lock(&pagemap_lru_lock);
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	curr = head->next;
 
 	while (curr != head) {
@@ -201,11 +211,27 @@ void invalidate_inode_pages(struct inode * inode)
 		if (page->buffers && !try_to_free_buffers(page, 0))
 			goto unlock;
 
-		if (page_count(page) != 1)
+		/*
+		 * The LRU lock nests outside the page cache locks, so
+		 * we can only try it here.  This is a best effort anyway.
+		 */
+		zone = page_zone(page);
+		if (!spin_trylock(&zone->lru_lock))
+			goto unlock;
+
+		/* Keep lookups from taking a new reference */
+		hash_lock = page_hash_lock(page_hash(mapping, page->index));
+		spin_lock(hash_lock);
+		if (page_count(page) != 1) {
+			spin_unlock(hash_lock);
+			spin_unlock(&zone->lru_lock);
 			goto unlock;
+		}
 
 		__lru_cache_del(page);
 		__remove_inode_page(page);
+		spin_unlock(hash_lock);
+		spin_unlock(&zone->lru_lock);
 		UnlockPage(page);
 		page_cache_release(page);
 		continue;
@@ -214,8 +240,7 @@ unlock:
 		continue;
 	}
 
-	spin_unlock(&pagecache_lock);
-	spin_unlock(&pagemap_lru_lock);
+	spin_unlock(&mapping->page_lock);
 }
 
 static int do_flushpage(struct page *page, unsigned long offset)
@@ -253,8 +278,8 @@ static void truncate_complete_page(struct page *page)
 	page_cache_release(page);
 }
 
-static int FASTCALL(truncate_list_pages(struct list_head *, unsigned long, unsigned *));
-static int truncate_list_pages(struct list_head *head, unsigned long start, unsigned *partial)
+static int FASTCALL(truncate_list_pages(struct address_space *, struct list_head *, unsigned long, unsigned *));
+static int truncate_list_pages(struct address_space *mapping, struct list_head *head, unsigned long start, unsigned *partial)
 {
 	struct list_head *curr;
 	struct page * page;
@@ -283,7 +308,7 @@ static int truncate_list_pages(struct list_head *head, unsigned long start, unsi
 				/* Restart on this page */
 				list_add(head, curr);
 
-			spin_unlock(&pagecache_lock);
+			spin_unlock(&mapping->page_lock);
 			unlocked = 1;
 
  			if (!failed) {
@@ -304,7 +329,7 @@ static int truncate_list_pages(struct list_head *head, unsigned long start, unsi
 				schedule();
 			}
 
-			spin_lock(&pagecache_lock);
+			spin_lock(&mapping->page_lock);
 			goto restart;
 		}
 		curr = curr->prev;
@@ -328,33 +353,40 @@ void truncate_inode_pages(struct address_space * mapping, loff_t lstart)
 	unsigned partial = lstart & (PAGE_CACHE_SIZE - 1);
 	int unlocked;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	do {
-		unlocked = truncate_list_pages(&mapping->clean_pages, start, &partial);
-		unlocked |= truncate_list_pages(&mapping->dirty_pages, start, &partial);
-		unlocked |= truncate_list_pages(&mapping->locked_pages, start, &partial);
+		unlocked = truncate_list_pages(mapping, &mapping->clean_pages, start, &partial);
+		unlocked |= truncate_list_pages(mapping, &mapping->dirty_pages, start, &partial);
+		unlocked |= truncate_list_pages(mapping, &mapping->locked_pages, start, &partial);
 	} while (unlocked);
 	/* Traversed all three lists without dropping the lock */
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 }
 
-static inline int invalidate_this_page2(struct page * page,
+static inline int invalidate_this_page2(struct address_space * mapping,
+					struct page * page,
 					struct list_head * curr,
 					struct list_head * head)
 {
+	spinlock_t *hash_lock = page_hash_lock(page_hash(mapping, page->index));
 	int unlocked = 1;
+	int unused;
 
 	/*
-	 * The page is locked and we hold the pagecache_lock as well
+	 * The page is locked and we hold both page cache locks as well
 	 * so both page_count(page) and page->buffers stays constant here.
 	 */
-	if (page_count(page) == 1 + !!page->buffers) {
+	spin_lock(hash_lock);
+	unused = page_count(page) == 1 + !!page->buffers;
+	spin_unlock(hash_lock);
+
+	if (unused) {
 		/* Restart after this page */
 		list_del(head);
 		list_add_tail(head, curr);
 
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 		truncate_complete_page(page);
 	} else {
 		if (page->buffers) {
@@ -363,7 +395,7 @@ static inline int invalidate_this_page2(struct page * page,
 			list_add_tail(head, curr);
 
 			page_cache_get(page);
-			spin_unlock(&pagecache_lock);
+			spin_unlock(&mapping->page_lock);
 			block_invalidate_page(page);
 		} else
 			unlocked = 0;
@@ -375,8 +407,8 @@ static inline int invalidate_this_page2(struct page * page,
 	return unlocked;
 }
 
-static int FASTCALL(invalidate_list_pages2(struct list_head *));
-static int invalidate_list_pages2(struct list_head *head)
+static int FASTCALL(invalidate_list_pages2(struct address_space *, struct list_head *));
+static int invalidate_list_pages2(struct address_space *mapping, struct list_head *head)
 {
 	struct list_head *curr;
 	struct page * page;
@@ -390,7 +422,7 @@ static int invalidate_list_pages2(struct list_head *head)
 		if (!TryLockPage(page)) {
 			int __unlocked;
 
-			__unlocked = invalidate_this_page2(page, curr, head);
+			__unlocked = invalidate_this_page2(mapping, page, curr, head);
 			UnlockPage(page);
 			unlocked |= __unlocked;
 			if (!__unlocked) {
@@ -403,7 +435,7 @@ static int invalidate_list_pages2(struct list_head *head)
 			list_add(head, curr);
 
 			page_cache_get(page);
-			spin_unlock(&pagecache_lock);
+			spin_unlock(&mapping->page_lock);
 			unlocked = 1;
 			wait_on_page(page);
 		}
@@ -414,7 +446,7 @@ static int invalidate_list_pages2(struct list_head *head)
 			schedule();
 		}
 
-		spin_lock(&pagecache_lock);
+		spin_lock(&mapping->page_lock);
 		goto restart;
 	}
 	return unlocked;
@@ -429,13 +461,13 @@ void invalidate_inode_pages2(struct address_space * mapping)
 {
 	int unlocked;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	do {
-		unlocked = invalidate_list_pages2(&mapping->clean_pages);
-		unlocked |= invalidate_list_pages2(&mapping->dirty_pages);
-		unlocked |= invalidate_list_pages2(&mapping->locked_pages);
+		unlocked = invalidate_list_pages2(mapping, &mapping->clean_pages);
+		unlocked |= invalidate_list_pages2(mapping, &mapping->dirty_pages);
+		unlocked |= invalidate_list_pages2(mapping, &mapping->locked_pages);
 	} while (unlocked);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 }
 
 static inline struct page * __find_page_nolock(struct address_space *mapping, unsigned long offset, struct page *page)
@@ -457,13 +489,13 @@ not_found:
 	return page;
 }
 
-static int do_buffer_fdatasync(struct list_head *head, unsigned long start, unsigned long end, int (*fn)(struct page *))
+static int do_buffer_fdatasync(struct address_space *mapping, struct list_head *head, unsigned long start, unsigned long end, int (*fn)(struct page *))
 {
 	struct list_head *curr;
 	struct page *page;
 	int retval = 0;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	curr = head->next;
 	while (curr != head) {
 		page = list_entry(curr, struct page, list);
@@ -476,7 +508,7 @@ static int do_buffer_fdatasync(struct list_head *head, unsigned long start, unsi
 			continue;
 
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 		lock_page(page);
 
 		/* The buffers could have been free'd while we waited for the page lock */
@@ -484,11 +516,11 @@ static int do_buffer_fdatasync(struct list_head *head, unsigned long start, unsi
 			retval |= fn(page);
 
 		UnlockPage(page);
-		spin_lock(&pagecache_lock);
+		spin_lock(&mapping->page_lock);
 		curr = page->list.next;
 		page_cache_release(page);
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 
 	return retval;
 }
@@ -499,17 +531,18 @@ static int do_buffer_fdatasync(struct list_head *head, unsigned long start, unsi
  */
 int generic_buffer_fdatasync(struct inode *inode, unsigned long start_idx, unsigned long end_idx)
 {
+	struct address_space *mapping = inode->i_mapping;
 	int retval;
 
 	/* writeout dirty buffers on pages from both clean and dirty lists */
-	retval = do_buffer_fdatasync(&inode->i_mapping->dirty_pages, start_idx, end_idx, writeout_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->clean_pages, start_idx, end_idx, writeout_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->locked_pages, start_idx, end_idx, writeout_one_page);
+	retval = do_buffer_fdatasync(mapping, &mapping->dirty_pages, start_idx, end_idx, writeout_one_page);
+	retval |= do_buffer_fdatasync(mapping, &mapping->clean_pages, start_idx, end_idx, writeout_one_page);
+	retval |= do_buffer_fdatasync(mapping, &mapping->locked_pages, start_idx, end_idx, writeout_one_page);
 
 	/* now wait for locked buffers on pages from both clean and dirty lists */
-	retval |= do_buffer_fdatasync(&inode->i_mapping->dirty_pages, start_idx, end_idx, waitfor_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->clean_pages, start_idx, end_idx, waitfor_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->locked_pages, start_idx, end_idx, waitfor_one_page);
+	retval |= do_buffer_fdatasync(mapping, &mapping->dirty_pages, start_idx, end_idx, waitfor_one_page);
+	retval |= do_buffer_fdatasync(mapping, &mapping->clean_pages, start_idx, end_idx, waitfor_one_page);
+	retval |= do_buffer_fdatasync(mapping, &mapping->locked_pages, start_idx, end_idx, waitfor_one_page);
 
 	return retval;
 }
@@ -555,7 +588,7 @@ int filemap_fdatasync(struct address_space * mapping)
 	int ret = 0;
 	int (*writepage)(struct page *) = mapping->a_ops->writepage;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 
         while (!list_empty(&mapping->dirty_pages)) {
 		struct page *page = list_entry(mapping->dirty_pages.prev, struct page, list);
@@ -567,7 +600,7 @@ int filemap_fdatasync(struct address_space * mapping)
 			continue;
 
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 
 		lock_page(page);
 
@@ -581,9 +614,9 @@ int filemap_fdatasync(struct address_space * mapping)
 			UnlockPage(page);
 
 		page_cache_release(page);
-		spin_lock(&pagecache_lock);
+		spin_lock(&mapping->page_lock);
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 	return ret;
 }
 
@@ -598,7 +631,7 @@ int filemap_fdatawait(struct address_space * mapping)
 {
 	int ret = 0;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 
         while (!list_empty(&mapping->locked_pages)) {
 		struct page *page = list_entry(mapping->locked_pages.next, struct page, list);
@@ -610,16 +643,16 @@ int filemap_fdatawait(struct address_space * mapping)
 			continue;
 
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 
 		___wait_on_page(page);
 		if (PageError(page))
 			ret = -EIO;
 
 		page_cache_release(page);
-		spin_lock(&pagecache_lock);
+		spin_lock(&mapping->page_lock);
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 	return ret;
 }
 
@@ -631,15 +664,17 @@ int filemap_fdatawait(struct address_space * mapping)
  */
 void add_to_page_cache_locked(struct page * page, struct address_space *mapping, unsigned long index)
 {
+	struct page **hash = page_hash(mapping, index);
+
 	if (!PageLocked(page))
 		BUG();
 
 	page->index = index;
 	page_cache_get(page);
-	spin_lock(&pagecache_lock);
+	lock_page_cache(mapping, hash);
 	add_page_to_inode_queue(mapping, page);
-	add_page_to_hash_queue(page, page_hash(mapping, index));
-	spin_unlock(&pagecache_lock);
+	add_page_to_hash_queue(page, hash);
+	unlock_page_cache(mapping, hash);
 
 	lru_cache_add(page);
 }
@@ -664,9 +699,11 @@ static inline void __add_to_page_cache(struct page * page,
 
 void add_to_page_cache(struct page * page, struct address_space * mapping, unsigned long offset)
 {
-	spin_lock(&pagecache_lock);
-	__add_to_page_cache(page, mapping, offset, page_hash(mapping, offset));
-	spin_unlock(&pagecache_lock);
+	struct page **hash = page_hash(mapping, offset);
+
+	lock_page_cache(mapping, hash);
+	__add_to_page_cache(page, mapping, offset, hash);
+	unlock_page_cache(mapping, hash);
 	lru_cache_add(page);
 }
 
@@ -677,7 +714,7 @@ int add_to_page_cache_unique(struct page * page,
 	int err;
 	struct page *alias;
 
-	spin_lock(&pagecache_lock);
+	lock_page_cache(mapping, hash);
 	alias = __find_page_nolock(mapping, offset, *hash);
 
 	err = 1;
@@ -686,7 +723,7 @@ int add_to_page_cache_unique(struct page * page,
 		err = 0;
 	}
 
-	spin_unlock(&pagecache_lock);
+	unlock_page_cache(mapping, hash);
 	if (!err)
 		lru_cache_add(page);
 	return err;
@@ -703,13 +740,13 @@ static int page_cache_read(struct file * file, unsigned long offset)
 	struct page **hash = page_hash(mapping, offset);
 	struct page *page; 
 
-	spin_lock(&pagecache_lock);
+	spin_lock(page_hash_lock(hash));
 	page = __find_page_nolock(mapping, offset, *hash);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(page_hash_lock(hash));
 	if (page)
 		return 0;
 
-	page = page_cache_alloc(mapping);
+	page = page_cache_alloc_cold(mapping);
 	if (!page)
 		return -ENOMEM;
 
@@ -918,14 +955,14 @@ struct page * __find_get_page(struct address_space *mapping,
 	struct page *page;
 
 	/*
-	 * We scan the hash list read-only. Addition to and removal from
-	 * the hash-list needs a held write-lock.
+	 * We scan the hash list under its bucket lock only. Addition to
+	 * and removal from the hash-list needs the same lock.
 	 */
-	spin_lock(&pagecache_lock);
+	spin_lock(page_hash_lock(hash));
 	page = __find_page_nolock(mapping, offset, *hash);
 	if (page)
 		page_cache_get(page);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(page_hash_lock(hash));
 	return page;
 }
 
@@ -937,39 +974,35 @@ struct page *find_trylock_page(struct address_space *mapping, unsigned long offs
 	struct page *page;
 	struct page **hash = page_hash(mapping, offset);
 
-	spin_lock(&pagecache_lock);
+	spin_lock(page_hash_lock(hash));
 	page = __find_page_nolock(mapping, offset, *hash);
 	if (page) {
 		if (TryLockPage(page))
 			page = NULL;
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(page_hash_lock(hash));
 	return page;
 }
 
 /*
- * Must be called with the pagecache lock held,
+ * Must be called with the page hash lock held,
  * will return with it held (but it may be dropped
  * during blocking operations..
  */
-static struct page * FASTCALL(__find_lock_page_helper(struct address_space *, unsigned long, struct page *));
+static struct page * FASTCALL(__find_lock_page_helper(struct address_space *, unsigned long, struct page **));
 static struct page * __find_lock_page_helper(struct address_space *mapping,
-					unsigned long offset, struct page *hash)
+					unsigned long offset, struct page **hash)
 {
 	struct page *page;
 
-	/*
-	 * We scan the hash list read-only. Addition to and removal from
-	 * the hash-list needs a held write-lock.
-	 */
 repeat:
-	page = __find_page_nolock(mapping, offset, hash);
+	page = __find_page_nolock(mapping, offset, *hash);
 	if (page) {
 		page_cache_get(page);
 		if (TryLockPage(page)) {
-			spin_unlock(&pagecache_lock);
+			spin_unlock(page_hash_lock(hash));
 			lock_page(page);
-			spin_lock(&pagecache_lock);
+			spin_lock(page_hash_lock(hash));
 
 			/* Has the page been re-allocated while we slept? */
 			if (page->mapping != mapping || page->index != offset) {
@@ -991,9 +1024,9 @@ struct page * __find_lock_page (struct address_space *mapping,
 {
 	struct page *page;
 
-	spin_lock(&pagecache_lock);
-	page = __find_lock_page_helper(mapping, offset, *hash);
-	spin_unlock(&pagecache_lock);
+	spin_lock(page_hash_lock(hash));
+	page = __find_lock_page_helper(mapping, offset, hash);
+	spin_unlock(page_hash_lock(hash));
 	return page;
 }
 
@@ -1005,24 +1038,28 @@ struct page * find_or_create_page(struct address_space *mapping, unsigned long i
 	struct page *page;
 	struct page **hash = page_hash(mapping, index);
 
-	spin_lock(&pagecache_lock);
-	page = __find_lock_page_helper(mapping, index, *hash);
-	spin_unlock(&pagecache_lock);
+repeat:
+	spin_lock(page_hash_lock(hash));
+	page = __find_lock_page_helper(mapping, index, hash);
+	spin_unlock(page_hash_lock(hash));
 	if (!page) {
 		struct page *newpage = alloc_page(gfp_mask);
 		if (newpage) {
-			spin_lock(&pagecache_lock);
-			page = __find_lock_page_helper(mapping, index, *hash);
+			lock_page_cache(mapping, hash);
+			page = __find_page_nolock(mapping, index, *hash);
 			if (likely(!page)) {
 				page = newpage;
 				__add_to_page_cache(page, mapping, index, hash);
 				newpage = NULL;
 			}
-			spin_unlock(&pagecache_lock);
+			unlock_page_cache(mapping, hash);
 			if (newpage == NULL)
 				lru_cache_add(page);
-			else 
+			else {
+				/* Raced with another add: go and lock theirs */
 				page_cache_release(newpage);
+				goto repeat;
+			}
 		}
 	}
 	return page;	
@@ -1073,127 +1110,35 @@ struct page *grab_cache_page_nowait(struct address_space *mapping, unsigned long
 	return page;
 }
 
-#if 0
-#define PROFILE_READAHEAD
-#define DEBUG_READAHEAD
-#endif
-
-/*
- * Read-ahead profiling information
- * --------------------------------
- * Every PROFILE_MAXREADCOUNT, the following information is written 
- * to the syslog:
- *   Percentage of asynchronous read-ahead.
- *   Average of read-ahead fields context value.
- * If DEBUG_READAHEAD is defined, a snapshot of these fields is written 
- * to the syslog.
- */
-
-#ifdef PROFILE_READAHEAD
-
-#define PROFILE_MAXREADCOUNT 1000
-
-static unsigned long total_reada;
-static unsigned long total_async;
-static unsigned long total_ramax;
-static unsigned long total_ralen;
-static unsigned long total_rawin;
-
-static void profile_readahead(int async, struct file *filp)
-{
-	unsigned long flags;
-
-	++total_reada;
-	if (async)
-		++total_async;
-
-	total_ramax	+= filp->f_ramax;
-	total_ralen	+= filp->f_ralen;
-	total_rawin	+= filp->f_rawin;
-
-	if (total_reada > PROFILE_MAXREADCOUNT) {
-		save_flags(flags);
-		cli();
-		if (!(total_reada > PROFILE_MAXREADCOUNT)) {
-			restore_flags(flags);
-			return;
-		}
-
-		printk("Readahead average:  max=%ld, len=%ld, win=%ld, async=%ld%%\n",
-			total_ramax/total_reada,
-			total_ralen/total_reada,
-			total_rawin/total_reada,
-			(total_async*100)/total_reada);
-#ifdef DEBUG_READAHEAD
-		printk("Readahead snapshot: max=%ld, len=%ld, win=%ld, raend=%Ld\n",
-			filp->f_ramax, filp->f_ralen, filp->f_rawin, filp->f_raend);
-#endif
-
-		total_reada	= 0;
-		total_async	= 0;
-		total_ramax	= 0;
-		total_ralen	= 0;
-		total_rawin	= 0;
-
-		restore_flags(flags);
-	}
-}
-#endif  /* defined PROFILE_READAHEAD */
-
 /*
- * Read-ahead context:
- * -------------------
- * The read ahead context fields of the "struct file" are the following:
- * - f_raend : position of the first byte after the last page we tried to
- *	       read ahead.
- * - f_ramax : current read-ahead maximum size.
- * - f_ralen : length of the current IO read block we tried to read-ahead.
- * - f_rawin : length of the current read-ahead window.
- *		if last read-ahead was synchronous then
- *			f_rawin = f_ralen
- *		otherwise (was asynchronous)
- *			f_rawin = previous value of f_ralen + f_ralen
- *
- * Read-ahead limits:
- * ------------------
- * MIN_READAHEAD   : minimum read-ahead size when read-ahead.
- * MAX_READAHEAD   : maximum read-ahead size when read-ahead.
+ * Read-ahead
+ * ----------
+ * Read-ahead works on streams: runs of sequential page reads through a
+ * file.  A file keeps up to RA_STREAMS of them in filp->f_ra, so that a
+ * reader interleaving several sequential scans of one file (or several
+ * readers sharing a file descriptor) don't keep resetting each other's
+ * state.  A read is part of a stream if it is the page after the last one
+ * the stream read, or falls in the pages the stream has read ahead;
+ * otherwise the least recently used stream is recycled for it.  A stream
+ * starting at the beginning of the file is assumed to be sequential, any
+ * other only once it has read two pages in a row.
  *
- * Synchronous read-ahead benefits:
- * --------------------------------
- * Using reasonable IO xfer length from peripheral devices increase system 
- * performances.
- * Reasonable means, in this context, not too large but not too small.
- * The actual maximum value is:
- *	MAX_READAHEAD + PAGE_CACHE_SIZE = 76k is CONFIG_READA_SMALL is undefined
- *      and 32K if defined (4K page size assumed).
+ * A sequential stream has two windows:
+ * - [start, start + size) : the window the reader is in,
+ * - [start + size, start + size + ahead_size) : the window read ahead of it.
+ * When the reader enters the ahead window it becomes the current window,
+ * and the next ahead window is submitted straight away.  Nothing ever
+ * waits for read-ahead I/O to complete: the reader only waits for the page
+ * it wants, so one window's worth of I/O is always in flight ahead of it.
  *
- * Asynchronous read-ahead benefits:
- * ---------------------------------
- * Overlapping next read request and user process execution increase system 
- * performance.
- *
- * Read-ahead risks:
- * -----------------
- * We have to guess which further data are needed by the user process.
- * If these data are often not really needed, it's bad for system 
- * performances.
- * However, we know that files are often accessed sequentially by 
- * application programs and it seems that it is possible to have some good 
- * strategy in that guessing.
- * We only try to read-ahead files that seems to be read sequentially.
- *
- * Asynchronous read-ahead risks:
- * ------------------------------
- * In order to maximize overlapping, we must start some asynchronous read 
- * request from the device, as soon as possible.
- * We must be very careful about:
- * - The number of effective pending IO read requests.
- *   ONE seems to be the only reasonable value.
- * - The total memory pool usage for the file access stream.
- *   This maximum memory usage is implicitly 2 IO read chunks:
- *   2*(MAX_READAHEAD + PAGE_CACHE_SIZE) = 156K if CONFIG_READA_SMALL is undefined,
- *   64k if defined (4K page size assumed).
+ * Window size:
+ * Every page the reader takes from a window is counted as a hit if it
+ * was in the page cache (whether or not its I/O had completed), and as a
+ * miss if it was not, because the read-ahead allocation failed or the
+ * page was reclaimed before the reader got to it.  The next ahead window
+ * is twice the current one scaled by the hit rate: it doubles while all
+ * read-ahead gets used, and shrinks when memory is too tight to hold it.
+ * It is kept between vm_min_readahead and the device's max_readahead.
  */
 
 static inline int get_max_readahead(struct inode * inode)
@@ -1203,108 +1148,125 @@ static inline int get_max_readahead(struct inode * inode)
 	return max_readahead[MAJOR(inode->i_dev)][MINOR(inode->i_dev)];
 }
 
-static void generic_file_readahead(int reada_ok,
-	struct file * filp, struct inode * inode,
-	struct page * page)
-{
-	unsigned long end_index;
-	unsigned long index = page->index;
-	unsigned long max_ahead, ahead;
-	unsigned long raend;
-	int max_readahead = get_max_readahead(inode);
-
-	end_index = inode->i_size >> PAGE_CACHE_SHIFT;
+#define RA_HIT		0	/* page found in the page cache */
+#define RA_MISS		1	/* page had to be read by the reader */
 
-	raend = filp->f_raend;
-	max_ahead = 0;
+static struct file_ra_stream *ra_find_stream(struct file_ra_state *ra,
+	unsigned long index)
+{
+	struct file_ra_stream *s, *lru = ra->streams;
 
-/*
- * The current page is locked.
- * If the current position is inside the previous read IO request, do not
- * try to reread previously read ahead pages.
- * Otherwise decide or not to read ahead some pages synchronously.
- * If we are not going to read ahead, set the read ahead context for this 
- * page only.
- */
-	if (PageLocked(page)) {
-		if (!filp->f_ralen || index >= raend || index + filp->f_rawin < raend) {
-			raend = index;
-			if (raend < end_index)
-				max_ahead = filp->f_ramax;
-			filp->f_rawin = 0;
-			filp->f_ralen = 1;
-			if (!max_ahead) {
-				filp->f_raend  = index + filp->f_ralen;
-				filp->f_rawin += filp->f_ralen;
-			}
-		}
-	}
-/*
- * The current page is not locked.
- * If we were reading ahead and,
- * if the current max read ahead size is not zero and,
- * if the current position is inside the last read-ahead IO request,
- *   it is the moment to try to read ahead asynchronously.
- * We will later force unplug device in order to force asynchronous read IO.
- */
-	else if (reada_ok && filp->f_ramax && raend >= 1 &&
-		 index <= raend && index + filp->f_ralen >= raend) {
-/*
- * Add ONE page to max_ahead in order to try to have about the same IO max size
- * as synchronous read-ahead (MAX_READAHEAD + 1)*PAGE_CACHE_SIZE.
- * Compute the position of the last page we have tried to read in order to 
- * begin to read ahead just at the next page.
- */
-		raend -= 1;
-		if (raend < end_index)
-			max_ahead = filp->f_ramax + 1;
-
-		if (max_ahead) {
-			filp->f_rawin = filp->f_ralen;
-			filp->f_ralen = 0;
-			reada_ok      = 2;
+	for (s = ra->streams; s < ra->streams + RA_STREAMS; s++) {
+		if (!s->stamp) {
+			lru = s;
+			break;
 		}
-	}
+		if (index == s->prev || index == s->prev + 1)
+			return s;
+		if (s->size && index >= s->start &&
+		    index < s->start + s->size + s->ahead_size)
+			return s;
+		if (s->stamp < lru->stamp)
+			lru = s;
+	}
+
+	memset(lru, 0, sizeof(*lru));
+	lru->prev = index - 1;
+	if (index)
+		lru->prev--;		/* not sequential yet */
+	return lru;
+}
+
+static unsigned long next_ra_size(struct file_ra_stream *s,
+	unsigned long min, unsigned long max)
+{
+	unsigned long total = s->hits + s->misses;
+	unsigned long size = s->size;
+
+	if (total)
+		size = 2 * size * s->hits / total;
+	if (size < min)
+		size = min;
+	if (size > max)
+		size = max;
+	s->hits = 0;
+	s->misses = 0;
+	return size;
+}
+
 /*
- * Try to read ahead pages.
- * We hope that ll_rw_blk() plug/unplug, coalescence, requests sort and the
- * scheduler, will work enough for us to avoid too bad actuals IO requests.
+ * Start reading 'nr' pages from 'index' on, stopping at the end of the
+ * file or at the first page we can't allocate.  Pages already in the page
+ * cache, uptodate or not, are left alone.
  */
-	ahead = 0;
-	while (ahead < max_ahead) {
-		ahead ++;
-		if ((raend + ahead) >= end_index)
-			break;
-		if (page_cache_read(filp, raend + ahead) < 0)
+static void ra_submit(struct file *filp, struct inode *inode,
+	unsigned long index, unsigned long nr)
+{
+	unsigned long end_index;
+
+	end_index = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	for (; nr && index < end_index; index++, nr--)
+		if (page_cache_read(filp, index) < 0)
 			break;
-	}
+}
+
 /*
- * If we tried to read ahead some pages,
- * If we tried to read ahead asynchronously,
- *   Try to force unplug of the device in order to start an asynchronous
- *   read IO request.
- * Update the read-ahead context.
- * Store the length of the current read-ahead window.
- * Double the current max read ahead size.
- *   That heuristic avoid to do some large IO for files that are not really
- *   accessed sequentially.
+ * The reader of 'filp' has got to page 'index', in the state given by
+ * 'how'.  Account for it and keep the read-ahead going.  Called for every
+ * page read; a second call for the same page is ignored.
  */
-	if (ahead) {
-		filp->f_ralen += ahead;
-		filp->f_rawin += filp->f_ralen;
-		filp->f_raend = raend + ahead + 1;
-
-		filp->f_ramax += filp->f_ramax;
-
-		if (filp->f_ramax > max_readahead)
-			filp->f_ramax = max_readahead;
+static void page_cache_readahead(struct file *filp, struct inode *inode,
+	unsigned long index, int how)
+{
+	struct file_ra_state *ra = &filp->f_ra;
+	struct file_ra_stream *s;
+	unsigned long min, max;
+	int sequential;
+
+	max = get_max_readahead(inode);
+	if (!max)
+		return;
+	min = vm_min_readahead;
+	if (min > max)
+		min = max;
+
+	s = ra_find_stream(ra, index);
+	s->stamp = ++ra->stamp;
+	if (index == s->prev)
+		return;
+	sequential = (index == s->prev + 1);
+	s->prev = index;
+
+	if (s->size && index < s->start + s->size + s->ahead_size) {
+		if (how == RA_MISS) {
+			s->misses++;
+			ra->misses++;
+		} else {
+			s->hits++;
+			ra->hits++;
+		}
+	} else if (sequential) {
+		/* A new stream, or one that has run past its windows */
+		s->start = index;
+		s->size = s->size ? s->size : min;
+		s->ahead_size = 0;
+		ra_submit(filp, inode, s->start, s->size);
+	} else
+		return;
 
-#ifdef PROFILE_READAHEAD
-		profile_readahead((reada_ok == 2), filp);
-#endif
+	if (index >= s->start + s->size) {
+		s->start += s->size;
+		s->size = s->ahead_size;
+		s->ahead_size = 0;
 	}
 
-	return;
+	if (!s->ahead_size) {
+		s->ahead_size = next_ra_size(s, min, max);
+		ra_submit(filp, inode, s->start + s->size, s->ahead_size);
+		ra->windows++;
+		/* Get the I/O going while the reader copies out its page */
+		run_task_queue(&tq_disk);
+	}
 }
 
 /*
@@ -1336,53 +1298,12 @@ void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t *
 	struct inode *inode = mapping->host;
 	unsigned long index, offset;
 	struct page *cached_page;
-	int reada_ok;
 	int error;
-	int max_readahead = get_max_readahead(inode);
 
 	cached_page = NULL;
 	index = *ppos >> PAGE_CACHE_SHIFT;
 	offset = *ppos & ~PAGE_CACHE_MASK;
 
-/*
- * If the current position is outside the previous read-ahead window, 
- * we reset the current read-ahead context and set read ahead max to zero
- * (will be set to just needed value later),
- * otherwise, we assume that the file accesses are sequential enough to
- * continue read-ahead.
- */
-	if (index > filp->f_raend || index + filp->f_rawin < filp->f_raend) {
-		reada_ok = 0;
-		filp->f_raend = 0;
-		filp->f_ralen = 0;
-		filp->f_ramax = 0;
-		filp->f_rawin = 0;
-	} else {
-		reada_ok = 1;
-	}
-/*
- * Adjust the current value of read-ahead max.
- * If the read operation stay in the first half page, force no readahead.
- * Otherwise try to increase read ahead max just enough to do the read request.
- * Then, at least MIN_READAHEAD if read ahead is ok,
- * and at most MAX_READAHEAD in all cases.
- */
-	if (!index && offset + desc->count <= (PAGE_CACHE_SIZE >> 1)) {
-		filp->f_ramax = 0;
-	} else {
-		unsigned long needed;
-
-		needed = ((offset + desc->count) >> PAGE_CACHE_SHIFT) + 1;
-
-		if (filp->f_ramax < needed)
-			filp->f_ramax = needed;
-
-		if (reada_ok && filp->f_ramax < vm_min_readahead)
-				filp->f_ramax = vm_min_readahead;
-		if (filp->f_ramax > max_readahead)
-			filp->f_ramax = max_readahead;
-	}
-
 	for (;;) {
 		struct page *page, **hash;
 		unsigned long end_index, nr, ret;
@@ -1405,17 +1326,17 @@ void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t *
 		 */
 		hash = page_hash(mapping, index);
 
-		spin_lock(&pagecache_lock);
+		spin_lock(page_hash_lock(hash));
 		page = __find_page_nolock(mapping, index, *hash);
 		if (!page)
 			goto no_cached_page;
 found_page:
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(page_hash_lock(hash));
 
+		page_cache_readahead(filp, inode, index, RA_HIT);
 		if (!Page_Uptodate(page))
 			goto page_not_up_to_date;
-		generic_file_readahead(reada_ok, filp, inode, page);
 page_ok:
 		/* If users can be writing to this page using arbitrary
 		 * virtual addresses, take care about potential aliasing
@@ -1452,14 +1373,9 @@ page_ok:
 		break;
 
 /*
- * Ok, the page was not immediately readable, so let's try to read ahead while we're at it..
+ * Ok, the page was not immediately readable, so let's wait for it..
  */
 page_not_up_to_date:
-		generic_file_readahead(reada_ok, filp, inode, page);
-
-		if (Page_Uptodate(page))
-			goto page_ok;
-
 		/* Get exclusive access to the page ... */
 		lock_page(page);
 
@@ -1481,11 +1397,10 @@ readpage:
 		error = mapping->a_ops->readpage(filp, page);
 
 		if (!error) {
+			/* Get the read-ahead going before we wait for the page */
+			page_cache_readahead(filp, inode, index, RA_MISS);
 			if (Page_Uptodate(page))
 				goto page_ok;
-
-			/* Again, try some read-ahead while waiting for the page to finish.. */
-			generic_file_readahead(reada_ok, filp, inode, page);
 			wait_on_page(page);
 			if (Page_Uptodate(page))
 				goto page_ok;
@@ -1502,24 +1417,27 @@ no_cached_page:
 		 * Ok, it wasn't cached, so we need to create a new
 		 * page..
 		 *
-		 * We get here with the page cache lock held.
+		 * We get here with the page hash lock held.
 		 */
+		spin_unlock(page_hash_lock(hash));
 		if (!cached_page) {
-			spin_unlock(&pagecache_lock);
 			cached_page = page_cache_alloc(mapping);
 			if (!cached_page) {
 				desc->error = -ENOMEM;
 				break;
 			}
+		}
 
-			/*
-			 * Somebody may have added the page while we
-			 * dropped the page cache lock. Check for that.
-			 */
-			spin_lock(&pagecache_lock);
-			page = __find_page_nolock(mapping, index, *hash);
-			if (page)
-				goto found_page;
+		/*
+		 * Somebody may have added the page while we
+		 * dropped the page hash lock. Check for that.
+		 */
+		lock_page_cache(mapping, hash);
+		page = __find_page_nolock(mapping, index, *hash);
+		if (page) {
+			/* found_page wants the hash lock only */
+			spin_unlock(&mapping->page_lock);
+			goto found_page;
 		}
 
 		/*
@@ -1527,7 +1445,7 @@ no_cached_page:
 		 */
 		page = cached_page;
 		__add_to_page_cache(page, mapping, index, hash);
-		spin_unlock(&pagecache_lock);
+		unlock_page_cache(mapping, hash);
 		lru_cache_add(page);		
 		cached_page = NULL;
 
@@ -1819,7 +1737,7 @@ out:
 static ssize_t do_readahead(struct file *file, unsigned long index, unsigned long nr)
 {
 	struct address_space *mapping = file->f_dentry->d_inode->i_mapping;
-	unsigned long max;
+	unsigned long max, active, inactive;
 
 	if (!mapping || !mapping->a_ops || !mapping->a_ops->readpage)
 		return -EINVAL;
@@ -1833,7 +1751,8 @@ static ssize_t do_readahead(struct file *file, unsigned long index, unsigned lon
 		nr = max;
 
 	/* And limit it to a sane percentage of the inactive list.. */
-	max = nr_inactive_pages / 2;
+	get_zone_counts(&active, &inactive);
+	max = inactive / 2;
 	if (nr > max)
 		nr = max;
 
@@ -2219,6 +2138,10 @@ static int msync_interval(struct vm_area * vma,
 	if ( (flags & MS_INVALIDATE) && (vma->vm_flags & VM_LOCKED) )
 		return -EBUSY;
 
+	/* Nothing to write back from huge pages */
+	if (is_vm_hugetlb_page(vma))
+		return 0;
+
 	if (file && (vma->vm_flags & VM_SHARED)) {
 		ret = filemap_sync(vma, start, end-start, flags);
 
@@ -2536,6 +2459,9 @@ static long madvise_vma(struct vm_area * vma, unsigned long start,
 {
 	long error = -EBADF;
 
+	if (is_vm_hugetlb_page(vma))
+		return -EINVAL;
+
 	switch (behavior) {
 	case MADV_NORMAL:
 	case MADV_SEQUENTIAL:
@@ -2668,11 +2594,11 @@ static unsigned char mincore_page(struct vm_area * vma,
 	struct address_space * as = vma->vm_file->f_dentry->d_inode->i_mapping;
 	struct page * page, ** hash = page_hash(as, pgoff);
 
-	spin_lock(&pagecache_lock);
+	spin_lock(page_hash_lock(hash));
 	page = __find_page_nolock(as, pgoff, *hash);
 	if ((page) && (Page_Uptodate(page)))
 		present = 1;
-	spin_unlock(&pagecache_lock);
+	spin_unlock(page_hash_lock(hash));
 
 	return present;
 }
@@ -3172,6 +3098,7 @@ o_direct:
 void __init page_cache_init(unsigned long mempages)
 {
 	unsigned long htable_size, order;
+	int i;
 
 	htable_size = mempages;
 	htable_size *= sizeof(struct page *);
@@ -3194,4 +3121,7 @@ void __init page_cache_init(unsigned long mempages)
 	if (!page_hash_table)
 		panic("Failed to allocate page hash table\n");
 	memset((void *)page_hash_table, 0, PAGE_HASH_SIZE * sizeof(struct page *));
+
+	for (i = 0; i < PAGE_HASH_LOCKS; i++)
+		spin_lock_init(&page_hash_locks[i].lock);
 }
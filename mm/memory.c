@@ -45,6 +45,7 @@
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
 #include <linux/module.h>
+#include <linux/hugetlb.h>
 
 #include <asm/pgalloc.h>
 #include <asm/uaccess.h>
@@ -56,6 +57,11 @@ unsigned long num_mappedpages;
 void * high_memory;
 struct page *highmem_start_page;
 
+/*
+ * Don't copy the ptes of shared mappings on fork, see copy_page_range().
+ */
+int sysctl_lazy_fork = 1;
+
 /*
  * We special-case the C-O-W ZERO_PAGE, because it's such
  * a common occurrence (no need to read the page to know
@@ -180,6 +186,20 @@ int copy_page_range(struct mm_struct *dst, struct mm_struct *src,
 	unsigned long address = vma->vm_start;
 	unsigned long end = vma->vm_end;
 	unsigned long cow = (vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) == VM_MAYWRITE;
+	struct pte_chain *pte_chain = NULL;
+
+	if (is_vm_hugetlb_page(vma))
+		return copy_hugetlb_page_range(dst, src, vma);
+
+	/*
+	 * A shared mapping with a ->nopage() holds nothing the child can't
+	 * fault in again from the page cache, and most children exec()
+	 * before they would.  Leave its page tables empty.
+	 */
+	if (sysctl_lazy_fork && (vma->vm_flags & VM_MAYSHARE) &&
+	    !(vma->vm_flags & (VM_IO | VM_RESERVED)) &&
+	    vma->vm_ops && vma->vm_ops->vnopage)
+		return 0;
 
 	src_pgd = pgd_offset(src, address)-1;
 	dst_pgd = pgd_offset(dst, address)-1;
@@ -230,11 +250,12 @@ skip_copy_pte_range:		address = (address + PMD_SIZE) & PMD_MASK;
 
 			spin_lock(&src->page_table_lock);			
 			do {
-				pte_t pte = *src_pte;
+				pte_t pte;
 				struct page *ptepage;
 				
 				/* copy_one_pte */
-
+again:
+				pte = *src_pte;
 				if (pte_none(pte))
 					goto cont_copy_pte_range_noset;
 				if (!pte_present(pte)) {
@@ -246,6 +267,25 @@ skip_copy_pte_range:		address = (address + PMD_SIZE) & PMD_MASK;
 				    PageReserved(ptepage))
 					goto cont_copy_pte_range;
 
+				/*
+				 * The child's pte goes on the page's chain.  If
+				 * we have to sleep for the chain entry, the
+				 * parent's pte may have changed meanwhile.
+				 */
+				if (!pte_chain) {
+					pte_chain = pte_chain_alloc(GFP_ATOMIC);
+					if (!pte_chain) {
+						spin_unlock(&src->page_table_lock);
+						spin_unlock(&dst->page_table_lock);
+						pte_chain = pte_chain_alloc(GFP_KERNEL);
+						spin_lock(&dst->page_table_lock);
+						spin_lock(&src->page_table_lock);
+						if (!pte_chain)
+							goto nomem_unlock;
+						goto again;
+					}
+				}
+
 				/* If it's a COW mapping, write protect it both in the parent and the child */
 				if (cow && pte_write(pte)) {
 					ptep_set_wrprotect(src_pte);
@@ -258,6 +298,8 @@ skip_copy_pte_range:		address = (address + PMD_SIZE) & PMD_MASK;
 				pte = pte_mkold(pte);
 				get_page(ptepage);
 				dst->rss++;
+				pte_chain = page_add_rmap(ptepage, dst_pte, dst,
+							  address, pte_chain);
 
 cont_copy_pte_range:		set_pte(dst_pte, pte);
 cont_copy_pte_range_noset:	address += PAGE_SIZE;
@@ -275,8 +317,12 @@ cont_copy_pmd_range:	src_pmd++;
 out_unlock:
 	spin_unlock(&src->page_table_lock);
 out:
+	pte_chain_free(pte_chain);
 	return 0;
+nomem_unlock:
+	spin_unlock(&src->page_table_lock);
 nomem:
+	pte_chain_free(pte_chain);
 	return -ENOMEM;
 }
 
@@ -315,8 +361,10 @@ static inline int zap_pte_range(mmu_gather_t *tlb, pmd_t * pmd, unsigned long ad
 			continue;
 		if (pte_present(pte)) {
 			struct page *page = pte_page(pte);
-			if (VALID_PAGE(page) && !PageReserved(page))
+			if (VALID_PAGE(page) && !PageReserved(page)) {
 				freed ++;
+				page_remove_rmap(page, ptep);
+			}
 			/* This will eventually call __free_pte on the pte. */
 			tlb_remove_page(tlb, ptep, address + offset);
 		} else {
@@ -355,39 +403,24 @@ static inline int zap_pmd_range(mmu_gather_t *tlb, pgd_t * dir, unsigned long ad
 }
 
 /*
- * remove user pages in a given range.
+ * Unmap [address, end) into the gather 'tlb'.  The caller holds the
+ * page_table_lock and flushes the tlb with tlb_finish_mmu().
  */
-void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long size)
+static void unmap_page_range(mmu_gather_t *tlb, struct mm_struct *mm,
+	unsigned long address, unsigned long end)
 {
-	mmu_gather_t *tlb;
 	pgd_t * dir;
-	unsigned long start = address, end = address + size;
 	int freed = 0;
 
-	dir = pgd_offset(mm, address);
-
-	/*
-	 * This is a long-lived spinlock. That's fine.
-	 * There's no contention, because the page table
-	 * lock only protects against kswapd anyway, and
-	 * even if kswapd happened to be looking at this
-	 * process we _want_ it to get stuck.
-	 */
 	if (address >= end)
 		BUG();
-	spin_lock(&mm->page_table_lock);
-	flush_cache_range(mm, address, end);
-	tlb = tlb_gather_mmu(mm);
-
+	dir = pgd_offset(mm, address);
 	do {
 		freed += zap_pmd_range(tlb, dir, address, end - address);
 		address = (address + PGDIR_SIZE) & PGDIR_MASK;
 		dir++;
 	} while (address && (address < end));
 
-	/* this will flush any remaining tlb entries */
-	tlb_finish_mmu(tlb, start, end);
-
 	/*
 	 * Update rss for the mm_struct (not necessarily current->mm)
 	 * Notice that rss is an unsigned long.
@@ -396,9 +429,66 @@ void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long s
 		mm->rss -= freed;
 	else
 		mm->rss = 0;
+}
+
+/*
+ * remove user pages in a given range.
+ */
+void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long size)
+{
+	mmu_gather_t *tlb;
+	unsigned long end = address + size;
+
+	/*
+	 * This is a long-lived spinlock. That's fine.
+	 * There's no contention, because the page table
+	 * lock only protects against kswapd anyway, and
+	 * even if kswapd happened to be looking at this
+	 * process we _want_ it to get stuck.
+	 */
+	spin_lock(&mm->page_table_lock);
+	flush_cache_range(mm, address, end);
+	tlb = tlb_gather_mmu(mm);
+	unmap_page_range(tlb, mm, address, end);
+	/* this will flush any remaining tlb entries */
+	tlb_finish_mmu(tlb, address, end);
 	spin_unlock(&mm->page_table_lock);
 }
 
+/*
+ * Remove the user pages in [start, end) of each vma on the ->vm_next
+ * list 'vma'.  munmap() and exit take down many vmas at once; gathering
+ * them all costs one tlb flush (and one round of flush IPIs) per batch
+ * of pages instead of at least one per vma.
+ */
+void unmap_vmas(struct mm_struct *mm, struct vm_area *vma,
+	unsigned long start, unsigned long end)
+{
+	struct vm_area *mpnt;
+	mmu_gather_t *tlb;
+
+	spin_lock(&mm->page_table_lock);
+	flush_cache_range(mm, start, end);
+	tlb = tlb_gather_mmu(mm);
+	for (mpnt = vma; mpnt; mpnt = mpnt->vm_next) {
+		unsigned long st = max(start, mpnt->vm_start);
+		unsigned long en = min(end, mpnt->vm_end);
+
+		if (st < en && !is_vm_hugetlb_page(mpnt))
+			unmap_page_range(tlb, mm, st, en);
+	}
+	tlb_finish_mmu(tlb, start, end);
+	spin_unlock(&mm->page_table_lock);
+
+	for (mpnt = vma; mpnt; mpnt = mpnt->vm_next) {
+		unsigned long st = max(start, mpnt->vm_start);
+		unsigned long en = min(end, mpnt->vm_end);
+
+		if (st < en && is_vm_hugetlb_page(mpnt))
+			zap_hugepage_range(mpnt, st, en - st);
+	}
+}
+
 /*
  * Do a quick page-table lookup for a single page. 
  */
@@ -473,6 +563,12 @@ int get_user_pages(struct task_struct *tsk, struct mm_struct *mm, unsigned long
 		if ( !vma || (pages && vma->vm_flags & VM_IO) || !(flags & vma->vm_flags) )
 			return i ? : -EFAULT;
 
+		if (is_vm_hugetlb_page(vma)) {
+			i = follow_hugetlb_page(mm, vma, pages, vmas,
+						&start, &len, i);
+			continue;
+		}
+
 		spin_lock(&mm->page_table_lock);
 		do {
 			struct page *map;
@@ -949,6 +1045,7 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area * vma,
 	unsigned long address, pte_t *page_table, pte_t pte)
 {
 	struct page *old_page, *new_page;
+	struct pte_chain *pte_chain;
 
 	old_page = pte_page(pte);
 	if (!VALID_PAGE(old_page))
@@ -974,6 +1071,9 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area * vma,
 	new_page = alloc_page(GFP_HIGHUSER);
 	if (!new_page)
 		goto no_mem;
+	pte_chain = pte_chain_alloc(GFP_KERNEL);
+	if (!pte_chain)
+		goto no_mem_free;
 	copy_cow_page(old_page,new_page,address);
 
 	/*
@@ -983,13 +1083,17 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area * vma,
 	if (pte_same(*page_table, pte)) {
 		if (PageReserved(old_page))
 			++mm->rss;
+		page_remove_rmap(old_page, page_table);
 		break_cow(vma, new_page, address, page_table);
+		pte_chain = page_add_rmap(new_page, page_table, mm, address,
+					  pte_chain);
 		lru_cache_add(new_page);
 
 		/* Free the old page.. */
 		new_page = old_page;
 	}
 	spin_unlock(&mm->page_table_lock);
+	pte_chain_free(pte_chain);
 	page_cache_release(new_page);
 	page_cache_release(old_page);
 	return 1;	/* Minor fault */
@@ -998,6 +1102,8 @@ bad_wp_page:
 	spin_unlock(&mm->page_table_lock);
 	printk("do_wp_page: bogus page at address %08lx (page 0x%lx)\n",address,(unsigned long)old_page);
 	return -1;
+no_mem_free:
+	page_cache_release(new_page);
 no_mem:
 	page_cache_release(old_page);
 	return -1;
@@ -1014,7 +1120,10 @@ static void vmtruncate_list(struct vm_area *mpnt, unsigned long pgoff)
 
 		/* mapping wholly truncated? */
 		if (mpnt->vm_pgoff >= pgoff) {
-			zap_page_range(mm, start, len);
+			if (is_vm_hugetlb_page(mpnt))
+				zap_hugepage_range(mpnt, start, len);
+			else
+				zap_page_range(mm, start, len);
 			continue;
 		}
 
@@ -1027,7 +1136,10 @@ static void vmtruncate_list(struct vm_area *mpnt, unsigned long pgoff)
 		/* Ok, partially affected.. */
 		start += diff << PAGE_SHIFT;
 		len = (len - diff) << PAGE_SHIFT;
-		zap_page_range(mm, start, len);
+		if (is_vm_hugetlb_page(mpnt))
+			zap_hugepage_range(mpnt, start, len);
+		else
+			zap_page_range(mm, start, len);
 	} while ((mpnt = mpnt->vm_next_share) != NULL);
 }
 
@@ -1119,6 +1231,7 @@ static int do_swap_page(struct mm_struct * mm,
 	pte_t * page_table, pte_t orig_pte, int write_access)
 {
 	struct page *page;
+	struct pte_chain *pte_chain;
 	swp_entry_t entry = pte_to_swp_entry(orig_pte);
 	pte_t pte;
 	int ret = 1;
@@ -1146,6 +1259,12 @@ static int do_swap_page(struct mm_struct * mm,
 
 	mark_page_accessed(page);
 
+	pte_chain = pte_chain_alloc(GFP_KERNEL);
+	if (!pte_chain) {
+		page_cache_release(page);
+		return -1;
+	}
+
 	lock_page(page);
 
 	/*
@@ -1157,6 +1276,7 @@ static int do_swap_page(struct mm_struct * mm,
 		spin_unlock(&mm->page_table_lock);
 		unlock_page(page);
 		page_cache_release(page);
+		pte_chain_free(pte_chain);
 		return 1;
 	}
 
@@ -1175,10 +1295,12 @@ static int do_swap_page(struct mm_struct * mm,
 	flush_page_to_ram(page);
 	flush_icache_page(vma, page);
 	set_pte(page_table, pte);
+	pte_chain = page_add_rmap(page, page_table, mm, address, pte_chain);
 
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(vma, address, pte);
 	spin_unlock(&mm->page_table_lock);
+	pte_chain_free(pte_chain);
 	return ret;
 }
 
@@ -1189,6 +1311,7 @@ static int do_swap_page(struct mm_struct * mm,
  */
 static int do_anonymous_page(struct mm_struct * mm, struct vm_area * vma, pte_t *page_table, int write_access, unsigned long addr)
 {
+	struct pte_chain *pte_chain = NULL;
 	pte_t entry;
 
 	/* Read-only mapping of ZERO_PAGE. */
@@ -1204,17 +1327,24 @@ static int do_anonymous_page(struct mm_struct * mm, struct vm_area * vma, pte_t
 		page = alloc_page(GFP_HIGHUSER);
 		if (!page)
 			goto no_mem;
+		pte_chain = pte_chain_alloc(GFP_KERNEL);
+		if (!pte_chain) {
+			page_cache_release(page);
+			goto no_mem;
+		}
 		clear_user_highpage(page, addr);
 
 		spin_lock(&mm->page_table_lock);
 		if (!pte_none(*page_table)) {
 			page_cache_release(page);
 			spin_unlock(&mm->page_table_lock);
+			pte_chain_free(pte_chain);
 			return 1;
 		}
 		mm->rss++;
 		flush_page_to_ram(page);
 		entry = pte_mkwrite(pte_mkdirty(mk_pte(page, vma->vm_page_prot)));
+		pte_chain = page_add_rmap(page, page_table, mm, addr, pte_chain);
 		lru_cache_add(page);
 		mark_page_accessed(page);
 	}
@@ -1224,6 +1354,7 @@ static int do_anonymous_page(struct mm_struct * mm, struct vm_area * vma, pte_t
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(vma, addr, entry);
 	spin_unlock(&mm->page_table_lock);
+	pte_chain_free(pte_chain);
 	return 1;	/* Minor fault */
 
 no_mem:
@@ -1246,6 +1377,7 @@ static int do_no_page(struct mm_struct * mm, struct vm_area * vma,
 	unsigned long address, int write_access, pte_t *page_table)
 {
 	struct page * new_page;
+	struct pte_chain *pte_chain;
 	pte_t entry;
 
 	if (!vma->vm_ops || !vma->vm_ops->vnopage)
@@ -1259,6 +1391,12 @@ static int do_no_page(struct mm_struct * mm, struct vm_area * vma,
 	if (new_page == NOPAGE_OOM)
 		return -1;
 
+	pte_chain = pte_chain_alloc(GFP_KERNEL);
+	if (!pte_chain) {
+		page_cache_release(new_page);
+		return -1;
+	}
+
 	/*
 	 * Should we do an early C-O-W break?
 	 */
@@ -1266,6 +1404,7 @@ static int do_no_page(struct mm_struct * mm, struct vm_area * vma,
 		struct page * page = alloc_page(GFP_HIGHUSER);
 		if (!page) {
 			page_cache_release(new_page);
+			pte_chain_free(pte_chain);
 			return -1;
 		}
 		copy_user_highpage(page, new_page, address);
@@ -1294,16 +1433,20 @@ static int do_no_page(struct mm_struct * mm, struct vm_area * vma,
 		if (write_access)
 			entry = pte_mkwrite(pte_mkdirty(entry));
 		set_pte(page_table, entry);
+		pte_chain = page_add_rmap(new_page, page_table, mm, address,
+					  pte_chain);
 	} else {
 		/* One of our sibling threads was faster, back out. */
 		page_cache_release(new_page);
 		spin_unlock(&mm->page_table_lock);
+		pte_chain_free(pte_chain);
 		return 1;
 	}
 
 	/* no need to invalidate: a not-present page shouldn't be cached */
 	update_mmu_cache(vma, address, entry);
 	spin_unlock(&mm->page_table_lock);
+	pte_chain_free(pte_chain);
 	return 2;	/* Major fault */
 }
 
@@ -1368,6 +1511,11 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area * vma,
 	pmd_t *pmd;
 
 	current->state = TASK_RUNNING;
+
+	/* Huge pages are mapped at mmap time; a hole means truncated */
+	if (is_vm_hugetlb_page(vma))
+		return 0;
+
 	pgd = pgd_offset(mm, address);
 
 	/*
@@ -14,6 +14,7 @@
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/personality.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgalloc.h>
@@ -940,6 +941,9 @@ int do_munmap(struct mm_struct *mm, unsigned long addr, size_t len)
 	if (mpnt->vm_start >= addr+len)
 		return 0;
 
+	if (!hugetlb_unmap_ok(mpnt, addr, addr+len))
+		return -EINVAL;
+
 	/* If we'll make "hole", check the vm areas limit */
 	if ((mpnt->vm_start < addr && mpnt->vm_end > addr+len)
 	    && mm->map_count >= max_map_count)
@@ -966,11 +970,12 @@ int do_munmap(struct mm_struct *mm, unsigned long addr, size_t len)
 	spin_unlock(&mm->page_table_lock);
 
 	/* Ok - we have the memory areas we should free on the 'free' list,
-	 * so release them, and unmap the page range..
+	 * so unmap the page range of them all at once, and release them..
 	 * If the one of the segments is only being partially unmapped,
 	 * it will put new vm_area(s) into the address space.
 	 * In that case we have to be careful with VM_DENYWRITE.
 	 */
+	unmap_vmas(mm, free, addr, addr+len);
 	while ((mpnt = free) != NULL) {
 		unsigned long st, end, size;
 		struct file *file = NULL;
@@ -990,8 +995,6 @@ int do_munmap(struct mm_struct *mm, unsigned long addr, size_t len)
 		remove_shared_vm_struct(mpnt);
 		mm->map_count--;
 
-		zap_page_range(mm, st, size);
-
 		/*
 		 * Fix the mapping, and free the old area if it wasn't reused.
 		 */
@@ -1135,11 +1138,10 @@ void exit_mmap(struct mm_struct * mm)
 	mm->locked_vm = 0;
 
 	flush_cache_mm(mm);
+	if (mpnt)
+		unmap_vmas(mm, mpnt, 0, TASK_SIZE);
 	while (mpnt) {
 		struct vm_area * next = mpnt->vm_next;
-		unsigned long start = mpnt->vm_start;
-		unsigned long end = mpnt->vm_end;
-		unsigned long size = end - start;
 
 		if (mpnt->vm_ops) {
 			if (mpnt->vm_ops->vclose)
@@ -1147,7 +1149,6 @@ void exit_mmap(struct mm_struct * mm)
 		}
 		mm->map_count--;
 		remove_shared_vm_struct(mpnt);
-		zap_page_range(mm, start, size);
 		if (mpnt->vm_file)
 			fput(mpnt->vm_file);
 		kmem_cache_free(vm_area_cachep, mpnt);
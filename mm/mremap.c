@@ -9,6 +9,7 @@
 #include <linux/shm.h>
 #include <linux/mman.h>
 #include <linux/swap.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgalloc.h>
@@ -57,7 +58,8 @@ static inline pte_t *alloc_one_pte(struct mm_struct *mm, unsigned long addr)
 	return pte;
 }
 
-static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst)
+static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst,
+	unsigned long new_addr)
 {
 	int error = 0;
 	pte_t pte;
@@ -68,7 +70,8 @@ static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst)
 			/* No dest?  We must put it back. */
 			dst = src;
 			error++;
-		}
+		} else if (pte_present(pte))
+			page_move_rmap(pte_page(pte), src, dst, new_addr);
 		set_pte(dst, pte);
 	}
 	return error;
@@ -82,7 +85,7 @@ static int move_one_page(struct mm_struct *mm, unsigned long old_addr, unsigned
 	spin_lock(&mm->page_table_lock);
 	src = get_one_pte(mm, old_addr);
 	if (src)
-		error = copy_one_pte(mm, src, alloc_one_pte(mm, new_addr));
+		error = copy_one_pte(mm, src, alloc_one_pte(mm, new_addr), new_addr);
 	spin_unlock(&mm->page_table_lock);
 	return error;
 }
@@ -270,6 +273,11 @@ unsigned long do_mremap(unsigned long addr,
 	/* We can't remap across vm area boundaries */
 	if (old_len > vma->vm_end - addr)
 		goto out;
+	/* Huge page mappings stay where they are */
+	if (is_vm_hugetlb_page(vma)) {
+		ret = -EINVAL;
+		goto out;
+	}
 	if (vma->vm_flags & VM_DONTEXPAND) {
 		if (new_len > old_len)
 			goto out;
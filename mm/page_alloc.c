@@ -23,10 +23,6 @@
 #include <linux/module.h>
 
 int nr_swap_pages;
-int nr_active_pages;
-int nr_inactive_pages;
-LIST_HEAD(inactive_list);
-LIST_HEAD(active_list);
 struct pm_node *nod_list;
 
 /*
@@ -78,41 +74,16 @@ static int zone_balance_max[MAX_NR_ZONES] __initdata = { 255 , 255, 255, };
  * -- wli
  */
 
-static void FASTCALL(__free_pages_ok (struct page *page, unsigned int order));
-static void __free_pages_ok (struct page *page, unsigned int order)
+/*
+ * Merge a block back into the buddy lists.  Called with the zone lock
+ * held.
+ */
+static inline void __free_one_page(struct page *page, struct pm_zone *zone,
+				   unsigned int order)
 {
-	unsigned long index, page_idx, mask, flags;
+	unsigned long index, page_idx, mask;
 	struct free_area *area;
 	struct page *base;
-	struct pm_zone *zone;
-
-	/*
-	 * Yes, think what happens when other parts of the kernel take 
-	 * a reference to a page in order to pin it for io. -ben
-	 */
-	if (PageLRU(page)) {
-		if (unlikely(in_interrupt()))
-			BUG();
-		lru_cache_del(page);
-	}
-
-	if (page->buffers)
-		BUG();
-	if (page->mapping)
-		BUG();
-	if (!VALID_PAGE(page))
-		BUG();
-	if (PageLocked(page))
-		BUG();
-	if (PageActive(page))
-		BUG();
-	page->flags &= ~((1<<PG_referenced) | (1<<PG_dirty));
-
-	if (current->flags & PF_FREE_PAGES)
-		goto local_freelist;
- back_local_freelist:
-
-	zone = page_zone(page);
 
 	mask = (~0UL) << order;
 	base = zone->zone_pg_map;
@@ -123,8 +94,6 @@ static void __free_pages_ok (struct page *page, unsigned int order)
 
 	area = zone->free_areas + order;
 
-	spin_lock_irqsave(&zone->lock, flags);
-
 	zone->free_pages -= mask;
 
 	while (mask + (1 << (MAX_ORDER-1))) {
@@ -156,7 +125,51 @@ static void __free_pages_ok (struct page *page, unsigned int order)
 		page_idx &= mask;
 	}
 	list_add(&(base + page_idx)->list, &area->free_list);
+}
+
+static inline void free_pages_check(struct page *page)
+{
+	/*
+	 * Yes, think what happens when other parts of the kernel take 
+	 * a reference to a page in order to pin it for io. -ben
+	 */
+	if (PageLRU(page)) {
+		if (unlikely(in_interrupt()))
+			BUG();
+		lru_cache_del(page);
+	}
 
+	if (page->buffers)
+		BUG();
+	if (page->mapping)
+		BUG();
+	if (page->pte_chain)
+		BUG();
+	if (!VALID_PAGE(page))
+		BUG();
+	if (PageLocked(page))
+		BUG();
+	if (PageActive(page))
+		BUG();
+	page->flags &= ~((1<<PG_referenced) | (1<<PG_dirty));
+}
+
+static void FASTCALL(__free_pages_ok (struct page *page, unsigned int order));
+static void __free_pages_ok (struct page *page, unsigned int order)
+{
+	unsigned long flags;
+	struct pm_zone *zone;
+
+	free_pages_check(page);
+
+	if (current->flags & PF_FREE_PAGES)
+		goto local_freelist;
+ back_local_freelist:
+
+	zone = page_zone(page);
+
+	spin_lock_irqsave(&zone->lock, flags);
+	__free_one_page(page, zone, order);
 	spin_unlock_irqrestore(&zone->lock, flags);
 	return;
 
@@ -171,6 +184,56 @@ static void __free_pages_ok (struct page *page, unsigned int order)
 	current->nr_local_pages++;
 }
 
+/*
+ * Hand the oldest 'count' pages of a per-CPU list back to the buddy
+ * lists, under one acquisition of the zone lock.
+ */
+static int free_pages_bulk(struct pm_zone *zone, int count,
+			   struct list_head *list)
+{
+	struct page *page;
+	int freed = 0;
+
+	spin_lock(&zone->lock);
+	while (count-- && !list_empty(list)) {
+		page = list_entry(list->prev, struct page, list);
+		list_del(&page->list);
+		__free_one_page(page, zone, 0);
+		freed++;
+	}
+	spin_unlock(&zone->lock);
+	return freed;
+}
+
+/*
+ * Free an order-0 page to this CPU's hot or cold list.  Pages freed by
+ * someone who has just touched them go to the hot list, to be handed
+ * out again first; pages nobody will touch soon go to the cold one.
+ */
+static void FASTCALL(free_hot_cold_page(struct page *page, int cold));
+static void free_hot_cold_page(struct page *page, int cold)
+{
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+
+	/* balance_classzone() wants to see what it freed */
+	if (current->flags & PF_FREE_PAGES) {
+		__free_pages_ok(page, 0);
+		return;
+	}
+
+	free_pages_check(page);
+
+	local_irq_save(flags);
+	pcp = &page_zone(page)->pageset[smp_processor_id()].pcp[cold];
+	if (pcp->count >= pcp->high)
+		pcp->count -= free_pages_bulk(page_zone(page), pcp->batch,
+					      &pcp->list);
+	list_add(&page->list, &pcp->list);
+	pcp->count++;
+	local_irq_restore(flags);
+}
+
 #define MARK_USED(index, order, area) \
 	__change_bit((index) >> (1+(order)), (area)->map)
 
@@ -195,16 +258,16 @@ static inline struct page * expand (struct pm_zone *zone, struct page *page,
 	return page;
 }
 
-static FASTCALL(struct page * rmqueue(struct pm_zone *zone, unsigned int order));
-static struct page * rmqueue(struct pm_zone *zone, unsigned int order)
+/*
+ * Take a block off the buddy lists.  Called with the zone lock held.
+ */
+static struct page * __rmqueue(struct pm_zone *zone, unsigned int order)
 {
 	struct free_area * area = zone->free_areas + order;
 	unsigned int curr_order = order;
 	struct list_head *head, *curr;
-	unsigned long flags;
 	struct page *page;
 
-	spin_lock_irqsave(&zone->lock, flags);
 	do {
 		head = &area->free_list;
 		curr = head->next;
@@ -221,32 +284,98 @@ static struct page * rmqueue(struct pm_zone *zone, unsigned int order)
 				MARK_USED(index, curr_order, area);
 			zone->free_pages -= 1UL << order;
 
-			page = expand(zone, page, index, order, curr_order, area);
-			spin_unlock_irqrestore(&zone->lock, flags);
-
-			set_page_count(page, 1);
-			if (BAD_RANGE(zone,page))
-				BUG();
-			if (PageLRU(page))
-				BUG();
-			if (PageActive(page))
-				BUG();
-			return page;	
+			return expand(zone, page, index, order, curr_order, area);
 		}
 		curr_order++;
 		area++;
 	} while (curr_order < MAX_ORDER);
-	spin_unlock_irqrestore(&zone->lock, flags);
 
 	return NULL;
 }
 
+/*
+ * Refill a per-CPU list with up to 'count' pages under one acquisition
+ * of the zone lock.
+ */
+static int rmqueue_bulk(struct pm_zone *zone, int count,
+			struct list_head *list)
+{
+	struct page *page;
+	int allocated = 0;
+
+	spin_lock(&zone->lock);
+	while (allocated < count) {
+		page = __rmqueue(zone, 0);
+		if (!page)
+			break;
+		list_add_tail(&page->list, list);
+		allocated++;
+	}
+	spin_unlock(&zone->lock);
+	return allocated;
+}
+
+static FASTCALL(struct page * rmqueue(struct pm_zone *zone, unsigned int order, unsigned int gfp_mask));
+static struct page * rmqueue(struct pm_zone *zone, unsigned int order, unsigned int gfp_mask)
+{
+	unsigned long flags;
+	struct page *page = NULL;
+
+	if (order == 0) {
+		struct per_cpu_pages *pcp;
+		int cold = !!(gfp_mask & __GFP_COLD);
+
+		local_irq_save(flags);
+		pcp = &zone->pageset[smp_processor_id()].pcp[cold];
+		if (pcp->count <= pcp->low)
+			pcp->count += rmqueue_bulk(zone, pcp->batch, &pcp->list);
+		if (pcp->count) {
+			page = list_entry(pcp->list.next, struct page, list);
+			list_del(&page->list);
+			pcp->count--;
+		}
+		local_irq_restore(flags);
+	}
+
+	if (!page) {
+		spin_lock_irqsave(&zone->lock, flags);
+		page = __rmqueue(zone, order);
+		spin_unlock_irqrestore(&zone->lock, flags);
+		if (!page)
+			return NULL;
+	}
+
+	set_page_count(page, 1);
+	if (BAD_RANGE(zone,page))
+		BUG();
+	if (PageLRU(page))
+		BUG();
+	if (PageActive(page))
+		BUG();
+	return page;	
+}
+
 struct page *_alloc_pages(unsigned int gfp_mask, unsigned int order)
 {
 	return __alloc_pages(gfp_mask, order,
 		contig_pm_node.node_zonelists+(gfp_mask & GFP_ZONEMASK));
 }
 
+/*
+ * Allocate starting from the zones of node 'nid', for callers that care
+ * whose memory they get.  Unknown nodes get the default zonelists.
+ */
+struct page *alloc_pages_node(int nid, unsigned int gfp_mask, unsigned int order)
+{
+	struct pm_node *pmnod;
+
+	for (pmnod = nod_list; pmnod; pmnod = pmnod->node_next)
+		if (pmnod->node_id == nid)
+			return __alloc_pages(gfp_mask, order,
+				pmnod->node_zonelists+(gfp_mask & GFP_ZONEMASK));
+	return _alloc_pages(gfp_mask, order);
+}
+
 static struct page * FASTCALL(balance_classzone(struct pm_zone *, unsigned int, unsigned int, int *));
 static struct page * balance_classzone(struct pm_zone * classzone, unsigned int gfp_mask, unsigned int order, int * freed)
 {
@@ -341,7 +470,7 @@ struct page * __alloc_pages(unsigned int gfp_mask, unsigned int order, struct pm
 
 		min += z->pages_low;
 		if (z->free_pages > min) {
-			page = rmqueue(z, order);
+			page = rmqueue(z, order, gfp_mask);
 			if (page)
 				return page;
 		}
@@ -365,7 +494,7 @@ struct page * __alloc_pages(unsigned int gfp_mask, unsigned int order, struct pm
 			local_min >>= 2;
 		min += local_min;
 		if (z->free_pages > min) {
-			page = rmqueue(z, order);
+			page = rmqueue(z, order, gfp_mask);
 			if (page)
 				return page;
 		}
@@ -381,7 +510,7 @@ rebalance:
 			if (!z)
 				break;
 
-			page = rmqueue(z, order);
+			page = rmqueue(z, order, gfp_mask);
 			if (page)
 				return page;
 		}
@@ -405,7 +534,7 @@ rebalance:
 
 		min += z->pages_min;
 		if (z->free_pages > min) {
-			page = rmqueue(z, order);
+			page = rmqueue(z, order, gfp_mask);
 			if (page)
 				return page;
 		}
@@ -447,9 +576,23 @@ unsigned long get_zeroed_page(unsigned int gfp_mask)
 }
 
 void __free_pages(struct page *page, unsigned int order)
+{
+	if (!PageReserved(page) && put_page_testzero(page)) {
+		if (order == 0)
+			free_hot_cold_page(page, 0);
+		else
+			__free_pages_ok(page, order);
+	}
+}
+
+/*
+ * Drop a reference on a page that the caller has not touched lately,
+ * such as one just reclaimed.
+ */
+void __free_page_cold(struct page *page)
 {
 	if (!PageReserved(page) && put_page_testzero(page))
-		__free_pages_ok(page, order);
+		free_hot_cold_page(page, 1);
 }
 
 void free_pages(unsigned long addr, unsigned int order)
@@ -509,6 +652,25 @@ unsigned int nr_free_highpages (void)
 }
 #endif
 
+/*
+ * Total size of the active and inactive lists of all zones.
+ */
+void get_zone_counts(unsigned long *active, unsigned long *inactive)
+{
+	struct pm_node *pmnod;
+	struct pm_zone *zone;
+
+	*active = 0;
+	*inactive = 0;
+	for (pmnod = nod_list; pmnod; pmnod = pmnod->node_next) {
+		for (zone = pmnod->node_zones;
+		     zone < pmnod->node_zones + MAX_NR_ZONES; zone++) {
+			*active += zone->nr_active;
+			*inactive += zone->nr_inactive;
+		}
+	}
+}
+
 #define K(x) ((x) << (PAGE_SHIFT-10))
 
 /*
@@ -521,6 +683,7 @@ void show_free_areas_core(struct pm_node *pmnod)
  	unsigned int order;
 	unsigned type;
 	struct pm_node *tmpdat = pmnod;
+	unsigned long active, inactive;
 
 	printk("Free pages:      %6dkB (%6dkB HighMem)\n",
 		K(nr_free_pages()),
@@ -531,19 +694,25 @@ void show_free_areas_core(struct pm_node *pmnod)
 		for (zone = tmpdat->node_zones;
 			       	zone < tmpdat->node_zones + MAX_NR_ZONES; zone++)
 			printk("Zone:%s freepages:%6lukB min:%6lukB low:%6lukB " 
-				       "high:%6lukB\n", 
+				       "high:%6lukB active:%lu inactive:%lu "
+				       "scanned:%lu reclaimed:%lu\n", 
 					zone->name,
 					K(zone->free_pages),
 					K(zone->pages_min),
 					K(zone->pages_low),
-					K(zone->pages_high));
+					K(zone->pages_high),
+					zone->nr_active,
+					zone->nr_inactive,
+					zone->pages_scanned,
+					zone->pages_reclaimed);
 			
 		tmpdat = tmpdat->node_next;
 	}
 
-	printk("( Active: %d, inactive: %d, free: %d )\n",
-	       nr_active_pages,
-	       nr_inactive_pages,
+	get_zone_counts(&active, &inactive);
+	printk("( Active: %lu, inactive: %lu, free: %d )\n",
+	       active,
+	       inactive,
 	       nr_free_pages());
 
 	for (type = 0; type < MAX_NR_ZONES; type++) {
@@ -723,7 +892,8 @@ void __init free_area_init_core(int nid, struct pm_node *pmnod, struct page **gm
 	for (j = 0; j < MAX_NR_ZONES; j++) {
 		struct pm_zone *zone = pmnod->node_zones + j;
 		unsigned long mask;
-		unsigned long size, realsize;
+		unsigned long size, realsize, batch;
+		int cpu;
 
 		zone_table[nid * MAX_NR_ZONES + j] = zone;
 		realsize = size = zones_size[j];
@@ -737,6 +907,40 @@ void __init free_area_init_core(int nid, struct pm_node *pmnod, struct page **gm
 		zone->zone_pmnod = pmnod;
 		zone->free_pages = 0;
 		zone->need_balance = 0;
+		zone->lru_lock = SPIN_LOCK_UNLOCKED;
+		INIT_LIST_HEAD(&zone->active_list);
+		INIT_LIST_HEAD(&zone->inactive_list);
+		zone->nr_active = 0;
+		zone->nr_inactive = 0;
+
+		/*
+		 * Per-CPU batches of about 1/4096 of the zone, but no
+		 * more than 64k worth of pages.
+		 */
+		batch = realsize / 1024;
+		if (batch * PAGE_SIZE > 256*1024)
+			batch = (256*1024) / PAGE_SIZE;
+		batch /= 4;
+		if (batch < 1)
+			batch = 1;
+		for (cpu = 0; cpu < NR_CPUS; cpu++) {
+			struct per_cpu_pages *pcp;
+
+			pcp = &zone->pageset[cpu].pcp[0];	/* hot */
+			pcp->count = 0;
+			pcp->low = 2 * batch;
+			pcp->high = 6 * batch;
+			pcp->batch = batch;
+			INIT_LIST_HEAD(&pcp->list);
+
+			pcp = &zone->pageset[cpu].pcp[1];	/* cold */
+			pcp->count = 0;
+			pcp->low = 0;
+			pcp->high = 2 * batch;
+			pcp->batch = batch;
+			INIT_LIST_HEAD(&pcp->list);
+		}
+
 		if (!size)
 			continue;
 
@@ -96,6 +96,53 @@ void rw_swap_page(int rw, struct page *page)
 		UnlockPage(page);
 }
 
+/*
+ * Does entry a come before entry b in swap?
+ */
+static inline int swap_entry_before(swp_entry_t a, swp_entry_t b)
+{
+	if (SWP_TYPE(a) != SWP_TYPE(b))
+		return SWP_TYPE(a) < SWP_TYPE(b);
+	return SWP_OFFSET(a) < SWP_OFFSET(b);
+}
+
+/*
+ * Write out a batch of locked, dirty swap cache pages picked by the
+ * pageout code, and drop the references it took on them.  The writes
+ * are started in swap order, so that pages in neighbouring slots
+ * follow each other into the request queue and get merged into large
+ * requests there.
+ */
+void swap_writepages(struct page **pages, int nr)
+{
+	int i, j;
+
+	/* Insertion sort, the batches are small */
+	for (i = 1; i < nr; i++) {
+		struct page *page = pages[i];
+		swp_entry_t entry;
+
+		entry.val = page->index;
+		for (j = i; j > 0; j--) {
+			swp_entry_t prev;
+
+			prev.val = pages[j-1]->index;
+			if (!swap_entry_before(entry, prev))
+				break;
+			pages[j] = pages[j-1];
+		}
+		pages[j] = page;
+	}
+
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
+
+		SetPageLaunder(page);
+		swapper_space.a_ops->writepage(page);
+		page_cache_release(page);
+	}
+}
+
 /*
  * The swap lock map insists that pages be in the page cache!
  * Therefore we can't use it.  Later when we can remove the need for the
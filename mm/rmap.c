@@ -0,0 +1,244 @@
+/*
+ *  linux/mm/rmap.c
+ *
+ *  Reverse mapping of user pages.  Every pte that maps a pageable page
+ *  is recorded on a chain hanging off the page, so the pageout code can
+ *  unmap a page it has picked from the inactive list directly instead
+ *  of scanning the page tables of every process for it.
+ *
+ *  Locking: page->pte_chain is protected by pte_chain_lock(), which
+ *  nests inside mm->page_table_lock.  Entries are added and removed
+ *  with the page_table_lock of their mm held; try_to_unmap() comes from
+ *  the page side and can only trylock it.
+ */
+
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+#include <linux/pagemap.h>
+#include <linux/init.h>
+
+#include <asm/pgalloc.h>
+
+struct pte_chain {
+	struct pte_chain * next;
+	pte_t * ptep;
+	struct mm_struct * mm;
+	unsigned long address;
+};
+
+static struct kmem_cache_s *pte_chain_cachep;
+
+static atomic_t nr_pte_chains = ATOMIC_INIT(0);
+
+struct pte_chain * pte_chain_alloc(int gfp_mask)
+{
+	struct pte_chain *pc;
+
+	pc = kmem_cache_alloc(pte_chain_cachep, gfp_mask);
+	if (pc)
+		atomic_inc(&nr_pte_chains);
+	return pc;
+}
+
+void pte_chain_free(struct pte_chain *pc)
+{
+	if (pc) {
+		atomic_dec(&nr_pte_chains);
+		kmem_cache_free(pte_chain_cachep, pc);
+	}
+}
+
+/* Memory taken by pte chains, for /proc/meminfo */
+unsigned long pte_chain_size(void)
+{
+	return atomic_read(&nr_pte_chains) * sizeof(struct pte_chain);
+}
+
+/*
+ * Record that 'ptep', mapping 'address' in 'mm', now points to 'page'.
+ * The chain entry has to be allocated beforehand since we are called
+ * with mm->page_table_lock held.  Pages that are never reclaimed are not
+ * tracked, and then the entry is handed back to be freed by the caller.
+ */
+struct pte_chain * page_add_rmap(struct page *page, pte_t *ptep,
+	struct mm_struct *mm, unsigned long address, struct pte_chain *pc)
+{
+	if (!VALID_PAGE(page) || PageReserved(page))
+		return pc;
+
+	pc->ptep = ptep;
+	pc->mm = mm;
+	pc->address = address & PAGE_MASK;
+
+	pte_chain_lock(page);
+	pc->next = page->pte_chain;
+	page->pte_chain = pc;
+	pte_chain_unlock(page);
+	return NULL;
+}
+
+/*
+ * 'ptep' no longer maps 'page'.  mm->page_table_lock is held.
+ */
+void page_remove_rmap(struct page *page, pte_t *ptep)
+{
+	struct pte_chain *pc, **pprev;
+
+	if (!VALID_PAGE(page) || PageReserved(page))
+		return;
+
+	pte_chain_lock(page);
+	for (pprev = &page->pte_chain; (pc = *pprev) != NULL; pprev = &pc->next) {
+		if (pc->ptep == ptep) {
+			*pprev = pc->next;
+			pte_chain_unlock(page);
+			pte_chain_free(pc);
+			return;
+		}
+	}
+	pte_chain_unlock(page);
+	printk(KERN_ERR "page_remove_rmap: pte %p not on the chain of page %p\n",
+	       ptep, page);
+}
+
+/*
+ * mremap() moved the pte mapping 'page' from 'old_ptep' to 'new_ptep'
+ * at 'address', in the same mm.  mm->page_table_lock is held.
+ */
+void page_move_rmap(struct page *page, pte_t *old_ptep, pte_t *new_ptep,
+	unsigned long address)
+{
+	struct pte_chain *pc;
+
+	if (!VALID_PAGE(page) || PageReserved(page))
+		return;
+
+	pte_chain_lock(page);
+	for (pc = page->pte_chain; pc; pc = pc->next) {
+		if (pc->ptep == old_ptep) {
+			pc->ptep = new_ptep;
+			pc->address = address & PAGE_MASK;
+			break;
+		}
+	}
+	pte_chain_unlock(page);
+}
+
+/*
+ * Test and clear the accessed bit of every pte mapping the page and
+ * return how many were set.  The ptes are only looked at, the pte
+ * chain lock keeps them from going away under us.
+ */
+int page_referenced(struct page *page)
+{
+	struct pte_chain *pc;
+	int referenced = 0;
+
+	pte_chain_lock(page);
+	for (pc = page->pte_chain; pc; pc = pc->next)
+		if (ptep_test_and_clear_young(pc->ptep))
+			referenced++;
+	pte_chain_unlock(page);
+	return referenced;
+}
+
+/* The pte chain lock is held, and the page is locked */
+static int try_to_unmap_one(struct page *page, struct pte_chain *pc)
+{
+	struct mm_struct *mm = pc->mm;
+	unsigned long address = pc->address;
+	struct vm_area *vma;
+	pte_t pte;
+	int ret;
+
+	if (!spin_trylock(&mm->page_table_lock))
+		return SWAP_AGAIN;
+
+	/* munmap() unlinks the vma before it zaps the ptes */
+	ret = SWAP_AGAIN;
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start)
+		goto out_unlock;
+
+	/* Don't look at this pte if it's been accessed recently. */
+	ret = SWAP_FAIL;
+	if ((vma->vm_flags & (VM_LOCKED | VM_RESERVED)) ||
+	    ptep_test_and_clear_young(pc->ptep))
+		goto out_unlock;
+
+	flush_cache_page(vma, address);
+	pte = ptep_get_and_clear(pc->ptep);
+	flush_tlb_page(vma, address);
+
+	if (pte_dirty(pte))
+		set_page_dirty(page);
+
+	/*
+	 * A swap cache page is found again through the swap entry, a page
+	 * cache page through its file offset.
+	 */
+	if (PageSwapCache(page)) {
+		swp_entry_t entry;
+
+		entry.val = page->index;
+		swap_duplicate(entry);
+		set_pte(pc->ptep, swp_entry_to_pte(entry));
+	}
+
+	mm->rss--;
+	page_cache_release(page);
+	ret = SWAP_SUCCESS;
+
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+
+/*
+ * Unmap a locked page from every pte on its chain.  The caller must
+ * hold a reference on the page besides the mapping ones, usually the
+ * page cache or swap cache one, and anonymous pages need to be in the
+ * swap cache first.
+ *
+ * Returns SWAP_SUCCESS if the page is no longer mapped, SWAP_AGAIN if
+ * some of the ptes could not be got at right now, and SWAP_FAIL if the
+ * page is in active use and should not be evicted at all.
+ */
+int try_to_unmap(struct page *page)
+{
+	struct pte_chain *pc, **pprev;
+	int ret = SWAP_SUCCESS;
+
+	if (!PageLocked(page))
+		BUG();
+
+	pte_chain_lock(page);
+	pprev = &page->pte_chain;
+	while ((pc = *pprev) != NULL) {
+		switch (try_to_unmap_one(page, pc)) {
+		case SWAP_SUCCESS:
+			*pprev = pc->next;
+			pte_chain_free(pc);
+			continue;
+		case SWAP_AGAIN:
+			ret = SWAP_AGAIN;
+			break;
+		case SWAP_FAIL:
+			ret = SWAP_FAIL;
+			goto out;
+		}
+		pprev = &pc->next;
+	}
+out:
+	pte_chain_unlock(page);
+	return ret;
+}
+
+void __init pte_chain_init(void)
+{
+	pte_chain_cachep = kmem_cache_create("pte_chain",
+			sizeof(struct pte_chain), 0, 0, NULL, NULL);
+	if (!pte_chain_cachep)
+		panic("Cannot create pte_chain SLAB cache");
+}
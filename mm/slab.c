@@ -45,12 +45,21 @@
  *
  * The c_cpuarray may not be read with enabled local interrupts.
  *
+ * The slab lists are kept per node: every slab belongs to the node it was
+ * grown for, cpus allocate from the lists of their own node, and each
+ * node's lists have their own lock.  An object freed on a cpu of another
+ * node is queued in that cpu's alien array for its home node and goes
+ * back to it in a batch, under the home node's lock.  Without NUMA there
+ * is just one node.
+ *
  * SMP synchronization:
  *  constructors and destructors are called without any locking.
  *  Several members in struct kmem_cache_s and struct slab never change, they
  *	are accessed without any locking.
  *  The per-cpu arrays are never accessed from the wrong cpu, no locking.
- *  The non-constant members are protected with a per-cache irq spinlock.
+ *  The slab lists of a node are protected with the node's irq spinlock,
+ *	the other non-constant members with a per-cache irq spinlock.
+ *	The two are never held together.
  *
  * Further notes from the original documentation:
  *
@@ -158,27 +167,64 @@ struct slab {
 	void			*s_mem;		/* including colour offset */
 	unsigned int		inuse;		/* num of objs active in slab */
 	kmem_bufctl_t		free;
+	unsigned int		nodeid;		/* whose lists it is on */
 };
 
 #define slab_bufctl(slabp) \
 	((kmem_bufctl_t *)(((struct slab*)slabp)+1))
 
+/*
+ * struct alien_cache
+ *
+ * Objects a cpu frees that belong to the slabs of another node.  They
+ * are given back to that node ALIEN_LIMIT at a time.
+ */
+struct alien_cache {
+	unsigned int avail;
+	unsigned int limit;
+};
+
+#define ALIEN_LIMIT	16
+
+#define ac_entry(aliencache) \
+	((void **)(((struct alien_cache*)(aliencache))+1))
+
 /*
  * struct cpu_cache
  *
  * Per cpu structures
  * The limit is stored in the per-cpu structure to reduce the data cache
- * footprint.
+ * footprint.  The counters are only touched by their own cpu, and are
+ * carried over when the array is replaced by kmem_tune_cpucache().
  */
 struct cpu_cache {
 	unsigned int avail;
 	unsigned int limit;
+	unsigned long allochit;		/* allocs served from the array */
+	unsigned long allocmiss;	/* allocs that refilled it */
+	unsigned long freehit;		/* frees into the array */
+	unsigned long freemiss;		/* frees that flushed part of it */
+	unsigned long alienfree;	/* frees of objects of other nodes */
+	struct alien_cache *alien[MAX_NR_NODES];
 };
 
 #define cc_entry(cpucache) \
 	((void **)(((struct cpu_cache*)(cpucache))+1))
 #define cc_data(cachep) \
 	((cachep)->cpudata[smp_processor_id()])
+
+/*
+ * struct kmem_nodelists
+ *
+ * The slabs of a cache that belong to one node.
+ */
+struct kmem_nodelists {
+	/* full, partial first, then free */
+	struct list_head	slabs_full;
+	struct list_head	slabs_partial;
+	struct list_head	slabs_free;
+	spinlock_t		spinlock;
+} ____cacheline_aligned;
 /*
  * struct kmem_cache_s
  *
@@ -189,10 +235,7 @@ struct cpu_cache {
 
 struct kmem_cache_s {
 /* 1) each alloc & free */
-	/* full, partial first, then free */
-	struct list_head	slabs_full;
-	struct list_head	slabs_partial;
-	struct list_head	slabs_free;
+	struct kmem_nodelists	nodelists[MAX_NR_NODES];
 	unsigned int		objsize;
 	unsigned int	 	flags;	/* constant flags */
 	unsigned int		num;	/* # of objs per slab */
@@ -237,12 +280,6 @@ struct kmem_cache_s {
 	unsigned long		grown;
 	unsigned long		reaped;
 	unsigned long 		errors;
-#ifdef CONFIG_SMP
-	atomic_t		allochit;
-	atomic_t		allocmiss;
-	atomic_t		freehit;
-	atomic_t		freemiss;
-#endif
 #endif
 };
 
@@ -277,18 +314,6 @@ struct kmem_cache_s {
 #define	STATS_INC_ERR(x)	do { } while (0)
 #endif
 
-#if STATS && defined(CONFIG_SMP)
-#define STATS_INC_ALLOCHIT(x)	atomic_inc(&(x)->allochit)
-#define STATS_INC_ALLOCMISS(x)	atomic_inc(&(x)->allocmiss)
-#define STATS_INC_FREEHIT(x)	atomic_inc(&(x)->freehit)
-#define STATS_INC_FREEMISS(x)	atomic_inc(&(x)->freemiss)
-#else
-#define STATS_INC_ALLOCHIT(x)	do { } while (0)
-#define STATS_INC_ALLOCMISS(x)	do { } while (0)
-#define STATS_INC_FREEHIT(x)	do { } while (0)
-#define STATS_INC_FREEMISS(x)	do { } while (0)
-#endif
-
 #if DEBUG
 /* Magic nums for obj red zoning.
  * Placed in the first word before and the first word after an obj.
@@ -327,6 +352,10 @@ static int slab_break_gfp_order = BREAK_GFP_ORDER_LO;
 #define	SET_PAGE_SLAB(pg,x)   ((pg)->list.prev = (struct list_head *)(x))
 #define	GET_PAGE_SLAB(pg)     ((struct slab *)(pg)->list.prev)
 
+/* The lists of the node an object's slab belongs to */
+#define	obj_nodelists(cachep, objp) \
+	(&(cachep)->nodelists[GET_PAGE_SLAB(virt_to_page(objp))->nodeid])
+
 /* Size description struct for general caches. */
 struct cache_sizes_t {
 	size_t		 cs_size;
@@ -355,9 +384,6 @@ static struct cache_sizes_t cache_sizes[] = {
 
 /* internal cache of cache description objs */
 static struct kmem_cache_s cache_cache = {
-	slabs_full:	LIST_HEAD_INIT(cache_cache.slabs_full),
-	slabs_partial:	LIST_HEAD_INIT(cache_cache.slabs_partial),
-	slabs_free:	LIST_HEAD_INIT(cache_cache.slabs_free),
 	objsize:	sizeof(struct kmem_cache_s),
 	flags:		SLAB_NO_REAP,
 	spinlock:	SPIN_LOCK_UNLOCKED,
@@ -412,13 +438,30 @@ static void kmem_cache_estimate (unsigned long gfporder, size_t size,
 	*left_over = wastage;
 }
 
+static void kmem_nodelists_init (struct kmem_cache_s *cachep)
+{
+	int i;
+
+	for (i = 0; i < MAX_NR_NODES; i++) {
+		struct kmem_nodelists *l3 = &cachep->nodelists[i];
+
+		INIT_LIST_HEAD(&l3->slabs_full);
+		INIT_LIST_HEAD(&l3->slabs_partial);
+		INIT_LIST_HEAD(&l3->slabs_free);
+		spin_lock_init(&l3->spinlock);
+	}
+}
+
 /* Initialisation - setup the `cache' cache. */
 void __init kmem_cache_init(void)
 {
 	size_t left_over;
 
+	if (numnodes > MAX_NR_NODES)
+		BUG();
 	init_MUTEX(&cache_chain_sem);
 	INIT_LIST_HEAD(&cache_chain);
+	kmem_nodelists_init(&cache_cache);
 
 	kmem_cache_estimate(0, cache_cache.objsize, 0,
 			&left_over, &cache_cache.num);
@@ -482,10 +525,11 @@ int __init kmem_cpucache_init(void)
 __initcall(kmem_cpucache_init);
 
 /* Interface to system's page allocator. No need to hold the cache-lock.
+ * The pages come from node 'nid' if it has any to spare.
  */
-static inline void * kmem_getpages (struct kmem_cache_s *cachep, unsigned long flags)
+static inline void * kmem_getpages (struct kmem_cache_s *cachep, unsigned long flags, int nid)
 {
-	void	*addr;
+	struct page	*page;
 
 	/*
 	 * If we requested dmaable memory, we will get it. Even if we
@@ -493,14 +537,16 @@ static inline void * kmem_getpages (struct kmem_cache_s *cachep, unsigned long f
 	 * would be relatively rare and ignorable.
 	 */
 	flags |= cachep->gfpflags;
-	addr = (void*) __get_free_pages(flags, cachep->gfporder);
+	page = alloc_pages_node(nid, flags, cachep->gfporder);
+	if (!page)
+		return NULL;
 	/* Assume that now we have the pages no one else can legally
 	 * messes with the 'struct page's.
 	 * However vm_scan() might try to test the structure to see if
 	 * it is a named-page or buffer-page.  The members it tests are
 	 * of no interest here.....
 	 */
-	return addr;
+	return page_address(page);
 }
 
 /* Interface to system's page release. */
@@ -787,9 +833,7 @@ next:
 		cachep->gfpflags |= GFP_DMA;
 	spin_lock_init(&cachep->spinlock);
 	cachep->objsize = size;
-	INIT_LIST_HEAD(&cachep->slabs_full);
-	INIT_LIST_HEAD(&cachep->slabs_partial);
-	INIT_LIST_HEAD(&cachep->slabs_free);
+	kmem_nodelists_init(cachep);
 
 	if (flags & CFLGS_OFF_SLAB)
 		cachep->slabp_cache = kmem_find_general_cachep(slab_size,0);
@@ -875,13 +919,90 @@ static void do_ccupdate_local(void *info)
 {
 	ccupdate_struct_t *new = (ccupdate_struct_t *)info;
 	struct cpu_cache *old = cc_data(new->cachep);
-	
-	cc_data(new->cachep) = new->new[smp_processor_id()];
+	struct cpu_cache *cc = new->new[smp_processor_id()];
+
+	/* a retuned array keeps counting where the old one stopped */
+	if (old && cc) {
+		cc->allochit = old->allochit;
+		cc->allocmiss = old->allocmiss;
+		cc->freehit = old->freehit;
+		cc->freemiss = old->freemiss;
+		cc->alienfree = old->alienfree;
+	}
+	cc_data(new->cachep) = cc;
 	new->new[smp_processor_id()] = old;
 }
 
 static void free_block (struct kmem_cache_s* cachep, void** objpp, int len);
 
+/*
+ * Allocate the per-cpu array for 'cpu', with room for 'limit' objects
+ * and an alien array for every other node.
+ */
+static struct cpu_cache * alloc_cpucache (int cpu, int limit)
+{
+	struct cpu_cache *cc;
+	int i;
+
+	cc = kmalloc(sizeof(void*)*limit+sizeof(struct cpu_cache), GFP_KERNEL);
+	if (!cc)
+		return NULL;
+	memset(cc, 0, sizeof(struct cpu_cache));
+	cc->limit = limit;
+	for (i = 0; i < numnodes; i++) {
+		struct alien_cache *ac;
+
+		if (i == cpu_to_node(cpu))
+			continue;
+		ac = kmalloc(sizeof(void*)*ALIEN_LIMIT+
+				sizeof(struct alien_cache), GFP_KERNEL);
+		cc->alien[i] = ac;
+		if (!ac)
+			goto oom;
+		ac->limit = ALIEN_LIMIT;
+		ac->avail = 0;
+	}
+	return cc;
+oom:
+	while (i--)
+		kfree(cc->alien[i]);
+	kfree(cc);
+	return NULL;
+}
+
+static void free_cpucache (struct cpu_cache *cc)
+{
+	int i;
+
+	if (!cc)
+		return;
+	for (i = 0; i < numnodes; i++)
+		kfree(cc->alien[i]);
+	kfree(cc);
+}
+
+/*
+ * Give the objects in a per-cpu array that nobody uses any more back
+ * to their slabs.  Called with disabled ints.
+ */
+static void drain_cpucache (struct kmem_cache_s *cachep, struct cpu_cache *cc)
+{
+	int i;
+
+	for (i = 0; i < numnodes; i++) {
+		struct alien_cache *ac = cc->alien[i];
+
+		if (ac && ac->avail) {
+			free_block(cachep, ac_entry(ac), ac->avail);
+			ac->avail = 0;
+		}
+	}
+	if (cc->avail) {
+		free_block(cachep, cc_entry(cc), cc->avail);
+		cc->avail = 0;
+	}
+}
+
 static void drain_cpu_caches(struct kmem_cache_s *cachep)
 {
 	ccupdate_struct_t new;
@@ -896,12 +1017,11 @@ static void drain_cpu_caches(struct kmem_cache_s *cachep)
 
 	for (i = 0; i < smp_num_cpus; i++) {
 		struct cpu_cache* ccold = new.new[cpu_logical_map(i)];
-		if (!ccold || (ccold->avail == 0))
+		if (!ccold)
 			continue;
 		local_irq_disable();
-		free_block(cachep, cc_entry(ccold), ccold->avail);
+		drain_cpucache(cachep, ccold);
 		local_irq_enable();
-		ccold->avail = 0;
 	}
 	smp_call_function_all_cpus(do_ccupdate_local, (void *)&new);
 	up(&cache_chain_sem);
@@ -912,47 +1032,55 @@ static void drain_cpu_caches(struct kmem_cache_s *cachep)
 #endif
 
 /*
- * Called with the &cachep->spinlock held, returns number of slabs released
+ * Release up to nr of the free slabs of one node.  Called with the node's
+ * spinlock held, which is dropped around the freeing of each slab.
+ * Returns number of slabs released.
  */
-static int __kmem_cache_shrink_locked(struct kmem_cache_s *cachep)
+static int __kmem_cache_shrink_locked(struct kmem_cache_s *cachep,
+				struct kmem_nodelists *l3, int nr)
 {
 	struct slab *slabp;
 	int ret = 0;
 
 	/* If the cache is growing, stop shrinking. */
-	while (!cachep->growing) {
+	while (ret < nr && !cachep->growing) {
 		struct list_head *p;
 
-		p = cachep->slabs_free.prev;
-		if (p == &cachep->slabs_free)
+		p = l3->slabs_free.prev;
+		if (p == &l3->slabs_free)
 			break;
 
-		slabp = list_entry(cachep->slabs_free.prev, struct slab, list);
+		slabp = list_entry(p, struct slab, list);
 #if DEBUG
 		if (slabp->inuse)
 			BUG();
 #endif
 		list_del(&slabp->list);
 
-		spin_unlock_irq(&cachep->spinlock);
+		spin_unlock_irq(&l3->spinlock);
 		kmem_slab_destroy(cachep, slabp);
 		ret++;
-		spin_lock_irq(&cachep->spinlock);
+		spin_lock_irq(&l3->spinlock);
 	}
 	return ret;
 }
 
 static int __kmem_cache_shrink(struct kmem_cache_s *cachep)
 {
-	int ret;
+	int i, ret = 0;
 
 	drain_cpu_caches(cachep);
 
-	spin_lock_irq(&cachep->spinlock);
-	__kmem_cache_shrink_locked(cachep);
-	ret = !list_empty(&cachep->slabs_full) ||
-		!list_empty(&cachep->slabs_partial);
-	spin_unlock_irq(&cachep->spinlock);
+	for (i = 0; i < numnodes; i++) {
+		struct kmem_nodelists *l3 = &cachep->nodelists[i];
+
+		spin_lock_irq(&l3->spinlock);
+		__kmem_cache_shrink_locked(cachep, l3, INT_MAX);
+		if (!list_empty(&l3->slabs_full) ||
+				!list_empty(&l3->slabs_partial))
+			ret = 1;
+		spin_unlock_irq(&l3->spinlock);
+	}
 	return ret;
 }
 
@@ -965,14 +1093,18 @@ static int __kmem_cache_shrink(struct kmem_cache_s *cachep)
  */
 int kmem_cache_shrink(struct kmem_cache_s *cachep)
 {
-	int ret;
+	int i, ret = 0;
 
 	if (!cachep || in_interrupt() || !is_chained_kmem_cache(cachep))
 		BUG();
 
-	spin_lock_irq(&cachep->spinlock);
-	ret = __kmem_cache_shrink_locked(cachep);
-	spin_unlock_irq(&cachep->spinlock);
+	for (i = 0; i < numnodes; i++) {
+		struct kmem_nodelists *l3 = &cachep->nodelists[i];
+
+		spin_lock_irq(&l3->spinlock);
+		ret += __kmem_cache_shrink_locked(cachep, l3, INT_MAX);
+		spin_unlock_irq(&l3->spinlock);
+	}
 
 	return ret << cachep->gfporder;
 }
@@ -1018,7 +1150,7 @@ int kmem_cache_destroy (struct kmem_cache_s * cachep)
 	{
 		int i;
 		for (i = 0; i < NR_CPUS; i++)
-			kfree(cachep->cpudata[i]);
+			free_cpucache(cachep->cpudata[i]);
 	}
 #endif
 	kmem_cache_free(&cache_cache, cachep);
@@ -1097,11 +1229,13 @@ static inline void kmem_cache_init_objs (struct kmem_cache_s * cachep,
 }
 
 /*
- * Grow (by 1) the number of slabs within a cache.  This is called by
- * kmem_cache_alloc() when there are no active objs left in a cache.
+ * Grow (by 1) the number of slabs of node nid within a cache.  This is
+ * called by kmem_cache_alloc() when there are no active objs left on
+ * the node.
  */
-static int kmem_cache_grow (struct kmem_cache_s * cachep, int flags)
+static int kmem_cache_grow (struct kmem_cache_s * cachep, int flags, int nid)
 {
+	struct kmem_nodelists *l3 = &cachep->nodelists[nid];
 	struct slab	*slabp;
 	struct page	*page;
 	void		*objp;
@@ -1160,7 +1294,7 @@ static int kmem_cache_grow (struct kmem_cache_s * cachep, int flags)
 	 */
 
 	/* Get mem for the objs. */
-	if (!(objp = kmem_getpages(cachep, flags)))
+	if (!(objp = kmem_getpages(cachep, flags, nid)))
 		goto failed;
 
 	/* Get slab management. */
@@ -1179,14 +1313,21 @@ static int kmem_cache_grow (struct kmem_cache_s * cachep, int flags)
 
 	kmem_cache_init_objs(cachep, slabp, ctor_flags);
 
-	spin_lock_irqsave(&cachep->spinlock, save_flags);
-	cachep->growing--;
+	/*
+	 * The slab stays with the node it was grown for even if the page
+	 * allocator had to fall back to another node's memory.
+	 */
+	slabp->nodeid = nid;
 
 	/* Make slab active. */
-	list_add_tail(&slabp->list, &cachep->slabs_free);
+	spin_lock_irqsave(&l3->spinlock, save_flags);
+	list_add_tail(&slabp->list, &l3->slabs_free);
+	spin_unlock(&l3->spinlock);
+
+	spin_lock(&cachep->spinlock);
+	cachep->growing--;
 	STATS_INC_GROWN(cachep);
 	cachep->failures = 0;
-
 	spin_unlock_irqrestore(&cachep->spinlock, save_flags);
 	return 1;
 opps1:
@@ -1238,7 +1379,7 @@ static inline void kmem_cache_alloc_head(struct kmem_cache_s *cachep, int flags)
 }
 
 static inline void * kmem_cache_alloc_one_tail (struct kmem_cache_s *cachep,
-						struct slab *slabp)
+				struct kmem_nodelists *l3, struct slab *slabp)
 {
 	void *objp;
 
@@ -1253,7 +1394,7 @@ static inline void * kmem_cache_alloc_one_tail (struct kmem_cache_s *cachep,
 
 	if (unlikely(slabp->free == BUFCTL_END)) {
 		list_del(&slabp->list);
-		list_add(&slabp->list, &cachep->slabs_full);
+		list_add(&slabp->list, &l3->slabs_full);
 	}
 #if DEBUG
 	if (cachep->flags & SLAB_POISON)
@@ -1274,20 +1415,20 @@ static inline void * kmem_cache_alloc_one_tail (struct kmem_cache_s *cachep,
 }
 
 /*
- * Returns a ptr to an obj in the given cache.
+ * Returns a ptr to an obj from the given node lists of the cache.
  * caller must guarantee synchronization
  * #define for the goto optimization 8-)
  */
-#define kmem_cache_alloc_one(cachep)				\
+#define kmem_cache_alloc_one(cachep, l3)			\
 ({								\
 	struct list_head * slabs_partial, * entry;		\
 	struct slab *slabp;						\
 								\
-	slabs_partial = &(cachep)->slabs_partial;		\
+	slabs_partial = &(l3)->slabs_partial;			\
 	entry = slabs_partial->next;				\
 	if (unlikely(entry == slabs_partial)) {			\
 		struct list_head * slabs_free;			\
-		slabs_free = &(cachep)->slabs_free;		\
+		slabs_free = &(l3)->slabs_free;			\
 		entry = slabs_free->next;			\
 		if (unlikely(entry == slabs_free))		\
 			goto alloc_new_slab;			\
@@ -1296,24 +1437,25 @@ static inline void * kmem_cache_alloc_one_tail (struct kmem_cache_s *cachep,
 	}							\
 								\
 	slabp = list_entry(entry, struct slab, list);		\
-	kmem_cache_alloc_one_tail(cachep, slabp);		\
+	kmem_cache_alloc_one_tail(cachep, l3, slabp);		\
 })
 
 #ifdef CONFIG_SMP
 void* kmem_cache_alloc_batch(struct kmem_cache_s* cachep, struct cpu_cache* cc, int flags)
 {
+	struct kmem_nodelists *l3 = &cachep->nodelists[numa_node_id()];
 	int batchcount = cachep->batchcount;
 
-	spin_lock(&cachep->spinlock);
+	spin_lock(&l3->spinlock);
 	while (batchcount--) {
 		struct list_head * slabs_partial, * entry;
 		struct slab *slabp;
 		/* Get slab alloc is to come from. */
-		slabs_partial = &(cachep)->slabs_partial;
+		slabs_partial = &l3->slabs_partial;
 		entry = slabs_partial->next;
 		if (unlikely(entry == slabs_partial)) {
 			struct list_head * slabs_free;
-			slabs_free = &(cachep)->slabs_free;
+			slabs_free = &l3->slabs_free;
 			entry = slabs_free->next;
 			if (unlikely(entry == slabs_free))
 				break;
@@ -1323,9 +1465,9 @@ void* kmem_cache_alloc_batch(struct kmem_cache_s* cachep, struct cpu_cache* cc,
 
 		slabp = list_entry(entry, struct slab, list);
 		cc_entry(cc)[cc->avail++] =
-				kmem_cache_alloc_one_tail(cachep, slabp);
+				kmem_cache_alloc_one_tail(cachep, l3, slabp);
 	}
-	spin_unlock(&cachep->spinlock);
+	spin_unlock(&l3->spinlock);
 
 	if (cc->avail)
 		return cc_entry(cc)[--cc->avail];
@@ -1336,43 +1478,47 @@ void* kmem_cache_alloc_batch(struct kmem_cache_s* cachep, struct cpu_cache* cc,
 static inline void * __kmem_cache_alloc (struct kmem_cache_s *cachep, int flags)
 {
 	unsigned long save_flags;
+	struct kmem_nodelists *l3;
+	int nid;
 	void* objp;
 
 	kmem_cache_alloc_head(cachep, flags);
 try_again:
 	local_irq_save(save_flags);
+	nid = numa_node_id();
+	l3 = &cachep->nodelists[nid];
 #ifdef CONFIG_SMP
 	{
 		struct cpu_cache *cc = cc_data(cachep);
 
 		if (cc) {
 			if (cc->avail) {
-				STATS_INC_ALLOCHIT(cachep);
+				cc->allochit++;
 				objp = cc_entry(cc)[--cc->avail];
 			} else {
-				STATS_INC_ALLOCMISS(cachep);
+				cc->allocmiss++;
 				objp = kmem_cache_alloc_batch(cachep,cc,flags);
 				if (!objp)
 					goto alloc_new_slab_nolock;
 			}
 		} else {
-			spin_lock(&cachep->spinlock);
-			objp = kmem_cache_alloc_one(cachep);
-			spin_unlock(&cachep->spinlock);
+			spin_lock(&l3->spinlock);
+			objp = kmem_cache_alloc_one(cachep, l3);
+			spin_unlock(&l3->spinlock);
 		}
 	}
 #else
-	objp = kmem_cache_alloc_one(cachep);
+	objp = kmem_cache_alloc_one(cachep, l3);
 #endif
 	local_irq_restore(save_flags);
 	return objp;
 alloc_new_slab:
 #ifdef CONFIG_SMP
-	spin_unlock(&cachep->spinlock);
+	spin_unlock(&l3->spinlock);
 alloc_new_slab_nolock:
 #endif
 	local_irq_restore(save_flags);
-	if (kmem_cache_grow(cachep, flags))
+	if (kmem_cache_grow(cachep, flags, nid))
 		/* Someone may have stolen our objs.  Doesn't matter, we'll
 		 * just come back here again.
 		 */
@@ -1455,32 +1601,55 @@ static inline void kmem_cache_free_one(struct kmem_cache_s *cachep, void *objp)
 	
 	/* fixup slab chains */
 	{
+		struct kmem_nodelists *l3 = &cachep->nodelists[slabp->nodeid];
 		int inuse = slabp->inuse;
 		if (unlikely(!--slabp->inuse)) {
 			/* Was partial or full, now empty. */
 			list_del(&slabp->list);
-			list_add(&slabp->list, &cachep->slabs_free);
+			list_add(&slabp->list, &l3->slabs_free);
 		} else if (unlikely(inuse == cachep->num)) {
 			/* Was full. */
 			list_del(&slabp->list);
-			list_add(&slabp->list, &cachep->slabs_partial);
+			list_add(&slabp->list, &l3->slabs_partial);
 		}
 	}
 }
 
 #ifdef CONFIG_SMP
-static inline void __free_block (struct kmem_cache_s* cachep,
-							void** objpp, int len)
+/*
+ * Objects usually come in runs from the same node, take each node's
+ * lock once per run.
+ */
+static void free_block (struct kmem_cache_s* cachep, void** objpp, int len)
 {
-	for ( ; len > 0; len--, objpp++)
-		kmem_cache_free_one(cachep, *objpp);
+	while (len > 0) {
+		struct kmem_nodelists *l3 = obj_nodelists(cachep, *objpp);
+
+		spin_lock(&l3->spinlock);
+		do {
+			kmem_cache_free_one(cachep, *objpp);
+			objpp++;
+			len--;
+		} while (len > 0 && obj_nodelists(cachep, *objpp) == l3);
+		spin_unlock(&l3->spinlock);
+	}
 }
 
-static void free_block (struct kmem_cache_s* cachep, void** objpp, int len)
+/*
+ * An object of node nid freed on a cpu of another node.  Called with
+ * disabled ints.
+ */
+static inline void kmem_cache_free_alien (struct kmem_cache_s *cachep,
+				struct cpu_cache *cc, int nid, void *objp)
 {
-	spin_lock(&cachep->spinlock);
-	__free_block(cachep, objpp, len);
-	spin_unlock(&cachep->spinlock);
+	struct alien_cache *ac = cc->alien[nid];
+
+	cc->alienfree++;
+	if (ac->avail == ac->limit) {
+		free_block(cachep, ac_entry(ac), ac->avail);
+		ac->avail = 0;
+	}
+	ac_entry(ac)[ac->avail++] = objp;
 }
 #endif
 
@@ -1496,12 +1665,20 @@ static inline void __kmem_cache_free (struct kmem_cache_s *cachep, void* objp)
 	CHECK_PAGE(virt_to_page(objp));
 	if (cc) {
 		int batchcount;
+		if (numnodes > 1) {
+			int nid = GET_PAGE_SLAB(virt_to_page(objp))->nodeid;
+
+			if (nid != numa_node_id()) {
+				kmem_cache_free_alien(cachep, cc, nid, objp);
+				return;
+			}
+		}
 		if (cc->avail < cc->limit) {
-			STATS_INC_FREEHIT(cachep);
+			cc->freehit++;
 			cc_entry(cc)[cc->avail++] = objp;
 			return;
 		}
-		STATS_INC_FREEMISS(cachep);
+		cc->freemiss++;
 		batchcount = cachep->batchcount;
 		cc->avail -= batchcount;
 		free_block(cachep,
@@ -1656,12 +1833,9 @@ static int kmem_tune_cpucache (struct kmem_cache_s* cachep, int limit, int batch
 		for (i = 0; i< smp_num_cpus; i++) {
 			struct cpu_cache* ccnew;
 
-			ccnew = kmalloc(sizeof(void*)*limit+
-					sizeof(struct cpu_cache), GFP_KERNEL);
+			ccnew = alloc_cpucache(cpu_logical_map(i), limit);
 			if (!ccnew)
 				goto oom;
-			ccnew->limit = limit;
-			ccnew->avail = 0;
 			new.new[cpu_logical_map(i)] = ccnew;
 		}
 	}
@@ -1677,14 +1851,14 @@ static int kmem_tune_cpucache (struct kmem_cache_s* cachep, int limit, int batch
 		if (!ccold)
 			continue;
 		local_irq_disable();
-		free_block(cachep, cc_entry(ccold), ccold->avail);
+		drain_cpucache(cachep, ccold);
 		local_irq_enable();
-		kfree(ccold);
+		free_cpucache(ccold);
 	}
 	return 0;
 oom:
 	for (i--; i >= 0; i--)
-		kfree(new.new[cpu_logical_map(i)]);
+		free_cpucache(new.new[cpu_logical_map(i)]);
 	return -ENOMEM;
 }
 
@@ -1735,13 +1909,12 @@ static void enable_all_cpucaches (void)
  */
 int kmem_cache_reap (int gfp_mask)
 {
-	struct slab *slabp;
 	struct kmem_cache_s *searchp;
 	struct kmem_cache_s *best_cachep;
 	unsigned int best_pages;
 	unsigned int best_len;
 	unsigned int scan;
-	int ret = 0;
+	int i, ret = 0;
 
 	if (gfp_mask & __GFP_WAIT)
 		down(&cache_chain_sem);
@@ -1756,7 +1929,6 @@ int kmem_cache_reap (int gfp_mask)
 	searchp = clock_searchp;
 	do {
 		unsigned int pages;
-		struct list_head* p;
 		unsigned int full_free;
 
 		/* It's safe to test this without holding the cache-lock. */
@@ -1769,27 +1941,31 @@ int kmem_cache_reap (int gfp_mask)
 			searchp->dflags &= ~DFLGS_GROWN;
 			goto next_unlock;
 		}
+		spin_unlock(&searchp->spinlock);
 #ifdef CONFIG_SMP
 		{
 			struct cpu_cache *cc = cc_data(searchp);
-			if (cc && cc->avail) {
-				__free_block(searchp, cc_entry(cc), cc->avail);
-				cc->avail = 0;
-			}
+			if (cc)
+				drain_cpucache(searchp, cc);
 		}
 #endif
 
 		full_free = 0;
-		p = searchp->slabs_free.next;
-		while (p != &searchp->slabs_free) {
-			slabp = list_entry(p, struct slab, list);
+		for (i = 0; i < numnodes; i++) {
+			struct kmem_nodelists *l3 = &searchp->nodelists[i];
+			struct list_head* p;
+
+			spin_lock(&l3->spinlock);
+			list_for_each(p, &l3->slabs_free) {
 #if DEBUG
-			if (slabp->inuse)
-				BUG();
+				if (list_entry(p, struct slab, list)->inuse)
+					BUG();
 #endif
-			full_free++;
-			p = p->next;
+				full_free++;
+			}
+			spin_unlock(&l3->spinlock);
 		}
+		local_irq_enable();
 
 		/*
 		 * Try to avoid slabs with constructors and/or
@@ -1811,6 +1987,7 @@ int kmem_cache_reap (int gfp_mask)
 				goto perfect;
 			}
 		}
+		goto next;
 next_unlock:
 		spin_unlock_irq(&searchp->spinlock);
 next:
@@ -1823,34 +2000,21 @@ next:
 		/* couldn't find anything to reap */
 		goto out;
 
-	spin_lock_irq(&best_cachep->spinlock);
 perfect:
-	/* free only 50% of the free slabs */
+	/* free only 50% of the free slabs, starting with the first node */
 	best_len = (best_len + 1)/2;
-	for (scan = 0; scan < best_len; scan++) {
-		struct list_head *p;
-
-		if (best_cachep->growing)
-			break;
-		p = best_cachep->slabs_free.prev;
-		if (p == &best_cachep->slabs_free)
-			break;
-		slabp = list_entry(p,struct slab,list);
-#if DEBUG
-		if (slabp->inuse)
-			BUG();
-#endif
-		list_del(&slabp->list);
-		STATS_INC_REAPED(best_cachep);
-
-		/* Safe to drop the lock. The slab is no longer linked to the
-		 * cache.
-		 */
-		spin_unlock_irq(&best_cachep->spinlock);
-		kmem_slab_destroy(best_cachep, slabp);
-		spin_lock_irq(&best_cachep->spinlock);
+	for (i = 0, scan = 0; i < numnodes && scan < best_len; i++) {
+		struct kmem_nodelists *l3 = &best_cachep->nodelists[i];
+		int reaped;
+
+		spin_lock_irq(&l3->spinlock);
+		reaped = __kmem_cache_shrink_locked(best_cachep, l3,
+							best_len - scan);
+		spin_unlock_irq(&l3->spinlock);
+		scan += reaped;
+		while (reaped--)
+			STATS_INC_REAPED(best_cachep);
 	}
-	spin_unlock_irq(&best_cachep->spinlock);
 	ret = scan * (1 << best_cachep->gfporder);
 out:
 	up(&cache_chain_sem);
@@ -1901,13 +2065,14 @@ static int s_show(struct seq_file *m, void *p)
 	unsigned long	active_slabs = 0;
 	unsigned long	num_slabs;
 	const char *name; 
+	int i;
 
 	if (p == (void*)1) {
 		/*
 		 * Output format version, so at least we can change it
 		 * without _too_ many complaints.
 		 */
-		seq_puts(m, "slabinfo - version: 1.1"
+		seq_puts(m, "slabinfo - version: 1.2"
 #if STATS
 				" (statistics)"
 #endif
@@ -1918,28 +2083,33 @@ static int s_show(struct seq_file *m, void *p)
 		return 0;
 	}
 
-	spin_lock_irq(&cachep->spinlock);
 	active_objs = 0;
 	num_slabs = 0;
-	list_for_each(q,&cachep->slabs_full) {
-		slabp = list_entry(q, struct slab, list);
-		if (slabp->inuse != cachep->num)
-			BUG();
-		active_objs += cachep->num;
-		active_slabs++;
-	}
-	list_for_each(q,&cachep->slabs_partial) {
-		slabp = list_entry(q, struct slab, list);
-		if (slabp->inuse == cachep->num || !slabp->inuse)
-			BUG();
-		active_objs += slabp->inuse;
-		active_slabs++;
-	}
-	list_for_each(q,&cachep->slabs_free) {
-		slabp = list_entry(q, struct slab, list);
-		if (slabp->inuse)
-			BUG();
-		num_slabs++;
+	for (i = 0; i < numnodes; i++) {
+		struct kmem_nodelists *l3 = &cachep->nodelists[i];
+
+		spin_lock_irq(&l3->spinlock);
+		list_for_each(q,&l3->slabs_full) {
+			slabp = list_entry(q, struct slab, list);
+			if (slabp->inuse != cachep->num)
+				BUG();
+			active_objs += cachep->num;
+			active_slabs++;
+		}
+		list_for_each(q,&l3->slabs_partial) {
+			slabp = list_entry(q, struct slab, list);
+			if (slabp->inuse == cachep->num || !slabp->inuse)
+				BUG();
+			active_objs += slabp->inuse;
+			active_slabs++;
+		}
+		list_for_each(q,&l3->slabs_free) {
+			slabp = list_entry(q, struct slab, list);
+			if (slabp->inuse)
+				BUG();
+			num_slabs++;
+		}
+		spin_unlock_irq(&l3->spinlock);
 	}
 	num_slabs+=active_slabs;
 	num_objs = num_slabs*cachep->num;
@@ -1980,18 +2150,27 @@ static int s_show(struct seq_file *m, void *p)
 		seq_printf(m, " : %4u %4u",
 				limit, batchcount);
 	}
-#endif
-#if STATS && defined(CONFIG_SMP)
 	{
-		unsigned long allochit = atomic_read(&cachep->allochit);
-		unsigned long allocmiss = atomic_read(&cachep->allocmiss);
-		unsigned long freehit = atomic_read(&cachep->freehit);
-		unsigned long freemiss = atomic_read(&cachep->freemiss);
-		seq_printf(m, " : %6lu %6lu %6lu %6lu",
-				allochit, allocmiss, freehit, freemiss);
+		unsigned long allochit = 0, allocmiss = 0;
+		unsigned long freehit = 0, freemiss = 0, alienfree = 0;
+
+		/* the counters are per-cpu, we add up racy snapshots */
+		for (i = 0; i < smp_num_cpus; i++) {
+			struct cpu_cache *cc = cachep->cpudata[cpu_logical_map(i)];
+
+			if (!cc)
+				continue;
+			allochit += cc->allochit;
+			allocmiss += cc->allocmiss;
+			freehit += cc->freehit;
+			freemiss += cc->freemiss;
+			alienfree += cc->alienfree;
+		}
+		seq_printf(m, " : %6lu %6lu %6lu %6lu %6lu",
+				allochit, allocmiss, freehit, freemiss,
+				alienfree);
 	}
 #endif
-	spin_unlock_irq(&cachep->spinlock);
 	seq_putc(m, '\n');
 	return 0;
 }
@@ -2007,7 +2186,10 @@ static int s_show(struct seq_file *m, void *p)
  * num-active-slabs
  * total-slabs
  * num-pages-per-slab
- * + further values on SMP and with statistics enabled
+ * + further values with statistics enabled
+ * + on SMP: per-cpu array limit and batchcount, then the per-cpu
+ *   alloc hits and misses, free hits and misses, and frees of objects
+ *   of other nodes, summed over all cpus
  */
 
 struct seq_operations slabinfo_op = {
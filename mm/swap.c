@@ -36,19 +36,21 @@ pager_daemon_t pager_daemon = {
 /*
  * Move an inactive page to the active list.
  */
-static inline void activate_page_nolock(struct page * page)
+static inline void activate_page_nolock(struct pm_zone * zone, struct page * page)
 {
 	if (PageLRU(page) && !PageActive(page)) {
-		del_page_from_inactive_list(page);
-		add_page_to_active_list(page);
+		del_page_from_inactive_list(zone, page);
+		add_page_to_active_list(zone, page);
 	}
 }
 
 void activate_page(struct page * page)
 {
-	spin_lock(&pagemap_lru_lock);
-	activate_page_nolock(page);
-	spin_unlock(&pagemap_lru_lock);
+	struct pm_zone *zone = page_zone(page);
+
+	spin_lock(&zone->lru_lock);
+	activate_page_nolock(zone, page);
+	spin_unlock(&zone->lru_lock);
 }
 
 /**
@@ -58,10 +60,12 @@ void activate_page(struct page * page)
 void lru_cache_add(struct page * page)
 {
 	if (!PageLRU(page)) {
-		spin_lock(&pagemap_lru_lock);
+		struct pm_zone *zone = page_zone(page);
+
+		spin_lock(&zone->lru_lock);
 		if (!TestSetPageLRU(page))
-			add_page_to_inactive_list(page);
-		spin_unlock(&pagemap_lru_lock);
+			add_page_to_inactive_list(zone, page);
+		spin_unlock(&zone->lru_lock);
 	}
 }
 
@@ -70,15 +74,17 @@ void lru_cache_add(struct page * page)
  * @page: the page to add
  *
  * This function is for when the caller already holds
- * the pagemap_lru_lock.
+ * the lru_lock of the page's zone.
  */
 void __lru_cache_del(struct page * page)
 {
+	struct pm_zone *zone = page_zone(page);
+
 	if (TestClearPageLRU(page)) {
 		if (PageActive(page)) {
-			del_page_from_active_list(page);
+			del_page_from_active_list(zone, page);
 		} else {
-			del_page_from_inactive_list(page);
+			del_page_from_inactive_list(zone, page);
 		}
 	}
 }
@@ -89,9 +95,11 @@ void __lru_cache_del(struct page * page)
  */
 void lru_cache_del(struct page * page)
 {
-	spin_lock(&pagemap_lru_lock);
+	struct pm_zone *zone = page_zone(page);
+
+	spin_lock(&zone->lru_lock);
 	__lru_cache_del(page);
-	spin_unlock(&pagemap_lru_lock);
+	spin_unlock(&zone->lru_lock);
 }
 
 /*
@@ -37,11 +37,12 @@ static struct address_space_operations swap_aops = {
 };
 
 struct address_space swapper_space = {
-	LIST_HEAD_INIT(swapper_space.clean_pages),
-	LIST_HEAD_INIT(swapper_space.dirty_pages),
-	LIST_HEAD_INIT(swapper_space.locked_pages),
-	0,				/* nrpages	*/
-	&swap_aops,
+	clean_pages:	LIST_HEAD_INIT(swapper_space.clean_pages),
+	dirty_pages:	LIST_HEAD_INIT(swapper_space.dirty_pages),
+	locked_pages:	LIST_HEAD_INIT(swapper_space.locked_pages),
+	nrpages:	0,
+	page_lock:	SPIN_LOCK_UNLOCKED,
+	a_ops:		&swap_aops,
 };
 
 #ifdef SWAP_CACHE_INFO
@@ -113,6 +114,7 @@ void __delete_from_swap_cache(struct page *page)
 void delete_from_swap_cache(struct page *page)
 {
 	swp_entry_t entry;
+	struct page **hash;
 
 	if (!PageLocked(page))
 		BUG();
@@ -122,9 +124,10 @@ void delete_from_swap_cache(struct page *page)
 
 	entry.val = page->index;
 
-	spin_lock(&pagecache_lock);
+	hash = page_hash(&swapper_space, entry.val);
+	lock_page_cache(&swapper_space, hash);
 	__delete_from_swap_cache(page);
-	spin_unlock(&pagecache_lock);
+	unlock_page_cache(&swapper_space, hash);
 
 	swap_free(entry);
 	page_cache_release(page);
@@ -212,7 +215,7 @@ struct page * read_swap_cache_async(swp_entry_t entry)
 		 * our caller observed it.  May fail (-EEXIST) if there
 		 * is already a page associated with this entry in the
 		 * swap cache: added by a racing read_swap_cache_async,
-		 * or by try_to_swap_out (or shmem_writepage) re-using
+		 * or by shrink_cache (or shmem_writepage) re-using
 		 * the just freed swap entry for an existing page.
 		 */
 		err = add_to_swap_cache(new_page, entry);
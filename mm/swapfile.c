@@ -14,6 +14,7 @@
 #include <linux/vmalloc.h>
 #include <linux/pagemap.h>
 #include <linux/shm.h>
+#include <linux/hugetlb.h>
 
 #include <asm/pgtable.h>
 
@@ -33,50 +34,73 @@ struct swap_info_struct swap_info[MAX_SWAPFILES];
 
 #define SWAPFILE_CLUSTER 256
 
+/*
+ * Look for an aligned cluster without a single slot in use, starting
+ * where the previous search stopped.  Returns its first slot, or 0 if
+ * there is none (the cluster at 0 holds the swap header).
+ */
+static inline unsigned long find_free_cluster(struct swap_info_struct *si)
+{
+	unsigned long first, last, offset, nr, i;
+
+	first = si->lowest_bit & ~(SWAPFILE_CLUSTER - 1);
+	last = si->highest_bit + 1;
+	if (last < first + SWAPFILE_CLUSTER)
+		return 0;
+
+	offset = si->cluster_search;
+	for (i = (last - first) / SWAPFILE_CLUSTER; i; i--) {
+		if (offset < first || offset + SWAPFILE_CLUSTER > last)
+			offset = first;
+		for (nr = 0; nr < SWAPFILE_CLUSTER; nr++)
+			if (si->swap_map[offset + nr])
+				break;
+		if (nr == SWAPFILE_CLUSTER) {
+			si->cluster_search = offset + SWAPFILE_CLUSTER;
+			return offset;
+		}
+		offset += SWAPFILE_CLUSTER;
+	}
+	return 0;
+}
+
 static inline int scan_swap_map(struct swap_info_struct *si)
 {
+	struct swap_cluster *cl = si->cluster + smp_processor_id();
 	unsigned long offset;
-	/* 
-	 * We try to cluster swap pages by allocating them
-	 * sequentially in swap.  Once we've allocated
-	 * SWAPFILE_CLUSTER pages this way, however, we resort to
-	 * first-free allocation, starting a new cluster.  This
-	 * prevents us from scattering swap pages all over the entire
-	 * swap partition, so that we reduce overall disk seek times
-	 * between swap pages.  -- sct */
-	if (si->cluster_nr) {
-		while (si->cluster_next <= si->highest_bit) {
-			offset = si->cluster_next++;
-			if (si->swap_map[offset])
-				continue;
-			si->cluster_nr--;
+	/*
+	 * Every CPU, and so every task pushing pages out at one time,
+	 * allocates sequentially from an aligned cluster of its own.
+	 * What one reclaimer writes out together lands next to each
+	 * other in swap, to be written with a few large requests and
+	 * read back the same way by swapin_readahead().  Only when no
+	 * free cluster is left do we resort to first-free allocation,
+	 * and then go on sequentially from the slot it found, so that the
+	 * cluster map is not searched again for every page.
+	 */
+	while (cl->next < cl->end) {
+		offset = cl->next++;
+		if (!si->swap_map[offset])
 			goto got_page;
-		}
 	}
-	si->cluster_nr = SWAPFILE_CLUSTER;
-
-	/* try to find an empty (even not aligned) cluster. */
-	offset = si->lowest_bit;
- check_next_cluster:
-	if (offset+SWAPFILE_CLUSTER-1 <= si->highest_bit)
-	{
-		int nr;
-		for (nr = offset; nr < offset+SWAPFILE_CLUSTER; nr++)
-			if (si->swap_map[nr])
-			{
-				offset = nr+1;
-				goto check_next_cluster;
-			}
-		/* We found a completly empty cluster, so start
-		 * using it.
-		 */
+
+	offset = find_free_cluster(si);
+	if (offset) {
+		cl->next = offset + 1;
+		cl->end = offset + SWAPFILE_CLUSTER;
 		goto got_page;
 	}
+	cl->next = cl->end = 0;
+
 	/* No luck, so now go finegrined as usual. -Andrea */
 	for (offset = si->lowest_bit; offset <= si->highest_bit ; offset++) {
 		if (si->swap_map[offset])
 			continue;
 		si->lowest_bit = offset+1;
+		cl->next = offset + 1;
+		cl->end = offset + SWAPFILE_CLUSTER;
+		if (cl->end > si->highest_bit + 1)
+			cl->end = si->highest_bit + 1;
 	got_page:
 		if (offset == si->lowest_bit)
 			si->lowest_bit++;
@@ -88,7 +112,6 @@ static inline int scan_swap_map(struct swap_info_struct *si)
 		}
 		si->swap_map[offset] = 1;
 		nr_swap_pages--;
-		si->cluster_next = offset+1;
 		return offset;
 	}
 	si->lowest_bit = si->max;
@@ -237,11 +260,13 @@ static int exclusive_swap_page(struct page *page)
 	if (p) {
 		/* Is the only swap cache user the cache itself? */
 		if (p->swap_map[SWP_OFFSET(entry)] == 1) {
-			/* Recheck the page count with the pagecache lock held.. */
-			spin_lock(&pagecache_lock);
+			struct page **hash = page_hash(&swapper_space, entry.val);
+
+			/* Recheck the page count with the page hash lock held.. */
+			spin_lock(page_hash_lock(hash));
 			if (page_count(page) - !!page->buffers == 2)
 				retval = 1;
-			spin_unlock(&pagecache_lock);
+			spin_unlock(page_hash_lock(hash));
 		}
 		swap_info_put(p);
 	}
@@ -305,14 +330,16 @@ int remove_exclusive_swap_page(struct page *page)
 	/* Is the only swap cache user the cache itself? */
 	retval = 0;
 	if (p->swap_map[SWP_OFFSET(entry)] == 1) {
-		/* Recheck the page count with the pagecache lock held.. */
-		spin_lock(&pagecache_lock);
+		struct page **hash = page_hash(&swapper_space, entry.val);
+
+		/* Recheck the page count with the page cache locks held.. */
+		lock_page_cache(&swapper_space, hash);
 		if (page_count(page) - !!page->buffers == 2) {
 			__delete_from_swap_cache(page);
 			SetPageDirty(page);
 			retval = 1;
 		}
-		spin_unlock(&pagecache_lock);
+		unlock_page_cache(&swapper_space, hash);
 	}
 	swap_info_put(p);
 
@@ -361,18 +388,26 @@ void free_swap_and_cache(swp_entry_t entry)
  * share this swap entry, so be cautious and let do_wp_page work out
  * what to do if a write is requested later.
  */
-/* mmlist_lock and vma->vm_mm->page_table_lock are held */
+/*
+ * mmlist_lock and vma->vm_mm->page_table_lock are held.  Without a pte
+ * chain entry the pte is left alone, try_to_unuse() comes back for it.
+ */
 static inline void unuse_pte(struct vm_area * vma, unsigned long address,
 	pte_t *dir, swp_entry_t entry, struct page* page)
 {
 	pte_t pte = *dir;
+	struct pte_chain *pte_chain;
 
 	if (likely(pte_to_swp_entry(pte).val != entry.val))
 		return;
 	if (unlikely(pte_none(pte) || pte_present(pte)))
 		return;
+	pte_chain = pte_chain_alloc(GFP_ATOMIC);
+	if (!pte_chain)
+		return;
 	get_page(page);
 	set_pte(dir, pte_mkold(mk_pte(page, vma->vm_page_prot)));
+	page_add_rmap(page, dir, vma->vm_mm, address, pte_chain);
 	swap_free(entry);
 	++vma->vm_mm->rss;
 }
@@ -462,6 +497,9 @@ static void unuse_process(struct mm_struct * mm,
 	spin_lock(&mm->page_table_lock);
 	for (vma = mm->mmap; vma; vma = vma->vm_next) {
 		pgd_t * pgd = pgd_offset(mm, vma->vm_start);
+
+		if (is_vm_hugetlb_page(vma))
+			continue;
 		unuse_vma(vma, pgd, entry, page);
 	}
 	spin_unlock(&mm->page_table_lock);
@@ -530,7 +568,7 @@ static int try_to_unuse(unsigned int type)
 	 *
 	 * A simpler strategy would be to start at the last mm we
 	 * freed the previous entry from; but that would take less
-	 * advantage of mmlist ordering (now preserved by swap_out()),
+	 * advantage of mmlist ordering (preserved by dup_mmap()),
 	 * which clusters forked address spaces together, most recent
 	 * child immediately after parent.  If we race with dup_mmap(),
 	 * we very much want to resolve parent before child, otherwise
@@ -659,7 +697,7 @@ static int try_to_unuse(unsigned int type)
 
 		/*
 		 * If a reference remains (rare), we would like to leave
-		 * the page in the swap cache; but try_to_swap_out could
+		 * the page in the swap cache; but try_to_unmap could
 		 * then re-duplicate the entry once we drop page lock,
 		 * so we might loop indefinitely; also, that page could
 		 * not be swapped out to other storage meanwhile.  So:
@@ -681,7 +719,7 @@ static int try_to_unuse(unsigned int type)
 		/*
 		 * So we could skip searching mms once swap count went
 		 * to 1, we did not mark any present ptes as dirty: must
-		 * mark page dirty so try_to_swap_out will preserve it.
+		 * mark page dirty so shrink_cache will preserve it.
 		 */
 		SetPageDirty(page);
 		UnlockPage(page);
@@ -891,7 +929,8 @@ asmlinkage long sys_swapon(const char * specialfile, int swap_flags)
 	p->swap_map = NULL;
 	p->lowest_bit = 0;
 	p->highest_bit = 0;
-	p->cluster_nr = 0;
+	p->cluster_search = 0;
+	memset(p->cluster, 0, sizeof(p->cluster));
 	p->sdev_lock = SPIN_LOCK_UNLOCKED;
 	p->next = -1;
 	if (swap_flags & SWAP_FLAG_PREFER) {
@@ -1260,30 +1299,45 @@ void get_swaphandle_info(swp_entry_t entry, unsigned long *offset,
  */
 int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 {
-	int ret = 0, i = 1 << page_cluster;
-	unsigned long toff;
+	int ret = 0, max = 2 << page_cluster;
+	unsigned long toff, base, end;
 	struct swap_info_struct *swapdev = SWP_TYPE(entry) + swap_info;
 
 	if (!page_cluster)	/* no readahead */
 		return 0;
-	toff = (SWP_OFFSET(entry) >> page_cluster) << page_cluster;
-	if (!toff)		/* first page is swap header */
-		toff++, i--;
-	*offset = toff;
+
+	/*
+	 * Slots are handed out a cluster at a time and each cluster is
+	 * filled in order, so the pages around this one in its cluster
+	 * most likely went out to swap together.  Read the run of slots
+	 * in use around the entry, without leaving its cluster.
+	 */
+	toff = SWP_OFFSET(entry);
+	base = toff & ~(SWAPFILE_CLUSTER - 1);
+	if (!base)		/* first page is swap header */
+		base = 1;
+	end = (toff | (SWAPFILE_CLUSTER - 1)) + 1;
 
 	swap_device_lock(swapdev);
-	do {
-		/* Don't read-ahead past the end of the swap area */
-		if (toff >= swapdev->max)
-			break;
+	if (end > swapdev->max)
+		end = swapdev->max;
+	while (toff > base && SWP_OFFSET(entry) - toff < max / 2) {
 		/* Don't read in free or bad pages */
+		if (!swapdev->swap_map[toff - 1])
+			break;
+		if (swapdev->swap_map[toff - 1] == SWAP_MAP_BAD)
+			break;
+		toff--;
+	}
+	*offset = toff;
+	while (toff < end && ret < max) {
 		if (!swapdev->swap_map[toff])
 			break;
 		if (swapdev->swap_map[toff] == SWAP_MAP_BAD)
 			break;
 		toff++;
 		ret++;
-	} while (--i);
+	}
 	swap_device_unlock(swapdev);
 	return ret;
 }
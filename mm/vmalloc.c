@@ -19,6 +19,25 @@
 rwlock_t vmlist_lock = RW_LOCK_UNLOCKED;
 struct vm_struct * vmlist;
 
+/*
+ * The areas are also kept in a tree by address, where every node knows
+ * the largest free gap below any area of its subtree.  That makes both
+ * the first-fit search of get_vm_area() and the lookup of vfree() take
+ * O(log n) instead of a walk of vmlist.
+ */
+static rb_root_t vmlist_rb = RB_ROOT;
+
+/*
+ * vfree() unmaps an area right away but leaves it in place, and only
+ * flushes the TLBs once VM_LAZY_MAX_PAGES have piled up or the address
+ * space runs out.  Nobody may touch an area after freeing it, so the
+ * stale TLB entries only matter once its addresses are handed out again.
+ */
+#define VM_LAZY_MAX_PAGES	((8 << 20) >> PAGE_SHIFT)
+
+static struct vm_struct * vm_lazy_list;
+static unsigned long vm_lazy_pages;
+
 static inline void free_area_pte(pmd_t * pmd, unsigned long address, unsigned long size)
 {
 	pte_t * pte;
@@ -77,7 +96,8 @@ static inline void free_area_pmd(pgd_t * dir, unsigned long address, unsigned lo
 	} while (address < end);
 }
 
-void vmfree_area_pages(unsigned long address, unsigned long size)
+/* The caller flushes the TLBs */
+static void unmap_area_pages(unsigned long address, unsigned long size)
 {
 	pgd_t * dir;
 	unsigned long end = address + size;
@@ -89,6 +109,11 @@ void vmfree_area_pages(unsigned long address, unsigned long size)
 		address = (address + PGDIR_SIZE) & PGDIR_MASK;
 		dir++;
 	} while (address && (address < end));
+}
+
+void vmfree_area_pages(unsigned long address, unsigned long size)
+{
+	unmap_area_pages(address, size);
 	flush_tlb_all();
 }
 
@@ -168,10 +193,233 @@ inline int vmalloc_area_pages (unsigned long address, unsigned long size,
 	return ret;
 }
 
+#define vm_entry(node)	rb_entry(node, struct vm_struct, vm_rb)
+
+static inline void vm_augment(rb_node_t * node)
+{
+	struct vm_struct * area = vm_entry(node);
+	unsigned long max_gap = area->gap;
+
+	if (node->rb_left && vm_entry(node->rb_left)->max_gap > max_gap)
+		max_gap = vm_entry(node->rb_left)->max_gap;
+	if (node->rb_right && vm_entry(node->rb_right)->max_gap > max_gap)
+		max_gap = vm_entry(node->rb_right)->max_gap;
+	area->max_gap = max_gap;
+}
+
+/*
+ * Bring max_gap up to date from 'node' up to the root.  The rotations
+ * done by rb_insert_color() and rb_erase() only move nodes next to this
+ * path, so redoing the sibling at each level as well is enough.
+ */
+static void vm_augment_path(rb_node_t * node)
+{
+	rb_node_t * parent;
+
+	for (;;) {
+		vm_augment(node);
+		parent = node->rb_parent;
+		if (!parent)
+			break;
+		if (node == parent->rb_left && parent->rb_right)
+			vm_augment(parent->rb_right);
+		else if (node == parent->rb_right && parent->rb_left)
+			vm_augment(parent->rb_left);
+		node = parent;
+	}
+}
+
+/*
+ * The lowest node whose subtree rb_erase() is going to change when it
+ * takes out 'node'.
+ */
+static rb_node_t * vm_augment_erase_begin(rb_node_t * node)
+{
+	rb_node_t * deepest;
+
+	if (!node->rb_left && !node->rb_right)
+		return node->rb_parent;
+	if (!node->rb_right)
+		return node->rb_left;
+	if (!node->rb_left)
+		return node->rb_right;
+
+	deepest = node->rb_right;
+	while (deepest->rb_left)
+		deepest = deepest->rb_left;
+	if (deepest->rb_right)
+		return deepest->rb_right;
+	if (deepest->rb_parent != node)
+		return deepest->rb_parent;
+	return deepest;
+}
+
+static struct vm_struct * vm_prev(struct vm_struct * area)
+{
+	rb_node_t * node = &area->vm_rb, * parent;
+
+	if (node->rb_left) {
+		node = node->rb_left;
+		while (node->rb_right)
+			node = node->rb_right;
+		return vm_entry(node);
+	}
+	while ((parent = node->rb_parent) && node == parent->rb_left)
+		node = parent;
+	return parent ? vm_entry(parent) : NULL;
+}
+
+static struct vm_struct * vm_last(void)
+{
+	rb_node_t * node = vmlist_rb.rb_node;
+
+	if (!node)
+		return NULL;
+	while (node->rb_right)
+		node = node->rb_right;
+	return vm_entry(node);
+}
+
+static struct vm_struct * find_vm_area(void * addr)
+{
+	rb_node_t * node = vmlist_rb.rb_node;
+
+	while (node) {
+		struct vm_struct * area = vm_entry(node);
+
+		if (addr < area->addr)
+			node = node->rb_left;
+		else if (addr > area->addr)
+			node = node->rb_right;
+		else
+			return area;
+	}
+	return NULL;
+}
+
+/*
+ * First fit: the lowest address with room for 'size' bytes, or 0.  The
+ * area the new one goes right below is returned in *next, NULL if it
+ * goes above all of them.
+ */
+static unsigned long vm_first_fit(unsigned long size, struct vm_struct ** next)
+{
+	rb_node_t * node = vmlist_rb.rb_node;
+	struct vm_struct * area;
+	unsigned long addr;
+
+	if (node && vm_entry(node)->max_gap >= size) {
+		for (;;) {
+			area = vm_entry(node);
+			if (node->rb_left &&
+			    vm_entry(node->rb_left)->max_gap >= size) {
+				node = node->rb_left;
+				continue;
+			}
+			if (area->gap >= size) {
+				*next = area;
+				return (unsigned long) area->addr - area->gap;
+			}
+			/* then it has to be on the right */
+			node = node->rb_right;
+		}
+	}
+
+	*next = NULL;
+	addr = VMALLOC_START;
+	area = vm_last();
+	if (area)
+		addr = (unsigned long) area->addr + area->size;
+	if (addr + size < addr || addr + size > VMALLOC_END)
+		return 0;
+	return addr;
+}
+
+static void link_vm_area(struct vm_struct * area, struct vm_struct * next)
+{
+	unsigned long addr = (unsigned long) area->addr;
+	rb_node_t ** p = &vmlist_rb.rb_node, * parent = NULL;
+	struct vm_struct * prev;
+
+	prev = next ? vm_prev(next) : vm_last();
+	if (prev) {
+		area->gap = addr - ((unsigned long) prev->addr + prev->size);
+		area->next = prev->next;
+		prev->next = area;
+	} else {
+		area->gap = addr - VMALLOC_START;
+		area->next = vmlist;
+		vmlist = area;
+	}
+	area->max_gap = area->gap;
+
+	while (*p) {
+		parent = *p;
+		if (area->addr < vm_entry(parent)->addr)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&area->vm_rb, parent, p);
+	rb_insert_color(&area->vm_rb, &vmlist_rb);
+	/* a node that was rotated up has stale children */
+	if (area->vm_rb.rb_left)
+		vm_augment_path(area->vm_rb.rb_left);
+	else if (area->vm_rb.rb_right)
+		vm_augment_path(area->vm_rb.rb_right);
+	else
+		vm_augment_path(&area->vm_rb);
+
+	if (next) {
+		next->gap = (unsigned long) next->addr - (addr + area->size);
+		vm_augment_path(&next->vm_rb);
+	}
+}
+
+static void unlink_vm_area(struct vm_struct * area)
+{
+	struct vm_struct * prev = vm_prev(area), * next = area->next;
+	rb_node_t * deepest;
+
+	if (prev)
+		prev->next = next;
+	else
+		vmlist = next;
+
+	deepest = vm_augment_erase_begin(&area->vm_rb);
+	rb_erase(&area->vm_rb, &vmlist_rb);
+	if (deepest)
+		vm_augment_path(deepest);
+
+	if (next) {
+		next->gap += area->gap + area->size;
+		vm_augment_path(&next->vm_rb);
+	}
+}
+
+/*
+ * Flush the TLBs once for all the areas vfree() left behind, and give
+ * their address space back.  Called with vmlist_lock held for writing.
+ */
+static void purge_lazy_areas(void)
+{
+	struct vm_struct * area;
+
+	if (!vm_lazy_list)
+		return;
+	flush_tlb_all();
+	while ((area = vm_lazy_list) != NULL) {
+		vm_lazy_list = area->lazy_next;
+		unlink_vm_area(area);
+		kfree(area);
+	}
+	vm_lazy_pages = 0;
+}
+
 struct vm_struct * get_vm_area(unsigned long size, unsigned long flags)
 {
 	unsigned long addr;
-	struct vm_struct **p, *tmp, *area;
+	struct vm_struct *next, *area;
 
 	area = (struct vm_struct *) kmalloc(sizeof(*area), GFP_KERNEL);
 	if (!area)
@@ -183,22 +431,18 @@ struct vm_struct * get_vm_area(unsigned long size, unsigned long flags)
 		return NULL;
 	}
 
-	addr = VMALLOC_START;
 	write_lock(&vmlist_lock);
-	for (p = &vmlist; (tmp = *p) ; p = &tmp->next) {
-		if ((size + addr) < addr)
-			goto out;
-		if (size + addr <= (unsigned long) tmp->addr)
-			break;
-		addr = tmp->size + (unsigned long) tmp->addr;
-		if (addr > VMALLOC_END-size)
-			goto out;
+	addr = vm_first_fit(size, &next);
+	if (!addr && vm_lazy_list) {
+		purge_lazy_areas();
+		addr = vm_first_fit(size, &next);
 	}
+	if (!addr)
+		goto out;
 	area->flags = flags;
 	area->addr = (void *)addr;
 	area->size = size;
-	area->next = *p;
-	*p = area;
+	link_vm_area(area, next);
 	write_unlock(&vmlist_lock);
 	return area;
 
@@ -210,7 +454,7 @@ out:
 
 void vfree(void * addr)
 {
-	struct vm_struct **p, *tmp;
+	struct vm_struct *area;
 
 	if (!addr)
 		return;
@@ -219,17 +463,20 @@ void vfree(void * addr)
 		return;
 	}
 	write_lock(&vmlist_lock);
-	for (p = &vmlist ; (tmp = *p) ; p = &tmp->next) {
-		if (tmp->addr == addr) {
-			*p = tmp->next;
-			vmfree_area_pages(VMALLOC_VMADDR(tmp->addr), tmp->size);
-			write_unlock(&vmlist_lock);
-			kfree(tmp);
-			return;
-		}
+	area = find_vm_area(addr);
+	if (!area || (area->flags & VM_LAZYFREE)) {
+		write_unlock(&vmlist_lock);
+		printk(KERN_ERR "Trying to vfree() nonexistent vm area (%p)\n", addr);
+		return;
 	}
+	unmap_area_pages(VMALLOC_VMADDR(area->addr), area->size);
+	area->flags |= VM_LAZYFREE;
+	area->lazy_next = vm_lazy_list;
+	vm_lazy_list = area;
+	vm_lazy_pages += area->size >> PAGE_SHIFT;
+	if (vm_lazy_pages > VM_LAZY_MAX_PAGES)
+		purge_lazy_areas();
 	write_unlock(&vmlist_lock);
-	printk(KERN_ERR "Trying to vfree() nonexistent vm area (%p)\n", addr);
 }
 
 void * __vmalloc (unsigned long size, int gfp_mask, pgprot_t prot)
@@ -265,6 +512,8 @@ long vread(char *buf, char *addr, unsigned long count)
 
 	read_lock(&vmlist_lock);
 	for (tmp = vmlist; tmp; tmp = tmp->next) {
+		if (tmp->flags & VM_LAZYFREE)
+			continue;
 		vaddr = (char *) tmp->addr;
 		if (addr >= vaddr + tmp->size - PAGE_SIZE)
 			continue;
@@ -303,6 +552,8 @@ long vwrite(char *buf, char *addr, unsigned long count)
 
 	read_lock(&vmlist_lock);
 	for (tmp = vmlist; tmp; tmp = tmp->next) {
+		if (tmp->flags & VM_LAZYFREE)
+			continue;
 		vaddr = (char *) tmp->addr;
 		if (addr >= vaddr + tmp->size - PAGE_SIZE)
 			continue;
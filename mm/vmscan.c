@@ -35,101 +35,17 @@
 #define DEF_PRIORITY (6)
 
 /*
- * The swap-out function returns 1 if it successfully
- * scanned all the pages it was asked to (`count').
- * It returns zero if it couldn't do anything,
- *
- * rss may decrease because pages are shared, but this
- * doesn't count as having freed a page.
+ * Give an anonymous page a swap entry and put it in the swap cache, so
+ * that try_to_unmap() has something to replace its ptes with.  The page
+ * is locked and the pte chain lock keeps page_add_rmap() away from
+ * page->flags while add_to_swap_cache() rewrites them.
  */
-
-/* mm->page_table_lock is held. mmap_sem is not held */
-static inline int try_to_swap_out(struct mm_struct * mm, struct vm_area* vma, unsigned long address, pte_t * page_table, struct page *page, struct pm_zone * classzone)
+static int add_to_swap(struct page * page)
 {
-	pte_t pte;
 	swp_entry_t entry;
+	int ret = 0;
 
-	/* Don't look at this pte if it's been accessed recently. */
-	if ((vma->vm_flags & VM_LOCKED) || ptep_test_and_clear_young(page_table)) {
-		mark_page_accessed(page);
-		return 0;
-	}
-
-	/* Don't bother unmapping pages that are active */
-	if (PageActive(page))
-		return 0;
-
-	/* Don't bother replenishing zones not under pressure.. */
-	if (!memclass(page_zone(page), classzone))
-		return 0;
-
-	if (TryLockPage(page))
-		return 0;
-
-	/* From this point on, the odds are that we're going to
-	 * nuke this pte, so read and clear the pte.  This hook
-	 * is needed on CPUs which update the accessed and dirty
-	 * bits in hardware.
-	 */
-	flush_cache_page(vma, address);
-	pte = ptep_get_and_clear(page_table);
-	flush_tlb_page(vma, address);
-
-	if (pte_dirty(pte))
-		set_page_dirty(page);
-
-	/*
-	 * Is the page already in the swap cache? If so, then
-	 * we can just drop our reference to it without doing
-	 * any IO - it's already up-to-date on disk.
-	 */
-	if (PageSwapCache(page)) {
-		entry.val = page->index;
-		swap_duplicate(entry);
-set_swap_pte:
-		set_pte(page_table, swp_entry_to_pte(entry));
-drop_pte:
-		mm->rss--;
-		UnlockPage(page);
-		{
-			int freeable = page_count(page) - !!page->buffers <= 2;
-			page_cache_release(page);
-			return freeable;
-		}
-	}
-
-	/*
-	 * Is it a clean page? Then it must be recoverable
-	 * by just paging it in again, and we can just drop
-	 * it..  or if it's dirty but has backing store,
-	 * just mark the page dirty and drop it.
-	 *
-	 * However, this won't actually free any real
-	 * memory, as the page will just be in the page cache
-	 * somewhere, and as such we should just continue
-	 * our scan.
-	 *
-	 * Basically, this just makes it possible for us to do
-	 * some real work in the future in "refill_inactive()".
-	 */
-	if (page->mapping)
-		goto drop_pte;
-	if (!PageDirty(page))
-		goto drop_pte;
-
-	/*
-	 * Anonymous buffercache pages can be left behind by
-	 * concurrent truncate and pagefault.
-	 */
-	if (page->buffers)
-		goto preserve;
-
-	/*
-	 * This is a dirty, swappable page.  First of all,
-	 * get a suitable swap entry for it, and make sure
-	 * we have the swap cache set up to associate the
-	 * page with that swap entry.
-	 */
+	pte_chain_lock(page);
 	for (;;) {
 		entry = get_swap_page();
 		if (!entry.val)
@@ -141,215 +57,34 @@ drop_pte:
 		if (add_to_swap_cache(page, entry) == 0) {
 			SetPageUptodate(page);
 			set_page_dirty(page);
-			goto set_swap_pte;
+			ret = 1;
+			break;
 		}
 		/* Raced with "speculative" read_swap_cache_async */
 		swap_free(entry);
 	}
-
-	/* No swap space left */
-preserve:
-	set_pte(page_table, pte);
-	UnlockPage(page);
-	return 0;
-}
-
-/* mm->page_table_lock is held. mmap_sem is not held */
-static inline int swap_out_pmd(struct mm_struct * mm, struct vm_area * vma, pmd_t *dir, unsigned long address, unsigned long end, int count, struct pm_zone * classzone)
-{
-	pte_t * pte;
-	unsigned long pmd_end;
-
-	if (pmd_none(*dir))
-		return count;
-	if (pmd_bad(*dir)) {
-		pmd_ERROR(*dir);
-		pmd_clear(dir);
-		return count;
-	}
-	
-	pte = pte_offset(dir, address);
-	
-	pmd_end = (address + PMD_SIZE) & PMD_MASK;
-	if (end > pmd_end)
-		end = pmd_end;
-
-	do {
-		if (pte_present(*pte)) {
-			struct page *page = pte_page(*pte);
-
-			if (VALID_PAGE(page) && !PageReserved(page)) {
-				count -= try_to_swap_out(mm, vma, address, pte, page, classzone);
-				if (!count) {
-					address += PAGE_SIZE;
-					break;
-				}
-			}
-		}
-		address += PAGE_SIZE;
-		pte++;
-	} while (address && (address < end));
-	mm->swap_address = address;
-	return count;
-}
-
-/* mm->page_table_lock is held. mmap_sem is not held */
-static inline int swap_out_pgd(struct mm_struct * mm, struct vm_area * vma, pgd_t *dir, unsigned long address, unsigned long end, int count, struct pm_zone * classzone)
-{
-	pmd_t * pmd;
-	unsigned long pgd_end;
-
-	if (pgd_none(*dir))
-		return count;
-	if (pgd_bad(*dir)) {
-		pgd_ERROR(*dir);
-		pgd_clear(dir);
-		return count;
-	}
-
-	pmd = pmd_offset(dir, address);
-
-	pgd_end = (address + PGDIR_SIZE) & PGDIR_MASK;	
-	if (pgd_end && (end > pgd_end))
-		end = pgd_end;
-	
-	do {
-		count = swap_out_pmd(mm, vma, pmd, address, end, count, classzone);
-		if (!count)
-			break;
-		address = (address + PMD_SIZE) & PMD_MASK;
-		pmd++;
-	} while (address && (address < end));
-	return count;
+	pte_chain_unlock(page);
+	return ret;
 }
 
-/* mm->page_table_lock is held. mmap_sem is not held */
-static inline int swap_out_vma(struct mm_struct * mm, struct vm_area * vma, unsigned long address, int count, struct pm_zone * classzone)
-{
-	pgd_t *pgdir;
-	unsigned long end;
-
-	/* Don't swap out areas which are reserved */
-	if (vma->vm_flags & VM_RESERVED)
-		return count;
-
-	pgdir = pgd_offset(mm, address);
-
-	end = vma->vm_end;
-	BUG_ON(address >= end);
-	do {
-		count = swap_out_pgd(mm, vma, pgdir, address, end, count, classzone);
-		if (!count)
-			break;
-		address = (address + PGDIR_SIZE) & PGDIR_MASK;
-		pgdir++;
-	} while (address && (address < end));
-	return count;
-}
-
-/* Placeholder for swap_out(): may be updated by fork.c:mmput() */
-struct mm_struct *swap_mm = &init_mm;
-
-/*
- * Returns remaining count of pages to be swapped out by followup call.
- */
-static inline int swap_out_mm(struct mm_struct * mm, int count, int * mmcounter, struct pm_zone * classzone)
-{
-	unsigned long address;
-	struct vm_area* vma;
-
-	/*
-	 * Find the proper vm-area after freezing the vma chain 
-	 * and ptes.
-	 */
-	spin_lock(&mm->page_table_lock);
-	address = mm->swap_address;
-	if (address == TASK_SIZE || swap_mm != mm) {
-		/* We raced: don't count this mm but try again */
-		++*mmcounter;
-		goto out_unlock;
-	}
-	vma = find_vma(mm, address);
-	if (vma) {
-		if (address < vma->vm_start)
-			address = vma->vm_start;
-
-		for (;;) {
-			count = swap_out_vma(mm, vma, address, count, classzone);
-			vma = vma->vm_next;
-			if (!vma)
-				break;
-			if (!count)
-				goto out_unlock;
-			address = vma->vm_start;
-		}
-	}
-	/* Indicate that we reached the end of address space */
-	mm->swap_address = TASK_SIZE;
-
-out_unlock:
-	spin_unlock(&mm->page_table_lock);
-	return count;
-}
-
-static int FASTCALL(swap_out(unsigned int priority, unsigned int gfp_mask, struct pm_zone * classzone));
-static int swap_out(unsigned int priority, unsigned int gfp_mask, struct pm_zone * classzone)
-{
-	int counter, nr_pages = SWAP_CLUSTER_MAX;
-	struct mm_struct *mm;
-
-	counter = mmlist_nr;
-	do {
-		if (unlikely(current->need_resched)) {
-			__set_current_state(TASK_RUNNING);
-			schedule();
-		}
-
-		spin_lock(&mmlist_lock);
-		mm = swap_mm;
-		while (mm->swap_address == TASK_SIZE || mm == &init_mm) {
-			mm->swap_address = 0;
-			mm = list_entry(mm->mmlist.next, struct mm_struct, mmlist);
-			if (mm == swap_mm)
-				goto empty;
-			swap_mm = mm;
-		}
-
-		/* Make sure the mm doesn't disappear when we drop the lock.. */
-		atomic_inc(&mm->mm_users);
-		spin_unlock(&mmlist_lock);
-
-		nr_pages = swap_out_mm(mm, nr_pages, &counter, classzone);
-
-		mmput(mm);
-
-		if (!nr_pages)
-			return 1;
-	} while (--counter >= 0);
-
-	return 0;
-
-empty:
-	spin_unlock(&mmlist_lock);
-	return 0;
-}
-
-static int FASTCALL(shrink_cache(int nr_pages, struct pm_zone * classzone, unsigned int gfp_mask, int priority));
-static int shrink_cache(int nr_pages, struct pm_zone * classzone, unsigned int gfp_mask, int priority)
+static int FASTCALL(shrink_cache(int nr_pages, struct pm_zone * zone, unsigned int gfp_mask, int priority));
+static int shrink_cache(int nr_pages, struct pm_zone * zone, unsigned int gfp_mask, int priority)
 {
 	struct list_head * entry;
-	int max_scan = nr_inactive_pages / priority;
-	int max_mapped = min((nr_pages << (10 - priority)), max_scan / 10);
+	int max_scan = zone->nr_inactive / priority;
+	struct page * swap_batch[SWAP_CLUSTER_MAX];
+	int nr_swap_batch = 0;
 
-	spin_lock(&pagemap_lru_lock);
-	while (--max_scan >= 0 && (entry = inactive_list.prev) != &inactive_list) {
-		struct page * page;
+	spin_lock(&zone->lru_lock);
+	while (--max_scan >= 0 && (entry = zone->inactive_list.prev) != &zone->inactive_list) {
+		struct page * page, ** hash;
+		struct address_space * mapping;
 
 		if (unlikely(current->need_resched)) {
-			spin_unlock(&pagemap_lru_lock);
+			spin_unlock(&zone->lru_lock);
 			__set_current_state(TASK_RUNNING);
 			schedule();
-			spin_lock(&pagemap_lru_lock);
+			spin_lock(&zone->lru_lock);
 			continue;
 		}
 
@@ -359,7 +94,8 @@ static int shrink_cache(int nr_pages, struct pm_zone * classzone, unsigned int g
 		BUG_ON(PageActive(page));
 
 		list_del(entry);
-		list_add(entry, &inactive_list);
+		list_add(entry, &zone->inactive_list);
+		zone->pages_scanned++;
 
 		/*
 		 * Zero page counts can happen because we unlink the pages
@@ -368,12 +104,10 @@ static int shrink_cache(int nr_pages, struct pm_zone * classzone, unsigned int g
 		if (unlikely(!page_count(page)))
 			continue;
 
-		if (!memclass(page_zone(page), classzone))
-			continue;
-
 		/* Racy check to avoid trylocking when not worthwhile */
-		if (!page->buffers && (page_count(page) != 1 || !page->mapping))
-			goto page_mapped;
+		if (!page->buffers && !page->pte_chain &&
+		    (page_count(page) != 1 || !page->mapping))
+			continue;
 
 		/*
 		 * The page is locked. IO in progress?
@@ -382,14 +116,36 @@ static int shrink_cache(int nr_pages, struct pm_zone * classzone, unsigned int g
 		if (unlikely(TryLockPage(page))) {
 			if (PageLaunder(page) && (gfp_mask & __GFP_FS)) {
 				page_cache_get(page);
-				spin_unlock(&pagemap_lru_lock);
+				spin_unlock(&zone->lru_lock);
 				wait_on_page(page);
 				page_cache_release(page);
-				spin_lock(&pagemap_lru_lock);
+				spin_lock(&zone->lru_lock);
 			}
 			continue;
 		}
 
+		/*
+		 * Mapped pages are unmapped right here through their pte
+		 * chains, unless they are still being used.
+		 */
+		if (page->pte_chain) {
+			if (page_referenced(page))
+				goto page_active;
+			if (!page->mapping) {
+				if (page->buffers || !add_to_swap(page))
+					goto page_active;
+			}
+			switch (try_to_unmap(page)) {
+			case SWAP_FAIL:
+				goto page_active;
+			case SWAP_AGAIN:
+				UnlockPage(page);
+				continue;
+			case SWAP_SUCCESS:
+				break;
+			}
+		}
+
 		if (PageDirty(page) && is_page_cache_freeable(page) && page->mapping) {
 			/*
 			 * It is not critical here to write it only if
@@ -404,14 +160,33 @@ static int shrink_cache(int nr_pages, struct pm_zone * classzone, unsigned int g
 			writepage = page->mapping->a_ops->writepage;
 			if ((gfp_mask & __GFP_FS) && writepage) {
 				ClearPageDirty(page);
-				SetPageLaunder(page);
 				page_cache_get(page);
-				spin_unlock(&pagemap_lru_lock);
+
+				/*
+				 * Swap cache pages are collected and
+				 * written in swap order.  PG_launder is
+				 * only set once the write is started, so
+				 * nobody waits on a page still sitting
+				 * in the batch.
+				 */
+				if (PageSwapCache(page)) {
+					swap_batch[nr_swap_batch++] = page;
+					if (nr_swap_batch < SWAP_CLUSTER_MAX)
+						continue;
+					spin_unlock(&zone->lru_lock);
+					swap_writepages(swap_batch, nr_swap_batch);
+					nr_swap_batch = 0;
+					spin_lock(&zone->lru_lock);
+					continue;
+				}
+
+				SetPageLaunder(page);
+				spin_unlock(&zone->lru_lock);
 
 				writepage(page);
 				page_cache_release(page);
 
-				spin_lock(&pagemap_lru_lock);
+				spin_lock(&zone->lru_lock);
 				continue;
 			}
 		}
@@ -422,7 +197,7 @@ static int shrink_cache(int nr_pages, struct pm_zone * classzone, unsigned int g
 		 * the page as well.
 		 */
 		if (page->buffers) {
-			spin_unlock(&pagemap_lru_lock);
+			spin_unlock(&zone->lru_lock);
 
 			/* avoid to free a locked page */
 			page_cache_get(page);
@@ -435,12 +210,13 @@ static int shrink_cache(int nr_pages, struct pm_zone * classzone, unsigned int g
 					 * the LRU, so we unlock the page after
 					 * taking the lru lock
 					 */
-					spin_lock(&pagemap_lru_lock);
+					spin_lock(&zone->lru_lock);
 					UnlockPage(page);
 					__lru_cache_del(page);
 
 					/* effectively free the page here */
 					page_cache_release(page);
+					zone->pages_reclaimed++;
 
 					if (--nr_pages)
 						continue;
@@ -453,37 +229,32 @@ static int shrink_cache(int nr_pages, struct pm_zone * classzone, unsigned int g
 					 */
 					page_cache_release(page);
 
-					spin_lock(&pagemap_lru_lock);
+					spin_lock(&zone->lru_lock);
 				}
 			} else {
 				/* failed to drop the buffers so stop here */
 				UnlockPage(page);
 				page_cache_release(page);
 
-				spin_lock(&pagemap_lru_lock);
+				spin_lock(&zone->lru_lock);
 				continue;
 			}
 		}
 
-		spin_lock(&pagecache_lock);
-
 		/*
-		 * this is the non-racy check for busy page.
+		 * this is the non-racy check for busy page.  We hold
+		 * the page lock, so page->mapping can't change under us.
 		 */
-		if (!page->mapping || !is_page_cache_freeable(page)) {
-			spin_unlock(&pagecache_lock);
+		mapping = page->mapping;
+		if (!mapping)
+			goto page_busy;
+		hash = page_hash(mapping, page->index);
+		lock_page_cache(mapping, hash);
+		if (!is_page_cache_freeable(page)) {
+			unlock_page_cache(mapping, hash);
+page_busy:
 			UnlockPage(page);
-page_mapped:
-			if (--max_mapped >= 0)
-				continue;
-
-			/*
-			 * Alert! We've found too many mapped pages on the
-			 * inactive list, so we start swapping out now!
-			 */
-			spin_unlock(&pagemap_lru_lock);
-			swap_out(priority, gfp_mask, classzone);
-			return nr_pages;
+			continue;
 		}
 
 		/*
@@ -491,7 +262,7 @@ page_mapped:
 		 * the page is freeable* so not in use by anybody.
 		 */
 		if (PageDirty(page)) {
-			spin_unlock(&pagecache_lock);
+			unlock_page_cache(mapping, hash);
 			UnlockPage(page);
 			continue;
 		}
@@ -499,12 +270,12 @@ page_mapped:
 		/* point of no return */
 		if (likely(!PageSwapCache(page))) {
 			__remove_inode_page(page);
-			spin_unlock(&pagecache_lock);
+			unlock_page_cache(mapping, hash);
 		} else {
 			swp_entry_t swap;
 			swap.val = page->index;
 			__delete_from_swap_cache(page);
-			spin_unlock(&pagecache_lock);
+			unlock_page_cache(mapping, hash);
 			swap_free(swap);
 		}
 
@@ -512,13 +283,22 @@ page_mapped:
 		UnlockPage(page);
 
 		/* effectively free the page here */
-		page_cache_release(page);
+		page_cache_release_cold(page);
+		zone->pages_reclaimed++;
 
 		if (--nr_pages)
 			continue;
 		break;
+
+page_active:
+		UnlockPage(page);
+		del_page_from_inactive_list(zone, page);
+		add_page_to_active_list(zone, page);
 	}
-	spin_unlock(&pagemap_lru_lock);
+	spin_unlock(&zone->lru_lock);
+
+	if (nr_swap_batch)
+		swap_writepages(swap_batch, nr_swap_batch);
 
 	return nr_pages;
 }
@@ -530,50 +310,63 @@ page_mapped:
  * We move them the other way when we see the
  * reference bit on the page.
  */
-static void refill_inactive(int nr_pages)
+static void refill_inactive(struct pm_zone * zone, int nr_pages)
 {
 	struct list_head * entry;
 
-	spin_lock(&pagemap_lru_lock);
-	entry = active_list.prev;
-	while (nr_pages && entry != &active_list) {
+	spin_lock(&zone->lru_lock);
+	entry = zone->active_list.prev;
+	while (nr_pages && entry != &zone->active_list) {
 		struct page * page;
 
 		page = list_entry(entry, struct page, lru);
 		entry = entry->prev;
-		if (PageTestandClearReferenced(page)) {
+		if (PageTestandClearReferenced(page) ||
+		    (page->pte_chain && page_referenced(page))) {
 			list_del(&page->lru);
-			list_add(&page->lru, &active_list);
+			list_add(&page->lru, &zone->active_list);
 			continue;
 		}
 
 		nr_pages--;
 
-		del_page_from_active_list(page);
-		add_page_to_inactive_list(page);
+		del_page_from_active_list(zone, page);
+		add_page_to_inactive_list(zone, page);
 		SetPageReferenced(page);
+		zone->pages_deactivated++;
 	}
-	spin_unlock(&pagemap_lru_lock);
+	spin_unlock(&zone->lru_lock);
 }
 
 static int FASTCALL(shrink_caches(struct pm_zone * classzone, int priority, unsigned int gfp_mask, int nr_pages));
 static int shrink_caches(struct pm_zone * classzone, int priority, unsigned int gfp_mask, int nr_pages)
 {
 	int chunk_size = nr_pages;
+	struct pm_zone * first_classzone, * zone;
 	unsigned long ratio;
 
 	nr_pages -= kmem_cache_reap(gfp_mask);
 	if (nr_pages <= 0)
 		return 0;
 
+	/*
+	 * Only the zones the allocation can be satisfied from are
+	 * scanned, starting with the classzone itself.
+	 */
 	nr_pages = chunk_size;
-	/* try to keep the active list 2/3 of the size of the cache */
-	ratio = (unsigned long) nr_pages * nr_active_pages / ((nr_inactive_pages + 1) * 2);
-	refill_inactive(ratio);
+	first_classzone = classzone->zone_pmnod->node_zones;
+	for (zone = classzone; zone >= first_classzone; zone--) {
+		if (!zone->size)
+			continue;
 
-	nr_pages = shrink_cache(nr_pages, classzone, gfp_mask, priority);
-	if (nr_pages <= 0)
-		return 0;
+		/* try to keep the active list 2/3 of the size of the cache */
+		ratio = (unsigned long) nr_pages * zone->nr_active / ((zone->nr_inactive + 1) * 2);
+		refill_inactive(zone, ratio);
+
+		nr_pages = shrink_cache(nr_pages, zone, gfp_mask, priority);
+		if (nr_pages <= 0)
+			return 0;
+	}
 
 	shrink_dcache_memory(priority, gfp_mask);
 	shrink_icache_memory(priority, gfp_mask);
@@ -1315,11 +1315,11 @@ static int deliver_to_old_ones(struct packet_type *pt, struct sk_buff *skb, int
 	spin_lock(&net_bh_lock);
 
 	/* Disable timers and wait for all timers completion */
-	tasklet_disable(bh_task_vec+TIMER_BH);
+	br_write_lock(BR_TIMER_LOCK);
 
 	ret = pt->func(skb, skb->dev, pt);
 
-	tasklet_hi_enable(bh_task_vec+TIMER_BH);
+	br_write_unlock(BR_TIMER_LOCK);
 	spin_unlock(&net_bh_lock);
 	return ret;
 }